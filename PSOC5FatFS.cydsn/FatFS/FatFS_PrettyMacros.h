@@ -12,6 +12,12 @@ typedef FIL     FatFS_File_t;
 typedef DIR     FatFS_Dir_t;
 typedef DSTATUS FatFS_DiskStatus_t;
 typedef DRESULT FatFS_DiskOpResult_t;
+#if _USE_DIRPLUS
+typedef DIRITEM FatFS_DirItem_t;
+#endif
+#if _USE_FRAGINFO
+typedef FRAGINFO FatFS_FragInfo_t;
+#endif
     
    
 
@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+#include "FatFS/FatFS_StreamRing.h"
+
+
+/*  Implementation of the ISR to file streaming ring
+ *
+ *  head and tail are free running slot counts, head - tail is the number of full slots.  The producer only ever
+ *  writes head and the consumer only ever writes tail, so each side publishes its progress with a release store and
+ *  reads the other side's with an acquire load, and no lock is needed.  The slot at head is the one being filled;
+ *  it is never handed to the consumer until it is full.
+ */
+
+
+#if (STREAM_SLOT_COUNT & (STREAM_SLOT_COUNT - 1)) != 0
+#error STREAM_SLOT_COUNT must be a power of 2
+#endif
+
+
+
+// empty the ring and clear its counters, the producer must not be running
+void StreamRing_Init(StreamRing_t *ring) {
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->fill = 0;
+    ring->part = 0;
+    ring->highWater = 0;
+    ring->overruns = 0;
+    ring->overrunBytes = 0;
+}
+
+
+// producer: add a record to the ring, returns false and counts an overrun if it does not fit
+bool StreamRing_Commit(StreamRing_t *ring, const void *record, uint32_t size) {
+    const uint8_t *src = record;
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    // room is every slot that is not full less what is already in the slot being filled
+    if (size > ((STREAM_SLOT_COUNT - (head - tail)) * STREAM_SLOT_SIZE) - ring->fill) {
+        ring->overruns++;
+        ring->overrunBytes += size;
+        return false;
+    }
+
+    while (size) {
+        uint32_t n = STREAM_SLOT_SIZE - ring->fill;
+        if (n > size) n = size;
+
+        memcpy(&ring->slots[head & (STREAM_SLOT_COUNT - 1)][ring->fill], src, n);
+        ring->fill += n;
+        src += n;
+        size -= n;
+
+        // the slot is full, hand it to the consumer
+        if (ring->fill == STREAM_SLOT_SIZE) {
+            ring->fill = 0;
+            head++;
+            __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+            if ((head - tail) > ring->highWater) ring->highWater = head - tail;
+        }
+    }
+
+    return true;
+}
+
+
+// consumer: write all the full slots to file, slotsWritten (may be 0) gets the number written
+FatFS_Result_t StreamRing_Drain(StreamRing_t *ring, FatFS_File_t *file, uint32_t *slotsWritten) {
+    FatFS_Result_t res = FR_OK;
+    uint32_t tail = ring->tail;
+    uint32_t full = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    uint32_t written = 0;
+
+    // at most two writes, the full slots up to the end of the ring and then the ones that wrapped to the front
+    while (full && (res == FR_OK)) {
+        uint32_t index = tail & (STREAM_SLOT_COUNT - 1);
+        uint32_t n = STREAM_SLOT_COUNT - index;
+        UINT bytesWritten;
+
+        // the start of the first slot may already be in the file from a short write before
+        if (n > full) n = full;
+        res = f_write(file, &ring->slots[index][ring->part], n * STREAM_SLOT_SIZE - ring->part, &bytesWritten);
+
+        // a short write means the volume is full
+        if ((res == FR_OK) && (bytesWritten != n * STREAM_SLOT_SIZE - ring->part)) {
+            res = FR_DENIED;
+        }
+
+        // only whole slots are given back, the bytes written of the next one are remembered so they are not
+        // written again
+        bytesWritten += ring->part;
+        n = bytesWritten / STREAM_SLOT_SIZE;
+        ring->part = bytesWritten % STREAM_SLOT_SIZE;
+        tail += n;
+        written += n;
+        full -= n;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    if (slotsWritten) *slotsWritten = written;
+    return res;
+}
+
+
+// consumer: write out everything in the ring including the partly filled slot, the producer must be stopped
+FatFS_Result_t StreamRing_Flush(StreamRing_t *ring, FatFS_File_t *file) {
+    UINT bytesWritten;
+
+    FatFS_Result_t res = StreamRing_Drain(ring, file, 0);
+    if ((res == FR_OK) && ring->fill) {
+        res = f_write(file, ring->slots[ring->head & (STREAM_SLOT_COUNT - 1)], ring->fill, &bytesWritten);
+        if ((res == FR_OK) && (bytesWritten != ring->fill)) {
+            res = FR_DENIED;
+        }
+        ring->fill = 0;
+    }
+    return res;
+}
+
+
+// number of full slots waiting to be drained
+uint32_t StreamRing_Pending(StreamRing_t *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+}
@@ -0,0 +1,45 @@
+#ifndef FATFS_STREAMRING_H
+#define FATFS_STREAMRING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+
+
+/*  Ring of sector sized slots for streaming records from an ISR to a file
+ *
+ *  One producer (normally an ISR) packs records into the slots with StreamRing_Commit, which takes no locks and never
+ *  waits.  Records are packed back to back and may straddle slots, so every slot that is handed on is a full sector.
+ *  One consumer (the main loop) calls StreamRing_Drain, which writes all the full slots with as few f_write calls as
+ *  possible, so a burst goes to the card as a multi-sector write.  When the ring has no room for a record the record
+ *  is dropped whole and counted as an overrun.
+ */
+
+
+#define STREAM_SLOT_SIZE        512u        // bytes per slot, one sector
+#define STREAM_SLOT_COUNT       8u          // number of slots, must be a power of 2
+
+
+typedef struct {
+    uint8_t slots[STREAM_SLOT_COUNT][STREAM_SLOT_SIZE];
+    uint32_t head;                  // slots the producer has filled (written by the producer only)
+    uint32_t tail;                  // slots the consumer has written out (written by the consumer only)
+    uint32_t fill;                  // bytes in the slot the producer is filling (producer only)
+    uint32_t part;                  // bytes of the slot at tail already in the file after a short write (consumer only)
+
+    // counters, written by the producer
+    uint32_t highWater;             // most full slots waiting at once
+    uint32_t overruns;              // records dropped because the ring was full
+    uint32_t overrunBytes;          // bytes in those records
+} StreamRing_t;
+
+
+void StreamRing_Init(StreamRing_t *ring);
+bool StreamRing_Commit(StreamRing_t *ring, const void *record, uint32_t size);
+FatFS_Result_t StreamRing_Drain(StreamRing_t *ring, FatFS_File_t *file, uint32_t *slotsWritten);
+FatFS_Result_t StreamRing_Flush(StreamRing_t *ring, FatFS_File_t *file);
+uint32_t StreamRing_Pending(StreamRing_t *ring);
+
+
+#endif
@@ -0,0 +1,181 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+#include "FatFS/FatFS_TreeWalk.h"
+
+
+/*  Implementation of the bounded tree walk
+ *
+ *  The walk is a loop over levels[depth] instead of a recursion, so its stack use does not grow with the tree.  A
+ *  directory is only ever open while it is being scanned, so a deep walk does not hold one directory object (and
+ *  lock) per level.  Sub-directories are taken in increasing start cluster, lastClust is the one taken last, so a
+ *  new scan of the same directory picks up where the previous batch ended.
+ */
+
+
+#if !_USE_DIRPLUS || !_USE_FIND
+#error The tree walk needs _USE_DIRPLUS and _USE_FIND
+#endif
+
+
+
+// start a level for the directory at the current end of the path
+static void Level_Init(TreeWalk_t *walk) {
+    TreeLevel_t *level = &walk->levels[walk->depth];
+
+    level->subdirCnt = 0;
+    level->subdirNext = 0;
+    level->more = false;
+    level->lastClust = 0;
+    level->pathLen = strlen(walk->path);
+    level->bytes = 0;
+    level->files = 0;
+    level->dirs = 0;
+}
+
+
+// the "." and ".." entries of a sub-directory
+static bool Is_DotName(const char *name) {
+
+    return (name[0] == '.') && ((name[1] == 0) || ((name[1] == '.') && (name[2] == 0)));
+}
+
+
+// add a sub-directory to the sorted batch of the level, keeping the ones with the lowest start clusters
+static void Level_AddSubdir(TreeLevel_t *level, const FatFS_DirItem_t *item) {
+    uint8_t pos = level->subdirCnt;
+
+    if (pos == TREE_SUBDIR_BATCH) {
+        level->more = true;
+        if (item->sclust > level->subdirs[pos - 1].clust) return;   // it waits for a later scan
+        pos--;                                                      // the last one makes room and waits instead
+    }
+    else {
+        level->subdirCnt++;
+    }
+
+    while ((pos > 0) && (level->subdirs[pos - 1].clust > item->sclust)) {
+        level->subdirs[pos] = level->subdirs[pos - 1];
+        pos--;
+    }
+    level->subdirs[pos].clust = item->sclust;
+    strcpy(level->subdirs[pos].name, item->fname);
+}
+
+
+// read the current directory in one pass, report its files on the first scan and gather the next batch of
+// sub-directories after lastClust
+static FatFS_Result_t Scan_Dir(TreeWalk_t *walk, bool firstScan) {
+    TreeLevel_t *level = &walk->levels[walk->depth];
+    FatFS_Dir_t dirObj;
+    UINT readCnt = 0;
+
+    level->subdirCnt = 0;
+    level->subdirNext = 0;
+    level->more = false;
+    walk->scans++;
+
+    FatFS_Result_t res = f_opendir(&dirObj, walk->path);
+    if (res != FR_OK) return res;
+
+    while ((res == FR_OK) && !walk->stopped) {
+        res = f_readdirplus(&dirObj, walk->items, TREE_ITEM_BATCH, &readCnt);
+        for (UINT i = 0; (res == FR_OK) && (i < readCnt) && !walk->stopped; i++) {
+            const FatFS_DirItem_t *item = &walk->items[i];
+
+            if (item->fattrib & AM_DIR) {
+                // dot entries and entries at or before the last one taken are skipped, which also drops a broken
+                // entry pointing back to the root (cluster 0)
+                if (!Is_DotName(item->fname) && (item->sclust > level->lastClust)) {
+                    Level_AddSubdir(level, item);
+                }
+            }
+            else if (firstScan) {
+                level->files++;
+                level->bytes += item->fsize;
+                if (!walk->pattern[0] || f_match(walk->pattern, item->fname)) {
+                    walk->stopped = !walk->callback(walk, TREE_EVENT_FILE, item);
+                }
+            }
+        }
+        if (readCnt < TREE_ITEM_BATCH) break;
+    }
+    f_closedir(&dirObj);
+    return res;
+}
+
+
+// add name to the end of the path, false when it does not fit
+static bool Path_Push(TreeWalk_t *walk, const char *name) {
+    uint16_t len = walk->levels[walk->depth].pathLen;
+    bool sep = (len != 0) && (walk->path[len - 1] != '/');
+
+    if (len + sep + strlen(name) >= TREE_PATH_SIZE) return false;
+    if (sep) walk->path[len++] = '/';
+    strcpy(&walk->path[len], name);
+    return true;
+}
+
+
+// walk everything below dirName (the root directory when empty), reporting the files that match pattern (all when
+// pattern is empty or 0) and every directory entered and done to callback
+FatFS_Result_t TreeWalk_Run(TreeWalk_t *walk, const char *dirName, const char *pattern, TreeWalk_Callback_t callback, void *context) {
+
+    uint16_t len = strlen(dirName);
+
+    // a trailing separator would be taken as an empty name when the directory is opened
+    while ((len > 1) && (dirName[len - 1] == '/')) len--;
+    if (len >= TREE_PATH_SIZE) return FR_INVALID_NAME;
+    memcpy(walk->path, dirName, len);
+    walk->path[len] = 0;
+    walk->depth = 0;
+    walk->pattern = pattern ? pattern : "";
+    walk->callback = callback;
+    walk->context = context;
+    walk->stopped = false;
+    walk->skipped = 0;
+    walk->scans = 0;
+    Level_Init(walk);
+
+    walk->stopped = !callback(walk, TREE_EVENT_DIR_ENTER, 0);
+    FatFS_Result_t res = walk->stopped ? FR_OK : Scan_Dir(walk, true);
+
+    while ((res == FR_OK) && !walk->stopped) {
+        TreeLevel_t *level = &walk->levels[walk->depth];
+
+        // the batch ran out but the directory has more sub-directories, scan it again for the next ones
+        if ((level->subdirNext == level->subdirCnt) && level->more) {
+            res = Scan_Dir(walk, false);
+            continue;
+        }
+
+        if (level->subdirNext < level->subdirCnt) {
+            TreeSubdir_t *subdir = &level->subdirs[level->subdirNext++];
+            level->lastClust = subdir->clust;
+            level->dirs++;
+            if ((walk->depth == TREE_MAX_DEPTH) || !Path_Push(walk, subdir->name)) {
+                walk->skipped++;
+                continue;
+            }
+            walk->depth++;
+            Level_Init(walk);
+            walk->stopped = !callback(walk, TREE_EVENT_DIR_ENTER, 0);
+            if (!walk->stopped) {
+                res = Scan_Dir(walk, true);
+            }
+            continue;
+        }
+
+        // everything below this directory is done, hand its totals to the parent
+        walk->stopped = !callback(walk, TREE_EVENT_DIR_DONE, 0);
+        if (walk->depth == 0) break;
+        walk->depth--;
+        walk->levels[walk->depth].bytes += level->bytes;
+        walk->levels[walk->depth].files += level->files;
+        walk->levels[walk->depth].dirs += level->dirs;
+        walk->path[walk->levels[walk->depth].pathLen] = 0;
+    }
+    return res;
+}
@@ -0,0 +1,77 @@
+#ifndef FATFS_TREEWALK_H
+#define FATFS_TREEWALK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+
+
+/*  Iterative walk of a directory tree in bounded memory
+ *
+ *  Each directory is read from start to end in one pass with f_readdirplus, the files are reported on the way and
+ *  the sub-directories are only remembered.  The sub-directories are then entered in order of their start cluster,
+ *  so the walk moves through the directory tables in one direction instead of jumping back to the parent after each
+ *  child.  A level remembers up to TREE_SUBDIR_BATCH sub-directories; a directory with more is scanned again for the
+ *  next batch after the last one.  Directories deeper than TREE_MAX_DEPTH or with a path longer than TREE_PATH_SIZE
+ *  are not entered and are counted in skipped.
+ */
+
+
+#define TREE_MAX_DEPTH          8u          // directory levels below the starting directory that are entered
+#define TREE_SUBDIR_BATCH       8u          // sub-directories a level remembers per scan
+#define TREE_ITEM_BATCH         16u         // directory items read per f_readdirplus call
+#define TREE_PATH_SIZE          128u        // longest path the walk builds, including the terminator
+
+
+typedef enum {
+    TREE_EVENT_FILE,                // a file matching the pattern, path is its directory
+    TREE_EVENT_DIR_ENTER,           // a directory is about to be walked, path is the directory
+    TREE_EVENT_DIR_DONE             // a directory and everything below it was walked, the level totals are final
+} TreeEvent_t;
+
+
+typedef struct {
+    DWORD clust;                    // start cluster of the sub-directory
+    TCHAR name[_USE_DIRPLUS];       // its name as given by f_readdirplus
+} TreeSubdir_t;
+
+
+typedef struct {
+    TreeSubdir_t subdirs[TREE_SUBDIR_BATCH];    // sub-directories still to enter, in cluster order
+    uint8_t subdirCnt;              // entries in subdirs
+    uint8_t subdirNext;             // next entry of subdirs to enter
+    bool more;                      // there are sub-directories after the last one in subdirs
+    DWORD lastClust;                // start cluster of the last sub-directory taken (0: none yet)
+    uint16_t pathLen;               // length of the path of this directory
+
+    // totals of everything below this directory, complete at TREE_EVENT_DIR_DONE
+    uint64_t bytes;                 // bytes in the files
+    uint32_t files;                 // files
+    uint32_t dirs;                  // sub-directories
+} TreeLevel_t;
+
+
+typedef struct TreeWalk TreeWalk_t;
+
+// called for each event, return false to end the walk
+typedef bool (*TreeWalk_Callback_t)(TreeWalk_t *walk, TreeEvent_t event, const FatFS_DirItem_t *item);
+
+struct TreeWalk {
+    char path[TREE_PATH_SIZE];      // path of the current directory
+    uint8_t depth;                  // level of the current directory, 0 is the starting directory
+    TreeLevel_t levels[TREE_MAX_DEPTH + 1];
+    FatFS_DirItem_t items[TREE_ITEM_BATCH];
+    const char *pattern;            // files reported are the ones matching this, all files when empty
+    TreeWalk_Callback_t callback;
+    void *context;                  // for the callback
+    bool stopped;                   // the callback ended the walk
+    uint32_t skipped;               // directories not entered because of depth or path length
+    uint32_t scans;                 // directory scans, more than the directories when some needed another batch
+};
+
+
+FatFS_Result_t TreeWalk_Run(TreeWalk_t *walk, const char *dirName, const char *pattern, TreeWalk_Callback_t callback, void *context);
+
+
+#endif
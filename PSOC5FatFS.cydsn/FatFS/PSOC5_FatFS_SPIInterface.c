@@ -1,78 +1,231 @@
 #include <project.h>
 #include <cytypes.h>
 #include <stdbool.h>
+#include <string.h>
 #include "FatFS/diskio.h"
 #include "FatFS/SDSPI_Commands.h"
 #include "FatFS/FatFS_PrettyMacros.h"
 #include "FatFSCmdInterface.h"
 
 
-// used to track the status of the disk
-static FatFS_DiskStatus_t _DiskStatus = STA_NOINIT;	
+// one card per volume, drive n is the card in slot n
+#define SD_CARD_COUNT                   _VOLUMES
 
+#if (SD_CARD_COUNT > 2)
+#error Only two card slots are bound, add the SPI components of the others to _Cards
+#endif
+
+// the driver takes no lock, each card and its bus are driven by one caller at a time
+//   _FS_REENTRANT 2 runs the data transfers of different files outside the volume lock, so they would meet on the bus
+#if (_FS_REENTRANT == 2)
+#error _FS_REENTRANT == 2 needs disk I/O functions that allow concurrent calls, which this driver does not
+#endif
+
+// the SPI component and chip select a card is wired to
+typedef struct {
+    reg8 *txData;                       // SPIM tx fifo
+    reg8 *rxData;                       // SPIM rx fifo
+    reg8 *rxStatus;                     // SPIM rx status register
+    void (*writeSelect)(uint8_t level); // chip select pin write function
+} SDBus_t;
+
+// everything the driver knows about one card
+typedef struct {
+    SDBus_t bus;
+
+    // used to track the status of the disk
+    FatFS_DiskStatus_t diskStatus;
+
+    uint8_t cardType;                   /* 0000 (Block) (SD2) (SD1) (MMC) */
+
+    // card registers and geometry, filled in by disk_initialize
+    SDCardInfo_t info;
+
+    // card wait time history, used to pick the poll intervals while waiting on the card
+    SDWaitStats_t waitStats;
 
-static uint8_t _CardType;			/* 0000 (Block) (SD2) (SD1) (MMC) */
-#define Is_CardTypeBlock()        (_CardType & CARDTYPE_BLOCK)
-#define Is_CardTypeSD2()          (_CardType & CARDTYPE_SD2)
-#define Is_CardTypeSD1()          (_CardType & CARDTYPE_SD1)
-#define Is_CardTypeSDC()          (_CardType & CARDTYPE_SDC)
+    // chip select state and the nesting depth of Begin_SDTransaction calls
+    bool selected;
+    uint8_t transactionDepth;
+} SDCard_t;
+
+#define Is_CardTypeBlock(card)          ((card)->cardType & CARDTYPE_BLOCK)
+#define Is_CardTypeSD2(card)            ((card)->cardType & CARDTYPE_SD2)
+#define Is_CardTypeSD1(card)            ((card)->cardType & CARDTYPE_SD1)
+#define Is_CardTypeSDC(card)            ((card)->cardType & CARDTYPE_SDC)
+
+// bind a card slot to the SPIM component spi and the chip select pin ss
+#define SD_CARD_SLOT(spi, ss)           { .bus = { spi##_TXDATA_PTR, spi##_RXDATA_PTR, spi##_RX_STATUS_PTR, ss##_Write }, \
+                                          .diskStatus = STA_NOINIT }
+
+// a slot with no hardware behind it
+#define SD_EMPTY_SLOT                   { .diskStatus = STA_NOINIT | STA_NODISK }
+
+static SDCard_t _Cards[SD_CARD_COUNT] = {
+    SD_CARD_SLOT(SDSPI, SS),
+
+    // the second slot is bound when the design has an SDSPI2 SPI master and an SS2 chip select pin
+#if (SD_CARD_COUNT > 1)
+#if defined(CY_SPIM_SDSPI2_H) && defined(CY_PINS_SS2_H)
+    SD_CARD_SLOT(SDSPI2, SS2),
+#else
+    SD_EMPTY_SLOT,
+#endif
+#endif
+};
 
 #define SDSPI_DUMMY_BYTE                0xFF
-#define Does_SdspiRxFifoHaveData()      (SDSPI_RX_STATUS_REG & SDSPI_STS_RX_FIFO_NOT_EMPTY)
+#define Does_SdspiRxFifoHaveData(bus)   (CY_GET_REG8((bus).rxStatus) & SDSPI_STS_RX_FIFO_NOT_EMPTY)
+
+// direct access to the SPIM hardware fifos for the streaming loops
+//   as long as no more than SDSPI_FIFO_DEPTH bytes are in flight, the tx fifo never blocks and the rx fifo never overflows
+//   the loops work on a local copy of the bus so the register addresses stay in registers
+#define SDSPI_FIFO_DEPTH                4
+#define Write_SdspiTxFifo(bus, data)    CY_SET_REG8((bus).txData, (data))
+#define Read_SdspiRxFifo(bus)           CY_GET_REG8((bus).rxData)
+
+// take one received byte out of the rx fifo and queue another byte for transmission in its place
+#define Stream_SdspiByte(bus, rxDest, txByte)   do {                                    \
+                                                    while (!Does_SdspiRxFifoHaveData(bus)) {}; \
+                                                    (rxDest) = Read_SdspiRxFifo(bus);   \
+                                                    Write_SdspiTxFifo(bus, txByte);     \
+                                                } while (0)
+
+// take one received byte out of the rx fifo once nothing else remains to be sent
+#define Drain_SdspiByte(bus, rxDest)            do {                                    \
+                                                    while (!Does_SdspiRxFifoHaveData(bus)) {}; \
+                                                    (rxDest) = Read_SdspiRxFifo(bus);   \
+                                                } while (0)
+
+
+// throw away anything left in the rx fifo
+static void Clear_SdspiRxFifo(const SDBus_t bus) {
+    while (Does_SdspiRxFifoHaveData(bus)) {
+        (void)Read_SdspiRxFifo(bus);
+    }
+}
 
 
 // A convenience function to perform a blocking exchange of a byte of data over SPI
-uint8_t SDSPI_ExchangeByte(uint8_t data) {
-    SDSPI_WriteByte(data);
-    while (!Does_SdspiRxFifoHaveData()) {};
-    return SDSPI_ReadRxData();    
+static uint8_t Exchange_SDByte(SDCard_t *card, uint8_t data) {
+    const SDBus_t bus = card->bus;
+
+    Write_SdspiTxFifo(bus, data);
+    while (!Does_SdspiRxFifoHaveData(bus)) {};
+    return Read_SdspiRxFifo(bus);
 }
 
 
-// Check if the sd card is ready, if not, wait for a period of time for it to become ready
-//   timeOut is in increments of 100us
-static bool Is_CardReady(uint32_t timeOut) {
-    uint8_t statusByte;
+// limits on the interval between polls of a card we are waiting on
+#define SD_POLL_MIN_US                  2
+#define SD_POLL_MAX_US                  100
+
+// nominal SPI bit rate once the card is initialized, used to turn the CSD NSAC clock count into time
+#define SDSPI_DATA_CLOCK_MHZ            8
+
 
-    // keep checking if the card becomes active over the timeout perod
-    for (/*timeout*/; timeOut != 0; timeOut--) {	
+// Poll the card until it stops (untilIdle false) or starts (untilIdle true) returning idle bytes, or timeOutUs passes
+//   the first poll interval is a quarter of the wait learned for this kind and each later one doubles up to SD_POLL_MAX_US,
+//   so the usual waits end close to when the card becomes ready and long waits do not keep the bus busy
+//   the delays are still busy waits in CyDelayUs, the cpu does nothing else while the card is busy; only the spacing
+//   of the polls adapts, nothing here is driven by a timer or a pin interrupt
+//   the time recorded is the sum of the delays, which leaves out the time spent clocking the poll bytes
+static uint8_t Wait_Card(SDCard_t *card, uint8_t kind, bool untilIdle, uint32_t timeOutUs) {
+    SDWaitStats_t *stats = &card->waitStats;
+    uint32_t waitedUs = 0;
+    uint32_t interval = stats->expectedUs[kind] >> 2;
+    uint8_t response;
+    uint8_t bin = 0;
+    
+    stats->waits[kind]++;
+    
+    for (;;) {
+        stats->polls[kind]++;
+        response = Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
+        if ((response == SD_DATA_IDLE) == untilIdle) break;
+        
+        if (waitedUs >= timeOutUs) {
+            stats->timeouts[kind]++;
+            return response;
+        }
         
-        // query the sd card by sending a dummy byte
-        statusByte = SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+        if (interval < SD_POLL_MIN_US) interval = SD_POLL_MIN_US;
+        if (interval > SD_POLL_MAX_US) interval = SD_POLL_MAX_US;
+        CyDelayUs(interval);
+        waitedUs += interval;
+        interval <<= 1;
+    }
+    
+    // only waits where the card was not ready straight away teach us anything about how long it takes
+    if (waitedUs != 0) {
+        int32_t error = (int32_t)waitedUs - (int32_t)stats->expectedUs[kind];
+        stats->expectedUs[kind] += error / 8;
         
-        // 0xFF response indicates that the slave pulled MISO high and is active
-        if (statusByte == SD_DATA_IDLE) return true;
-        CyDelayUs(100);
+        if (waitedUs > stats->maxUs[kind]) stats->maxUs[kind] = waitedUs;
+        for (bin = 1; (bin < (SD_WAIT_HIST_BINS - 1)) && (waitedUs >> bin); bin++) {};
     }
+    stats->hist[kind][bin]++;
+    
+    return response;
+}
 
-    // we timed out without the slave pulling MISO high
-    return false;
+
+// Check if the sd card is ready, if not, wait for a period of time for it to become ready
+//   timeOut is in increments of 100us
+static bool Is_CardReady(SDCard_t *card, uint32_t timeOut) {
+
+    // 0xFF response indicates that the slave pulled MISO high and is active
+    return (Wait_Card(card, SD_WAIT_BUSY, true, timeOut * 100) == SD_DATA_IDLE);
+}
+
+
+// Start the learned wait times from the access times the card reports in its CSD
+//   the write time is the read time scaled by R2W_FACTOR, the history then takes over as the card is used
+static void Seed_WaitTimes(SDCard_t *card, const uint8_t *csd) {
+    static const uint8_t taacValue[16] = { 0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80 };
+    uint32_t taacNs = taacValue[(csd[1] >> 3) & 0x0F];
+    uint32_t readUs;
+    
+    // TAAC is a mantissa (in tenths) and a power of ten exponent in nanoseconds
+    for (uint8_t unit = csd[1] & 0x07; unit != 0; unit--) {
+        taacNs *= 10;
+    }
+    readUs = (taacNs / 10 / 1000) + ((uint32_t)csd[2] * 100 / SDSPI_DATA_CLOCK_MHZ);
+    
+    memset(&card->waitStats, 0, sizeof(SDWaitStats_t));
+    card->waitStats.expectedUs[SD_WAIT_TOKEN] = readUs;
+    card->waitStats.expectedUs[SD_WAIT_BUSY] = readUs << ((csd[12] >> 2) & 0x07);
 }
 
 
 
 // Deselect the SD Card
-static void Release_SDCard(void) {
+static void Release_SDCard(SDCard_t *card) {
 
-    SS_Write(1);
+    card->bus.writeSelect(1);
+    card->selected = false;
     
-    // write a dummy byte so the card releases MISO in case there are multiple slaves on the bus
-    SDSPI_WriteTxData(SDSPI_DUMMY_BYTE); 
+    // clock a dummy byte so the card releases MISO in case there are multiple slaves on the bus
+    //   it is read back so no byte is left in flight to overfill the fifos of the next streamed transfer
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
 }
 
 
 // Assert SS on the SD card and wait for it to 
-static bool Select_SDCard(void)	{
-    SS_Write(0);
+static bool Select_SDCard(SDCard_t *card)	{
+    card->bus.writeSelect(0);
  
     // write a dummy byte so the card acquires MISO in case there are multiple slaves on the bus
-    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
     
     // Check if the card is ready
-    if (Is_CardReady(5000)) return true;
+    if (Is_CardReady(card, 5000)) {
+        card->selected = true;
+        return true;
+    }
 
     // if not, release is SS
-    Release_SDCard();
+    Release_SDCard(card);
     return false;	
 }
 
@@ -80,29 +233,79 @@ static bool Select_SDCard(void)	{
 
 
 // send a buffer of the specified size to the card
-static void Send_BufferToSDCard(const uint8_t *buf, uint32_t size) {
-        uint32_t index = 0;
-           
-        // throw the contents of our buffer into the SPI tx
-        while (size) {
-            SDSPI_WriteTxData(buf[index++]);
-            --size;
+//   the tx fifo is kept primed SDSPI_FIFO_DEPTH bytes ahead and the rx fifo is emptied as the bytes come back,
+//   so the bus never idles between bytes and nothing is dropped on the floor
+static void Send_BufferToSDCard(SDCard_t *card, const uint8_t *buf, uint32_t size) {
+    const SDBus_t bus = card->bus;
+    const uint8_t *txEnd = buf + size;
+    uint32_t inFlight = (size < SDSPI_FIFO_DEPTH) ? size : SDSPI_FIFO_DEPTH;
+    uint8_t discard;
+    
+    Clear_SdspiRxFifo(bus);
+    
+    // prime the tx fifo
+    for (uint32_t i = inFlight; i != 0; i--) {
+        Write_SdspiTxFifo(bus, *buf++);
+    }
+    
+    // a full data block leaves 508 bytes to stream after priming, so unroll by the fifo depth
+    if (size == 512) {
+        while (buf != txEnd) {
+            Stream_SdspiByte(bus, discard, buf[0]);
+            Stream_SdspiByte(bus, discard, buf[1]);
+            Stream_SdspiByte(bus, discard, buf[2]);
+            Stream_SdspiByte(bus, discard, buf[3]);
+            buf += SDSPI_FIFO_DEPTH;
         }
-        
-        // wait for the transmit to complete
-        while (!(SDSPI_ReadTxStatus() & SDSPI_STS_SPI_DONE)) {};
+    }
+    else {
+        while (buf != txEnd) {
+            Stream_SdspiByte(bus, discard, *buf++);
+        }
+    }
+    
+    // wait for the transmit to complete by collecting the last bytes clocked back
+    while (inFlight--) {
+        Drain_SdspiByte(bus, discard);
+    }
+    (void)discard;
 }
 
 
 // clock out size bytes of data from the sd card
-static void Receive_DataBuf(uint8_t *buf, uint32_t size) {
-    uint32_t i = 0;
+//   dummy bytes are kept SDSPI_FIFO_DEPTH ahead of the bytes being read back, as in Send_BufferToSDCard
+static void Receive_DataBuf(SDCard_t *card, uint8_t *buf, uint32_t size) {
+    const SDBus_t bus = card->bus;
+    uint32_t inFlight = (size < SDSPI_FIFO_DEPTH) ? size : SDSPI_FIFO_DEPTH;
+    uint8_t *streamEnd = buf + size - inFlight;
     
-    SDSPI_ClearRxBuffer();
+    Clear_SdspiRxFifo(bus);
     
-    do {
-        buf[i++] = SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-    } while (--size);    
+    // prime the tx fifo
+    for (uint32_t i = inFlight; i != 0; i--) {
+        Write_SdspiTxFifo(bus, SDSPI_DUMMY_BYTE);
+    }
+    
+    // a full data block leaves 508 bytes to stream after priming, so unroll by the fifo depth
+    if (size == 512) {
+        while (buf != streamEnd) {
+            Stream_SdspiByte(bus, buf[0], SDSPI_DUMMY_BYTE);
+            Stream_SdspiByte(bus, buf[1], SDSPI_DUMMY_BYTE);
+            Stream_SdspiByte(bus, buf[2], SDSPI_DUMMY_BYTE);
+            Stream_SdspiByte(bus, buf[3], SDSPI_DUMMY_BYTE);
+            buf += SDSPI_FIFO_DEPTH;
+        }
+    }
+    else {
+        while (buf != streamEnd) {
+            Stream_SdspiByte(bus, *buf++, SDSPI_DUMMY_BYTE);
+        }
+    }
+    
+    // and collect the bytes still in flight
+    while (inFlight--) {
+        Drain_SdspiByte(bus, *buf++);
+    }
 }
 
 
@@ -111,28 +314,19 @@ static void Receive_DataBuf(uint8_t *buf, uint32_t size) {
 //  need to check for the SD_DATA_START_TOKEN and expect a CRC
 // this is usually done on a read block/multiblock command
 // but also happens with the read CSD and read CID commands
-static bool Receive_DataBlock(uint8_t *buf, uint32_t size) {
-    uint8_t token;
-    
-    // poll the sd card for a data start token
-    for (uint16_t retries = 1000; retries != 0; retries--) {	
-        
-        token = SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-        
-        // as soon as we get a non-idle token, leave the loop
-        if (token != SD_DATA_IDLE) break;
-        CyDelayUs(25);
-    }
+static bool Receive_DataBlock(SDCard_t *card, uint8_t *buf, uint32_t size) {
+    // poll the sd card for a data start token, as soon as we get a non-idle token we are done waiting
+    uint8_t token = Wait_Card(card, SD_WAIT_TOKEN, false, 25000);
     
     // make sure the token we received is the data block start token
     if (token != SD_DATA_START_TOKEN) return false;		
 
     // Now clock out the data
-    Receive_DataBuf(buf, size);
+    Receive_DataBuf(card, buf, size);
     
     // throw away the crc
-    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
     
     return true;
 }
@@ -140,24 +334,24 @@ static bool Receive_DataBlock(uint8_t *buf, uint32_t size) {
 
 
 // send a block of 512 bytes to the sd card
-static bool Write_DataBlock(const uint8_t *buf, uint8_t token) {
+static bool Write_DataBlock(SDCard_t *card, const uint8_t *buf, uint8_t token) {
     
-    if (!Is_CardReady(5000)) return 0;
+    if (!Is_CardReady(card, 5000)) return 0;
 
-    SDSPI_ExchangeByte(token);
+    Exchange_SDByte(card, token);
 
-    Send_BufferToSDCard(buf, 512);	
+    Send_BufferToSDCard(card, buf, 512);
 
-    SDSPI_ClearRxBuffer();
+    Clear_SdspiRxFifo(card->bus);
 
     // send dummy CRC bytes
-    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
+    Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
         
     // now wait for the write to be accepted
     uint32_t writeWait = 10000;
     do {
-        uint8_t response = SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+        uint8_t response = Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
             
         // if we get a write accepted response, return success
         if ((response & 0x1F) == SD_RESP_DATA_ACCEPTED) {
@@ -178,24 +372,34 @@ static bool Write_DataBlock(const uint8_t *buf, uint8_t token) {
 //  generally the value returned for all the commands used will be an R1 type
 //  response (as the first byte of R3 and R7 responses is a R1 response).
 //  Any additional response bytes are handled by the caller
-static uint8_t Send_SDCmd(SDCardCmd_t cmd,	uint32_t cmdArg) {		
+static uint8_t Send_SDCmd(SDCard_t *card, SDCardCmd_t cmd,	uint32_t cmdArg) {
     uint8_t cmdBuf[6];
+    bool keepSelected = (card->transactionDepth != 0);
 
     // handle the case we are sending an app specific command
     if (Is_AppSpecificCmd(cmd)) {
                 
         // send the application specific command preamble
-        uint8_t cmdResp = Send_SDCmd(APP_CMD_Cmd55, 0);
+        uint8_t cmdResp = Send_SDCmd(card, APP_CMD_Cmd55, 0);
         if (cmdResp > 1) return cmdResp;
         
         // And clear the app specific bit flag
         cmd &= ~(SDCMD_APP_SPECIFIC_FLAG);
+        
+        // the command itself follows the preamble without releasing the card
+        keepSelected = true;
     }
 
     // Select the card and wait for ready except to stop multiple block read
+    //   if the card is already held selected, only wait for it to be ready
     if (cmd != STOP_TRANSMISSION_Cmd12) {
-        Release_SDCard();
-        if (!Select_SDCard()) return 0xFF;
+        if (keepSelected && card->selected) {
+            if (!Is_CardReady(card, 5000)) return 0xFF;
+        }
+        else {
+            Release_SDCard(card);
+            if (!Select_SDCard(card)) return 0xFF;
+        }
     }
 
     // Build and send the command packet
@@ -211,21 +415,21 @@ static uint8_t Send_SDCmd(SDCardCmd_t cmd,	uint32_t cmdArg) {
     else if (cmd == SEND_IF_COND_Cmd8) {
         cmdBuf[5]  = 0x87;		//  CRC for CMD8
     }
-    Send_BufferToSDCard(cmdBuf, 6);
+    Send_BufferToSDCard(card, cmdBuf, 6);
     
     // Receive command response 
     if (cmd == STOP_TRANSMISSION_Cmd12) {
         //  as the card has preloaded the next byte of data already, there is a dummy byte in the sd card fifo we need to read
-        SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);	
+        Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
     }
 
     uint8_t response;
     uint8_t retries = 25;
     
     // clear out the bytes from the cmd transfer
-    SDSPI_ClearRxBuffer();   
+    Clear_SdspiRxFifo(card->bus);
     do {
-        response = SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+        response = Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
         
     } while (!Is_ValidR1Response(response) && --retries);
 
@@ -235,17 +439,349 @@ static uint8_t Send_SDCmd(SDCardCmd_t cmd,	uint32_t cmdArg) {
 }
 
 
+// read the card registers into the card info and work out the card geometry from them
+//   the CSD is required as it holds the capacity, the other registers are left zeroed if the card does not supply them
+static bool Read_CardInfo(SDCard_t *card) {
+    SDCardInfo_t *info = &card->info;
+    uint8_t *csd = info->csd;
+    uint8_t n;
+    
+    memset(info, 0, sizeof(SDCardInfo_t));
+    info->cardType = card->cardType;
+    
+    if (Send_SDCmd(card, SEND_CSD_Cmd9, 0) != R1_RESPONSE_OK) return false;
+    if (!Receive_DataBlock(card, csd, 16)) return false;
+    Seed_WaitTimes(card, csd);
+    
+    if (Send_SDCmd(card, SEND_CID_Cmd10, 0) == R1_RESPONSE_OK) {
+        Receive_DataBlock(card, info->cid, 16);
+    }
+    
+    // CMD58 has a R3 response with the 4 OCR bytes following the R1 byte
+    if (Send_SDCmd(card, READ_EXTR_MULTI_Cmd58, 0) == R1_RESPONSE_OK) {
+        Receive_DataBuf(card, info->ocr, 4);
+    }
+    
+    if (Is_CardTypeSDC(card)) {
+        if (Send_SDCmd(card, SEND_SCR_ACmd51, 0) == R1_RESPONSE_OK) {
+            Receive_DataBlock(card, info->scr, 8);
+        }
+    }
+    
+    if (Is_CardTypeSD2(card)) {
+        if (Send_SDCmd(card, SD_STATUS_ACmd13, 0) == R1_RESPONSE_OK) {
+            Exchange_SDByte(card, SDSPI_DUMMY_BYTE);    // ACMD13 has a R2 response so toss the second byte
+            Receive_DataBlock(card, info->sdStatus, 64);
+        }
+    }
+    
+    // check the CSD structure version to determine the type of card, 1 indidicates High Capacity and Extended Capacity
+    //   0 indicates standard capacity
+    if ((csd[0] >> 6) == 1) {
+        
+        // determine the number of sectors based on the csize field in the CSD v2
+        uint32_t csize = csd[9] + ((uint32_t)csd[8] << 8) + 1;
+        info->sectorCount = csize << 10;
+    }
+    
+    // determine the number of sectors based on the fields in the CSD v1
+    else {
+        n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
+        uint32_t csize = (csd[8] >> 6) + ((uint32_t)csd[7] << 2) + ((uint32_t)(csd[6] & 3) << 10) + 1;
+        info->sectorCount = csize << (n - 9);
+    }
+    
+    // the allocation unit comes from the SD status on v2 cards, and from the CSD on v1 and MMC cards
+    if (Is_CardTypeSD2(card)) {
+        info->auSectors = 16UL << (info->sdStatus[10] >> 4);    // sdStatus[10] 7-4 hold the allocation unit size with 0 = invalid
+                                                                //   the AU size is 16k * 2^(AU_Field - 1).  Thus, with 512 byte sectors,
+                                                                //      the number of sectors per AU is 16 * 2^AU_Field
+        
+        // sdStatus[8] holds the speed class code: 0 = class 0, 1 = class 2, 2 = class 4, 3 = class 6, 4 = class 10
+        n = info->sdStatus[8];
+        info->speedClass = (n == 4) ? 10 : (n < 4) ? (n << 1) : 0;
+    }
+    else if (Is_CardTypeSD1(card)) {
+        info->auSectors = (((csd[10] & 63) << 1) + ((uint16_t)(csd[11] & 128) >> 7) + 1) << ((csd[13] >> 6) - 1);
+    } 
+    else {				
+        info->auSectors = ((uint16_t)((csd[10] & 124) >> 2) + 1) * (((csd[11] & 3) << 3) + ((csd[11] & 224) >> 5) + 1);
+    }
+    
+    info->cmd23Support = Is_CardTypeSDC(card) && (info->scr[3] & SCR_CMD23_SUPPORT_FLAG);
+    
+    return true;
+}
+
+
+
+/*--------------------------------------------------------------------------
+   Block transfers
+
+   A transfer to or from one card is a run of blocks that is started, stepped
+   one block at a time and finished.  disk_read and disk_write do a single run,
+   the mirror and stripe helpers step the runs of several cards in turn so each
+   card programs (or fetches) its next block while the others are being clocked.
+---------------------------------------------------------------------------*/
+
+typedef struct {
+    SDCard_t *card;
+    uint8_t *buf;               // where the next block goes
+    uint32_t stride;            // bytes between the blocks in buf
+    uint32_t remaining;         // blocks still to read
+    bool multi;                 // CMD18 rather than CMD17
+    bool closedEnded;           // the card was told the block count with CMD23
+    bool open;                  // the read command was accepted
+    bool failed;                // a block did not arrive
+} SDReadRun_t;
+
+typedef struct {
+    SDCard_t *card;
+    const uint8_t *buf;         // the next block to send
+    uint32_t stride;            // bytes between the blocks in buf
+    uint32_t remaining;         // blocks still to write
+    bool multi;                 // CMD25 rather than CMD24
+    bool closedEnded;           // the card was told the block count with CMD23
+    bool open;                  // the write command was accepted
+    bool failed;                // a block was not accepted
+} SDWriteRun_t;
+
+
+// send the read command for a run, the card stays selected until the run is finished
+static void Start_ReadRun(SDReadRun_t *run, uint32_t sector) {
+    SDCard_t *card = run->card;
+
+    //covert sector number to byte number if we are using a block card
+    if (!Is_CardTypeBlock(card)) sector *= 512;
+
+    // determine if we need to use a single or multiblock read command
+    run->multi = (run->remaining > 1);
+    run->closedEnded = false;
+    run->failed = false;
+
+    Begin_SDTransaction(card - _Cards);
+
+    // cards supporting CMD23 are told the block count up front so the transfer ends by itself
+    if (run->multi && card->info.cmd23Support) {
+        run->closedEnded = (Send_SDCmd(card, SET_BLOCK_COUNT_Cmd23, run->remaining) == R1_RESPONSE_OK);
+    }
+
+    // send the read command to the card
+    run->open = (Send_SDCmd(card, run->multi ? READ_MULTIPLE_BLOCK_Cmd18 : READ_SINGLE_BLOCK_Cmd17, sector) == R1_RESPONSE_OK);
+}
+
+
+// grab the next data block of a run, returns false once the run has nothing more to do
+static bool Step_ReadRun(SDReadRun_t *run) {
+
+    if (!run->open || run->failed || (run->remaining == 0)) return false;
+
+    if (!Receive_DataBlock(run->card, run->buf, 512)) {
+        run->failed = true;
+        return false;
+    }
+    run->buf += run->stride;
+    run->remaining--;
+    return true;
+}
+
+
+// end a run and release the card
+static void Finish_ReadRun(SDReadRun_t *run) {
+
+    // if we are at the end of an open ended multiblock transmission, or a closed ended one failed part way,
+    //   send the stop transmission command too
+    if (run->open && run->multi && (!run->closedEnded || (run->remaining != 0))) {
+        Send_SDCmd(run->card, STOP_TRANSMISSION_Cmd12, 0);
+    }
+
+    End_SDTransaction(run->card - _Cards);
+}
+
+
+// send the write command for a run, the card stays selected until the run is finished
+static void Start_WriteRun(SDWriteRun_t *run, uint32_t sector) {
+    SDCard_t *card = run->card;
+
+    //covert sector number to byte number if we are using a block card
+    if (!Is_CardTypeBlock(card)) sector *= 512;
+
+    run->multi = (run->remaining > 1);
+    run->closedEnded = false;
+    run->failed = false;
+
+    Begin_SDTransaction(card - _Cards);
+
+    // if we are writing a single block, send the write block command
+    if (!run->multi) {
+        run->open = (Send_SDCmd(card, WRITE_BLOCK_Cmd24, sector) == R1_RESPONSE_OK);
+        return;
+    }
+
+    // cards supporting CMD23 are told the block count up front so the transfer ends by itself after the last block
+    if (card->info.cmd23Support) {
+        run->closedEnded = (Send_SDCmd(card, SET_BLOCK_COUNT_Cmd23, run->remaining) == R1_RESPONSE_OK);
+    }
+    // otherwise, including when the card rejected CMD23, SDC cards can preerase the blocks for better performance
+    if (!run->closedEnded && Is_CardTypeSDC(card)) {
+        Send_SDCmd(card, SET_WR_BLK_ERASE_CNT_ACmd23, run->remaining);
+    }
+
+    // now start the actual multiblock write
+    run->open = (Send_SDCmd(card, WRITE_MULTIPLE_BLOCK_Cmd25, sector) == R1_RESPONSE_OK);
+}
+
+
+// send the next data block of a run, returns false once the run has nothing more to do
+static bool Step_WriteRun(SDWriteRun_t *run) {
+
+    if (!run->open || run->failed || (run->remaining == 0)) return false;
+
+    if (!Write_DataBlock(run->card, run->buf, run->multi ? SD_DATA_MULTI_BLK_WRITE_TOKEN : SD_DATA_START_TOKEN)) {
+        run->failed = true;
+        return false;
+    }
+    run->buf += run->stride;
+    run->remaining--;
+    return true;
+}
+
+
+// end a run and release the card
+static void Finish_WriteRun(SDWriteRun_t *run) {
+
+    // Finalize the multi-block write
+    if (run->open && run->multi) {
+
+        // if the card is not ready after the last block write, at least one block remains unwritten
+        if (!Is_CardReady(run->card, 5000)) {
+            if (run->remaining == 0) run->remaining = 1;
+        }
+        // otherwise send the stop token, unless a closed ended transfer completed by itself
+        else if (!run->closedEnded || (run->remaining != 0)) {
+            Exchange_SDByte(run->card, SD_STOP_TRANS_TOKEN);
+        }
+    }
+
+    End_SDTransaction(run->card - _Cards);
+}
+
+
+// read the runs of several cards at once, a block from each card in turn
+static FatFS_DiskOpResult_t Do_ReadRuns(SDReadRun_t *runs, const uint32_t *sectors, uint8_t runCount) {
+    FatFS_DiskOpResult_t res = RES_OK;
+    bool stepped;
+
+    for (uint8_t i = 0; i < runCount; i++) {
+        Start_ReadRun(&runs[i], sectors[i]);
+    }
+
+    do {
+        stepped = false;
+        for (uint8_t i = 0; i < runCount; i++) {
+            stepped |= Step_ReadRun(&runs[i]);
+        }
+    } while (stepped);
+
+    for (uint8_t i = 0; i < runCount; i++) {
+        Finish_ReadRun(&runs[i]);
+
+        // if we were unable to read all our blocks successfully, return an error
+        if (runs[i].remaining != 0) res = RES_ERROR;
+    }
+
+    return res;
+}
+
+
+// write the runs of several cards at once, a block to each card in turn so the cards program in parallel
+static FatFS_DiskOpResult_t Do_WriteRuns(SDWriteRun_t *runs, const uint32_t *sectors, uint8_t runCount) {
+    FatFS_DiskOpResult_t res = RES_OK;
+    bool stepped;
+
+    for (uint8_t i = 0; i < runCount; i++) {
+        Start_WriteRun(&runs[i], sectors[i]);
+    }
+
+    do {
+        stepped = false;
+        for (uint8_t i = 0; i < runCount; i++) {
+            stepped |= Step_WriteRun(&runs[i]);
+        }
+    } while (stepped);
+
+    for (uint8_t i = 0; i < runCount; i++) {
+        Finish_WriteRun(&runs[i]);
+
+        // one or more blocks of this run failed
+        if (runs[i].remaining != 0) res = RES_ERROR;
+    }
+
+    return res;
+}
+
+
+// check a list of drives for the mirror and stripe helpers, every drive must be initialized and appear only once
+static bool Are_DrivesUsable(const uint8_t *drives, uint8_t driveCount) {
+
+    if ((driveCount == 0) || (driveCount > SD_CARD_COUNT)) return false;
+
+    for (uint8_t i = 0; i < driveCount; i++) {
+        if (Is_DiskUninitialized(drives[i])) return false;
+        for (uint8_t j = 0; j < i; j++) {
+            if (drives[i] == drives[j]) return false;
+        }
+    }
+    return true;
+}
+
+
+// work out the run of a stripe that lands on the card at position index in the stripe
+//   logical sector n of the stripe is sector n / driveCount of card n % driveCount
+static uint32_t Get_StripeRun(uint8_t index, uint8_t driveCount, uint32_t sector, uint32_t count, uint32_t *cardSector, uint32_t *bufOffset) {
+    uint32_t first = sector + ((index + driveCount - (sector % driveCount)) % driveCount);
+
+    if (first >= (sector + count)) return 0;
+
+    *cardSector = first / driveCount;
+    *bufOffset = (first - sector) * 512;
+    return ((sector + count - 1 - first) / driveCount) + 1;
+}
+
+
 /*--------------------------------------------------------------------------
    Public Functions
 ---------------------------------------------------------------------------*/
 
+// start holding the card selected across disk operations, the card is selected by the first command sent
+void Begin_SDTransaction(uint8_t drv) {
+    if (drv >= SD_CARD_COUNT) return;
+
+    _Cards[drv].transactionDepth++;
+}
+
+
+// end a transaction and release the card when the outermost transaction ends
+void End_SDTransaction(uint8_t drv) {
+    if (drv >= SD_CARD_COUNT) return;
+
+    SDCard_t *card = &_Cards[drv];
+    if (card->transactionDepth != 0) {
+        card->transactionDepth--;
+    }
+    if (card->transactionDepth == 0) {
+        Release_SDCard(card);
+    }
+}
+
+
 /*-----------------------------------------------------------------------*/
-/* Get Disk Status - only drive 0 supported                              */
+/* Get Disk Status                                                       */
 /*-----------------------------------------------------------------------*/
 FatFS_DiskStatus_t disk_status(uint8_t drv) {
-    if (drv) return STA_NOINIT;
+    if (drv >= SD_CARD_COUNT) return STA_NOINIT;
 
-    return _DiskStatus;
+    return _Cards[drv].diskStatus;
 }
 
 /*-----------------------------------------------------------------------*/
@@ -258,37 +794,40 @@ FatFS_DiskStatus_t disk_initialize(uint8_t drv) {
 
     uint8_t cardType = CARDTYPE_UNDEFINED;
     
-    // only drive 0 is supported
-    if (drv) return RES_NOTRDY;
+    // only the drives with a card slot are supported
+    if (drv >= SD_CARD_COUNT) return STA_NOINIT;
+
+    SDCard_t *card = &_Cards[drv];
+    if (card->bus.writeSelect == 0) return card->diskStatus;
 
     CyDelay(10);
 
     // dummy clocks to prepare card
     for (uint8_t i = 0; i < 10; i++) {
-        SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
+        Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
     }
     
     // tell the card to go to the idle state as the first step in initialization
-    if (Send_SDCmd(GO_IDLE_STATE_Cmd0, 0) == R1_RESPONSE_IDLE) {
+    if (Send_SDCmd(card, GO_IDLE_STATE_Cmd0, 0) == R1_RESPONSE_IDLE) {
         
         // Cmd8 actually responds with a R7 response (5 bytes).  The first byte, however, is the same as an R1 response
         //   Send the command with an echo byte of 0xAA and check if it supports 2.7-3.6V
         //   If we receive an idle response, it is a v2 sd card so initialize it as such
-        if (Send_SDCmd(SEND_IF_COND_Cmd8, 0x1AA) == R1_RESPONSE_IDLE) {	
-            Receive_DataBuf(buf, 4);    // grab the rest of the R7 response
+        if (Send_SDCmd(card, SEND_IF_COND_Cmd8, 0x1AA) == R1_RESPONSE_IDLE) {
+            Receive_DataBuf(card, buf, 4);    // grab the rest of the R7 response
             if ((buf[2] == 0x01) && (buf[3] == 0xAA)) {		// verify that the response indicates the card can operate at 2.7-3.6V and that the echo byte supplied matches
                 
                 // now send the command indicating that we support SDHC cards and wait for the card to leave the idle state
                 for (retries = 1000; (retries != 0); retries--) {
-                    if (Send_SDCmd(SD_SEND_OP_COND_ACmd41, HOST_CAPACITY_SUPPORT) == R1_RESPONSE_OK) break;
+                    if (Send_SDCmd(card, SD_SEND_OP_COND_ACmd41, HOST_CAPACITY_SUPPORT) == R1_RESPONSE_OK) break;
                     CyDelay(1);
                 }
                 
                 // if the card has left idle, grab the operations conditions register (OCR) with CMD58
                 //   CMD58 has a R3 response of 5 bytes with byte one being equiv to an R1 response
-                if ((retries != 0) && Send_SDCmd(READ_EXTR_MULTI_Cmd58, 0) == R1_RESPONSE_OK) {
+                if ((retries != 0) && Send_SDCmd(card, READ_EXTR_MULTI_Cmd58, 0) == R1_RESPONSE_OK) {
                     
-                    Receive_DataBuf(buf, 4);  // grab the rest of the R3 response
+                    Receive_DataBuf(card, buf, 4);  // grab the rest of the R3 response
                     
                     // OCR reg is in buf, transmitted MSB first
                     // check if the CCS flag is set
@@ -307,7 +846,7 @@ FatFS_DiskStatus_t disk_initialize(uint8_t drv) {
         else {
             
             // try to initialize (while indicating that we do not support high capacity)
-            uint8_t response = Send_SDCmd(SD_SEND_OP_COND_ACmd41, 0); 
+            uint8_t response = Send_SDCmd(card, SD_SEND_OP_COND_ACmd41, 0);
             
             // A sd v1 card will respond to the initialization request as either idle or command accepted
             if ((response == R1_RESPONSE_OK) || (response == R1_RESPONSE_IDLE)) {
@@ -323,7 +862,7 @@ FatFS_DiskStatus_t disk_initialize(uint8_t drv) {
             
             // send our initialization command until we get an ok response indicating everything is initialized
             for (retries = 1000; (retries != 0); retries--) {
-                if (Send_SDCmd(cmd, 0) == R1_RESPONSE_OK) break;
+                if (Send_SDCmd(card, cmd, 0) == R1_RESPONSE_OK) break;
                 CyDelay(1);
             }
 
@@ -334,24 +873,30 @@ FatFS_DiskStatus_t disk_initialize(uint8_t drv) {
             
             // otherwise, send the command to set the block length to 512
             else {
-                if (Send_SDCmd(SET_BLOCKLEN_Cmd16, 512) != R1_RESPONSE_OK) {
+                if (Send_SDCmd(card, SET_BLOCKLEN_Cmd16, 512) != R1_RESPONSE_OK) {
                     cardType = CARDTYPE_UNDEFINED;
                 }
             }
         }
     }
     
-    _CardType = cardType;
-    if (_CardType == CARDTYPE_UNDEFINED) {
-        _DiskStatus = STA_NOINIT;
+    card->cardType = cardType;
+    
+    // read the card registers once now so the ioctls do not have to go back to the card
+    if ((card->cardType != CARDTYPE_UNDEFINED) && !Read_CardInfo(card)) {
+        card->cardType = CARDTYPE_UNDEFINED;
+    }
+    
+    if (card->cardType == CARDTYPE_UNDEFINED) {
+        card->diskStatus = STA_NOINIT;
     }
     else {
-        _DiskStatus = DISK_STATUS_OK;
+        card->diskStatus = DISK_STATUS_OK;
     }
 
-    Release_SDCard();
+    Release_SDCard(card);
 
-    return _DiskStatus;
+    return card->diskStatus;
 }
 
 
@@ -359,44 +904,12 @@ FatFS_DiskStatus_t disk_initialize(uint8_t drv) {
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
 FatFS_DiskOpResult_t disk_read(uint8_t drv, uint8_t *buf,	uint32_t sector, uint32_t blockCount) {
-    SDCardCmd_t cmd;
 
     // uninitialized disks tell no tales
     if (Is_DiskUninitialized(drv)) return RES_NOTRDY;
     
-     //covert sector number to byte number if we are using a block card
-    if (!Is_CardTypeBlock()) sector *= 512;
-
-    // determine if we need to use a single or multiblock read command
-    if (blockCount > 1) {
-        cmd = READ_MULTIPLE_BLOCK_Cmd18;
-    }
-    else {
-        cmd = READ_SINGLE_BLOCK_Cmd17;
-    }
-    
-    // send the read command to the card
-    if (Send_SDCmd(cmd, sector) == R1_RESPONSE_OK) {
-        
-        // and now grab the data blocks
-        do {
-            if (!Receive_DataBlock(buf, 512)) break;
-            buf += 512;
-        } while (--blockCount);
-        
-        // if we are at the end of a multiblock transmission, send the stop transmission command too
-        if (cmd == READ_MULTIPLE_BLOCK_Cmd18) {
-            Send_SDCmd(STOP_TRANSMISSION_Cmd12, 0);	
-        }
-    }
-    
-    Release_SDCard();
-
-    // if we were unable to read all our blocks successfully, return an error
-    if (blockCount != 0) return RES_ERROR;
-    
-    // otherwise the read was successful
-    return RES_OK;
+    SDReadRun_t run = { .card = &_Cards[drv], .buf = buf, .stride = 512, .remaining = blockCount };
+    return Do_ReadRuns(&run, &sector, 1);
 }
 
 /*-----------------------------------------------------------------------*/
@@ -407,55 +920,65 @@ FatFS_DiskOpResult_t disk_write(uint8_t drv, const uint8_t *buf, uint32_t sector
     // uninitialized disks tell no tales
     if (Is_DiskUninitialized(drv)) return RES_NOTRDY;
     
-    //covert sector number to byte number if we are using a block card
-    if (!Is_CardTypeBlock()) sector *= 512;
+    SDWriteRun_t run = { .card = &_Cards[drv], .buf = buf, .stride = 512, .remaining = numBlocks };
+    return Do_WriteRuns(&run, &sector, 1);
+}
 
-    // if we are writing a single block
-    if (numBlocks == 1) {
+    
+/*-----------------------------------------------------------------------*/
+/* Mirrored and Striped Transfers                                        */
+/*-----------------------------------------------------------------------*/
         
-        // send the write block command
-        if (Send_SDCmd(WRITE_BLOCK_Cmd24, sector) == R1_RESPONSE_OK) {
+// write the same count sectors starting at sector to every card in drives
+FatFS_DiskOpResult_t SD_MirrorWrite(const uint8_t *drives, uint8_t driveCount, const uint8_t *buf, uint32_t sector, uint32_t count) {
+    SDWriteRun_t runs[SD_CARD_COUNT];
+    uint32_t sectors[SD_CARD_COUNT];
             
-            // and write the data if we received the command accepted response
-            if (Write_DataBlock(buf, SD_DATA_START_TOKEN)) {
-                numBlocks = 0; // no blocks remain
-            }
-        }
+    if (!Are_DrivesUsable(drives, driveCount)) return RES_NOTRDY;
+
+    for (uint8_t i = 0; i < driveCount; i++) {
+        runs[i] = (SDWriteRun_t) { .card = &_Cards[drives[i]], .buf = buf, .stride = 512, .remaining = count };
+        sectors[i] = sector;
     }
+    return Do_WriteRuns(runs, sectors, driveCount);
+}
     
-    // otherwise we are sending multiple blocks to be written
-    else {
         
-        // SDC cards can preerase the blocks for better performance
-        if (Is_CardTypeSDC()) {
-            Send_SDCmd(SET_WR_BLK_ERASE_CNT_ACmd23, numBlocks);
-        }
+// write count sectors of a stripe across the cards in drives, see Get_StripeRun for the layout
+FatFS_DiskOpResult_t SD_StripeWrite(const uint8_t *drives, uint8_t driveCount, const uint8_t *buf, uint32_t sector, uint32_t count) {
+    SDWriteRun_t runs[SD_CARD_COUNT];
+    uint32_t sectors[SD_CARD_COUNT];
+    uint32_t bufOffset;
+    uint8_t runCount = 0;
         
-        // now perform the actual multiblock write
-        if (Send_SDCmd(WRITE_MULTIPLE_BLOCK_Cmd25, sector) == R1_RESPONSE_OK) {
-            do {
-                if (!Write_DataBlock(buf, SD_DATA_MULTI_BLK_WRITE_TOKEN)) break;
-                buf += 512;
-            } while (--numBlocks);
+    if (!Are_DrivesUsable(drives, driveCount)) return RES_NOTRDY;
+        
+    for (uint8_t i = 0; i < driveCount; i++) {
+        uint32_t blocks = Get_StripeRun(i, driveCount, sector, count, &sectors[runCount], &bufOffset);
+        if (blocks == 0) continue;
                         
-            // Finalize the multi-block write
-            // if the card is not ready after the last block write, at least one block remains unwritten
-            if (!Is_CardReady(5000)) {
-                numBlocks = 1;
-            }
-            // otherwise send the stop token
-            else {
-                SDSPI_ExchangeByte(SD_STOP_TRANS_TOKEN);
-            }
-        }
+        runs[runCount++] = (SDWriteRun_t) { .card = &_Cards[drives[i]], .buf = buf + bufOffset, .stride = driveCount * 512, .remaining = blocks };
     }
-    Release_SDCard();
+    return Do_WriteRuns(runs, sectors, runCount);
+}
 
-    // no blocks remain unwritten so return success
-    if (numBlocks == 0) return RES_OK;
     
-    //otherwise, one or more failed
-    return RES_ERROR;
+// read count sectors of a stripe written by SD_StripeWrite
+FatFS_DiskOpResult_t SD_StripeRead(const uint8_t *drives, uint8_t driveCount, uint8_t *buf, uint32_t sector, uint32_t count) {
+    SDReadRun_t runs[SD_CARD_COUNT];
+    uint32_t sectors[SD_CARD_COUNT];
+    uint32_t bufOffset;
+    uint8_t runCount = 0;
+
+    if (!Are_DrivesUsable(drives, driveCount)) return RES_NOTRDY;
+
+    for (uint8_t i = 0; i < driveCount; i++) {
+        uint32_t blocks = Get_StripeRun(i, driveCount, sector, count, &sectors[runCount], &bufOffset);
+        if (blocks == 0) continue;
+
+        runs[runCount++] = (SDReadRun_t) { .card = &_Cards[drives[i]], .buf = buf + bufOffset, .stride = driveCount * 512, .remaining = blocks };
+    }
+    return Do_ReadRuns(runs, sectors, runCount);
 }
 
 
@@ -464,41 +987,25 @@ FatFS_DiskOpResult_t disk_write(uint8_t drv, const uint8_t *buf, uint32_t sector
 /*-----------------------------------------------------------------------*/
 FatFS_DiskOpResult_t disk_ioctl (uint8_t drv, uint8_t ctrlCode,	void *buf) {
     FatFS_DiskOpResult_t res;
-    uint8_t n, csd[16];
 
     if (Is_DiskUninitialized(drv)) return RES_NOTRDY;
 
+    SDCard_t *card = &_Cards[drv];
+
+    Begin_SDTransaction(drv);
+    
     res = RES_ERROR;
     switch (ctrlCode) {
         
         // make sure card is in ready state
         case CTRL_SYNC :
-            if (Select_SDCard()) res = RES_OK;
+            if (card->selected ? Is_CardReady(card, 5000) : Select_SDCard(card)) res = RES_OK;
             break;
         
-        // return the number of sectors on the disk, calculated based on the contents of the CSD register
+        // return the number of sectors on the disk, calculated from the CSD register at initialization
         case GET_SECTOR_COUNT :
-            if (Send_SDCmd(SEND_CSD_Cmd9, 0) == 0) {
-                if (Receive_DataBlock(csd, 16)) {
-                    
-                    // check the CSD structure version to determine the type of card, 1 indidicates High Capacity and Extended Capacity
-                    //   0 indicates standard capacity
-                    if ((csd[0] >> 6) == 1) {
-                        
-                        // determine the number of sectors based on the csize field in the CSD v2
-                        uint32_t csize = csd[9] + ((uint32_t)csd[8] << 8) + 1;
-                        *(uint32_t *)buf = csize << 10;
-                    }
-                    
-                    // determine the number of sectors based on the fields in the CSD v1
-                    else {
-                        n = (csd[5] & 15) + ((csd[10] & 128) >> 7) + ((csd[9] & 3) << 1) + 2;
-                        uint32_t csize = (csd[8] >> 6) + ((uint32_t)csd[7] << 2) + ((uint32_t)(csd[6] & 3) << 10) + 1;
-                        *(uint32_t *)buf = csize << (n - 9);
-                    }
-                    res = RES_OK;
-                }
-            }
+            *(uint32_t *)buf = card->info.sectorCount;
+            res = RES_OK;
             break;
 
             
@@ -514,48 +1021,55 @@ FatFS_DiskOpResult_t disk_ioctl (uint8_t drv, uint8_t ctrlCode,	void *buf) {
             
         // get the number of sectors per allocation unit
         case GET_BLOCK_SIZE :
+            *(uint32_t *)buf = card->info.auSectors;
+            res = RES_OK;
+            break;
+            
+            
+        // the raw card registers and the full card information are copied out of the cache
+        case MMC_GET_TYPE :
+            *(uint8_t *)buf = card->cardType;
+            res = RES_OK;
+            break;
 
-            // case where it is a v2 sd card
-            if (Is_CardTypeSD2()) {
-                if (Send_SDCmd(SD_STATUS_ACmd13, 0) == R1_RESPONSE_OK) {
-                    SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-                    if (Receive_DataBlock(csd, 16)) {
-                        
-                        // the actual response is 64 bytes so toss the remainder
-                        for (n = 64 - 16; n; n--) SDSPI_ExchangeByte(SDSPI_DUMMY_BYTE);
-                        *(uint32_t*)buf = 16UL << (csd[10] >> 4);       // csd[10] 7-4   hold the allocation unit size with 0 = invalid
-                                                                        //   the AU size is 16k * 2^(AU_Field - 1).  Thus, with 512 byte sectors,
-                                                                        //      the number of sectors per AU is 16 * 2^AU_Field
-                        res = RES_OK;
-                    }
-                }
-            }
+        case MMC_GET_CSD :
+            memcpy(buf, card->info.csd, sizeof(card->info.csd));
+            res = RES_OK;
+            break;
             
-            // SD v1 or MMC
-            else {			
-                if (Send_SDCmd(SEND_CSD_Cmd9, R1_RESPONSE_OK) == 0) {
-                    if (Receive_DataBlock(csd, 16)) {
-                        
-                        // each of these calculations relies on values found in the CSD register described in the spec
-                        if (Is_CardTypeSD1()) {
-                            *(uint32_t *)buf = (((csd[10] & 63) << 1) + ((uint16_t)(csd[11] & 128) >> 7) + 1) << ((csd[13] >> 6) - 1);
-                        } 
-                        else {				
-                            *(uint32_t *)buf = ((uint16_t)((csd[10] & 124) >> 2) + 1) * (((csd[11] & 3) << 3) + ((csd[11] & 224) >> 5) + 1);
-                        }
-                    }
-                    res = RES_OK;
-                }
+        case MMC_GET_CID :
+            memcpy(buf, card->info.cid, sizeof(card->info.cid));
+            res = RES_OK;
+            break;
+            
+        case MMC_GET_OCR :
+            memcpy(buf, card->info.ocr, sizeof(card->info.ocr));
+            res = RES_OK;
+            break;
+            
+        case MMC_GET_SDSTAT :
+            if (Is_CardTypeSD2(card)) {
+                memcpy(buf, card->info.sdStatus, sizeof(card->info.sdStatus));
+                res = RES_OK;
             }
             break;
+            
+        case MMC_GET_CARDINFO :
+            memcpy(buf, &card->info, sizeof(SDCardInfo_t));
+            res = RES_OK;
+            break;
+            
+        case MMC_GET_WAITSTATS :
+            memcpy(buf, &card->waitStats, sizeof(SDWaitStats_t));
+            res = RES_OK;
+            break;
 
                 
         default:
             res = RES_PARERR;
     }
 
-    Release_SDCard();
+    End_SDTransaction(drv);
 
     return res;
 }
-
@@ -130,6 +130,10 @@ command rather than a standard command */
 #define CMD55	(55)		/* APP_CMD */
 #define SDCMD_APP_CMD           (55)
 
+/* Reads the SD Configuration Register (SCR). */
+#define ACMD51	(SDCMD_APP_SPECIFIC_FLAG | 51)	/* SEND_SCR (SDC) */
+#define SDCMD_SEND_SCR          (SDCMD_APP_SPECIFIC_FLAG | 51)
+
 /* Multi-block read type. Refer to Section 5.7.2.4. */
 #define CMD58	(58)		/* READ_EXTR_MULTI */
 #define SDCMD_READ_EXTR_MULTI      (58)
@@ -155,7 +159,8 @@ typedef enum {
     ERASE_Cmd38 = CMD38,
     APP_CMD_Cmd55 = CMD55,
     READ_EXTR_MULTI_Cmd58 = CMD58,
-    SD_STATUS_ACmd13    = ACMD13
+    SD_STATUS_ACmd13    = ACMD13,
+    SEND_SCR_ACmd51 = ACMD51
     
 } SDCardCmd_t;    
     
@@ -179,11 +184,14 @@ typedef enum {
 // flag for last byte (of 4) in OCR register indicating if the card is high capacity
 #define CARD_CAPACITY_SUPPORT_FLAG  0x40
 
+// CMD_SUPPORT bit in the SCR register (bit 33, byte 3 when read MSB first) indicating the card supports CMD23
+#define SCR_CMD23_SUPPORT_FLAG      0x02
+
 // a valid response (error or non-error alike) will have a 0 in the MSB
 #define Is_ValidR1Response(resp)    (!(resp & 0x80))
 
 
-#define Is_DiskUninitialized(drive)       (disk_status(drv) & STA_NOINIT)
+#define Is_DiskUninitialized(drive)       (disk_status(drive) & STA_NOINIT)
     
 #define DISK_STATUS_OK          0x00
 
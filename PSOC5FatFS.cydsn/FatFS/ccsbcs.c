@@ -0,0 +1,187 @@
+/*------------------------------------------------------------------------*/
+/* Unicode - OEM code bidirectional converter  (C)ChaN, 2015              */
+/* (SBCS code pages)                                                      */
+/*------------------------------------------------------------------------*/
+/*  437   U.S.
+/   850   Latin 1
+/   1252  Windows Latin 1 (ANSI)
+*/
+
+#include "ff.h"
+
+
+#if _USE_LFN
+
+#if _CODE_PAGE == 437	/* U.S. */
+static
+const WCHAR Tbl[] = {	/*  CP437(0x80-0xFF) to Unicode conversion table */
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+	0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+	0x00FF, 0x00D6, 0x00DC, 0x00A2, 0x00A3, 0x00A5, 0x20A7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+	0x00BF, 0x2310, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x2561, 0x2562, 0x2556,
+	0x2555, 0x2563, 0x2551, 0x2557, 0x255D, 0x255C, 0x255B, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x255E, 0x255F,
+	0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x2567,
+	0x2568, 0x2564, 0x2565, 0x2559, 0x2558, 0x2552, 0x2553, 0x256B,
+	0x256A, 0x2518, 0x250C, 0x2588, 0x2584, 0x258C, 0x2590, 0x2580,
+	0x03B1, 0x00DF, 0x0393, 0x03C0, 0x03A3, 0x03C3, 0x00B5, 0x03C4,
+	0x03A6, 0x0398, 0x03A9, 0x03B4, 0x221E, 0x03C6, 0x03B5, 0x2229,
+	0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248,
+	0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
+};
+
+#elif _CODE_PAGE == 850	/* Latin 1 */
+static
+const WCHAR Tbl[] = {	/*  CP850(0x80-0xFF) to Unicode conversion table */
+	0x00C7, 0x00FC, 0x00E9, 0x00E2, 0x00E4, 0x00E0, 0x00E5, 0x00E7,
+	0x00EA, 0x00EB, 0x00E8, 0x00EF, 0x00EE, 0x00EC, 0x00C4, 0x00C5,
+	0x00C9, 0x00E6, 0x00C6, 0x00F4, 0x00F6, 0x00F2, 0x00FB, 0x00F9,
+	0x00FF, 0x00D6, 0x00DC, 0x00F8, 0x00A3, 0x00D8, 0x00D7, 0x0192,
+	0x00E1, 0x00ED, 0x00F3, 0x00FA, 0x00F1, 0x00D1, 0x00AA, 0x00BA,
+	0x00BF, 0x00AE, 0x00AC, 0x00BD, 0x00BC, 0x00A1, 0x00AB, 0x00BB,
+	0x2591, 0x2592, 0x2593, 0x2502, 0x2524, 0x00C1, 0x00C2, 0x00C0,
+	0x00A9, 0x2563, 0x2551, 0x2557, 0x255D, 0x00A2, 0x00A5, 0x2510,
+	0x2514, 0x2534, 0x252C, 0x251C, 0x2500, 0x253C, 0x00E3, 0x00C3,
+	0x255A, 0x2554, 0x2569, 0x2566, 0x2560, 0x2550, 0x256C, 0x00A4,
+	0x00F0, 0x00D0, 0x00CA, 0x00CB, 0x00C8, 0x0131, 0x00CD, 0x00CE,
+	0x00CF, 0x2518, 0x250C, 0x2588, 0x2584, 0x00A6, 0x00CC, 0x2580,
+	0x00D3, 0x00DF, 0x00D4, 0x00D2, 0x00F5, 0x00D5, 0x00B5, 0x00FE,
+	0x00DE, 0x00DA, 0x00DB, 0x00D9, 0x00FD, 0x00DD, 0x00AF, 0x00B4,
+	0x00AD, 0x00B1, 0x2017, 0x00BE, 0x00B6, 0x00A7, 0x00F7, 0x00B8,
+	0x00B0, 0x00A8, 0x00B7, 0x00B9, 0x00B3, 0x00B2, 0x25A0, 0x00A0,
+};
+
+#elif _CODE_PAGE == 1252	/* Windows Latin 1 */
+static
+const WCHAR Tbl[] = {	/*  CP1252(0x80-0xFF) to Unicode conversion table */
+	0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+	0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+	0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+	0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178,
+	0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+	0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+	0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+	0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+	0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+	0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+	0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+	0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+	0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+	0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+	0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+	0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF,
+};
+
+#elif _CODE_PAGE == 1	/* ASCII (for only non-LFN cfg) */
+#error Cannot use LFN feature without valid code page.
+
+#else
+#error Unknown code page (this module supports 437, 850 and 1252)
+
+#endif
+
+
+/* Up-case conversion of the Unicode characters out of ASCII, compressed into runs sorted by
+/  the first character. Each run is {first, span, delta}: the characters first to first+span-1
+/  are up-cased by adding delta. If b15 of span is set, only every second character of the run
+/  (first, first+2, ...) is a lower case letter, as in the alternating upper/lower blocks. */
+static
+const WCHAR Cvt[] = {
+	0x00B5, 0x0001, 0x02E7, 0x00E0, 0x0017, 0xFFE0, 0x00F8, 0x0007, 0xFFE0, 0x00FF, 0x0001, 0x0079,
+	0x0101, 0x802F, 0xFFFF, 0x0131, 0x0001, 0xFF18, 0x0133, 0x8005, 0xFFFF, 0x013A, 0x800F, 0xFFFF,
+	0x014B, 0x802D, 0xFFFF, 0x017A, 0x8005, 0xFFFF, 0x017F, 0x0001, 0xFED4, 0x0180, 0x0001, 0x00C3,
+	0x0183, 0x8003, 0xFFFF, 0x0188, 0x0001, 0xFFFF, 0x018C, 0x0001, 0xFFFF, 0x0192, 0x0001, 0xFFFF,
+	0x0195, 0x0001, 0x0061, 0x0199, 0x0001, 0xFFFF, 0x019A, 0x0001, 0x00A3, 0x019E, 0x0001, 0x0082,
+	0x01A1, 0x8005, 0xFFFF, 0x01A8, 0x0001, 0xFFFF, 0x01AD, 0x0001, 0xFFFF, 0x01B0, 0x0001, 0xFFFF,
+	0x01B4, 0x8003, 0xFFFF, 0x01B9, 0x0001, 0xFFFF, 0x01BD, 0x0001, 0xFFFF, 0x01BF, 0x0001, 0x0038,
+	0x01C6, 0x0001, 0xFFFE, 0x01C9, 0x0001, 0xFFFE, 0x01CC, 0x0001, 0xFFFE, 0x01CE, 0x800F, 0xFFFF,
+	0x01DD, 0x0001, 0xFFB1, 0x01DF, 0x8011, 0xFFFF, 0x01F3, 0x0001, 0xFFFE, 0x01F5, 0x0001, 0xFFFF,
+	0x01F9, 0x8027, 0xFFFF, 0x0223, 0x8011, 0xFFFF, 0x023C, 0x0001, 0xFFFF, 0x023F, 0x0002, 0x2A3F,
+	0x0242, 0x0001, 0xFFFF, 0x0247, 0x8009, 0xFFFF, 0x0250, 0x0001, 0x2A1F, 0x0251, 0x0001, 0x2A1C,
+	0x0252, 0x0001, 0x2A1E, 0x0253, 0x0001, 0xFF2E, 0x0254, 0x0001, 0xFF32, 0x0256, 0x0002, 0xFF33,
+	0x0259, 0x0001, 0xFF36, 0x025B, 0x0001, 0xFF35, 0x025C, 0x0001, 0xA54F, 0x0260, 0x0001, 0xFF33,
+	0x0261, 0x0001, 0xA54B, 0x0263, 0x0001, 0xFF31, 0x0265, 0x0001, 0xA528, 0x0266, 0x0001, 0xA544,
+	0x0268, 0x0001, 0xFF2F, 0x0269, 0x0001, 0xFF2D, 0x026A, 0x0001, 0xA544, 0x026B, 0x0001, 0x29F7,
+	0x026C, 0x0001, 0xA541, 0x026F, 0x0001, 0xFF2D, 0x0271, 0x0001, 0x29FD, 0x0272, 0x0001, 0xFF2B,
+	0x0275, 0x0001, 0xFF2A, 0x027D, 0x0001, 0x29E7, 0x0280, 0x0001, 0xFF26, 0x0282, 0x0001, 0xA543,
+	0x0283, 0x0001, 0xFF26, 0x0287, 0x0001, 0xA52A, 0x0288, 0x0001, 0xFF26, 0x0289, 0x0001, 0xFFBB,
+	0x028A, 0x0002, 0xFF27, 0x028C, 0x0001, 0xFFB9, 0x0292, 0x0001, 0xFF25, 0x029D, 0x0001, 0xA515,
+	0x029E, 0x0001, 0xA512, 0x0371, 0x8003, 0xFFFF, 0x0377, 0x0001, 0xFFFF, 0x037B, 0x0003, 0x0082,
+	0x03AC, 0x0001, 0xFFDA, 0x03AD, 0x0003, 0xFFDB, 0x03B1, 0x0011, 0xFFE0, 0x03C2, 0x0001, 0xFFE1,
+	0x03C3, 0x0009, 0xFFE0, 0x03CC, 0x0001, 0xFFC0, 0x03CD, 0x0002, 0xFFC1, 0x03D0, 0x0001, 0xFFC2,
+	0x03D1, 0x0001, 0xFFC7, 0x03D5, 0x0001, 0xFFD1, 0x03D6, 0x0001, 0xFFCA, 0x03D7, 0x0001, 0xFFF8,
+	0x03D9, 0x8017, 0xFFFF, 0x03F0, 0x0001, 0xFFAA, 0x03F1, 0x0001, 0xFFB0, 0x03F2, 0x0001, 0x0007,
+	0x03F3, 0x0001, 0xFF8C, 0x03F5, 0x0001, 0xFFA0, 0x03F8, 0x0001, 0xFFFF, 0x03FB, 0x0001, 0xFFFF,
+	0x0430, 0x0020, 0xFFE0, 0x0450, 0x0010, 0xFFB0, 0x0461, 0x8021, 0xFFFF, 0x048B, 0x8035, 0xFFFF,
+	0x04C2, 0x800D, 0xFFFF, 0x04CF, 0x0001, 0xFFF1, 0x04D1, 0x805F, 0xFFFF, 0x0561, 0x0026, 0xFFD0,
+	0x10D0, 0x002B, 0x0BC0, 0x10FD, 0x0003, 0x0BC0, 0x13F8, 0x0006, 0xFFF8, 0x1C80, 0x0001, 0xE792,
+	0x1C81, 0x0001, 0xE793, 0x1C82, 0x0001, 0xE79C, 0x1C83, 0x0002, 0xE79E, 0x1C85, 0x0001, 0xE79D,
+	0x1C86, 0x0001, 0xE7A4, 0x1C87, 0x0001, 0xE7DB, 0x1C88, 0x0001, 0x89C2, 0x1D79, 0x0001, 0x8A04,
+	0x1D7D, 0x0001, 0x0EE6, 0x1D8E, 0x0001, 0x8A38, 0x1E01, 0x8095, 0xFFFF, 0x1E9B, 0x0001, 0xFFC5,
+	0x1EA1, 0x805F, 0xFFFF, 0x1F00, 0x0008, 0x0008, 0x1F10, 0x0006, 0x0008, 0x1F20, 0x0008, 0x0008,
+	0x1F30, 0x0008, 0x0008, 0x1F40, 0x0006, 0x0008, 0x1F51, 0x0001, 0x0008, 0x1F53, 0x0001, 0x0008,
+	0x1F55, 0x0001, 0x0008, 0x1F57, 0x0001, 0x0008, 0x1F60, 0x0008, 0x0008, 0x1F70, 0x0002, 0x004A,
+	0x1F72, 0x0004, 0x0056, 0x1F76, 0x0002, 0x0064, 0x1F78, 0x0002, 0x0080, 0x1F7A, 0x0002, 0x0070,
+	0x1F7C, 0x0002, 0x007E, 0x1FB0, 0x0002, 0x0008, 0x1FBE, 0x0001, 0xE3DB, 0x1FD0, 0x0002, 0x0008,
+	0x1FE0, 0x0002, 0x0008, 0x1FE5, 0x0001, 0x0007, 0x214E, 0x0001, 0xFFE4, 0x2184, 0x0001, 0xFFFF,
+	0xFF41, 0x001A, 0xFFE0,
+};
+#define	NCVT	(sizeof Cvt / sizeof Cvt[0] / 3)
+
+
+WCHAR ff_convert (	/* Converted character, Returns zero on error */
+	WCHAR	chr,	/* Character code to be converted */
+	UINT	dir		/* 0: Unicode to OEM code, 1: OEM code to Unicode */
+)
+{
+	WCHAR c;
+
+
+	if (chr < 0x80) {	/* ASCII */
+		c = chr;
+
+	} else {
+		if (dir) {		/* OEM code to Unicode */
+			c = (chr >= 0x100) ? 0 : Tbl[chr - 0x80];
+
+		} else {		/* Unicode to OEM code */
+			for (c = 0; c < 0x80; c++) {
+				if (chr == Tbl[c]) break;
+			}
+			c = (c + 0x80) & 0xFF;
+		}
+	}
+
+	return c;
+}
+
+
+
+WCHAR ff_wtoupper (	/* Returns upper converted character */
+	WCHAR chr		/* Unicode character to be upper converted */
+)
+{
+	const WCHAR *p;
+	UINT lo, hi, i, n;
+
+
+	if (chr < 0x80)	/* ASCII */
+		return (chr >= 'a' && chr <= 'z') ? chr - 0x20 : chr;
+
+	lo = 0; hi = NCVT;
+	while (hi - lo > 1) {	/* Binary search for the last run starting at or below chr */
+		i = (lo + hi) / 2;
+		if (Cvt[i * 3] <= chr) lo = i; else hi = i;
+	}
+	p = &Cvt[lo * 3];
+	n = chr - p[0];
+	if (chr < p[0] || n >= (p[1] & 0x7FFF)) return chr;	/* Not in the run */
+	if ((p[1] & 0x8000) && (n & 1)) return chr;			/* Upper case of an alternating run */
+
+	return chr + p[2];
+}
+
+#endif /* _USE_LFN */
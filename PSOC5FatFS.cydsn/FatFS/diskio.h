@@ -41,6 +41,21 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 // send the Stop Transmission command (CMD12) to possibly recover when something goes wrong
 void Attempt_TransactionCancel(void);
 
+// keep the card selected across a sequence of disk operations, so commands inside only wait for the card to be ready
+//   instead of releasing and reselecting it.  Transactions nest and the card is released when the outermost one ends.
+//   No other device on the SPI bus can be used while a transaction is open.
+void Begin_SDTransaction(BYTE pdrv);
+void End_SDTransaction(BYTE pdrv);
+
+// write or read the same sectors on several cards at once, stepping a block to or from each card in turn so the
+//   cards program and fetch in parallel.  drives lists driveCount different initialized drives, which must be on
+//   separate SPI buses as all of them are held selected for the whole transfer.
+//   SD_MirrorWrite writes the sectors to every card.  The stripe functions spread the sectors over the cards with
+//   logical sector n on sector n / driveCount of drive drives[n % driveCount].
+DRESULT SD_MirrorWrite (const BYTE* drives, BYTE driveCount, const BYTE* buff, DWORD sector, UINT count);
+DRESULT SD_StripeWrite (const BYTE* drives, BYTE driveCount, const BYTE* buff, DWORD sector, UINT count);
+DRESULT SD_StripeRead (const BYTE* drives, BYTE driveCount, BYTE* buff, DWORD sector, UINT count);
+
 
 /* Disk Status Bits (DSTATUS) */
 
@@ -70,6 +85,8 @@ void Attempt_TransactionCancel(void);
 #define MMC_GET_CID			12	/* Get CID */
 #define MMC_GET_OCR			13	/* Get OCR */
 #define MMC_GET_SDSTAT		14	/* Get SD status */
+#define MMC_GET_CARDINFO	15	/* Get card information read at initialization (SDCardInfo_t) */
+#define MMC_GET_WAITSTATS	16	/* Get card wait time statistics (SDWaitStats_t) */
 
 /* ATA/CF specific ioctl command */
 #define ATA_GET_REV			20	/* Get F/W revision */
@@ -85,6 +102,38 @@ void Attempt_TransactionCancel(void);
 #define CARDTYPE_SDC		(CARDTYPE_SD1|CARDTYPE_SD2)	/* SD */
 #define CARDTYPE_BLOCK	    0x08		                /* Block addressing */
 
+
+// card registers and geometry, read once in disk_initialize so the ioctls can answer without going to the card
+typedef struct {
+    BYTE    cardType;           // CARDTYPE_* flags
+    BYTE    ocr[4];             // OCR register (CMD58)
+    BYTE    csd[16];            // CSD register (CMD9)
+    BYTE    cid[16];            // CID register (CMD10)
+    BYTE    sdStatus[64];       // SD status (ACMD13), SD v2 cards only
+    BYTE    scr[8];             // SD configuration register (ACMD51), SD cards only
+    DWORD   sectorCount;        // number of 512 byte sectors on the card
+    DWORD   auSectors;          // allocation unit (erase block) size in sectors
+    BYTE    speedClass;         // SD speed class (0 if not reported)
+    BYTE    cmd23Support;       // non-zero if the card accepts SET_BLOCK_COUNT (CMD23)
+} SDCardInfo_t;
+
+
+// kinds of card wait tracked by the busy wait engine
+#define SD_WAIT_TOKEN       0           // waiting for the start token of a data block being read
+#define SD_WAIT_BUSY        1           // waiting for the card to release busy after a write or command
+#define SD_WAIT_KINDS       2
+#define SD_WAIT_HIST_BINS   16
+
+// card wait time statistics, all times are in microseconds
+typedef struct {
+    DWORD   waits[SD_WAIT_KINDS];                       // number of waits
+    DWORD   timeouts[SD_WAIT_KINDS];                    // number of waits that timed out
+    DWORD   polls[SD_WAIT_KINDS];                       // number of times the card was polled
+    DWORD   expectedUs[SD_WAIT_KINDS];                  // learned typical wait when the card is not ready at once
+    DWORD   maxUs[SD_WAIT_KINDS];                       // longest wait seen
+    DWORD   hist[SD_WAIT_KINDS][SD_WAIT_HIST_BINS];     // bin 0 counts waits where the card was ready at once, bin n counts waits of 2^(n-1) to 2^n-1 us
+} SDWaitStats_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,9 +33,6 @@
 
 /* Reentrancy related */
 #if _FS_REENTRANT
-#if _USE_LFN == 1
-#error Static LFN work area cannot be used at thread-safe configuration
-#endif
 #define	ENTER_FF(fs)		{ if (!lock_fs(fs)) return FR_TIMEOUT; }
 #define	LEAVE_FF(fs, res)	{ unlock_fs(fs, res); return res; }
 #else
@@ -43,7 +40,55 @@
 #define LEAVE_FF(fs, res)	return res
 #endif
 
-#define	ABORT(fs, res)		{ fp->err = (BYTE)(res); LEAVE_FF(fs, res); }
+#if _FS_REENTRANT == 2	/* File object lock (the volume lock is taken after it, never before) */
+#if _FS_TINY
+#error _FS_REENTRANT == 2 cannot be used at tiny buffer configuration
+#endif
+#define	ENTER_FIL(fp)		{ FRESULT lres = lock_fil(fp); if (lres != FR_OK) return lres; }
+#define	FIL_CLOSED	0x8000	/* Flag in FIL.nuse: the file object is closed, the last caller out of it discards the sync object */
+#define	LEAVE_FIL(fp, res)	{ unlock_fil(fp, res); return res; }
+#define	LEAVE_FILFS(fp, fs, res)	{ unlock_fs(fs, res); unlock_fil(fp, res); return res; }
+#else
+#define	ENTER_FIL(fp)
+#define	LEAVE_FIL(fp, res)	LEAVE_FF((fp)->fs, res)
+#define	LEAVE_FILFS(fp, fs, res)	LEAVE_FF(fs, res)
+#define	validate_fil(fp)	validate(fp)
+#define	validate_filfs(fp)	validate(fp)
+#define	get_fat_fil(fp, clst)		get_fat_obj(fp, clst)
+#define	create_chain_fil(fp, clst)	create_chain_obj(fp, clst)
+#define	create_run_fil(fp, clst, ncl)	create_run_obj(fp, clst, ncl)
+#endif
+
+#define	ABORT(fs, res)		{ fp->err = (BYTE)(res); LEAVE_FIL(fp, res); }
+
+
+/* exFAT feature (the cluster chain of a file or directory object is followed by its chain status) */
+#if _FS_EXFAT
+#if _FS_RPATH
+#error _FS_EXFAT cannot be used with relative path feature
+#endif
+#define	get_fat_obj(op, clst)			get_chain((op)->fs, (op)->stat, (op)->sclust, (op)->n_cont, clst)
+#define	create_chain_obj(op, clst)		create_xrun((op)->fs, &(op)->stat, (op)->sclust, &(op)->n_cont, clst, 1)
+#define	create_run_obj(op, clst, ncl)	create_xrun((op)->fs, &(op)->stat, (op)->sclust, &(op)->n_cont, clst, ncl)
+#define	OBJ_ATTR(dp)	((dp)->fs->fs_type == FS_EXFAT ? (dp)->fs->dirbuf[XDIR_Attr] : (dp)->dir[DIR_Attr])
+#define	get_cstat(fs, clst)	((fs)->fs_type == FS_EXFAT ? get_bitmap(fs, clst) : get_fat(fs, clst))
+#else
+#define	get_fat_obj(op, clst)			get_fat((op)->fs, clst)
+#define	create_chain_obj(op, clst)		create_chain((op)->fs, clst)
+#define	create_run_obj(op, clst, ncl)	create_run((op)->fs, clst, ncl)
+#define	OBJ_ATTR(dp)	((dp)->dir[DIR_Attr])
+#define	get_cstat(fs, clst)	get_fat(fs, clst)
+#endif
+
+
+/* Statistics counters */
+#if _FS_STATS && _FS_REENTRANT == 2
+#define	STAT_INC(fs, ctr)	__atomic_fetch_add(&(fs)->st.ctr, 1, __ATOMIC_RELAXED)	/* (File data transfers count without the volume lock) */
+#elif _FS_STATS
+#define	STAT_INC(fs, ctr)	((fs)->st.ctr++)
+#else
+#define	STAT_INC(fs, ctr)
+#endif
 
 
 /* Definitions of sector size */
@@ -82,6 +127,71 @@ typedef struct {
 #endif
 
 
+/* Sequential read-ahead feature */
+#if _FS_PREFETCH && _FS_TINY
+#error _FS_PREFETCH cannot be used at tiny buffer configuration
+#endif
+
+
+/* Shared sector buffer pool feature */
+#if _FS_POOL
+#if _FS_TINY
+#error _FS_POOL cannot be used at tiny buffer configuration
+#endif
+#if _FS_REENTRANT
+#error _FS_POOL cannot be used at thread-safe configuration
+#endif
+typedef struct {
+	FIL*	owner;			/* File object the buffer is bound to (NULL:blank entry) */
+	DWORD	stamp;			/* Last access time for LRU reclaim */
+	BYTE	pin;			/* Pinned flag (the buffer is not reclaimed while set) */
+	BYTE	buf[_MAX_SS];	/* Sector buffer */
+} POOLSLOT;
+#define	BIND_BUF(fp, rl)	{ FRESULT rb = pool_bind(fp, rl); if (rb != FR_OK) ABORT((fp)->fs, rb); }
+#else
+#define	BIND_BUF(fp, rl)
+#endif
+
+
+/* Metadata journal feature */
+#if _FS_JOURNAL
+#if _FS_READONLY || _FS_TINY
+#error _FS_JOURNAL cannot be used at read-only or tiny buffer configuration
+#endif
+#if _FS_JOURNAL > 32
+#error Wrong _FS_JOURNAL setting
+#endif
+#define	JNL_SIG		0x4C4E4A46				/* Journal record signature "FJNL" */
+#define	JNL_SECTS	(2 * (_FS_JOURNAL + 1))	/* Sectors of the journal area (two record slots) */
+#endif
+
+
+/* Allocation summary feature */
+#if _FS_ALLOCSUM
+#if _FS_READONLY
+#error _FS_ALLOCSUM cannot be used at read-only configuration
+#endif
+#if _FS_ALLOCSUM > 64
+#error Wrong _FS_ALLOCSUM setting
+#endif
+#define	AS_SIG		0x4D534146				/* Allocation summary signature "FASM" */
+#define	AS_VALID	0x01					/* as_flag: The region counts are valid */
+#define	AS_STALE	0x02					/* as_flag: The summary on the disk was not taken at mount */
+#define	AS_REG(fs, clst)	(((clst) - 2) / (fs)->as_rsize)	/* Region of a cluster */
+#define	AS_CNT(fs, clst)	{ if ((clst) >= 2) (fs)->as_free[AS_REG(fs, clst)]++; }	/* Count a free cluster into its region */
+#else
+#define	AS_CNT(fs, clst)
+#endif
+
+
+/* Sectors at end of the reserved area taken by the journal and the allocation summary */
+#if _FS_JOURNAL
+#define	RSV_SECTS	(JNL_SECTS + (_FS_ALLOCSUM ? 1 : 0))
+#elif _FS_ALLOCSUM
+#define	RSV_SECTS	1
+#endif
+
+
 
 /* DBCS code ranges and SBCS upper conversion tables */
 
@@ -355,11 +465,13 @@ typedef struct {
 #define NS_BODY		0x08	/* Lower case flag (body) */
 #define NS_EXT		0x10	/* Lower case flag (ext) */
 #define NS_DOT		0x20	/* Dot entry */
+#define NS_TRY		8		/* Number of numbered SFNs checked for collision while searching the name */
 
 
 /* FAT sub-type boundaries (Differ from specs but correct for real DOS/Windows) */
 #define MIN_FAT16	4086U	/* Minimum number of clusters of FAT16 */
 #define	MIN_FAT32	65526U	/* Minimum number of clusters of FAT32 */
+#define	MAX_EXFAT	0x7FFFFFFDU	/* Maximum number of clusters of exFAT */
 
 
 /* FatFs refers the members in the FAT structures as byte array instead of
@@ -405,6 +517,35 @@ typedef struct {
 #define MBR_Table			446		/* MBR: Partition table offset (2) */
 #define	SZ_PTE				16		/* MBR: Size of a partition table entry */
 #define BS_55AA				510		/* Signature word (2) */
+#define	JH_Sig				0		/* Journal record: Signature "FJNL" (4) */
+#define	JH_Seq				4		/* Journal record: Sequence number (4) */
+#define	JH_VolID			8		/* Journal record: Volume serial number (4) */
+#define	JH_Sum				12		/* Journal record: Checksum of the record (4) */
+#define	JH_Count			16		/* Journal record: Number of sectors in the record (2) */
+#define	JH_Sect				20		/* Journal record: Sector numbers of the sectors (4 * count) */
+#define	AS_Sig				0		/* Allocation summary: Signature "FASM" (4) */
+#define	AS_Gen				4		/* Allocation summary: Generation, odd while in use (4) */
+#define	AS_VolID			8		/* Allocation summary: Volume serial number (4) */
+#define	AS_Sum				12		/* Allocation summary: Checksum of the summary (4) */
+#define	AS_NumClus			16		/* Allocation summary: Number of clusters (4) */
+#define	AS_Free				20		/* Allocation summary: Number of free clusters (4) */
+#define	AS_Last				24		/* Allocation summary: Last allocated cluster (4) */
+#define	AS_NumReg			28		/* Allocation summary: Number of regions (2) */
+#define	AS_Region			32		/* Allocation summary: Number of free clusters in each region (4 * regions) */
+#define	BPB_ZeroedEx		11		/* exFAT: Must be zero (53) */
+#define	BPB_VolOfsEx		64		/* exFAT: Volume offset from top of the drive [sector] (8) */
+#define	BPB_TotSecEx		72		/* exFAT: Volume size [sector] (8) */
+#define	BPB_FatOfsEx		80		/* exFAT: FAT offset from top of the volume [sector] (4) */
+#define	BPB_FatSzEx			84		/* exFAT: FAT size [sector] (4) */
+#define	BPB_DataOfsEx		88		/* exFAT: Data offset from top of the volume [sector] (4) */
+#define	BPB_NumClusEx		92		/* exFAT: Number of clusters (4) */
+#define	BPB_RootClusEx		96		/* exFAT: Root directory first cluster (4) */
+#define	BPB_VolIDEx			100		/* exFAT: Volume serial number (4) */
+#define	BPB_FSVerEx			104		/* exFAT: File system version (2) */
+#define	BPB_VolFlagEx		106		/* exFAT: Volume flags (2) */
+#define	BPB_BytsPerSecEx	108		/* exFAT: Log2 of sector size [byte] (1) */
+#define	BPB_SecPerClusEx	109		/* exFAT: Log2 of cluster size [sector] (1) */
+#define	BPB_NumFATsEx		110		/* exFAT: Number of FATs (1) */
 
 #define	DIR_Name			0		/* Short file name (11) */
 #define	DIR_Attr			11		/* Attribute (1) */
@@ -428,6 +569,30 @@ typedef struct {
 #define	DDEM				0xE5	/* Deleted directory entry mark at DIR_Name[0] */
 #define	RDDEM				0x05	/* Replacement of the character collides with DDEM */
 
+#define	XDIR_Type			0		/* exFAT: Type of the entry, b7:in use (1) */
+#define	XDIR_NumLabel		1		/* exFAT: Number of volume label characters (1) */
+#define	XDIR_Label			2		/* exFAT: Volume label (22) */
+#define	XDIR_FstClusBm		20		/* exFAT: First cluster of the allocation bitmap (4) */
+#define	XDIR_NumSec			1		/* exFAT: Number of secondary entries (1) */
+#define	XDIR_SetSum			2		/* exFAT: Checksum of the entry set (2) */
+#define	XDIR_Attr			4		/* exFAT: Attribute (2) */
+#define	XDIR_CrtTime		8		/* exFAT: Created time (4) */
+#define	XDIR_ModTime		12		/* exFAT: Modified time (4) */
+#define	XDIR_AccTime		16		/* exFAT: Last accessed time (4) */
+#define	XDIR_CrtTime10		20		/* exFAT: Created time sub-second (1) */
+#define	XDIR_ModTime10		21		/* exFAT: Modified time sub-second (1) */
+#define	XDIR_CrtTZ			22		/* exFAT: Created timezone (1) */
+#define	XDIR_ModTZ			23		/* exFAT: Modified timezone (1) */
+#define	XDIR_AccTZ			24		/* exFAT: Last accessed timezone (1) */
+#define	XDIR_GenFlags		33		/* exFAT: General secondary flags, b0:allocation possible, b1:no FAT chain (1) */
+#define	XDIR_NumName		35		/* exFAT: Number of name characters (1) */
+#define	XDIR_NameHash		36		/* exFAT: Hash of the up-cased name (2) */
+#define	XDIR_ValidFileSize	40		/* exFAT: Valid data length (8) */
+#define	XDIR_FstClus		52		/* exFAT: First cluster of the object (4) */
+#define	XDIR_FileSize		56		/* exFAT: Data length (8) */
+#define	XS_NOFAT			0x02	/* exFAT: Chain status, contiguous without FAT chain */
+#define	XS_GROWN			0x04	/* exFAT: Chain status, the directory has been stretched */
+
 
 
 
@@ -456,6 +621,11 @@ static BYTE CurrVol;			/* Current drive */
 static FILESEM Files[_FS_LOCK];	/* Open object lock semaphores */
 #endif
 
+#if _FS_POOL
+static POOLSLOT Pool[_FS_POOL];	/* Shared sector buffers */
+static DWORD PoolStamp;			/* LRU time stamp */
+#endif
+
 #if _USE_LFN == 0			/* Non LFN feature */
 #define	DEFINE_NAMEBUF		BYTE sfn[12]
 #define INIT_BUF(dobj)		(dobj).fn = sfn
@@ -464,10 +634,9 @@ static FILESEM Files[_FS_LOCK];	/* Open object lock semaphores */
 #if _MAX_LFN < 12 || _MAX_LFN > 255
 #error Wrong _MAX_LFN setting
 #endif
-#if _USE_LFN == 1			/* LFN feature with static working buffer */
-static WCHAR LfnBuf[_MAX_LFN + 1];
+#if _USE_LFN == 1			/* LFN feature with static working buffer in the file system object */
 #define	DEFINE_NAMEBUF		BYTE sfn[12]
-#define INIT_BUF(dobj)		{ (dobj).fn = sfn; (dobj).lfn = LfnBuf; }
+#define INIT_BUF(dobj)		{ (dobj).fn = sfn; (dobj).lfn = (dobj).fs->lfnbuf; }
 #define	FREE_BUF()
 #elif _USE_LFN == 2 		/* LFN feature with dynamic working buffer on the stack */
 #define	DEFINE_NAMEBUF		BYTE sfn[12]; WCHAR lbuf[_MAX_LFN + 1]
@@ -480,6 +649,9 @@ static WCHAR LfnBuf[_MAX_LFN + 1];
 #else
 #error Wrong _USE_LFN setting
 #endif
+#if _LFN_HASH > 255
+#error Wrong _LFN_HASH setting
+#endif
 #endif
 
 #ifdef _EXCVT
@@ -578,6 +750,61 @@ void unlock_fs (
 #endif
 
 
+#if _FS_REENTRANT == 2
+static
+int unuse_fil (	/* 0:The sync object could not be discarded */
+	FIL* fp			/* File object the caller is done with */
+)
+{
+	_SYNC_t sobj = fp->sobj;
+
+
+	if (__atomic_sub_fetch(&fp->nuse, 1, __ATOMIC_ACQ_REL) == FIL_CLOSED)	/* Last caller out of a closed object */
+		return ff_del_syncobj(sobj);
+	return 1;
+}
+
+
+static
+FRESULT lock_fil (	/* FR_OK:Locked, FR_TIMEOUT:Timeout, FR_INVALID_OBJECT:The object has been closed */
+	FIL* fp			/* File object */
+)
+{
+	WORD n = __atomic_load_n(&fp->nuse, __ATOMIC_RELAXED);
+
+
+	do {			/* Count the caller in, unless it is closed and its sync object may be gone */
+		if (n & FIL_CLOSED) return FR_INVALID_OBJECT;
+	} while (!__atomic_compare_exchange_n(&fp->nuse, &n, (WORD)(n + 1), 1, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	if (!ff_req_grant(fp->sobj)) {
+		unuse_fil(fp);
+		return FR_TIMEOUT;
+	}
+	if (!fp->fs) {	/* Closed while waiting */
+		ff_rel_grant(fp->sobj);
+		unuse_fil(fp);
+		return FR_INVALID_OBJECT;
+	}
+	return FR_OK;
+}
+
+
+static
+void unlock_fil (
+	FIL* fp,		/* File object */
+	FRESULT res		/* Result code to be returned */
+)
+{
+	if (res != FR_INVALID_OBJECT &&
+		res != FR_TIMEOUT) {
+		ff_rel_grant(fp->sobj);
+		unuse_fil(fp);
+	}
+}
+#endif
+
+
 
 
 /*-----------------------------------------------------------------------*/
@@ -692,6 +919,316 @@ void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Shared sector buffer pool control functions                           */
+/*-----------------------------------------------------------------------*/
+#if _FS_POOL
+static
+UINT pool_slot (	/* Index of the pool entry owned by the file object (_FS_POOL:None) */
+	FIL* fp
+)
+{
+	UINT i;
+
+	for (i = 0; i < _FS_POOL && Pool[i].owner != fp; i++) ;
+	return i;
+}
+
+
+static
+FRESULT pool_bind (	/* FR_OK:Buffer is bound, FR_DISK_ERR:Write-back or reload failed, FR_NOT_ENOUGH_CORE:All buffers are pinned */
+	FIL* fp,		/* File object to give a buffer */
+	int reload		/* Reload the sector fp->dsect if the buffer was reclaimed */
+)
+{
+	UINT i, v;
+	FIL *ofp;
+
+
+	if (fp->buf) {	/* Buffer is resident */
+		i = pool_slot(fp);
+		if (i < _FS_POOL && Pool[i].buf == fp->buf) {
+			Pool[i].stamp = ++PoolStamp;
+			return FR_OK;
+		}
+		fp->buf = 0;	/* The pointer is not to a buffer the pool gave this file (e.g. a copy of the object): bind afresh */
+	}
+
+	for (i = 0, v = _FS_POOL; i < _FS_POOL; i++) {	/* Find a blank entry or the least recently used unpinned one */
+		if (!Pool[i].owner) {
+			v = i; break;
+		}
+		if (!Pool[i].pin && (v == _FS_POOL || Pool[i].stamp - Pool[v].stamp > 0x7FFFFFFF)) v = i;
+	}
+	if (v == _FS_POOL) return FR_NOT_ENOUGH_CORE;
+
+	ofp = Pool[v].owner;
+	if (ofp) {		/* Reclaim the buffer from its owner */
+#if !_FS_READONLY
+		if (ofp->flag & FA__DIRTY) {	/* Write-back dirty data */
+			if (disk_write(ofp->fs->drv, ofp->buf, ofp->dsect, 1) != RES_OK)
+				return FR_DISK_ERR;
+			ofp->flag &= ~FA__DIRTY;
+		}
+#endif
+		ofp->buf = 0;	/* Owner keeps dsect and reloads it on the next access */
+		STAT_INC(fp->fs, pool_rcl);
+	}
+	Pool[v].owner = fp;
+	Pool[v].stamp = ++PoolStamp;
+	Pool[v].pin = 0;
+	fp->buf = Pool[v].buf;
+
+	if (reload && fp->dsect) {	/* Restore the sector cached before reclaim */
+		if (disk_read(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK) {
+			fp->dsect = 0;
+			return FR_DISK_ERR;
+		}
+		STAT_INC(fp->fs, pool_rld);
+	}
+	return FR_OK;
+}
+
+
+static
+void pool_free (	/* Return the buffer of the file object to the pool */
+	FIL* fp
+)
+{
+	UINT i;
+
+	for (i = 0; i < _FS_POOL; i++) {
+		if (Pool[i].owner == fp) Pool[i].owner = 0;
+	}
+	fp->buf = 0;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Checksum of the journal record and allocation summary                 */
+/*-----------------------------------------------------------------------*/
+#if _FS_JOURNAL || _FS_ALLOCSUM
+static
+DWORD sum_rec (	/* Returns the checksum of the record */
+	const BYTE* p,	/* Pointer to the record */
+	UINT sz,		/* Size of the record in bytes */
+	UINT ofs		/* Offset of the checksum field (skipped) */
+)
+{
+	UINT i;
+	DWORD sum;
+
+
+	for (i = sum = 0; i < sz; i++) {
+		if (i == ofs) { i += 3; continue; }
+		sum = ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + p[i];
+	}
+	return sum;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Metadata journal                                                      */
+/*-----------------------------------------------------------------------*/
+/* The sectors written back from the window are kept in the journal buffer
+/  instead of being written in place. At each sync, the changed buffer is
+/  written as a record, a header and the sectors, with one multiple sector
+/  write into one of the two record slots in the reserved area, taken in turn.
+/  The sectors are written in place (checkpoint) only after a complete record
+/  holding them is on the disk: when the buffer gets full, on unmount and on
+/  the mount that finds a record left. */
+#if _FS_JOURNAL
+static
+FRESULT jnl_commit (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object */
+)
+{
+	BYTE *hd = fs->jbuf;
+
+
+	if (!fs->jflag) return FR_OK;		/* No change since the last record */
+
+	fs->jseq++;
+	ST_DWORD(hd + JH_Sig, JNL_SIG);
+	ST_DWORD(hd + JH_Seq, fs->jseq);
+	ST_WORD(hd + JH_Count, fs->jcnt);
+	ST_DWORD(hd + JH_Sum, sum_rec(hd, (fs->jcnt + 1) * SS(fs), JH_Sum));
+	if (disk_write(fs->drv, hd, fs->jbase + (fs->jseq & 1) * (_FS_JOURNAL + 1), fs->jcnt + 1) != RES_OK)
+		return FR_DISK_ERR;
+	fs->jflag = 0;
+	STAT_INC(fs, jnl_rec);
+	return FR_OK;
+}
+
+
+static
+FRESULT jnl_flush (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object */
+)
+{
+	UINT i, nf;
+	DWORD sect;
+	BYTE *p;
+	FRESULT res;
+
+
+	if (!fs->jcnt) return FR_OK;
+
+	res = jnl_commit(fs);				/* Make sure a record holding the sectors is on the disk */
+	if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
+		res = FR_DISK_ERR;
+	for (i = 0; res == FR_OK && i < fs->jcnt; i++) {	/* Write the sectors in place */
+		sect = LD_DWORD(fs->jbuf + JH_Sect + i * 4);
+		p = fs->jbuf + (i + 1) * SS(fs);
+		if (disk_write(fs->drv, p, sect, 1) != RES_OK) {
+			res = FR_DISK_ERR;
+		} else {
+			if (sect - fs->fatbase < fs->fsize) {		/* Is it in the FAT area? */
+				for (nf = fs->n_fats; nf >= 2; nf--) {	/* Reflect the change to all FAT copies */
+					sect += fs->fsize;
+					disk_write(fs->drv, p, sect, 1);
+				}
+			}
+		}
+	}
+	if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
+		res = FR_DISK_ERR;
+	if (res == FR_OK) {					/* Supersede the record with an empty one */
+		fs->jcnt = 0;
+		fs->jflag = 1;
+		res = jnl_commit(fs);
+		STAT_INC(fs, jnl_ckpt);
+	}
+	return res;
+}
+
+
+static
+FRESULT jnl_put (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object with the window to be written back */
+)
+{
+	UINT i;
+	FRESULT res;
+
+
+	for (i = 0; i < fs->jcnt && LD_DWORD(fs->jbuf + JH_Sect + i * 4) != fs->winsect; i++) ;	/* Find the sector in the buffer */
+	if (i == _FS_JOURNAL) {				/* The buffer is full, make room with a checkpoint */
+		res = jnl_flush(fs);
+		if (res != FR_OK) return res;
+		i = 0;
+	}
+	if (i == fs->jcnt) {				/* Add the sector */
+		ST_DWORD(fs->jbuf + JH_Sect + i * 4, fs->winsect);
+		fs->jcnt++;
+	}
+	mem_cpy(fs->jbuf + (i + 1) * SS(fs), fs->win, SS(fs));
+	fs->jflag = 1;
+	return FR_OK;
+}
+
+
+static
+int jnl_get (	/* 1:The sector is loaded from the journal buffer, 0:Not in the buffer */
+	FATFS* fs,		/* File system object */
+	DWORD sector	/* Sector number to load into the window */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->jcnt; i++) {
+		if (LD_DWORD(fs->jbuf + JH_Sect + i * 4) == sector) {
+			mem_cpy(fs->win, fs->jbuf + (i + 1) * SS(fs), SS(fs));
+			STAT_INC(fs, jnl_hit);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static
+void jnl_drop (	/* Remove the sectors of freed clusters from the journal buffer */
+	FATFS* fs,		/* File system object */
+	DWORD sect,		/* Top sector of the freed area */
+	DWORD n			/* Number of sectors in the freed area */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->jcnt; ) {
+		if (LD_DWORD(fs->jbuf + JH_Sect + i * 4) - sect < n) {	/* Move the last one into its place */
+			fs->jcnt--;
+			if (i < fs->jcnt) {
+				ST_DWORD(fs->jbuf + JH_Sect + i * 4, LD_DWORD(fs->jbuf + JH_Sect + fs->jcnt * 4));
+				mem_cpy(fs->jbuf + (i + 1) * SS(fs), fs->jbuf + (fs->jcnt + 1) * SS(fs), SS(fs));
+			}
+			fs->jflag = 1;
+		} else {
+			i++;
+		}
+	}
+}
+
+
+static
+FRESULT jnl_mount (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object with the volume boundaries */
+	DWORD vsn,		/* Volume serial number */
+	UINT nrsv		/* Number of sectors in use at top of the reserved area */
+)
+{
+	DWORD seq[2], sect;
+	UINT i, k, n;
+	BYTE *hd = fs->jbuf;
+
+
+	fs->jbase = fs->jseq = 0;
+	fs->jcnt = 0; fs->jflag = 0;
+	if (fs->fatbase - fs->volbase < nrsv + JNL_SECTS) return FR_OK;	/* No room for the journal, it is not used */
+	fs->jbase = fs->fatbase - JNL_SECTS;
+
+	/* Get the sequence numbers of the records in the slots (0:No record) */
+	for (i = 0; i < 2; i++) {
+		if (disk_read(fs->drv, hd, fs->jbase + i * (_FS_JOURNAL + 1), 1) != RES_OK) return FR_DISK_ERR;
+		seq[i] = (LD_DWORD(hd + JH_Sig) == JNL_SIG && LD_DWORD(hd + JH_VolID) == vsn) ? LD_DWORD(hd + JH_Seq) : 0;
+		if (seq[i] > fs->jseq) fs->jseq = seq[i];	/* New records follow the last one */
+	}
+
+	/* Load the newer record, or the older one when the newer one is torn */
+	for (k = 0; k < 2; k++) {
+		i = (seq[0] > seq[1]) ? k : 1 - k;
+		if (!seq[i]) continue;
+		sect = fs->jbase + i * (_FS_JOURNAL + 1);
+		if (disk_read(fs->drv, hd, sect, 1) != RES_OK) return FR_DISK_ERR;
+		n = LD_WORD(hd + JH_Count);
+		if (n > _FS_JOURNAL) continue;
+		if (n && disk_read(fs->drv, hd + SS(fs), sect + 1, n) != RES_OK) return FR_DISK_ERR;
+		if (sum_rec(hd, (n + 1) * SS(fs), JH_Sum) != LD_DWORD(hd + JH_Sum)) continue;
+		fs->jcnt = n;
+		break;
+	}
+	ST_DWORD(hd + JH_VolID, vsn);
+	if (!fs->jcnt) return FR_OK;
+
+	/* Apply the record left (the sectors are served from the buffer while the medium is write protected) */
+	fs->winsect = 0xFFFFFFFF;			/* The window may be older than the record */
+	if (disk_status(fs->drv) & STA_PROTECT) return FR_OK;
+	return jnl_flush(fs);
+}
+#endif /* _FS_JOURNAL */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the file system object               */
 /*-----------------------------------------------------------------------*/
@@ -707,6 +1244,13 @@ FRESULT sync_window (	/* FR_OK:succeeded, !=0:error */
 
 
 	if (fs->wflag) {	/* Write back the sector if it is dirty */
+#if _FS_JOURNAL
+		if (fs->jbase) {	/* Keep it in the journal buffer */
+			res = jnl_put(fs);
+			if (res == FR_OK) fs->wflag = 0;
+			return res;
+		}
+#endif
 		wsect = fs->winsect;	/* Current sector number */
 		if (disk_write(fs->drv, fs->win, wsect, 1) != RES_OK) {
 			res = FR_DISK_ERR;
@@ -725,6 +1269,23 @@ FRESULT sync_window (	/* FR_OK:succeeded, !=0:error */
 #endif
 
 
+#if !_FS_READONLY
+static
+FRESULT fill_window (	/* FR_OK:succeeded, !=0:error */
+	FATFS* fs		/* File system object with the window holding a sector of a cluster not yet in use */
+)
+{
+#if _FS_JOURNAL
+	if (fs->jbase) {	/* The cluster is not referred by a record yet, it is written in place */
+		fs->wflag = 0;
+		return (disk_write(fs->drv, fs->win, fs->winsect, 1) == RES_OK) ? FR_OK : FR_DISK_ERR;
+	}
+#endif
+	return sync_window(fs);
+}
+#endif
+
+
 static
 FRESULT move_window (	/* FR_OK(0):succeeded, !=0:error */
 	FATFS* fs,		/* File system object */
@@ -739,6 +1300,10 @@ FRESULT move_window (	/* FR_OK(0):succeeded, !=0:error */
 		res = sync_window(fs);		/* Write-back changes */
 #endif
 		if (res == FR_OK) {			/* Fill sector window with new data */
+#if _FS_JOURNAL
+			if (jnl_get(fs, sector)) {	/* The sector in the journal buffer is newer than on the disk */
+			} else
+#endif
 			if (disk_read(fs->drv, fs->win, sector, 1) != RES_OK) {
 				sector = 0xFFFFFFFF;	/* Invalidate window if data is not reliable */
 				res = FR_DISK_ERR;
@@ -777,11 +1342,21 @@ FRESULT sync_fs (	/* FR_OK:succeeded, !=0:error */
 			ST_DWORD(fs->win + FSI_Nxt_Free, fs->last_clust);
 			/* Write it into the FSInfo sector */
 			fs->winsect = fs->volbase + 1;
+#if _FS_JOURNAL
+			if (fs->jbase) {
+				fs->wflag = 1;
+				res = sync_window(fs);	/* (into the journal buffer) */
+			} else
+#endif
 			disk_write(fs->drv, fs->win, fs->winsect, 1);
 			fs->fsi_flag = 0;
 		}
+#if _FS_JOURNAL
+		if (res == FR_OK && fs->jbase)	/* Write the changes as a journal record */
+			res = jnl_commit(fs);
+#endif
 		/* Make sure that no pending write process in the physical drive */
-		if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
+		if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
 			res = FR_DISK_ERR;
 	}
 
@@ -793,13 +1368,205 @@ FRESULT sync_fs (	/* FR_OK:succeeded, !=0:error */
 
 
 /*-----------------------------------------------------------------------*/
-/* Get sector# from cluster#                                             */
+/* Allocation summary                                                    */
 /*-----------------------------------------------------------------------*/
-/* Hidden API for hacks and disk tools */
-
-DWORD clust2sect (	/* !=0:Sector number, 0:Failed (invalid cluster#) */
-	FATFS* fs,		/* File system object */
-	DWORD clst		/* Cluster# to be converted */
+/* The summary sector holds the free cluster counts of the volume and of its
+/  regions. Its generation is made odd on the disk before the first change of
+/  the allocation after the mount, and made even with the current counts on
+/  unmount, so that only a summary written on unmount is taken at mount. */
+#if _FS_ALLOCSUM
+static
+void as_fill (	/* Create the summary sector in the window */
+	FATFS* fs		/* File system object */
+)
+{
+	UINT i;
+	BYTE *p = fs->win;
+
+
+	mem_set(p, 0, SS(fs));
+	ST_DWORD(p + AS_Sig, AS_SIG);
+	ST_DWORD(p + AS_Gen, fs->as_gen);
+	ST_DWORD(p + AS_VolID, fs->as_vsn);
+	ST_DWORD(p + AS_NumClus, fs->n_fatent - 2);
+	ST_DWORD(p + AS_Free, fs->free_clust);
+	ST_DWORD(p + AS_Last, fs->last_clust);
+	ST_WORD(p + AS_NumReg, _FS_ALLOCSUM);
+	for (i = 0; i < _FS_ALLOCSUM; i++) {
+		ST_DWORD(p + AS_Region + i * 4, fs->as_free[i]);
+	}
+	ST_DWORD(p + AS_Sum, sum_rec(p, AS_Region + _FS_ALLOCSUM * 4, AS_Sum));
+}
+
+
+static
+FRESULT as_write (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object */
+)
+{
+	FRESULT res;
+
+
+	res = sync_window(fs);				/* The summary is created in the window */
+	if (res != FR_OK) return res;
+	as_fill(fs);
+	fs->winsect = fs->as_sect;
+	if (disk_write(fs->drv, fs->win, fs->as_sect, 1) != RES_OK) {
+		fs->winsect = 0xFFFFFFFF;
+		return FR_DISK_ERR;
+	}
+	return FR_OK;
+}
+
+
+static
+FRESULT as_open (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object about to change the allocation */
+)
+{
+	FRESULT res;
+
+
+	if (!fs->as_sect || (fs->as_gen & 1)) return FR_OK;	/* No summary, or it is out of date on the disk already */
+	fs->as_gen++;
+	res = as_write(fs);
+	if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)	/* It must be on the disk before the change */
+		res = FR_DISK_ERR;
+	return res;
+}
+
+
+static
+void as_update (
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* Top cluster# of the run */
+	DWORD ncl,		/* Number of clusters in the run */
+	int bv			/* Allocation status set to the run (0:Free, 1:In use) */
+)
+{
+	DWORD n, *cnt;
+
+
+	if (!(fs->as_flag & AS_VALID)) return;
+	while (ncl) {
+		n = fs->as_rsize - (clst - 2) % fs->as_rsize;	/* Clusters to end of the region */
+		if (n > ncl) n = ncl;
+		cnt = &fs->as_free[AS_REG(fs, clst)];
+		*cnt = bv ? *cnt - n : *cnt + n;
+		clst += n; ncl -= n;
+	}
+}
+
+
+static
+DWORD as_skip (	/* Returns cluster# to be checked next */
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* Cluster# to be checked */
+	DWORD scl		/* Cluster# the search ends at */
+)
+{
+	DWORD last;
+
+
+	if (!(fs->as_flag & AS_VALID) || fs->as_free[AS_REG(fs, clst)]) return clst;	/* The region has a free cluster */
+	last = clst - (clst - 2) % fs->as_rsize + fs->as_rsize - 1;	/* Last cluster# of the region */
+	if (last >= fs->n_fatent) last = fs->n_fatent - 1;
+	return (scl >= clst && scl <= last) ? scl : last;	/* Go to the last one, or to the end of the search in the region */
+}
+
+
+static
+FRESULT as_lost (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs		/* File system object whose counts hid free clusters */
+)
+{
+	fs->as_flag &= ~AS_VALID;			/* The counts are got again by f_getfree() */
+	fs->free_clust = 0xFFFFFFFF;
+	fs->frun_max = 0xFFFFFFFF;			/* (and the runs they hid are not known) */
+	return as_open(fs);					/* The summary on the disk is not taken again */
+}
+
+
+static
+void as_close (
+	FATFS* fs		/* File system object to be unmounted */
+)
+{
+	if (!fs->as_sect || !(fs->as_flag & AS_VALID)) return;		/* The counts are not known */
+	if (!(fs->as_gen & 1) && !(fs->as_flag & AS_STALE)) return;	/* The summary on the disk is up to date */
+	if (disk_status(fs->drv) & STA_PROTECT) return;
+	if (sync_fs(fs) != FR_OK) return;	/* Bring the FAT and FSINFO on the disk to the counts */
+#if _FS_JOURNAL
+	if (fs->jbase && jnl_flush(fs) != FR_OK) return;
+#endif
+	fs->as_gen = (fs->as_gen | 1) + 1;	/* Close the generation */
+	if (as_write(fs) == FR_OK) disk_ioctl(fs->drv, CTRL_SYNC, 0);
+}
+
+
+static
+FRESULT as_mount (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object with the volume boundaries and FSINFO */
+	BYTE fmt,		/* FAT sub-type */
+	DWORD vsn,		/* Volume serial number */
+	UINT nrsv		/* Number of sectors in use at top of the reserved area */
+)
+{
+	DWORD top, n, sum;
+	UINT i;
+	BYTE *p;
+	FRESULT res;
+
+
+	fs->as_sect = 0; fs->as_vsn = vsn;
+	fs->as_gen = 0xFFFFFFFF;			/* (Not a summary, it is out of date) */
+	fs->as_flag = AS_STALE;
+	fs->as_rsize = (fs->n_fatent - 2 + _FS_ALLOCSUM - 1) / _FS_ALLOCSUM;
+	if (fmt != FS_FAT32) return FR_OK;	/* Only the FSINFO shows that another system changed the FAT, the summary is not used without it */
+	top = fs->fatbase;
+#if _FS_JOURNAL
+	if (fs->jbase) top = fs->jbase;		/* The summary is in front of the journal area */
+#endif
+	if (top - fs->volbase < nrsv + 1) return FR_OK;	/* No room for the summary, it is not used */
+	fs->as_sect = top - 1;
+
+	res = move_window(fs, fs->as_sect);
+	if (res != FR_OK) return res;
+	p = fs->win;
+	if (LD_DWORD(p + AS_Sig) != AS_SIG || LD_DWORD(p + AS_VolID) != vsn
+		|| LD_DWORD(p + AS_NumClus) != fs->n_fatent - 2 || LD_WORD(p + AS_NumReg) != _FS_ALLOCSUM
+		|| sum_rec(p, AS_Region + _FS_ALLOCSUM * 4, AS_Sum) != LD_DWORD(p + AS_Sum)) return FR_OK;	/* Not a summary of this volume */
+	fs->as_gen = LD_DWORD(p + AS_Gen);
+	if (fs->as_gen & 1) {				/* The allocation was changed after it was written and the volume was not unmounted */
+		fs->free_clust = 0xFFFFFFFF;	/* (so the FSINFO may be out of date as well) */
+		return FR_OK;
+	}
+	for (i = sum = 0; i < _FS_ALLOCSUM; i++) {
+		n = LD_DWORD(p + AS_Region + i * 4);
+		if (n > fs->as_rsize) return FR_OK;
+		fs->as_free[i] = n; sum += n;
+	}
+	if (sum != LD_DWORD(p + AS_Free)) return FR_OK;
+	if (fs->free_clust != sum) return FR_OK;	/* The FSINFO was changed by another system, or it is not valid */
+
+	fs->free_clust = sum;				/* Take the counts */
+	fs->last_clust = LD_DWORD(p + AS_Last);
+	fs->as_flag = AS_VALID;
+	return FR_OK;
+}
+#endif /* _FS_ALLOCSUM */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get sector# from cluster#                                             */
+/*-----------------------------------------------------------------------*/
+/* Hidden API for hacks and disk tools */
+
+DWORD clust2sect (	/* !=0:Sector number, 0:Failed (invalid cluster#) */
+	FATFS* fs,		/* File system object */
+	DWORD clst		/* Cluster# to be converted */
 )
 {
 	clst -= 2;
@@ -853,6 +1620,14 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x0FFFFFFF:Cluste
 			val = LD_DWORD(p) & 0x0FFFFFFF;
 			break;
 
+#if _FS_EXFAT
+		case FS_EXFAT :
+			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
+			p = &fs->win[clst * 4 % SS(fs)];
+			val = LD_DWORD(p) & 0x7FFFFFFF;	/* (The end of chain mark reads as out of range) */
+			break;
+#endif
+
 		default:
 			val = 1;	/* Internal error */
 		}
@@ -917,6 +1692,17 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 			fs->wflag = 1;
 			break;
 
+#if _FS_EXFAT
+		case FS_EXFAT :
+			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
+			if (res != FR_OK) break;
+			p = &fs->win[clst * 4 % SS(fs)];
+			if (val == 0x0FFFFFFF) val = 0xFFFFFFFF;	/* End of chain mark */
+			ST_DWORD(p, val);
+			fs->wflag = 1;
+			break;
+#endif
+
 		default :
 			res = FR_INT_ERR;
 		}
@@ -929,6 +1715,54 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Allocation bitmap access                             */
+/*-----------------------------------------------------------------------*/
+#if _FS_EXFAT
+static
+DWORD get_bitmap (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 0:Free, 2:In use */
+	FATFS* fs,		/* File system object */
+	DWORD clst		/* Cluster# to get the allocation status */
+)
+{
+	if (clst < 2 || clst >= fs->n_fatent) return 1;	/* Check if in valid range */
+	clst -= 2;		/* Bit index in the bitmap */
+	if (move_window(fs, fs->bitbase + clst / 8 / SS(fs)) != FR_OK) return 0xFFFFFFFF;
+	return (fs->win[clst / 8 % SS(fs)] & (1 << (clst % 8))) ? 2 : 0;
+}
+
+
+#if !_FS_READONLY
+static
+FRESULT put_bitmap (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object */
+	DWORD clst,		/* Top cluster# of the run to be changed */
+	DWORD ncl,		/* Number of clusters in the run */
+	int bv			/* Allocation status to be set (0:Free, 1:In use) */
+)
+{
+	BYTE *p, bm;
+	FRESULT res;
+
+
+	if (clst < 2 || ncl > fs->n_fatent - clst) return FR_INT_ERR;	/* Check if in valid range */
+	clst -= 2;		/* Bit index in the bitmap */
+	for ( ; ncl; ncl--, clst++) {
+		res = move_window(fs, fs->bitbase + clst / 8 / SS(fs));
+		if (res != FR_OK) return res;
+		p = &fs->win[clst / 8 % SS(fs)];
+		bm = (BYTE)(1 << (clst % 8));
+		*p = bv ? (*p | bm) : (*p & ~bm);
+		fs->wflag = 1;
+	}
+	return FR_OK;
+}
+#endif /* !_FS_READONLY */
+#endif /* _FS_EXFAT */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* FAT handling - Remove a cluster chain                                 */
 /*-----------------------------------------------------------------------*/
@@ -949,18 +1783,34 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 		res = FR_INT_ERR;
 
 	} else {
+#if _FS_ALLOCSUM
+		res = as_open(fs);						/* Put the summary on the disk out of date before the change */
+#else
 		res = FR_OK;
-		while (clst < fs->n_fatent) {			/* Not a last link? */
+#endif
+		fs->frun_max = 0xFFFFFFFF;				/* Free runs can get longer */
+		while (res == FR_OK && clst < fs->n_fatent) {	/* Not a last link? */
 			nxt = get_fat(fs, clst);			/* Get cluster status */
 			if (nxt == 0) break;				/* Empty cluster? */
 			if (nxt == 1) { res = FR_INT_ERR; break; }	/* Internal error? */
 			if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }	/* Disk error? */
+#if _FS_EXFAT
+			if (fs->fs_type == FS_EXFAT)
+				res = put_bitmap(fs, clst, 1, 0);	/* Mark the cluster "free" on the allocation bitmap */
+			else
+#endif
 			res = put_fat(fs, clst, 0);			/* Mark the cluster "empty" */
 			if (res != FR_OK) break;
 			if (fs->free_clust != 0xFFFFFFFF) {	/* Update FSINFO */
 				fs->free_clust++;
 				fs->fsi_flag |= 1;
 			}
+#if _FS_ALLOCSUM
+			as_update(fs, clst, 1, 0);
+#endif
+#if _FS_JOURNAL
+			jnl_drop(fs, clust2sect(fs, clst), fs->csize);	/* The cluster can be reused for file data written in place */
+#endif
 #if _USE_TRIM
 			if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 				ecl = nxt;
@@ -1013,15 +1863,30 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 		ncl++;							/* Next cluster */
 		if (ncl >= fs->n_fatent) {		/* Check wrap around */
 			ncl = 2;
-			if (ncl > scl) return 0;	/* No free cluster */
+			if (ncl > scl) { ncl = 0; break; }	/* No free cluster */
 		}
+#if _FS_ALLOCSUM
+		ncl = as_skip(fs, ncl, scl);	/* Skip the region without free cluster */
+#endif
 		cs = get_fat(fs, ncl);			/* Get the cluster status */
 		if (cs == 0) break;				/* Found a free cluster */
 		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
 			return cs;
-		if (ncl == scl) return 0;		/* No free cluster */
+		if (ncl == scl) { ncl = 0; break; }	/* No free cluster */
+	}
+	if (!ncl) {
+#if _FS_ALLOCSUM
+		if (fs->as_flag & AS_VALID) {	/* The counts may have hidden free clusters, search again without them */
+			if (as_lost(fs) != FR_OK) return 0xFFFFFFFF;
+			return create_chain(fs, clst);
+		}
+#endif
+		return 0;
 	}
 
+#if _FS_ALLOCSUM
+	if (as_open(fs) != FR_OK) return 0xFFFFFFFF;	/* Put the summary on the disk out of date before the change */
+#endif
 	res = put_fat(fs, ncl, 0x0FFFFFFF);	/* Mark the new cluster "last link" */
 	if (res == FR_OK && clst != 0) {
 		res = put_fat(fs, clst, ncl);	/* Link it to the previous one if needed */
@@ -1032,6 +1897,9 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 			fs->free_clust--;
 			fs->fsi_flag |= 1;
 		}
+#if _FS_ALLOCSUM
+		as_update(fs, ncl, 1, 1);
+#endif
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
 	}
@@ -1044,129 +1912,518 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 
 
 /*-----------------------------------------------------------------------*/
-/* FAT handling - Convert offset into cluster with link map table        */
+/* FAT handling - Find a contiguous run of free clusters                 */
 /*-----------------------------------------------------------------------*/
-
-#if _USE_FASTSEEK
+#if !_FS_READONLY
 static
-DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
-	FIL* fp,		/* Pointer to the file object */
-	DWORD ofs		/* File offset to be converted to cluster# */
+DWORD find_run (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top cluster# of the run */
+	FATFS* fs,			/* File system object */
+	DWORD scl,			/* Cluster# to search from next to */
+	DWORD ncl,			/* Number of clusters wanted (>=1) */
+	DWORD* nrun			/* Pointer to the variable to return number of clusters in the run (<= ncl) */
 )
 {
-	DWORD cl, ncl, *tbl;
+	DWORD cs, cl, top, len, btop, blen;
 
 
-	tbl = fp->cltbl + 1;	/* Top of CLMT */
-	cl = ofs / SS(fp->fs) / fp->fs->csize;	/* Cluster order from top of the file */
+	if (fs->frun_max && ncl > fs->frun_max) ncl = fs->frun_max;	/* No run is longer than the longest one the last full scan found */
+	top = len = btop = blen = 0;
+	cl = scl;				/* Search a free run from next to the start point (first fit) */
 	for (;;) {
-		ncl = *tbl++;			/* Number of cluters in the fragment */
-		if (!ncl) return 0;		/* End of table? (error) */
-		if (cl < ncl) break;	/* In this fragment? */
-		cl -= ncl; tbl++;		/* Next fragment */
+		if (++cl >= fs->n_fatent) {		/* Check wrap around */
+			if (len > blen) { btop = top; blen = len; }
+			if (scl < 2) break;			/* All clusters scanned */
+			cl = 2; len = 0;			/* A run cannot wrap around */
+		}
+		if (cl == scl) break;			/* All clusters scanned */
+#if _FS_ALLOCSUM
+		cl = as_skip(fs, cl, scl);		/* Skip the region without free cluster */
+		if (cl == scl) break;
+#endif
+		cs = get_cstat(fs, cl);			/* Get the cluster status */
+		if (cs == 0xFFFFFFFF || cs == 1)/* An error occurred */
+			return cs;
+		if (cs == 0) {					/* Free cluster */
+			if (!len) top = cl;
+			if (++len >= ncl) break;	/* Found a run long enough */
+		} else {						/* End of a free run */
+			if (len > blen) { btop = top; blen = len; }
+			len = 0;
+		}
 	}
-	return cl + *tbl;	/* Return the cluster number */
+	if (len > blen) { btop = top; blen = len; }	/* Take the run found, or the longest one when no run is long enough */
+	if (blen < ncl) fs->frun_max = blen;	/* All clusters scanned, no run is longer until a cluster is freed */
+#if _FS_ALLOCSUM
+	if (!blen && (fs->as_flag & AS_VALID)) {	/* The counts may have hidden free clusters, search again without them */
+		if (as_lost(fs) != FR_OK) return 0xFFFFFFFF;
+		return find_run(fs, scl, ncl, nrun);
+	}
+#endif
+
+	*nrun = blen;
+	return blen ? btop : 0;
 }
-#endif	/* _USE_FASTSEEK */
+#endif /* !_FS_READONLY */
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Set directory index                              */
+/* FAT handling - Stretch or Create a chain with a contiguous run        */
 /*-----------------------------------------------------------------------*/
-
+#if !_FS_READONLY
 static
-FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp,		/* Pointer to directory object */
-	UINT idx		/* Index of directory table */
+DWORD create_run (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top cluster# of the new run */
+	FATFS* fs,			/* File system object */
+	DWORD clst,			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD ncl			/* Number of clusters wanted (>=1) */
 )
 {
-	DWORD clst, sect;
-	UINT ic;
+	DWORD cs, cl, scl, btop, blen;
+	FRESULT res;
 
 
-	dp->index = (WORD)idx;	/* Current index */
-	clst = dp->sclust;		/* Table start cluster (0:root) */
-	if (clst == 1 || clst >= dp->fs->n_fatent)	/* Check start cluster range */
-		return FR_INT_ERR;
-	if (!clst && dp->fs->fs_type == FS_FAT32)	/* Replace cluster# 0 with root cluster# if in FAT32 */
-		clst = dp->fs->dirbase;
+	if (clst == 0) {		/* Create a new chain */
+		scl = fs->last_clust;			/* Get suggested start point */
+		if (!scl || scl >= fs->n_fatent) scl = 1;
+	}
+	else {					/* Stretch the current chain */
+		cs = get_fat(fs, clst);			/* Check the cluster status */
+		if (cs < 2) return 1;			/* Invalid value */
+		if (cs == 0xFFFFFFFF) return cs;	/* A disk error occurred */
+		if (cs < fs->n_fatent) return cs;	/* It is already followed by next cluster */
+		scl = clst;
+	}
 
-	if (clst == 0) {	/* Static table (root-directory in FAT12/16) */
-		if (idx >= dp->fs->n_rootdir)	/* Is index out of range? */
-			return FR_INT_ERR;
-		sect = dp->fs->dirbase;
+	btop = find_run(fs, scl, ncl, &blen);	/* Find a free run */
+	if (btop < 2 || btop == 0xFFFFFFFF) return btop;
+#if _FS_ALLOCSUM
+	if (as_open(fs) != FR_OK) return 0xFFFFFFFF;	/* Put the summary on the disk out of date before the change */
+#endif
+
+	res = FR_OK;
+	for (cl = btop; res == FR_OK && cl < btop + blen - 1; cl++)
+		res = put_fat(fs, cl, cl + 1);	/* Link the run in a single pass over the FAT */
+	if (res == FR_OK)
+		res = put_fat(fs, cl, 0x0FFFFFFF);	/* Mark the last cluster "last link" */
+	if (res == FR_OK && clst != 0) {
+		res = put_fat(fs, clst, btop);	/* Link it to the previous one if needed */
 	}
-	else {				/* Dynamic table (root-directory in FAT32 or sub-directory) */
-		ic = SS(dp->fs) / SZ_DIRE * dp->fs->csize;	/* Entries per cluster */
-		while (idx >= ic) {	/* Follow cluster chain */
-			clst = get_fat(dp->fs, clst);				/* Get next cluster */
-			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error */
-			if (clst < 2 || clst >= dp->fs->n_fatent)	/* Reached to end of table or internal error */
-				return FR_INT_ERR;
-			idx -= ic;
-		}
-		sect = clust2sect(dp->fs, clst);
+#if _FS_EXFAT
+	if (res == FR_OK && fs->fs_type == FS_EXFAT)
+		res = put_bitmap(fs, btop, blen, 1);	/* Mark the run "in use" on the allocation bitmap */
+#endif
+	if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+
+	fs->last_clust = cl;				/* Update FSINFO */
+	if (fs->free_clust != 0xFFFFFFFF) {
+		fs->free_clust -= blen;
+		fs->fsi_flag |= 1;
 	}
-	dp->clust = clst;	/* Current cluster# */
-	if (!sect) return FR_INT_ERR;
-	dp->sect = sect + idx / (SS(dp->fs) / SZ_DIRE);					/* Sector# of the directory entry */
-	dp->dir = dp->fs->win + (idx % (SS(dp->fs) / SZ_DIRE)) * SZ_DIRE;	/* Ptr to the entry in the sector */
+#if _FS_ALLOCSUM
+	as_update(fs, btop, blen, 1);
+#endif
 
-	return FR_OK;
+	return btop;	/* Return top cluster number of the run */
 }
+#endif /* !_FS_READONLY */
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Move directory table index next                  */
+/* exFAT handling - Contiguous chain without FAT chain                   */
 /*-----------------------------------------------------------------------*/
-
+#if _FS_EXFAT
 static
-FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DENIED:Could not stretch */
-	DIR* dp,		/* Pointer to the directory object */
-	int stretch		/* 0: Do not stretch table, 1: Stretch table if needed */
+DWORD get_chain (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..:Next cluster# (>=n_fatent:end of chain) */
+	FATFS* fs,		/* File system object */
+	BYTE stat,		/* Chain status of the object */
+	DWORD sclust,	/* Top cluster# of the object */
+	DWORD ncont,	/* Number of clusters of the contiguous chain */
+	DWORD clst		/* Cluster# to get the next cluster of */
 )
 {
-	DWORD clst;
-	UINT i;
+	if (fs->fs_type == FS_EXFAT && (stat & XS_NOFAT)) {	/* The chain is not recorded in the FAT */
+		if (clst < sclust || clst - sclust >= ncont) return 1;	/* Out of the chain */
+		return (clst - sclust + 1 < ncont) ? clst + 1 : 0x7FFFFFFF;	/* Next cluster or end of chain */
+	}
+	return get_fat(fs, clst);
+}
+
+
 #if !_FS_READONLY
-	UINT c;
+static
+FRESULT remove_run (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,			/* File system object */
+	DWORD clst,			/* Top cluster# of the contiguous chain */
+	DWORD ncl			/* Number of clusters in the chain */
+)
+{
+	FRESULT res;
+
+
+#if _FS_ALLOCSUM
+	res = as_open(fs);						/* Put the summary on the disk out of date before the change */
+	if (res != FR_OK) return res;
+#endif
+	fs->frun_max = 0xFFFFFFFF;				/* Free runs can get longer */
+	res = put_bitmap(fs, clst, ncl, 0);		/* Mark the clusters "free" on the allocation bitmap */
+	if (res == FR_OK && fs->free_clust != 0xFFFFFFFF) {	/* Update free cluster count */
+		fs->free_clust += ncl;
+		fs->fsi_flag |= 1;
+	}
+#if _FS_ALLOCSUM
+	if (res == FR_OK) as_update(fs, clst, ncl, 0);
+#endif
+#if _FS_JOURNAL
+	if (res == FR_OK) jnl_drop(fs, clust2sect(fs, clst), ncl * fs->csize);
 #endif
+	return res;
+}
 
 
-	i = dp->index + 1;
-	if (!(i & 0xFFFF) || !dp->sect)	/* Report EOT when index has reached 65535 */
-		return FR_NO_FILE;
+static
+DWORD create_xrun (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk error, >=2:Top cluster# of the new run */
+	FATFS* fs,			/* File system object */
+	BYTE* stat,			/* Pointer to the chain status of the object (updated) */
+	DWORD sclust,		/* Top cluster# of the object */
+	DWORD* ncont,		/* Pointer to the number of clusters of the contiguous chain (updated) */
+	DWORD clst,			/* Cluster# to stretch, 0:Create a new chain */
+	DWORD ncl			/* Number of clusters wanted (>=1) */
+)
+{
+	DWORD cs, cl, n;
+	FRESULT res;
 
-	if (!(i % (SS(dp->fs) / SZ_DIRE))) {	/* Sector changed? */
-		dp->sect++;					/* Next sector */
 
-		if (!dp->clust) {		/* Static table */
-			if (i >= dp->fs->n_rootdir)	/* Report EOT if it reached end of static table */
+	if (fs->fs_type != FS_EXFAT) return create_run(fs, clst, ncl);	/* FAT volume */
+
+	if (clst == 0) {		/* Create a new chain, it is not recorded in the FAT while it is contiguous */
+		cl = fs->last_clust;			/* Get suggested start point */
+		if (!cl || cl >= fs->n_fatent) cl = 1;
+		cl = find_run(fs, cl, ncl, &n);	/* Find a free run */
+		if (cl < 2 || cl == 0xFFFFFFFF) return cl;
+		*stat |= XS_NOFAT;
+		*ncont = 0;
+	} else if (*stat & XS_NOFAT) {	/* Stretch the contiguous chain */
+		if (clst - sclust + 1 < *ncont) return clst + 1;	/* It is already followed by next cluster */
+		for (n = 0; n < ncl && clst + 1 + n < fs->n_fatent; n++) {	/* Count free clusters following the chain */
+			cs = get_bitmap(fs, clst + 1 + n);
+			if (cs == 0xFFFFFFFF || cs == 1) return cs;
+			if (cs) break;
+		}
+		if (!n) {			/* The chain cannot stay contiguous, record it in the FAT and stretch it as FAT chain */
+			res = FR_OK;
+			for (cl = sclust; res == FR_OK && cl < clst; cl++)
+				res = put_fat(fs, cl, cl + 1);
+			if (res == FR_OK) res = put_fat(fs, clst, 0x0FFFFFFF);
+			if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+			*stat &= ~XS_NOFAT;
+			return create_run(fs, clst, ncl);
+		}
+		cl = clst + 1;
+	} else {				/* Stretch the FAT chain */
+		return create_run(fs, clst, ncl);
+	}
+
+#if _FS_ALLOCSUM
+	if (as_open(fs) != FR_OK) return 0xFFFFFFFF;	/* Put the summary on the disk out of date before the change */
+#endif
+	res = put_bitmap(fs, cl, n, 1);		/* Mark the run "in use" on the allocation bitmap */
+	if (res != FR_OK) return (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;
+	*ncont += n;
+	fs->last_clust = cl + n - 1;		/* Update FSINFO */
+	if (fs->free_clust != 0xFFFFFFFF) {
+		fs->free_clust -= n;
+		fs->fsi_flag |= 1;
+	}
+#if _FS_ALLOCSUM
+	as_update(fs, cl, n, 1);
+#endif
+
+	return cl;	/* Return top cluster number of the run */
+}
+#endif /* !_FS_READONLY */
+#endif /* _FS_EXFAT */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - FAT access from functions holding only the file lock   */
+/*-----------------------------------------------------------------------*/
+#if _FS_REENTRANT == 2
+static
+DWORD get_fat_fil (	/* get_fat() under the volume lock (0xFFFFFFFF:Disk error or timeout) */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD clst		/* Cluster# to get the link information */
+)
+{
+	DWORD val;
+
+
+	if (!lock_fs(fp->fs)) return 0xFFFFFFFF;
+	val = get_fat_obj(fp, clst);
+	unlock_fs(fp->fs, FR_OK);
+	return val;
+}
+
+
+#if !_FS_READONLY
+static
+DWORD create_chain_fil (	/* create_chain() under the volume lock (0xFFFFFFFF:Disk error or timeout) */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD clst		/* Cluster# to stretch, 0:Create a new chain */
+)
+{
+	DWORD val;
+
+
+	if (!lock_fs(fp->fs)) return 0xFFFFFFFF;
+	val = create_chain_obj(fp, clst);
+	unlock_fs(fp->fs, FR_OK);
+	return val;
+}
+
+
+static
+DWORD create_run_fil (	/* create_run() under the volume lock (0xFFFFFFFF:Disk error or timeout) */
+	FIL* fp,		/* Pointer to the file object */
+	DWORD clst,		/* Cluster# to stretch, 0:Create a new chain */
+	DWORD ncl		/* Number of clusters wanted */
+)
+{
+	DWORD val;
+
+
+	if (!lock_fs(fp->fs)) return 0xFFFFFFFF;
+	val = create_run_obj(fp, clst, ncl);
+	unlock_fs(fp->fs, FR_OK);
+	return val;
+}
+#endif /* !_FS_READONLY */
+#endif /* _FS_REENTRANT == 2 */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Convert offset into cluster with link map table        */
+/*-----------------------------------------------------------------------*/
+
+#if _USE_FASTSEEK
+static
+DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t ofs		/* File offset to be converted to cluster# */
+)
+{
+	DWORD cl, ncl, *tbl;
+
+
+	tbl = fp->cltbl + 1;	/* Top of CLMT */
+	cl = (DWORD)(ofs / SS(fp->fs) / fp->fs->csize);	/* Cluster order from top of the file */
+	for (;;) {
+		ncl = *tbl++;			/* Number of cluters in the fragment */
+		if (!ncl) return 0;		/* End of table? (error) */
+		if (cl < ncl) break;	/* In this fragment? */
+		cl -= ncl; tbl++;		/* Next fragment */
+	}
+	return cl + *tbl;	/* Return the cluster number */
+}
+#endif	/* _USE_FASTSEEK */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Get length of contiguous sector run in the file        */
+/*-----------------------------------------------------------------------*/
+
+static
+UINT contig_sect (	/* Number of contiguous sectors from the current sector (1..cc) */
+	FIL* fp,		/* Pointer to the file object (fp->clust is moved to the last cluster in the run) */
+	UINT csect,		/* Sector offset of the current sector in the current cluster */
+	UINT cc			/* Number of sectors wanted */
+)
+{
+	DWORD clst, nxt;
+	UINT n;
+#if _USE_FASTSEEK
+	DWORD bcs;
+	FSIZE_t ofs;
+
+	bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
+	ofs = fp->fptr - fp->fptr % bcs;			/* Offset of the current cluster */
+#endif
+
+	n = fp->fs->csize - csect;		/* Sectors remaining in the current cluster */
+	clst = fp->clust;
+	while (n < cc) {				/* Look ahead while the run does not cover the request */
+#if _USE_FASTSEEK
+		if (fp->cltbl)
+			nxt = clmt_clust(fp, ofs += bcs);	/* Get next cluster# from the CLMT */
+		else
+#endif
+			nxt = get_fat_fil(fp, clst);		/* Get next cluster# from the FAT */
+		if (nxt != clst + 1) break;	/* End of chain, fragment or error (reported by the caller later) */
+		clst = nxt;
+		n += fp->fs->csize;
+	}
+	if (n > cc) n = cc;
+	fp->clust = clst;				/* Last cluster touched by the run */
+
+	return n;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* File read - Load a sector into the file buffer with read-ahead        */
+/*-----------------------------------------------------------------------*/
+#if _FS_PREFETCH
+static
+FRESULT pf_load (	/* FR_OK(0):succeeded, FR_DISK_ERR:disk error */
+	FIL* fp,		/* Pointer to the file object (sector is loaded into fp->buf) */
+	DWORD sect,		/* Sector to load */
+	UINT csect		/* Sector offset of sect in the current cluster */
+)
+{
+	DWORD clst;
+	UINT n;
+
+
+	if (sect - fp->pf_sect < fp->pf_cnt) {	/* Served from the read-ahead buffer */
+		mem_cpy(fp->buf, &fp->pf_buf[(sect - fp->pf_sect) * SS(fp->fs)], SS(fp->fs));
+		STAT_INC(fp->fs, pf_hit);
+	} else {
+		fp->pf_cnt = 0;
+		if (fp->fptr == fp->pf_next) {		/* Sequential access: read ahead from this sector */
+			n = (UINT)((fp->fsize - fp->fptr + SS(fp->fs) - 1) / SS(fp->fs));	/* Sectors left in the file */
+			if (n > _FS_PREFETCH) n = _FS_PREFETCH;
+			clst = fp->clust;
+			n = contig_sect(fp, csect, n);	/* Clip at end of the contiguous cluster run */
+			fp->clust = clst;
+			if (disk_read(fp->fs->drv, fp->pf_buf, sect, n) != RES_OK)
+				return FR_DISK_ERR;
+			fp->pf_sect = sect;
+			fp->pf_cnt = n;
+			mem_cpy(fp->buf, fp->pf_buf, SS(fp->fs));
+		} else {							/* Random access: load the sector alone */
+			if (disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
+				return FR_DISK_ERR;
+		}
+		STAT_INC(fp->fs, pf_miss);
+	}
+	fp->pf_next = fp->fptr + SS(fp->fs);
+
+	return FR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Set directory index                              */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_sdi (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,		/* Pointer to directory object */
+	UINT idx		/* Index of directory table */
+)
+{
+	DWORD clst, sect;
+	UINT ic;
+
+
+	dp->index = (WORD)idx;	/* Current index */
+	clst = dp->sclust;		/* Table start cluster (0:root) */
+	if (clst == 1 || clst >= dp->fs->n_fatent)	/* Check start cluster range */
+		return FR_INT_ERR;
+	if (!clst && (dp->fs->fs_type == FS_FAT32 || dp->fs->fs_type == FS_EXFAT))	/* Replace cluster# 0 with root cluster# if in FAT32/exFAT */
+		clst = dp->fs->dirbase;
+
+	if (clst == 0) {	/* Static table (root-directory in FAT12/16) */
+		if (idx >= dp->fs->n_rootdir)	/* Is index out of range? */
+			return FR_INT_ERR;
+		sect = dp->fs->dirbase;
+	}
+	else {				/* Dynamic table (root-directory in FAT32 or sub-directory) */
+		ic = SS(dp->fs) / SZ_DIRE * dp->fs->csize;	/* Entries per cluster */
+		while (idx >= ic) {	/* Follow cluster chain */
+			clst = get_fat_obj(dp, clst);				/* Get next cluster */
+			if (clst == 0xFFFFFFFF) return FR_DISK_ERR;	/* Disk error */
+			if (clst < 2 || clst >= dp->fs->n_fatent)	/* Reached to end of table or internal error */
+				return FR_INT_ERR;
+			idx -= ic;
+		}
+		sect = clust2sect(dp->fs, clst);
+	}
+	dp->clust = clst;	/* Current cluster# */
+	if (!sect) return FR_INT_ERR;
+	dp->sect = sect + idx / (SS(dp->fs) / SZ_DIRE);					/* Sector# of the directory entry */
+	dp->dir = dp->fs->win + (idx % (SS(dp->fs) / SZ_DIRE)) * SZ_DIRE;	/* Ptr to the entry in the sector */
+
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Move directory table index next                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DENIED:Could not stretch */
+	DIR* dp,		/* Pointer to the directory object */
+	int stretch		/* 0: Do not stretch table, 1: Stretch table if needed */
+)
+{
+	DWORD clst;
+	UINT i;
+#if !_FS_READONLY
+	UINT c;
+#endif
+
+
+	i = dp->index + 1;
+	if (!(i & 0xFFFF) || !dp->sect)	/* Report EOT when index has reached 65535 */
+		return FR_NO_FILE;
+
+	if (!(i % (SS(dp->fs) / SZ_DIRE))) {	/* Sector changed? */
+		dp->sect++;					/* Next sector */
+
+		if (!dp->clust) {		/* Static table */
+			if (i >= dp->fs->n_rootdir)	/* Report EOT if it reached end of static table */
 				return FR_NO_FILE;
 		}
 		else {					/* Dynamic table */
 			if (((i / (SS(dp->fs) / SZ_DIRE)) & (dp->fs->csize - 1)) == 0) {	/* Cluster changed? */
-				clst = get_fat(dp->fs, dp->clust);				/* Get next cluster */
+				clst = get_fat_obj(dp, dp->clust);				/* Get next cluster */
 				if (clst <= 1) return FR_INT_ERR;
 				if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
 				if (clst >= dp->fs->n_fatent) {					/* If it reached end of dynamic table, */
 #if !_FS_READONLY
 					if (!stretch) return FR_NO_FILE;			/* If do not stretch, report EOT */
-					clst = create_chain(dp->fs, dp->clust);		/* Stretch cluster chain */
+					clst = create_chain_obj(dp, dp->clust);		/* Stretch cluster chain */
 					if (clst == 0) return FR_DENIED;			/* No free cluster */
 					if (clst == 1) return FR_INT_ERR;
 					if (clst == 0xFFFFFFFF) return FR_DISK_ERR;
+#if _FS_EXFAT
+					dp->stat |= XS_GROWN;						/* Directory size in the entry is to be updated */
+#endif
 					/* Clean-up stretched table */
 					if (sync_window(dp->fs)) return FR_DISK_ERR;/* Flush disk access window */
 					mem_set(dp->fs->win, 0, SS(dp->fs));		/* Clear window buffer */
 					dp->fs->winsect = clust2sect(dp->fs, clst);	/* Cluster start sector */
 					for (c = 0; c < dp->fs->csize; c++) {		/* Fill the new cluster with 0 */
 						dp->fs->wflag = 1;
-						if (sync_window(dp->fs)) return FR_DISK_ERR;
+						if (fill_window(dp->fs)) return FR_DISK_ERR;
 						dp->fs->winsect++;
 					}
 					dp->fs->winsect -= c;						/* Rewind window offset */
@@ -1190,6 +2447,189 @@ FRESULT dir_next (	/* FR_OK(0):succeeded, FR_NO_FILE:End of table, FR_DENIED:Cou
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Free entry hint                                  */
+/*-----------------------------------------------------------------------*/
+#if _FS_DIRHINT && !_FS_READONLY
+/* Each hint holds an index of a directory below which all entries are in
+/  use, so that dir_alloc() can start there instead of the top of the table. */
+
+static
+DIRHINT* dh_find (	/* Pointer to the hint (moved to the top), 0:not found */
+	FATFS* fs,		/* File system object */
+	DWORD clust,	/* Start cluster of the directory */
+	int add			/* 1:Create a hint if not found */
+)
+{
+	DIRHINT dh;
+	UINT i;
+
+
+	for (i = 0; i < _FS_DIRHINT && fs->dh[i].clust != clust; i++) ;
+	if (i == _FS_DIRHINT) {				/* Not found */
+		if (!add) return 0;
+		i--;
+		fs->dh[i].clust = clust;		/* Reuse the least recently used one */
+		fs->dh[i].idx = 0;
+	}
+	dh = fs->dh[i];
+	for ( ; i; i--) fs->dh[i] = fs->dh[i - 1];	/* Move it to the top */
+	fs->dh[0] = dh;
+	return &fs->dh[0];
+}
+
+
+#if !_FS_MINIMIZE
+static
+void dh_free (
+	FATFS* fs,		/* File system object */
+	DWORD clust,	/* Start cluster of the directory */
+	UINT idx		/* Index of the top entry freed */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DIRHINT; i++) {
+		if (fs->dh[i].clust == clust) {
+			if (idx < fs->dh[i].idx) fs->dh[i].idx = (WORD)idx;
+			break;
+		}
+	}
+}
+#endif
+
+
+static
+void dh_forget (
+	FATFS* fs,		/* File system object */
+	DWORD clust		/* Start cluster of the directory removed (0xFFFFFFFF:all) */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DIRHINT; i++) {
+		if (clust == 0xFFFFFFFF || fs->dh[i].clust == clust) fs->dh[i].clust = 0xFFFFFFFF;
+	}
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Path cache                                       */
+/*-----------------------------------------------------------------------*/
+#if _FS_DCACHE
+/* A path segment followed into a sub-directory is recorded with the parent
+/  directory, so that the next path through it does not search the parent.
+/  The segment is compared as given in the path, and an item is forgotten
+/  when the directory is moved, removed or stretched (exFAT). */
+
+static
+UINT dc_seg (		/* Length of the segment (0:last segment of the path) */
+	const TCHAR* p	/* Pointer to the segment */
+)
+{
+	UINT n;
+
+
+	for (n = 0; (UINT)p[n] >= ' ' && p[n] != '/' && p[n] != '\\'; n++) ;
+	return ((UINT)p[n] < ' ') ? 0 : n;
+}
+
+
+static
+int dc_find (		/* 1:the directory of the segment is found and entered, 0:not found */
+	DIR* dp,		/* Directory object to follow the path */
+	const TCHAR** path	/* Pointer to pointer to the segment in the path string */
+)
+{
+	FATFS *fs = dp->fs;
+	DCACHE dc;
+	const TCHAR *p;
+	UINT i, n;
+
+
+	for (p = *path; *p == '/' || *p == '\\'; p++) ;	/* Strip duplicated separator */
+	n = dc_seg(p);
+	if (!n || n > sizeof dc.name / sizeof (TCHAR) || *p == '.') return 0;	/* (Not recorded) */
+	for (i = 0; i < _FS_DCACHE; i++) {
+		if (fs->dc[i].pclust == dp->sclust && fs->dc[i].nc == n && !mem_cmp(fs->dc[i].name, p, n * sizeof (TCHAR))) break;
+	}
+	if (i == _FS_DCACHE) return 0;
+	dc = fs->dc[i];
+	for ( ; i; i--) fs->dc[i] = fs->dc[i - 1];	/* Move it to the top */
+	fs->dc[0] = dc;
+#if _FS_EXFAT
+	dp->c_scl = dp->sclust;		/* Location of the entry set in the containing directory */
+	dp->c_stat = dp->stat & XS_NOFAT;
+	dp->c_ncont = dp->n_cont;
+	dp->c_idx = dc.idx;
+	dp->stat = dc.stat;
+	dp->n_cont = dc.n_cont;
+#endif
+	dp->sclust = dc.sclust;		/* Enter the sub-directory */
+	*path = &p[n + 1];			/* Next segment */
+	return 1;
+}
+
+
+static
+void dc_put (
+	DIR* dp,		/* Directory object that has entered the sub-directory */
+	DWORD pclust,	/* Start cluster of the parent directory */
+	const TCHAR* seg,	/* Pointer to the segment in the path string */
+	const TCHAR* next	/* Pointer to the next segment */
+)
+{
+	FATFS *fs = dp->fs;
+	const TCHAR *p;
+	UINT i, n;
+
+
+	for (p = seg; *p == '/' || *p == '\\'; p++) ;
+	n = (UINT)(next - p) - 1;
+	if (n > sizeof fs->dc[0].name / sizeof (TCHAR) || *p == '.') return;
+	for (i = 0; i + 1 < _FS_DCACHE && fs->dc[i].pclust != 0xFFFFFFFF; i++) ;	/* Take a free item or the least recently used one */
+	for ( ; i; i--) fs->dc[i] = fs->dc[i - 1];
+	fs->dc[0].pclust = pclust;
+	fs->dc[0].sclust = dp->sclust;
+#if _FS_EXFAT
+	fs->dc[0].idx = (fs->fs_type == FS_EXFAT) ? dp->c_idx : dp->index;
+#else
+	fs->dc[0].idx = dp->index;
+#endif
+	fs->dc[0].nc = (BYTE)n;
+#if _FS_EXFAT
+	fs->dc[0].stat = dp->stat;
+	fs->dc[0].n_cont = dp->n_cont;
+#endif
+	mem_cpy(fs->dc[0].name, p, n * sizeof (TCHAR));
+}
+
+
+static
+void dc_drop (
+	FATFS* fs,		/* File system object */
+	DWORD clust,	/* Start cluster of the directory (0xFFFFFFFF:all) */
+	int sub			/* 1:Also forget the sub-directories in it */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_DCACHE; i++) {
+		if (clust == 0xFFFFFFFF || fs->dc[i].sclust == clust || (sub && fs->dc[i].pclust == clust))
+			fs->dc[i].pclust = 0xFFFFFFFF;
+	}
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Directory handling - Reserve directory entry                          */
 /*-----------------------------------------------------------------------*/
@@ -1203,15 +2643,29 @@ FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 {
 	FRESULT res;
 	UINT n;
+#if _FS_DIRHINT
+	DIRHINT *dh;
+	UINT ff = 0xFFFF;
 
 
+	dh = dh_find(dp->fs, dp->sclust, 1);
+	res = dir_sdi(dp, dh->idx);		/* Start at the first entry that can be free */
+#else
 	res = dir_sdi(dp, 0);
+#endif
 	if (res == FR_OK) {
 		n = 0;
 		do {
 			res = move_window(dp->fs, dp->sect);
 			if (res != FR_OK) break;
+#if _FS_EXFAT
+			if (dp->fs->fs_type == FS_EXFAT ? !(dp->dir[XDIR_Type] & 0x80) : (dp->dir[0] == DDEM || dp->dir[0] == 0)) {	/* Is it a free entry? */
+#else
 			if (dp->dir[0] == DDEM || dp->dir[0] == 0) {	/* Is it a free entry? */
+#endif
+#if _FS_DIRHINT
+				if (ff == 0xFFFF) ff = dp->index;	/* First free entry found */
+#endif
 				if (++n == nent) break;	/* A block of contiguous free entries is found */
 			} else {
 				n = 0;					/* Not a blank entry. Restart to search */
@@ -1219,6 +2673,10 @@ FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 			res = dir_next(dp, 1);		/* Next entry with table stretch enabled */
 		} while (res == FR_OK);
 	}
+#if _FS_DIRHINT
+	if (ff != 0xFFFF)	/* Update the hint (past the block when it is taken from the first free entry) */
+		dh->idx = (WORD)((res == FR_OK && ff == dp->index - (nent - 1)) ? dp->index : ff);
+#endif
 	if (res == FR_NO_FILE) res = FR_DENIED;	/* No directory entry to allocate */
 	return res;
 }
@@ -1371,81 +2829,539 @@ void fit_lfn (
 
 
 
-/*-----------------------------------------------------------------------*/
-/* Create numbered name                                                  */
-/*-----------------------------------------------------------------------*/
-#if _USE_LFN
+/*-----------------------------------------------------------------------*/
+/* Create numbered name                                                  */
+/*-----------------------------------------------------------------------*/
+#if _USE_LFN
+static
+void gen_numname (
+	BYTE* dst,			/* Pointer to the buffer to store numbered SFN */
+	const BYTE* src,	/* Pointer to SFN */
+	const WCHAR* lfn,	/* Pointer to LFN */
+	UINT seq			/* Sequence number */
+)
+{
+	BYTE ns[8], c;
+	UINT i, j;
+	WCHAR wc;
+	DWORD sr;
+
+
+	mem_cpy(dst, src, 11);
+
+	if (seq > 5) {	/* On many collisions, generate a hash number instead of sequential number */
+		sr = seq;
+		while (*lfn) {	/* Create a CRC */
+			wc = *lfn++;
+			for (i = 0; i < 16; i++) {
+				sr = (sr << 1) + (wc & 1);
+				wc >>= 1;
+				if (sr & 0x10000) sr ^= 0x11021;
+			}
+		}
+		seq = (UINT)sr;
+	}
+
+	/* itoa (hexdecimal) */
+	i = 7;
+	do {
+		c = (seq % 16) + '0';
+		if (c > '9') c += 7;
+		ns[i--] = c;
+		seq /= 16;
+	} while (seq);
+	ns[i] = '~';
+
+	/* Append the number */
+	for (j = 0; j < i && dst[j] != ' '; j++) {
+		if (IsDBCS1(dst[j])) {
+			if (j == i - 1) break;
+			j++;
+		}
+	}
+	do {
+		dst[j++] = (i < 8) ? ns[i++] : ' ';
+	} while (j < 8);
+}
+
+
+#if !_FS_READONLY
+static
+BYTE free_seq (		/* First sequence number not collided (1..NS_TRY+1) */
+	UINT used		/* Collided numbered names (b0:sequence number 1) */
+)
+{
+	BYTE n = 1;
+
+
+	while (used & 1) {
+		used >>= 1; n++;
+	}
+	return n;
+}
+#endif
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Calculate checksum of an SFN entry                                    */
+/*-----------------------------------------------------------------------*/
+#if _USE_LFN
+static
+BYTE sum_sfn (
+	const BYTE* dir		/* Pointer to the SFN entry */
+)
+{
+	BYTE sum = 0;
+	UINT n = 11;
+
+	do sum = (sum >> 1) + (sum << 7) + *dir++; while (--n);
+	return sum;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* LFN handling - Name hash cache                                        */
+/*-----------------------------------------------------------------------*/
+#if _USE_LFN && _LFN_HASH
+/* The hash of a name is the sum of a hash of each character and its
+/  position, so that it can be taken from the LFN entries in any order. */
+
+static
+WORD hash_chr (		/* Hash value of a character at a position of the name */
+	WCHAR chr,		/* Character */
+	UINT pos		/* Position in the name */
+)
+{
+	DWORD h;
+
+
+	h = ((DWORD)ff_wtoupper(chr) << 16 | pos) * 0x9E3779B1;
+	h ^= h >> 15;	/* (Mix it non-linearly, or the sum would not depend on the order of the characters) */
+	h *= 0x85EBCA77;
+	return (WORD)(h >> 16);
+}
+
+
+static
+WORD hash_name (	/* Hash value of the name */
+	const WCHAR* lfn	/* Pointer to the name */
+)
+{
+	UINT i;
+	WORD hv = 0;
+
+
+	for (i = 0; lfn[i]; i++) hv += hash_chr(lfn[i], i);
+	return hv;
+}
+
+
+static
+WORD hash_lfn (		/* Hash value added with the characters in the LFN entry */
+	WORD hv,		/* Hash value of the other LFN entries */
+	const BYTE* dir	/* Pointer to the LFN entry */
+)
+{
+	UINT i, s;
+	WCHAR uc;
+
+
+	i = ((dir[LDIR_Ord] & 0x3F) - 1) * 13;	/* Offset in the name */
+	for (s = 0; s < 13; s++) {
+		uc = LD_WORD(dir + LfnOfs[s]);
+		if (!uc) break;						/* End of the name */
+		hv += hash_chr(uc, i + s);
+	}
+	return hv;
+}
+
+
+static
+int hc_put (		/* 1:recorded, 0:the cache is full */
+	FATFS* fs,		/* File system object */
+	UINT idx,		/* Index of the SFN entry */
+	UINT nlfn,		/* Number of LFN entries of the object (0:SFN only) */
+	WORD hash,		/* Hash value of the LFN */
+	BYTE sum		/* Checksum of the SFN */
+)
+{
+	LFNHASH *hp;
+
+
+	if (fs->hc_n >= _LFN_HASH) return 0;
+	hp = &fs->hc[fs->hc_n++];
+	hp->idx = (WORD)idx;
+	hp->nlfn = (BYTE)nlfn;
+	hp->hash = hash;
+	hp->sum = sum;
+	return 1;
+}
+
+
+static
+FRESULT hc_match (	/* FR_OK(0):matched, FR_NO_FILE:not matched, !=0:error */
+	DIR* dp,		/* Directory object with the name to find */
+	const LFNHASH* hp,	/* Cached object to be compared */
+	int lm			/* 1:LFN to be compared */
+)
+{
+	FRESULT res;
+	UINT ord;
+	BYTE *dir;
+
+
+	ord = hp->nlfn;
+	if (!ord) lm = 0;
+	res = dir_sdi(dp, (lm) ? hp->idx - ord : hp->idx);	/* Go to the top of the LFN entries or the SFN */
+	if (res != FR_OK) return res;
+	if (!lm) ord = 0;
+	for (;;) {
+		res = move_window(dp->fs, dp->sect);
+		if (res != FR_OK) return res;
+		dir = dp->dir;
+		if (!ord) break;					/* Reached the SFN entry */
+		if ((dir[LDIR_Ord] & 0x3F) != ord || dir[LDIR_Chksum] != hp->sum || !cmp_lfn(dp->lfn, dir)) {	/* LFN not matched */
+			if (dp->fn[NSFLAG] & NS_LOSS) return FR_NO_FILE;
+			lm = 0;
+			res = dir_sdi(dp, hp->idx);		/* Check the SFN instead */
+			if (res != FR_OK) return res;
+			ord = 0;
+			continue;
+		}
+		ord--;
+		res = dir_next(dp, 0);
+		if (res != FR_OK) return (res == FR_NO_FILE) ? FR_INT_ERR : res;
+	}
+	if (dir[DIR_Name] == DDEM || (dir[DIR_Attr] & AM_VOL) || sum_sfn(dir) != hp->sum) return FR_NO_FILE;	/* (Stale item) */
+	if (!lm && ((dp->fn[NSFLAG] & NS_LOSS) || mem_cmp(dir, dp->fn, 11))) return FR_NO_FILE;
+	dp->lfn_idx = (hp->nlfn) ? (WORD)(hp->idx - hp->nlfn) : 0xFFFF;
+	return FR_OK;
+}
+
+
+#if !_FS_READONLY
+static
+void hc_update (
+	DIR* dp,		/* Directory object pointing the SFN entry of the object created or removed */
+	int add			/* 1:created, 0:removed */
+)
+{
+	FATFS *fs = dp->fs;
+	UINT i, nlfn = 0;
+
+
+	if (fs->hc_clust != dp->sclust) return;	/* The directory is not cached */
+	if (add && (dp->fn[NSFLAG] & NS_LFN)) {	/* Number of LFN entries created */
+		while (dp->lfn[nlfn]) nlfn++;
+		nlfn = (nlfn + 12) / 13;
+	}
+	if (dp->index >= fs->hc_next) {			/* In the part not cached yet */
+		if (add) {
+			fs->hc_eot = 0;					/* (It may have been put at end of the directory) */
+			if (dp->index - nlfn < fs->hc_next) fs->hc_next = (WORD)(dp->index - nlfn);	/* (Its LFN may start in the cached part, scan it again from there) */
+		}
+		return;
+	}
+	if (add) {
+		if (!hc_put(fs, dp->index, nlfn, nlfn ? hash_name(dp->lfn) : 0, sum_sfn(dp->dir))) {
+			fs->hc_n = 0; fs->hc_next = 0; fs->hc_eot = 0;	/* No room, cache the directory again */
+		}
+	} else {
+		for (i = 0; i < fs->hc_n && fs->hc[i].idx != dp->index; i++) ;
+		if (i < fs->hc_n) fs->hc[i] = fs->hc[--fs->hc_n];	/* Forget the object */
+	}
+}
+#endif
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Entry set of a file or directory                     */
+/*-----------------------------------------------------------------------*/
+#if _FS_EXFAT
+static
+WORD xdir_sum (		/* Checksum of the entry set */
+	const BYTE* dirb	/* Pointer to the entry set */
+)
+{
+	UINT i, sz;
+	WORD sum = 0;
+
+
+	sz = (dirb[XDIR_NumSec] + 1) * SZ_DIRE;
+	for (i = 0; i < sz; i++) {
+		if (i == XDIR_SetSum) {		/* Skip the checksum field */
+			i++;
+		} else {
+			sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + dirb[i];
+		}
+	}
+	return sum;
+}
+
+
+static
+WORD xname_sum (	/* Hash value of the name */
+	const WCHAR* name	/* Pointer to the name to be hashed */
+)
+{
+	WCHAR chr;
+	WORD sum = 0;
+
+
+	while ((chr = *name++) != 0) {
+		chr = ff_wtoupper(chr);		/* The name is hashed in up-case */
+		sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr & 0xFF);
+		sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + (chr >> 8);
+	}
+	return sum;
+}
+
+
+static
+int cmp_xname (		/* 1:matched, 0:not matched */
+	const BYTE* dirb,	/* Pointer to the entry set */
+	const WCHAR* name	/* Pointer to the name to be compared */
+)
+{
+	UINT nc, si;
+
+
+	for (nc = dirb[XDIR_NumName], si = SZ_DIRE * 2; nc; nc--, si += 2, name++) {
+		if (si % SZ_DIRE == 0) si += 2;		/* Skip the entry type field of a name entry */
+		if (!*name || ff_wtoupper(LD_WORD(dirb + si)) != ff_wtoupper(*name)) return 0;
+	}
+	return !*name;
+}
+
+
+static
+void get_xname (
+	const BYTE* dirb,	/* Pointer to the entry set */
+	WCHAR* lfn			/* Pointer to the buffer to store the name (_MAX_LFN + 1 elements) */
+)
+{
+	UINT nc, si, di;
+
+
+	for (nc = dirb[XDIR_NumName], si = SZ_DIRE * 2, di = 0; nc && di < _MAX_LFN; nc--, si += 2, di++) {
+		if (si % SZ_DIRE == 0) si += 2;		/* Skip the entry type field of a name entry */
+		lfn[di] = LD_WORD(dirb + si);
+	}
+	lfn[di] = 0;
+}
+
+
+static
+FRESULT load_xdir (	/* FR_OK(0):succeeded, FR_INT_ERR:broken entry set, FR_DISK_ERR:disk error */
+	DIR* dp			/* Pointer to the directory object pointing the 85 entry (moved to the last entry) */
+)
+{
+	FRESULT res;
+	UINT i, sz, szn;
+	BYTE *dirb = dp->fs->dirbuf;
+
+
+	res = move_window(dp->fs, dp->sect);
+	if (res != FR_OK) return res;
+	if (dp->dir[XDIR_Type] != 0x85) return FR_INT_ERR;
+	sz = (dp->dir[XDIR_NumSec] + 1) * SZ_DIRE;	/* Size of the entry set */
+	if (sz < 3 * SZ_DIRE || sz > sizeof dp->fs->dirbuf) return FR_INT_ERR;	/* (It must fit in the dirbuf[]) */
+	szn = 0;
+	for (i = 0; i < sz; i += SZ_DIRE) {	/* Load the 85, C0 and following secondary entries */
+		if (i) {
+			res = dir_next(dp, 0);
+			if (res == FR_NO_FILE) res = FR_INT_ERR;
+			if (res == FR_OK) res = move_window(dp->fs, dp->sect);
+			if (res != FR_OK) return res;
+			if (i == SZ_DIRE) {			/* Stream extension entry */
+				if (dp->dir[XDIR_Type] != 0xC0) return FR_INT_ERR;
+				szn = ((dp->dir[XDIR_NumName - SZ_DIRE] + 14) / 15 + 2) * SZ_DIRE;	/* Size of the 85, C0 and name entries */
+				if (szn > sz) return FR_INT_ERR;
+			} else {
+				if (i < szn ? dp->dir[XDIR_Type] != 0xC1 : (dp->dir[XDIR_Type] & 0xC0) != 0xC0) return FR_INT_ERR;
+			}
+		}
+		mem_cpy(dirb + i, dp->dir, SZ_DIRE);
+	}
+	if (LD_WORD(dirb + XDIR_SetSum) != xdir_sum(dirb)) return FR_INT_ERR;
+
+	return FR_OK;
+}
+
+
+static
+FRESULT load_obj_xdir (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp,		/* Blank directory object to be used to access the containing directory */
+	FATFS* fs,		/* File system object */
+	DWORD scl,		/* Top cluster# of the containing directory */
+	BYTE stat,		/* Chain status of the containing directory */
+	DWORD ncont,	/* Number of clusters of the containing directory without FAT chain */
+	WORD idx		/* Index of the entry set in the containing directory */
+)
+{
+	FRESULT res;
+
+
+	dp->fs = fs;
+	dp->sclust = scl;
+	dp->stat = stat;
+	dp->n_cont = ncont;
+	res = dir_sdi(dp, idx);
+	if (res == FR_OK) {
+		dp->lfn_idx = idx;
+		res = load_xdir(dp);	/* Load the entry set into dirbuf[] */
+	}
+	return res;
+}
+
+
+static
+void enter_xdir (
+	DIR* dp			/* Directory object with the entry set of the sub-directory in dirbuf[] */
+)
+{
+	BYTE *dirb = dp->fs->dirbuf;
+
+
+	dp->c_scl = dp->sclust;		/* Location of the entry set in the containing directory */
+	dp->c_stat = dp->stat & XS_NOFAT;
+	dp->c_ncont = dp->n_cont;
+	dp->c_idx = dp->lfn_idx;
+	dp->sclust = LD_DWORD(dirb + XDIR_FstClus);	/* Table start cluster and its chain status */
+	dp->stat = dirb[XDIR_GenFlags] & XS_NOFAT;
+	dp->n_cont = (DWORD)(LD_QWORD(dirb + XDIR_FileSize) / ((DWORD)dp->fs->csize * SS(dp->fs)));
+}
+
+
+#if !_FS_READONLY
+static
+FRESULT store_xdir (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp				/* Pointer to the directory object (lfn_idx is the top of the entry set) */
+)
+{
+	FRESULT res;
+	UINT nent;
+	BYTE *dirb = dp->fs->dirbuf;
+
+
+	ST_WORD(dirb + XDIR_SetSum, xdir_sum(dirb));	/* Update the checksum */
+	nent = dirb[XDIR_NumSec] + 1;
+	res = dir_sdi(dp, dp->lfn_idx);
+	while (res == FR_OK) {		/* Store the entry set */
+		res = move_window(dp->fs, dp->sect);
+		if (res != FR_OK) break;
+		mem_cpy(dp->dir, dirb, SZ_DIRE);
+		dp->fs->wflag = 1;
+		if (--nent == 0) break;
+		dirb += SZ_DIRE;
+		res = dir_next(dp, 0);
+	}
+	return (res == FR_OK || res == FR_DISK_ERR) ? res : FR_INT_ERR;
+}
+
+
 static
-void gen_numname (
-	BYTE* dst,			/* Pointer to the buffer to store numbered SFN */
-	const BYTE* src,	/* Pointer to SFN */
-	const WCHAR* lfn,	/* Pointer to LFN */
-	UINT seq			/* Sequence number */
+void create_xdir (
+	BYTE* dirb,			/* Pointer to the buffer to create the entry set */
+	const WCHAR* lfn	/* Pointer to the name */
 )
 {
-	BYTE ns[8], c;
-	UINT i, j;
-	WCHAR wc;
-	DWORD sr;
+	UINT i, nc, nb;
+	WCHAR chr;
 
 
-	mem_cpy(dst, src, 11);
+	mem_set(dirb, 0, 2 * SZ_DIRE);		/* Create 85 and C0 entries */
+	dirb[XDIR_Type] = 0x85;
+	dirb[SZ_DIRE + XDIR_Type] = 0xC0;
+	ST_WORD(dirb + XDIR_NameHash, xname_sum(lfn));
 
-	if (seq > 5) {	/* On many collisions, generate a hash number instead of sequential number */
-		sr = seq;
-		while (*lfn) {	/* Create a CRC */
-			wc = *lfn++;
-			for (i = 0; i < 16; i++) {
-				sr = (sr << 1) + (wc & 1);
-				wc >>= 1;
-				if (sr & 0x10000) sr ^= 0x11021;
-			}
-		}
-		seq = (UINT)sr;
-	}
+	i = SZ_DIRE * 2; nc = 0; nb = 1; chr = 1;
+	do {						/* Create C1 entries */
+		dirb[i++] = 0xC1; dirb[i++] = 0;
+		do {					/* Fill the name field (the rest of the last one is padded with zero) */
+			if (chr && (chr = lfn[nc]) != 0) nc++;
+			ST_WORD(dirb + i, chr);
+		} while ((i += 2) % SZ_DIRE);
+		nb++;
+	} while (lfn[nc]);
 
-	/* itoa (hexdecimal) */
-	i = 7;
+	dirb[XDIR_NumName] = (BYTE)nc;
+	dirb[XDIR_NumSec] = (BYTE)nb;	/* Number of C0 and C1 entries */
+}
+
+
+static
+FRESULT grow_xdir (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp			/* Pointer to the sub-directory object that has been stretched */
+)
+{
+	DIR dj;
+	DWORD cl, n;
+	QWORD sz;
+	BYTE *dirb = dp->fs->dirbuf;
+	FRESULT res;
+
+
+	n = 0; cl = dp->sclust;	/* Count the clusters of the directory */
 	do {
-		c = (seq % 16) + '0';
-		if (c > '9') c += 7;
-		ns[i--] = c;
-		seq /= 16;
-	} while (seq);
-	ns[i] = '~';
+		n++;
+		cl = get_fat_obj(dp, cl);
+		if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+		if (cl < 2) return FR_INT_ERR;
+	} while (cl < dp->fs->n_fatent);
 
-	/* Append the number */
-	for (j = 0; j < i && dst[j] != ' '; j++) {
-		if (IsDBCS1(dst[j])) {
-			if (j == i - 1) break;
-			j++;
-		}
+	res = load_obj_xdir(&dj, dp->fs, dp->c_scl, dp->c_stat, dp->c_ncont, dp->c_idx);	/* Update the size in its entry set */
+	if (res == FR_OK) {
+		sz = (QWORD)n * dp->fs->csize * SS(dp->fs);
+		ST_QWORD(dirb + XDIR_FileSize, sz);
+		ST_QWORD(dirb + XDIR_ValidFileSize, sz);
+		dirb[XDIR_GenFlags] = 1 | (dp->stat & XS_NOFAT);
+		res = store_xdir(&dj);
 	}
-	do {
-		dst[j++] = (i < 8) ? ns[i++] : ' ';
-	} while (j < 8);
-}
+	dp->stat &= ~XS_GROWN;
+#if _FS_DCACHE
+	dc_drop(dp->fs, dp->sclust, 1);	/* Forget the paths with the old size of the directory */
 #endif
+	return res;
+}
 
 
-
-
-/*-----------------------------------------------------------------------*/
-/* Calculate checksum of an SFN entry                                    */
-/*-----------------------------------------------------------------------*/
-#if _USE_LFN
 static
-BYTE sum_sfn (
-	const BYTE* dir		/* Pointer to the SFN entry */
+FRESULT sync_xdir (	/* FR_OK(0):succeeded, !=0:error */
+	FIL* fp,		/* Pointer to the file object to reflect to its entry set */
+	DWORD tm		/* Modified time */
 )
 {
-	BYTE sum = 0;
-	UINT n = 11;
+	DIR dj;
+	BYTE *dirb = fp->fs->dirbuf;
+	FRESULT res;
 
-	do sum = (sum >> 1) + (sum << 7) + *dir++; while (--n);
-	return sum;
+
+	res = load_obj_xdir(&dj, fp->fs, fp->c_scl, fp->c_stat, fp->c_ncont, fp->c_idx);
+	if (res == FR_OK) {
+		dirb[XDIR_Attr] |= AM_ARC;					/* Set archive bit */
+		dirb[XDIR_GenFlags] = 1 | fp->stat;			/* Update chain status */
+		ST_DWORD(dirb + XDIR_FstClus, fp->sclust);	/* Update start cluster */
+		ST_QWORD(dirb + XDIR_FileSize, fp->fsize);	/* Update file size */
+		ST_QWORD(dirb + XDIR_ValidFileSize, fp->fsize);
+		ST_DWORD(dirb + XDIR_ModTime, tm);			/* Update modified time */
+		ST_DWORD(dirb + XDIR_AccTime, tm);
+		dirb[XDIR_ModTime10] = 0;
+		res = store_xdir(&dj);
+	}
+	return res;
 }
-#endif
+#endif /* !_FS_READONLY */
+#endif /* _FS_EXFAT */
 
 
 
@@ -1462,13 +3378,95 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	FRESULT res;
 	BYTE c, *dir;
 #if _USE_LFN
-	BYTE a, ord, sum;
+	BYTE a, ord, sum, lv, mt = 0;
+	UINT nf = 0;
+#if _LFN_HASH
+	FATFS *fs = dp->fs;
+	int rec = 0;
+	WORD nh, hv = 0;
+	BYTE ss;
+	UINT i;
+#endif
+#if !_FS_READONLY
+	BYTE ns[NS_TRY][11];
+	UINT k, nu = 0, ck = 0;
+#endif
 #endif
 
+#if _USE_LFN && !_FS_READONLY
+	dp->nseq = 0;
+#endif
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
 
+#if _FS_EXFAT
+	if (dp->fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		WORD hash = xname_sum(dp->lfn);	/* Hash value of the name to find */
+
+		do {
+			res = move_window(dp->fs, dp->sect);
+			if (res != FR_OK) break;
+			c = dp->dir[XDIR_Type];
+			if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+			if (c == 0x85) {			/* Top of an entry set */
+				dp->lfn_idx = dp->index;
+				res = load_xdir(dp);	/* Load the entry set into dirbuf[] */
+				if (res != FR_OK) break;
+				if (LD_WORD(dp->fs->dirbuf + XDIR_NameHash) == hash && cmp_xname(dp->fs->dirbuf, dp->lfn)) break;	/* Name matched? */
+			}
+			res = dir_next(dp, 0);		/* Next entry */
+		} while (res == FR_OK);
+		return res;
+	}
+#endif
 #if _USE_LFN
+	if (dp->lfn) {
+		while (dp->lfn[nf]) nf++;
+		nf = (nf + 12) / 13;		/* Number of LFN entries of the name to find */
+	}
+#if !_FS_READONLY
+	if (dp->lfn && (dp->fn[NSFLAG] & (NS_LOSS | NS_LAST)) == (NS_LOSS | NS_LAST)) {	/* The name may be created with a numbered SFN */
+		for (k = 0; k < NS_TRY; k++) gen_numname(ns[k], dp->fn, dp->lfn, k + 1);
+		ck = 1;		/* Check the numbered SFNs for collision while scanning the directory */
+	}
+#endif
+#if _LFN_HASH
+	if (dp->lfn && (dp->fn[NSFLAG] & NS_LAST)) {	/* Look up the name hash cache first (only for the last segment of the path) */
+		if (fs->hc_clust != dp->sclust) {	/* Cache the names in this directory instead */
+			fs->hc_clust = dp->sclust;
+			fs->hc_n = 0; fs->hc_next = 0; fs->hc_eot = 0;
+		}
+		nh = hash_name(dp->lfn);
+		ss = sum_sfn(dp->fn);
+		for (i = 0; i < fs->hc_n; i++) {	/* Check the objects whose LFN hash or SFN checksum matches */
+			if ((fs->hc[i].nlfn == nf && fs->hc[i].hash == nh) || (!(dp->fn[NSFLAG] & NS_LOSS) && fs->hc[i].sum == ss)) {
+				res = hc_match(dp, &fs->hc[i], fs->hc[i].nlfn == nf && fs->hc[i].hash == nh);
+				if (res != FR_NO_FILE) return res;	/* Found or error */
+			}
+		}
+#if !_FS_READONLY
+		if (ck) {	/* Numbered SFNs whose checksum is in the cache may collide */
+			for (k = 0; k < NS_TRY; k++) {
+				ss = sum_sfn(ns[k]);
+				for (i = 0; i < fs->hc_n && fs->hc[i].sum != ss; i++) ;
+				if (i < fs->hc_n) nu |= 1 << k;
+			}
+			if (fs->hc_eot) dp->nseq = free_seq(nu);
+		}
+#endif
+		if (fs->hc_eot) return FR_NO_FILE;	/* All names in the directory are in the cache */
+		res = dir_sdi(dp, fs->hc_next ? fs->hc_next - 1 : 0);	/* Search the rest of the directory and cache the names in it */
+		if (res == FR_OK && fs->hc_next) res = dir_next(dp, 0);	/* (hc_next can be end of the table) */
+		if (res != FR_OK) {
+			if (res == FR_NO_FILE) fs->hc_eot = 1;
+#if !_FS_READONLY
+			if (ck && res == FR_NO_FILE) dp->nseq = free_seq(nu);
+#endif
+			return res;
+		}
+		rec = 1;
+	}
+#endif
 	ord = sum = 0xFF; dp->lfn_idx = 0xFFFF;	/* Reset LFN sequence */
 #endif
 	do {
@@ -1488,13 +3486,38 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 						sum = dir[LDIR_Chksum];
 						c &= ~LLEF; ord = c;	/* LFN start order */
 						dp->lfn_idx = dp->index;	/* Start index of LFN */
+						mt = (c == nf);	/* Compare it only if it has the same number of entries */
+#if _LFN_HASH
+						hv = 0;
+#endif
+					}
+					if (c == ord && sum == dir[LDIR_Chksum]) {	/* Check validity of the LFN entry */
+#if _LFN_HASH
+						if (rec) hv = hash_lfn(hv, dir);
+#endif
+						if (mt) mt = cmp_lfn(dp->lfn, dir);	/* Compare it with given name */
+						ord--;
+					} else {
+						ord = 0xFF;
 					}
-					/* Check validity of the LFN entry and compare it with given name */
-					ord = (c == ord && sum == dir[LDIR_Chksum] && cmp_lfn(dp->lfn, dir)) ? ord - 1 : 0xFF;
 				}
 			} else {					/* An SFN entry is found */
-				if (!ord && sum == sum_sfn(dir)) break;	/* LFN matched? */
+				lv = (!ord && sum == sum_sfn(dir));	/* Is the LFN tied to the SFN? */
+#if _LFN_HASH
+				if (rec) {				/* Record the object in the cache */
+					rec = hc_put(fs, dp->index, lv ? dp->index - dp->lfn_idx : 0, lv ? hv : 0, sum_sfn(dir));
+					if (rec) fs->hc_next = (WORD)(dp->index + 1);
+				}
+#endif
+				if (lv && mt) break;	/* LFN matched? */
 				if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dir, dp->fn, 11)) break;	/* SFN matched? */
+#if !_FS_READONLY
+				if (ck) {				/* Is it one of the numbered SFNs? */
+					for (k = 0; k < NS_TRY; k++) {
+						if (!mem_cmp(dir, ns[k], 11)) nu |= 1 << k;
+					}
+				}
+#endif
 				ord = 0xFF; dp->lfn_idx = 0xFFFF;	/* Reset LFN sequence */
 			}
 		}
@@ -1505,6 +3528,15 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 		res = dir_next(dp, 0);		/* Next entry */
 	} while (res == FR_OK);
 
+#if _USE_LFN && _LFN_HASH
+	if (rec && res == FR_NO_FILE) {	/* All names in the directory have been cached */
+		fs->hc_eot = 1;
+		fs->hc_next = (WORD)(dp->index + (dp->dir[DIR_Name] ? 1 : 0));
+	}
+#endif
+#if _USE_LFN && !_FS_READONLY
+	if (ck && res == FR_NO_FILE) dp->nseq = free_seq(nu);	/* All SFNs in the directory have been checked */
+#endif
 	return res;
 }
 
@@ -1514,7 +3546,7 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 /*-----------------------------------------------------------------------*/
 /* Read an object from the directory                                     */
 /*-----------------------------------------------------------------------*/
-#if _FS_MINIMIZE <= 1 || _USE_LABEL || _FS_RPATH >= 2
+#if _FS_MINIMIZE <= 1 || _USE_LABEL || _FS_RPATH >= 2 || _FS_EXFAT
 static
 FRESULT dir_read (
 	DIR* dp,		/* Pointer to the directory object */
@@ -1535,6 +3567,17 @@ FRESULT dir_read (
 		c = dir[DIR_Name];
 		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
 		a = dir[DIR_Attr] & AM_MASK;
+#if _FS_EXFAT
+		if (dp->fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, find a volume label entry or top of an entry set */
+			if (c == (vol ? 0x83 : 0x85)) {
+				if (c == 0x85) {
+					dp->lfn_idx = dp->index;
+					res = load_xdir(dp);	/* Load the entry set into dirbuf[] */
+				}
+				break;
+			}
+		} else
+#endif
 #if _USE_LFN	/* LFN configuration */
 		if (c == DDEM || (!_FS_RPATH && c == '.') || (int)((a & ~AM_ARC) == AM_VOL) != vol) {	/* An entry without valid data */
 			ord = 0xFF;
@@ -1565,7 +3608,7 @@ FRESULT dir_read (
 
 	return res;
 }
-#endif	/* _FS_MINIMIZE <= 1 || _USE_LABEL || _FS_RPATH >= 2 */
+#endif	/* _FS_MINIMIZE <= 1 || _USE_LABEL || _FS_RPATH >= 2 || _FS_EXFAT */
 
 
 
@@ -1586,6 +3629,22 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 	WCHAR *lfn;
 
 
+#if _FS_EXFAT
+	if (dp->fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		for (n = 0; dp->lfn[n]; n++) ;
+		nent = (n + 14) / 15 + 2;		/* Number of entries to allocate (85, C0 and C1s) */
+		res = dir_alloc(dp, nent);		/* Allocate entries */
+		if (res != FR_OK) return res;
+		dp->lfn_idx = (WORD)(dp->index - (nent - 1));	/* Top of the entry set */
+		if (dp->sclust && (dp->stat & XS_GROWN)) {	/* Update the size of the sub-directory if it has been stretched */
+			res = grow_xdir(dp);
+			if (res != FR_OK) return res;
+		}
+		create_xdir(dp->fs->dirbuf, dp->lfn);	/* Create the entry set in dirbuf[] (it is stored by the caller) */
+		return FR_OK;
+	}
+#endif
+
 	fn = dp->fn; lfn = dp->lfn;
 	mem_cpy(sn, fn, 12);
 
@@ -1594,13 +3653,19 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 
 	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
 		fn[NSFLAG] = 0; dp->lfn = 0;			/* Find only SFN */
-		for (n = 1; n < 100; n++) {
-			gen_numname(fn, sn, lfn, n);	/* Generate a numbered name */
-			res = dir_find(dp);				/* Check if the name collides with existing SFN */
-			if (res != FR_OK) break;
+		n = dp->nseq;						/* Sequence number found not collided by dir_find() (0:unknown) */
+		if (n && n <= NS_TRY) {
+			gen_numname(fn, sn, lfn, n);	/* Generate the numbered name without searching it again */
+		} else {
+			if (!n) n = 1;
+			do {
+				gen_numname(fn, sn, lfn, n);	/* Generate a numbered name */
+				res = dir_find(dp);				/* Check if the name collides with existing SFN */
+				if (res != FR_OK) break;
+			} while (++n < 100);
+			if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
+			if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
 		}
-		if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
-		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
 		fn[NSFLAG] = sn[NSFLAG]; dp->lfn = lfn;
 	}
 
@@ -1636,6 +3701,9 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 			mem_cpy(dp->dir, dp->fn, 11);	/* Put SFN */
 #if _USE_LFN
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
+#if _LFN_HASH
+			hc_update(dp, 1);	/* Add it to the name hash cache */
+#endif
 #endif
 			dp->fs->wflag = 1;
 		}
@@ -1667,10 +3735,25 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		do {
 			res = move_window(dp->fs, dp->sect);
 			if (res != FR_OK) break;
-			mem_set(dp->dir, 0, SZ_DIRE);	/* Clear and mark the entry "deleted" */
-			*dp->dir = DDEM;
+#if _FS_EXFAT
+			if (dp->fs->fs_type == FS_EXFAT) {
+				dp->dir[XDIR_Type] &= 0x7F;		/* Clear the in-use bit of the entry */
+			} else
+#endif
+			{
+				mem_set(dp->dir, 0, SZ_DIRE);	/* Clear and mark the entry "deleted" */
+				*dp->dir = DDEM;
+			}
 			dp->fs->wflag = 1;
-			if (dp->index >= i) break;	/* When reached SFN, all entries of the object has been deleted. */
+			if (dp->index >= i) {		/* When reached SFN, all entries of the object has been deleted. */
+#if _LFN_HASH
+				if (dp->fs->fs_type != FS_EXFAT) hc_update(dp, 0);	/* Remove it from the name hash cache */
+#endif
+#if _FS_DIRHINT
+				dh_free(dp->fs, dp->sclust, (dp->lfn_idx == 0xFFFF) ? i : dp->lfn_idx);	/* The entries can be allocated again */
+#endif
+				break;
+			}
 			res = dir_next(dp, 0);		/* Next entry */
 		} while (res == FR_OK);
 		if (res == FR_NO_FILE) res = FR_INT_ERR;
@@ -1684,6 +3767,9 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 			mem_set(dp->dir, 0, SZ_DIRE);	/* Clear and mark the entry "deleted" */
 			*dp->dir = DDEM;
 			dp->fs->wflag = 1;
+#if _FS_DIRHINT
+			dh_free(dp->fs, dp->sclust, dp->index);	/* The entry can be allocated again */
+#endif
 		}
 	}
 #endif
@@ -1713,6 +3799,29 @@ void get_fileinfo (		/* No return code */
 #endif
 
 	p = fno->fname;
+#if _FS_EXFAT
+	if (dp->sect && dp->fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, get the information from the entry set */
+		dir = dp->fs->dirbuf;
+		lfn = dp->lfn;
+		get_xname(dir, lfn);			/* The name is given as LFN */
+		for (i = 0; lfn[i] && i < 12; i++) {	/* Put it as SFN too if it fits */
+#if !_LFN_UNICODE
+			w = ff_convert(lfn[i], 0);	/* Unicode -> OEM */
+			if (!w || w >= 0x100) break;
+#else
+			w = lfn[i];
+#endif
+			*p++ = (TCHAR)w;
+		}
+		if (lfn[i]) {					/* No SFN is available */
+			p = fno->fname; *p++ = '?';
+		}
+		fno->fattrib = dir[XDIR_Attr];	/* Attribute */
+		fno->fsize = (dir[XDIR_Attr] & AM_DIR) ? 0 : LD_QWORD(dir + XDIR_FileSize);	/* Size */
+		fno->fdate = LD_WORD(dir + XDIR_ModTime + 2);	/* Date */
+		fno->ftime = LD_WORD(dir + XDIR_ModTime);		/* Time */
+	} else
+#endif
 	if (dp->sect) {		/* Get SFN */
 		dir = dp->dir;
 		i = 0;
@@ -1765,6 +3874,92 @@ void get_fileinfo (		/* No return code */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Get directory item from directory entry                               */
+/*-----------------------------------------------------------------------*/
+#if _USE_DIRPLUS && _FS_MINIMIZE <= 1
+static
+void get_diritem (		/* No return code */
+	DIR* dp,			/* Pointer to the directory object */
+	DIRITEM* dip	 	/* Pointer to the directory item to be filled */
+)
+{
+	UINT i = 0;
+	TCHAR *p, c;
+	BYTE *dir;
+#if _USE_LFN
+	WCHAR w, *lfn;
+#endif
+
+
+	p = dip->fname;
+#if _FS_EXFAT
+	if (dp->fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, get the information from the entry set */
+		dir = dp->fs->dirbuf;
+		get_xname(dir, dp->lfn);		/* The name is given as LFN */
+		dip->fattrib = dir[XDIR_Attr];
+		dip->fsize = (dir[XDIR_Attr] & AM_DIR) ? 0 : LD_QWORD(dir + XDIR_FileSize);
+		dip->sclust = LD_DWORD(dir + XDIR_FstClus);
+		dip->fstat = dir[XDIR_GenFlags] & XS_NOFAT;
+	} else
+#endif
+	{
+		dir = dp->dir;
+		dip->fattrib = dir[DIR_Attr];
+		dip->fstat = 0;
+		dip->fsize = LD_DWORD(dir + DIR_FileSize);
+		dip->sclust = ld_clust(dp->fs, dir);
+	}
+
+#if _USE_LFN
+	if (dp->lfn_idx != 0xFFFF) {		/* Put the LFN if it fits in the name field */
+		lfn = dp->lfn;
+		while ((w = *lfn++) != 0) {
+#if !_LFN_UNICODE
+			w = ff_convert(w, 0);		/* Unicode -> OEM */
+			if (!w) { i = 0; break; }	/* No LFN if it could not be converted */
+			if (_DF1S && w >= 0x100)	/* Put 1st byte if it is a DBC (always false on SBCS cfg) */
+				p[i++] = (TCHAR)(w >> 8);
+#endif
+			if (i >= _USE_DIRPLUS - 1) { i = 0; break; }	/* No LFN if it does not fit */
+			p[i++] = (TCHAR)w;
+		}
+	}
+	if (i) {
+		p[i] = 0;
+		return;
+	}
+#if _FS_EXFAT
+	if (dp->fs->fs_type == FS_EXFAT) {	/* There is no SFN on the exFAT volume */
+		p[0] = '?'; p[1] = 0;
+		return;
+	}
+#endif
+#endif
+	while (i < 11) {		/* Copy name body and extension of the SFN */
+		c = (TCHAR)dir[i++];
+		if (c == ' ') continue;				/* Skip padding spaces */
+		if (c == RDDEM) c = (TCHAR)DDEM;	/* Restore replaced DDEM character */
+		if (i == 9) *p++ = '.';				/* Insert a . if extension is exist */
+#if _USE_LFN
+		if (IsUpper(c) && (dir[DIR_NTres] & (i >= 9 ? NS_EXT : NS_BODY)))
+			c += 0x20;			/* To lower */
+#if _LFN_UNICODE
+		if (IsDBCS1(c) && i != 8 && i != 11 && IsDBCS2(dir[i]))
+			c = c << 8 | dir[i++];
+		c = ff_convert(c, 1);	/* OEM -> Unicode */
+		if (!c) c = '?';
+#endif
+#endif
+		*p++ = c;
+	}
+	*p = 0;
+}
+#endif /* _USE_DIRPLUS && _FS_MINIMIZE <= 1 */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Pattern matching                                                      */
 /*-----------------------------------------------------------------------*/
@@ -2056,6 +4251,10 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 {
 	FRESULT res;
 	BYTE *dir, ns;
+#if _FS_DCACHE
+	const TCHAR *seg;
+	DWORD pcl;
+#endif
 
 
 #if _FS_RPATH
@@ -2069,12 +4268,19 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		path++;
 	dp->sclust = 0;							/* Always start from the root directory */
 #endif
+#if _FS_EXFAT
+	dp->stat = 0;							/* (Root directory is recorded in the FAT) */
+#endif
 
 	if ((UINT)*path < ' ') {				/* Null path name is the origin directory itself */
 		res = dir_sdi(dp, 0);
 		dp->dir = 0;
 	} else {								/* Follow path */
 		for (;;) {
+#if _FS_DCACHE
+			if (dc_find(dp, &path)) continue;	/* The sub-directory is in the path cache */
+			seg = path;
+#endif
 			res = create_name(dp, &path);	/* Get a segment name of the path */
 			if (res != FR_OK) break;
 			res = dir_find(dp);				/* Find an object with the sagment name */
@@ -2093,10 +4299,21 @@ FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 			}
 			if (ns & NS_LAST) break;			/* Last segment matched. Function completed. */
 			dir = dp->dir;						/* Follow the sub-directory */
-			if (!(dir[DIR_Attr] & AM_DIR)) {	/* It is not a sub-directory and cannot follow */
+			if (!(OBJ_ATTR(dp) & AM_DIR)) {		/* It is not a sub-directory and cannot follow */
 				res = FR_NO_PATH; break;
 			}
+#if _FS_DCACHE
+			pcl = dp->sclust;
+#endif
+#if _FS_EXFAT
+			if (dp->fs->fs_type == FS_EXFAT)
+				enter_xdir(dp);
+			else
+#endif
 			dp->sclust = ld_clust(dp->fs, dir);
+#if _FS_DCACHE
+			dc_put(dp, pcl, seg, path);		/* Record the sub-directory */
+#endif
 		}
 	}
 
@@ -2167,30 +4384,127 @@ int get_ldnumber (		/* Returns logical drive number (-1:invalid drive) */
 
 
 
-/*-----------------------------------------------------------------------*/
-/* Load a sector and check if it is an FAT boot sector                   */
-/*-----------------------------------------------------------------------*/
+/*-----------------------------------------------------------------------*/
+/* Load a sector and check if it is an FAT boot sector                   */
+/*-----------------------------------------------------------------------*/
+
+static
+BYTE check_fs (	/* 0:Valid FAT-BS, 1:Valid BS but not FAT, 2:Not a BS, 3:Disk error, 4:Valid exFAT-BS */
+	FATFS* fs,	/* File system object */
+	DWORD sect	/* Sector# (lba) to check if it is an FAT boot record or not */
+)
+{
+	fs->wflag = 0; fs->winsect = 0xFFFFFFFF;	/* Invaidate window */
+	if (move_window(fs, sect) != FR_OK)			/* Load boot record */
+		return 3;
+
+	if (LD_WORD(&fs->win[BS_55AA]) != 0xAA55)	/* Check boot record signature (always placed at offset 510 even if the sector size is >512) */
+		return 2;
+
+#if _FS_EXFAT
+	if (!mem_cmp(&fs->win[BS_OEMName], "EXFAT   ", 8))	/* Check "EXFAT" string */
+		return 4;
+#endif
+	if ((LD_DWORD(&fs->win[BS_FilSysType]) & 0xFFFFFF) == 0x544146)		/* Check "FAT" string */
+		return 0;
+	if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)	/* Check "FAT" string */
+		return 0;
+
+	return 1;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* exFAT handling - Initialize the file system object for exFAT volume   */
+/*-----------------------------------------------------------------------*/
+#if _FS_EXFAT
+static
+FRESULT mount_xvol (	/* FR_OK(0): successful, !=0: any error occurred */
+	FATFS* fs,		/* File system object with the boot sector in the win[] */
+	DWORD bsect		/* Volume start sector */
+)
+{
+	QWORD maxlba;
+	DWORD nclst, sect;
+	UINT i;
+#if _FS_JOURNAL || _FS_ALLOCSUM
+	FRESULT res;
+	DWORD vsn;
+#endif
+
+
+	for (i = BPB_ZeroedEx; i < BPB_ZeroedEx + 53 && !fs->win[i]; i++) ;	/* (The legacy BPB area must be zero) */
+	if (i < BPB_ZeroedEx + 53) return FR_NO_FILESYSTEM;
+
+	if (LD_WORD(fs->win + BPB_FSVerEx) != 0x100)		/* (File system revision must be 1.0) */
+		return FR_NO_FILESYSTEM;
+
+	if (fs->win[BPB_BytsPerSecEx] > 12 || 1U << fs->win[BPB_BytsPerSecEx] != SS(fs))	/* (Sector size must be equal to the physical sector size) */
+		return FR_NO_FILESYSTEM;
+
+	maxlba = LD_QWORD(fs->win + BPB_TotSecEx) + bsect;	/* Last LBA + 1 of the volume */
+	if (maxlba >= 0x100000000ULL) return FR_NO_FILESYSTEM;	/* (It cannot be accessed in 32-bit LBA) */
+
+	fs->fsize = LD_DWORD(fs->win + BPB_FatSzEx);		/* Number of sectors per FAT */
+	fs->n_fats = fs->win[BPB_NumFATsEx];				/* Number of FATs */
+	if (fs->n_fats != 1) return FR_NO_FILESYSTEM;		/* (Supports only one FAT) */
+
+	if (fs->win[BPB_SecPerClusEx] > 15) return FR_NO_FILESYSTEM;	/* (Cluster size must fit in csize) */
+	fs->csize = (WORD)(1 << fs->win[BPB_SecPerClusEx]);	/* Number of sectors per cluster */
+
+	nclst = LD_DWORD(fs->win + BPB_NumClusEx);			/* Number of clusters */
+	if (!nclst || nclst > MAX_EXFAT) return FR_NO_FILESYSTEM;
+	fs->n_fatent = nclst + 2;
+	if ((QWORD)fs->fsize * SS(fs) < (QWORD)fs->n_fatent * 4)	/* (BPB_FatSzEx must not be less than the size needed) */
+		return FR_NO_FILESYSTEM;
 
-static
-BYTE check_fs (	/* 0:Valid FAT-BS, 1:Valid BS but not FAT, 2:Not a BS, 3:Disk error */
-	FATFS* fs,	/* File system object */
-	DWORD sect	/* Sector# (lba) to check if it is an FAT boot record or not */
-)
-{
-	fs->wflag = 0; fs->winsect = 0xFFFFFFFF;	/* Invaidate window */
-	if (move_window(fs, sect) != FR_OK)			/* Load boot record */
-		return 3;
+	/* Boundaries and Limits */
+	fs->volbase = bsect;
+	fs->fatbase = bsect + LD_DWORD(fs->win + BPB_FatOfsEx);
+	fs->database = bsect + LD_DWORD(fs->win + BPB_DataOfsEx);
+	if (maxlba < (QWORD)fs->database + (QWORD)nclst * fs->csize)	/* (Volume size must not be less than the size needed) */
+		return FR_NO_FILESYSTEM;
+#if _FS_JOURNAL || _FS_ALLOCSUM
+	vsn = LD_DWORD(fs->win + BPB_VolIDEx);
+#endif
+#if _FS_JOURNAL
+	res = jnl_mount(fs, vsn, 24);		/* Find the journal past the main and backup boot regions */
+	if (res != FR_OK) return res;
+#endif
+	fs->dirbase = LD_DWORD(fs->win + BPB_RootClusEx);	/* Root directory start cluster */
+	fs->n_rootdir = 0;
 
-	if (LD_WORD(&fs->win[BS_55AA]) != 0xAA55)	/* Check boot record signature (always placed at offset 510 even if the sector size is >512) */
-		return 2;
+	/* Find the allocation bitmap entry in the top of the root directory */
+	sect = clust2sect(fs, fs->dirbase);
+	if (!sect) return FR_NO_FILESYSTEM;
+	if (move_window(fs, sect) != FR_OK) return FR_DISK_ERR;
+	for (i = 0; i < SS(fs) && fs->win[i + XDIR_Type] != 0x81; i += SZ_DIRE) ;
+	if (i == SS(fs)) return FR_NO_FILESYSTEM;
+	fs->bitbase = clust2sect(fs, LD_DWORD(fs->win + i + XDIR_FstClusBm));	/* Bitmap start sector */
+	if (!fs->bitbase) return FR_NO_FILESYSTEM;
 
-	if ((LD_DWORD(&fs->win[BS_FilSysType]) & 0xFFFFFF) == 0x544146)		/* Check "FAT" string */
-		return 0;
-	if ((LD_DWORD(&fs->win[BS_FilSysType32]) & 0xFFFFFF) == 0x544146)	/* Check "FAT" string */
-		return 0;
+#if !_FS_READONLY
+	fs->last_clust = fs->free_clust = fs->frun_max = 0xFFFFFFFF;	/* Initialize cluster allocation information */
+	fs->fsi_flag = 0x80;								/* (There is no FSINFO) */
+#endif
+#if _FS_ALLOCSUM
+	res = as_mount(fs, FS_EXFAT, vsn, 24);				/* (The summary is not used on exFAT) */
+	if (res != FR_OK) return res;
+#endif
+	fs->fs_type = FS_EXFAT;
+	fs->id = ++Fsid;	/* File system mount ID */
+#if _FS_STATS
+	mem_set(&fs->st, 0, sizeof fs->st);	/* Clear statistics counters */
+#endif
+#if _FS_LOCK			/* Clear file lock semaphores */
+	clear_lock(fs);
+#endif
 
-	return 1;
+	return FR_OK;
 }
+#endif /* _FS_EXFAT */
 
 
 
@@ -2213,6 +4527,11 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	WORD nrsv;
 	FATFS *fs;
 	UINT i;
+#if _FS_JOURNAL || _FS_ALLOCSUM
+	FRESULT res;
+	DWORD vsn;
+	UINT nbs;
+#endif
 
 
 	/* Get logical drive number from the path name */
@@ -2240,6 +4559,15 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	/* Following code attempts to mount the volume. (analyze BPB and initialize the fs object) */
 
 	fs->fs_type = 0;					/* Clear the file system object */
+#if _FS_DIRHINT && !_FS_READONLY
+	dh_forget(fs, 0xFFFFFFFF);			/* Clear free entry hints */
+#endif
+#if _FS_DCACHE
+	dc_drop(fs, 0xFFFFFFFF, 0);			/* Clear path cache */
+#endif
+#if _FS_JOURNAL
+	fs->jbase = 0; fs->jcnt = 0;		/* Discard the journal buffer */
+#endif
 	fs->drv = LD2PD(vol);				/* Bind the logical drive and a physical drive */
 	stat = disk_initialize(fs->drv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT)				/* Check if the initialization succeeded */
@@ -2253,7 +4581,7 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	/* Find an FAT partition on the drive. Supports only generic partitioning, FDISK and SFD. */
 	bsect = 0;
 	fmt = check_fs(fs, bsect);					/* Load sector 0 and check if it is an FAT boot sector as SFD */
-	if (fmt == 1 || (!fmt && (LD2PT(vol)))) {	/* Not an FAT boot sector or forced partition number */
+	if (fmt == 1 || ((!fmt || fmt == 4) && (LD2PT(vol)))) {	/* Not an FAT boot sector or forced partition number */
 		for (i = 0; i < 4; i++) {			/* Get partition offset */
 			pt = fs->win + MBR_Table + i * SZ_PTE;
 			br[i] = pt[4] ? LD_DWORD(&pt[8]) : 0;
@@ -2263,9 +4591,12 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 		do {								/* Find an FAT volume */
 			bsect = br[i];
 			fmt = bsect ? check_fs(fs, bsect) : 2;	/* Check the partition */
-		} while (!LD2PT(vol) && fmt && ++i < 4);
+		} while (!LD2PT(vol) && fmt && fmt != 4 && ++i < 4);
 	}
 	if (fmt == 3) return FR_DISK_ERR;		/* An error occured in the disk I/O layer */
+#if _FS_EXFAT
+	if (fmt == 4) return mount_xvol(fs, bsect);	/* An exFAT volume is found */
+#endif
 	if (fmt) return FR_NO_FILESYSTEM;		/* No FAT volume is found */
 
 	/* An FAT volume is found. Following code initializes the file system object */
@@ -2323,9 +4654,19 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	if (fs->fsize < (szbfat + (SS(fs) - 1)) / SS(fs))	/* (BPB_FATSz must not be less than the size needed) */
 		return FR_NO_FILESYSTEM;
 
+#if _FS_JOURNAL || _FS_ALLOCSUM
+	vsn = LD_DWORD(fs->win + (fmt == FS_FAT32 ? BS_VolID32 : BS_VolID));	/* Volume serial number */
+	nbs = (fmt == FS_FAT32) ? LD_WORD(fs->win + BPB_BkBootSec) + 3 : 1;	/* Sectors of the boot record and its backup at top of the reserved area */
+#endif
+#if _FS_JOURNAL
+	/* Find the journal and apply the record left if any */
+	res = jnl_mount(fs, vsn, nbs);
+	if (res != FR_OK) return res;
+#endif
+
 #if !_FS_READONLY
 	/* Initialize cluster allocation information */
-	fs->last_clust = fs->free_clust = 0xFFFFFFFF;
+	fs->last_clust = fs->free_clust = fs->frun_max = 0xFFFFFFFF;
 
 	/* Get fsinfo if available */
 	fs->fsi_flag = 0x80;
@@ -2348,9 +4689,20 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 		}
 	}
 #endif
+#if _FS_ALLOCSUM
+	/* Take the allocation summary if it was closed on unmount */
+	res = as_mount(fs, fmt, vsn, nbs);
+	if (res != FR_OK) return res;
+#endif
 #endif
 	fs->fs_type = fmt;	/* FAT sub-type */
 	fs->id = ++Fsid;	/* File system mount ID */
+#if _USE_LFN && _LFN_HASH
+	fs->hc_clust = 0xFFFFFFFF;	/* Clear name hash cache */
+#endif
+#if _FS_STATS
+	mem_set(&fs->st, 0, sizeof fs->st);	/* Clear statistics counters */
+#endif
 #if _FS_RPATH
 	fs->cdir = 0;		/* Set current directory to root */
 #endif
@@ -2385,6 +4737,42 @@ FRESULT validate (	/* FR_OK(0): The object is valid, !=0: Invalid */
 }
 
 
+#if _FS_REENTRANT == 2
+static
+FRESULT validate_fil (	/* FR_OK(0): The object is valid and locked, !=0: Invalid */
+	FIL* fp			/* Pointer to the file object to check validity */
+)
+{
+	FATFS *fs = fp ? __atomic_load_n(&fp->fs, __ATOMIC_RELAXED) : 0;	/* (f_close() may clear it meanwhile) */
+
+
+	if (!fs || !fs->fs_type || fs->id != fp->id || (disk_status(fs->drv) & STA_NOINIT))
+		return FR_INVALID_OBJECT;
+
+	ENTER_FIL(fp);		/* Lock file object */
+
+	return FR_OK;
+}
+
+
+static
+FRESULT validate_filfs (	/* FR_OK(0): The object is valid and locked with its volume, !=0: Invalid */
+	FIL* fp			/* Pointer to the file object to check validity */
+)
+{
+	FRESULT res;
+
+
+	res = validate_fil(fp);		/* Lock file object */
+	if (res == FR_OK && !lock_fs(fp->fs)) {	/* and then the file system */
+		unlock_fil(fp, FR_OK);
+		res = FR_TIMEOUT;
+	}
+	return res;
+}
+#endif
+
+
 
 
 /*--------------------------------------------------------------------------
@@ -2416,6 +4804,13 @@ FRESULT f_mount (
 	cfs = FatFs[vol];					/* Pointer to fs object */
 
 	if (cfs) {
+#if _FS_ALLOCSUM
+		if (cfs->fs_type) as_close(cfs);	/* Write the allocation summary */
+#endif
+#if _FS_JOURNAL
+		if (cfs->fs_type && cfs->jbase)	/* Checkpoint the journal (on failure it is applied on the next mount) */
+			jnl_flush(cfs);
+#endif
 #if _FS_LOCK
 		clear_lock(cfs);
 #endif
@@ -2459,6 +4854,13 @@ FRESULT f_open (
 #if !_FS_READONLY
 	DWORD dw, cl;
 #endif
+#if _FS_EXFAT
+	DWORD bcs;
+#if !_FS_READONLY
+	DWORD ncl;
+	BYTE st;
+#endif
+#endif
 
 
 	if (!fp) return FR_INVALID_OBJECT;
@@ -2498,7 +4900,7 @@ FRESULT f_open (
 				dir = dj.dir;					/* New entry */
 			}
 			else {								/* Any object is already existing */
-				if (dir[DIR_Attr] & (AM_RDO | AM_DIR)) {	/* Cannot overwrite it (R/O or DIR) */
+				if (OBJ_ATTR(&dj) & (AM_RDO | AM_DIR)) {	/* Cannot overwrite it (R/O or DIR) */
 					res = FR_DENIED;
 				} else {
 					if (mode & FA_CREATE_NEW)	/* Cannot create as new file */
@@ -2507,29 +4909,58 @@ FRESULT f_open (
 			}
 			if (res == FR_OK && (mode & FA_CREATE_ALWAYS)) {	/* Truncate it if overwrite mode */
 				dw = GET_FATTIME();
-				ST_DWORD(dir + DIR_CrtTime, dw);/* Set created time */
-				ST_DWORD(dir + DIR_WrtTime, dw);/* Set modified time */
-				dir[DIR_Attr] = 0;				/* Reset attribute */
-				ST_DWORD(dir + DIR_FileSize, 0);/* Reset file size */
-				cl = ld_clust(dj.fs, dir);		/* Get cluster chain */
-				st_clust(dir, 0);				/* Reset cluster */
-				dj.fs->wflag = 1;
-				if (cl) {						/* Remove the cluster chain if exist */
-					dw = dj.fs->winsect;
-					res = remove_chain(dj.fs, cl);
-					if (res == FR_OK) {
-						dj.fs->last_clust = cl - 1;	/* Reuse the cluster hole */
-						res = move_window(dj.fs, dw);
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, reset the entry set */
+					dir = dj.fs->dirbuf;
+					cl = LD_DWORD(dir + XDIR_FstClus);	/* Get cluster chain */
+					st = dir[XDIR_GenFlags];
+					bcs = (DWORD)dj.fs->csize * SS(dj.fs);
+					ncl = (DWORD)((LD_QWORD(dir + XDIR_FileSize) + bcs - 1) / bcs);
+					ST_DWORD(dir + XDIR_CrtTime, dw);	/* Set created time */
+					ST_DWORD(dir + XDIR_ModTime, dw);	/* Set modified time */
+					ST_DWORD(dir + XDIR_AccTime, dw);
+					dir[XDIR_CrtTime10] = dir[XDIR_ModTime10] = 0;
+					ST_WORD(dir + XDIR_Attr, 0);		/* Reset attribute */
+					dir[XDIR_GenFlags] = 1;				/* Reset cluster and file size */
+					ST_DWORD(dir + XDIR_FstClus, 0);
+					ST_QWORD(dir + XDIR_FileSize, 0);
+					ST_QWORD(dir + XDIR_ValidFileSize, 0);
+					res = store_xdir(&dj);
+					if (res == FR_OK && cl) {			/* Remove the cluster chain if exist */
+						if (st & XS_NOFAT)
+							res = remove_run(dj.fs, cl, ncl);
+						else
+							res = remove_chain(dj.fs, cl);
+						dj.fs->last_clust = cl - 1;		/* Reuse the cluster hole */
+					}
+					dir = dj.dir;
+				} else
+#endif
+				{
+					ST_DWORD(dir + DIR_CrtTime, dw);/* Set created time */
+					ST_DWORD(dir + DIR_WrtTime, dw);/* Set modified time */
+					dir[DIR_Attr] = 0;				/* Reset attribute */
+					ST_DWORD(dir + DIR_FileSize, 0);/* Reset file size */
+					cl = ld_clust(dj.fs, dir);		/* Get cluster chain */
+					st_clust(dir, 0);				/* Reset cluster */
+					dj.fs->wflag = 1;
+					if (cl) {						/* Remove the cluster chain if exist */
+						dw = dj.fs->winsect;
+						res = remove_chain(dj.fs, cl);
+						if (res == FR_OK) {
+							dj.fs->last_clust = cl - 1;	/* Reuse the cluster hole */
+							res = move_window(dj.fs, dw);
+						}
 					}
 				}
 			}
 		}
 		else {	/* Open an existing file */
 			if (res == FR_OK) {					/* Following succeeded */
-				if (dir[DIR_Attr] & AM_DIR) {	/* It is a directory */
+				if (OBJ_ATTR(&dj) & AM_DIR) {	/* It is a directory */
 					res = FR_NO_FILE;
 				} else {
-					if ((mode & FA_WRITE) && (dir[DIR_Attr] & AM_RDO)) /* R/O violation */
+					if ((mode & FA_WRITE) && (OBJ_ATTR(&dj) & AM_RDO)) /* R/O violation */
 						res = FR_DENIED;
 				}
 			}
@@ -2551,7 +4982,7 @@ FRESULT f_open (
 			if (!dir) {						/* Current directory itself */
 				res = FR_INVALID_NAME;
 			} else {
-				if (dir[DIR_Attr] & AM_DIR)	/* It is a directory */
+				if (OBJ_ATTR(&dj) & AM_DIR)	/* It is a directory */
 					res = FR_NO_FILE;
 			}
 		}
@@ -2561,12 +4992,49 @@ FRESULT f_open (
 		if (res == FR_OK) {
 			fp->flag = mode;					/* File access mode */
 			fp->err = 0;						/* Clear error flag */
-			fp->sclust = ld_clust(dj.fs, dir);	/* File start cluster */
-			fp->fsize = LD_DWORD(dir + DIR_FileSize);	/* File size */
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, get the object information from the entry set */
+				fp->sclust = LD_DWORD(dj.fs->dirbuf + XDIR_FstClus);	/* File start cluster */
+				fp->fsize = LD_QWORD(dj.fs->dirbuf + XDIR_FileSize);	/* File size */
+				fp->stat = dj.fs->dirbuf[XDIR_GenFlags] & XS_NOFAT;		/* Chain status */
+				bcs = (DWORD)dj.fs->csize * SS(dj.fs);
+				fp->n_cont = (DWORD)((fp->fsize + bcs - 1) / bcs);
+				fp->c_scl = dj.sclust;			/* Location of the entry set */
+				fp->c_stat = dj.stat & XS_NOFAT;
+				fp->c_ncont = dj.n_cont;
+				fp->c_idx = dj.lfn_idx;
+			} else
+#endif
+			{
+				fp->sclust = ld_clust(dj.fs, dir);	/* File start cluster */
+				fp->fsize = LD_DWORD(dir + DIR_FileSize);	/* File size */
+#if _FS_EXFAT
+				fp->stat = 0;
+#endif
+			}
+#if !_FS_READONLY
+			fp->vsize = fp->fsize;				/* Valid data extent */
+#endif
 			fp->fptr = 0;						/* File pointer */
 			fp->dsect = 0;
 #if _USE_FASTSEEK
 			fp->cltbl = 0;						/* Normal seek mode */
+#endif
+#if _FS_POOL
+			pool_free(fp);						/* No buffer until the first access */
+#endif
+#if _FS_PREFETCH
+			fp->pf_cnt = 0;						/* Empty read-ahead buffer */
+			fp->pf_next = 0;					/* Reading from the top is sequential */
+#endif
+#if _FS_REENTRANT == 2
+			fp->nuse = 0;						/* No callers of the file lock */
+			if (!ff_cre_syncobj(dj.fs->drv, &fp->sobj)) {	/* Create sync object for the file */
+#if _FS_LOCK
+				dec_lock(fp->lockid);
+#endif
+				LEAVE_FF(dj.fs, FR_INT_ERR);
+			}
 #endif
 			fp->fs = dj.fs;	 					/* Validate file object */
 			fp->id = fp->fs->id;
@@ -2591,26 +5059,27 @@ FRESULT f_read (
 )
 {
 	FRESULT res;
-	DWORD clst, sect, remain;
-	UINT rcnt, cc;
-	BYTE csect, *rbuff = (BYTE*)buff;
+	DWORD clst, sect;
+	FSIZE_t remain;
+	UINT rcnt, cc, csect;
+	BYTE *rbuff = (BYTE*)buff;
 
 
 	*br = 0;	/* Clear read byte counter */
 
-	res = validate(fp);							/* Check validity */
-	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	res = validate_fil(fp);							/* Check validity */
+	if (res != FR_OK) LEAVE_FIL(fp, res);
 	if (fp->err)								/* Check error */
-		LEAVE_FF(fp->fs, (FRESULT)fp->err);
+		LEAVE_FIL(fp, (FRESULT)fp->err);
 	if (!(fp->flag & FA_READ)) 					/* Check access mode */
-		LEAVE_FF(fp->fs, FR_DENIED);
+		LEAVE_FIL(fp, FR_DENIED);
 	remain = fp->fsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
 	for ( ;  btr;								/* Repeat until all data read */
 		rbuff += rcnt, fp->fptr += rcnt, *br += rcnt, btr -= rcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {		/* On the sector boundary? */
-			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+			csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 			if (!csect) {						/* On the cluster boundary? */
 				if (fp->fptr == 0) {			/* On the top of the file? */
 					clst = fp->sclust;			/* Follow from the origin */
@@ -2620,7 +5089,7 @@ FRESULT f_read (
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
-						clst = get_fat(fp->fs, fp->clust);	/* Follow cluster chain on the FAT */
+						clst = get_fat_fil(fp, fp->clust);	/* Follow cluster chain on the FAT */
 				}
 				if (clst < 2) ABORT(fp->fs, FR_INT_ERR);
 				if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
@@ -2631,8 +5100,7 @@ FRESULT f_read (
 			sect += csect;
 			cc = btr / SS(fp->fs);				/* When remaining bytes >= sector size, */
 			if (cc) {							/* Read maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - csect;
+				cc = contig_sect(fp, csect, cc);	/* Clip at end of the contiguous cluster run */
 				if (disk_read(fp->fs->drv, rbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if !_FS_READONLY && _FS_MINIMIZE <= 2			/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -2656,8 +5124,15 @@ FRESULT f_read (
 					fp->flag &= ~FA__DIRTY;
 				}
 #endif
+				BIND_BUF(fp, 0);
+#if _FS_PREFETCH
+				if (pf_load(fp, sect, csect) != FR_OK)	/* Fill sector cache with read-ahead */
+					ABORT(fp->fs, FR_DISK_ERR);
+#else
 				if (disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)	/* Fill sector cache */
 					ABORT(fp->fs, FR_DISK_ERR);
+#endif
+				STAT_INC(fp->fs, rd_fill);
 			}
 #endif
 			fp->dsect = sect;
@@ -2669,11 +5144,12 @@ FRESULT f_read (
 			ABORT(fp->fs, FR_DISK_ERR);
 		mem_cpy(rbuff, &fp->fs->win[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
 #else
+		BIND_BUF(fp, 1);
 		mem_cpy(rbuff, &fp->buf[fp->fptr % SS(fp->fs)], rcnt);	/* Pick partial sector */
 #endif
 	}
 
-	LEAVE_FF(fp->fs, FR_OK);
+	LEAVE_FIL(fp, FR_OK);
 }
 
 
@@ -2692,38 +5168,46 @@ FRESULT f_write (
 )
 {
 	FRESULT res;
-	DWORD clst, sect;
+	DWORD clst, sect, ncl;
 	UINT wcnt, cc;
 	const BYTE *wbuff = (const BYTE*)buff;
-	BYTE csect;
+	UINT csect;
 
 
 	*bw = 0;	/* Clear write byte counter */
 
-	res = validate(fp);						/* Check validity */
-	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	res = validate_fil(fp);						/* Check validity */
+	if (res != FR_OK) LEAVE_FIL(fp, res);
 	if (fp->err)							/* Check error */
-		LEAVE_FF(fp->fs, (FRESULT)fp->err);
+		LEAVE_FIL(fp, (FRESULT)fp->err);
 	if (!(fp->flag & FA_WRITE))				/* Check access mode */
-		LEAVE_FF(fp->fs, FR_DENIED);
+		LEAVE_FIL(fp, FR_DENIED);
+#if _FS_EXFAT
+	if (fp->fs->fs_type != FS_EXFAT && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) btw = 0;	/* File size cannot reach 4GB at FAT volume */
+#else
 	if (fp->fptr + btw < fp->fptr) btw = 0;	/* File size cannot reach 4GB */
+#endif
+#if _FS_PREFETCH
+	fp->pf_cnt = 0;							/* Discard read-ahead data */
+#endif
 
 	for ( ;  btw;							/* Repeat until all data written */
 		wbuff += wcnt, fp->fptr += wcnt, *bw += wcnt, btw -= wcnt) {
 		if ((fp->fptr % SS(fp->fs)) == 0) {	/* On the sector boundary? */
-			csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+			csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 			if (!csect) {					/* On the cluster boundary? */
+				ncl = (btw - 1) / ((DWORD)fp->fs->csize * SS(fp->fs)) + 1;	/* Number of clusters to be written in this call */
 				if (fp->fptr == 0) {		/* On the top of the file? */
 					clst = fp->sclust;		/* Follow from the origin */
 					if (clst == 0)			/* When no cluster is allocated, */
-						clst = create_chain(fp->fs, 0);	/* Create a new cluster chain */
+						clst = create_run_fil(fp, 0, ncl);	/* Create a new cluster chain */
 				} else {					/* Middle or end of the file */
 #if _USE_FASTSEEK
 					if (fp->cltbl)
 						clst = clmt_clust(fp, fp->fptr);	/* Get cluster# from the CLMT */
 					else
 #endif
-						clst = create_chain(fp->fs, fp->clust);	/* Follow or stretch cluster chain on the FAT */
+						clst = create_run_fil(fp, fp->clust, ncl);	/* Follow or stretch cluster chain on the FAT */
 				}
 				if (clst == 0) break;		/* Could not allocate a new cluster (disk full) */
 				if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
@@ -2746,8 +5230,7 @@ FRESULT f_write (
 			sect += csect;
 			cc = btw / SS(fp->fs);			/* When remaining bytes >= sector size, */
 			if (cc) {						/* Write maximum contiguous sectors directly */
-				if (csect + cc > fp->fs->csize)	/* Clip at cluster boundary */
-					cc = fp->fs->csize - csect;
+				cc = contig_sect(fp, csect, cc);	/* Clip at end of the contiguous cluster run */
 				if (disk_write(fp->fs->drv, wbuff, sect, cc) != RES_OK)
 					ABORT(fp->fs, FR_DISK_ERR);
 #if _FS_MINIMIZE <= 2
@@ -2758,6 +5241,7 @@ FRESULT f_write (
 				}
 #else
 				if (fp->dsect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
+					BIND_BUF(fp, 0);
 					mem_cpy(fp->buf, wbuff + ((fp->dsect - sect) * SS(fp->fs)), SS(fp->fs));
 					fp->flag &= ~FA__DIRTY;
 				}
@@ -2767,15 +5251,23 @@ FRESULT f_write (
 				continue;
 			}
 #if _FS_TINY
-			if (fp->fptr >= fp->fsize) {	/* Avoid silly cache filling at growing edge */
+			if (fp->fptr >= fp->vsize) {	/* Avoid silly cache filling at growing edge */
 				if (sync_window(fp->fs)) ABORT(fp->fs, FR_DISK_ERR);
+				mem_set(fp->fs->win, 0, SS(fp->fs));	/* Sector past the valid data extent is zero-filled instead of read */
 				fp->fs->winsect = sect;
+				STAT_INC(fp->fs, rd_skip);
 			}
 #else
 			if (fp->dsect != sect) {		/* Fill sector cache with file data */
-				if (fp->fptr < fp->fsize &&
-					disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
+				BIND_BUF(fp, 0);
+				if (fp->fptr < fp->vsize) {
+					if (disk_read(fp->fs->drv, fp->buf, sect, 1) != RES_OK)
 						ABORT(fp->fs, FR_DISK_ERR);
+					STAT_INC(fp->fs, rd_fill);
+				} else {					/* Sector past the valid data extent is zero-filled instead of read */
+					mem_set(fp->buf, 0, SS(fp->fs));
+					STAT_INC(fp->fs, rd_skip);
+				}
 			}
 #endif
 			fp->dsect = sect;
@@ -2788,15 +5280,17 @@ FRESULT f_write (
 		mem_cpy(&fp->fs->win[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
 		fp->fs->wflag = 1;
 #else
+		BIND_BUF(fp, 1);
 		mem_cpy(&fp->buf[fp->fptr % SS(fp->fs)], wbuff, wcnt);	/* Fit partial sector */
 		fp->flag |= FA__DIRTY;
 #endif
 	}
 
 	if (fp->fptr > fp->fsize) fp->fsize = fp->fptr;	/* Update file size if needed */
+	if (fp->fptr > fp->vsize) fp->vsize = fp->fptr;	/* Update valid data extent if needed */
 	fp->flag |= FA__WRITTEN;						/* Set file change flag */
 
-	LEAVE_FF(fp->fs, FR_OK);
+	LEAVE_FIL(fp, FR_OK);
 }
 
 
@@ -2806,26 +5300,35 @@ FRESULT f_write (
 /* Synchronize the File                                                  */
 /*-----------------------------------------------------------------------*/
 
-FRESULT f_sync (
+static
+FRESULT sync_fil (	/* Flush the file, it is locked with its volume */
 	FIL* fp		/* Pointer to the file object */
 )
 {
-	FRESULT res;
+	FRESULT res = FR_OK;
 	DWORD tm;
 	BYTE *dir;
 
 
-	res = validate(fp);					/* Check validity of the object */
-	if (res == FR_OK) {
-		if (fp->flag & FA__WRITTEN) {	/* Is there any change to the file? */
+	if (fp->flag & FA__WRITTEN) {	/* Is there any change to the file? */
 #if !_FS_TINY
-			if (fp->flag & FA__DIRTY) {	/* Write-back cached data if needed */
-				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
-					LEAVE_FF(fp->fs, FR_DISK_ERR);
-				fp->flag &= ~FA__DIRTY;
+		if (fp->flag & FA__DIRTY) {	/* Write-back cached data if needed */
+			if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+				return FR_DISK_ERR;
+			fp->flag &= ~FA__DIRTY;
+		}
+#endif
+		/* Update the directory entry */
+#if _FS_EXFAT
+		if (fp->fs->fs_type == FS_EXFAT) {
+			res = sync_xdir(fp, GET_FATTIME());
+			if (res == FR_OK) {
+				fp->flag &= ~FA__WRITTEN;
+				res = sync_fs(fp->fs);
 			}
+		} else
 #endif
-			/* Update the directory entry */
+		{
 			res = move_window(fp->fs, fp->dir_sect);
 			if (res == FR_OK) {
 				dir = fp->dir_ptr;
@@ -2841,8 +5344,136 @@ FRESULT f_sync (
 			}
 		}
 	}
+	return res;
+}
+
+
+FRESULT f_sync (
+	FIL* fp		/* Pointer to the file object */
+)
+{
+	FRESULT res;
+
+
+	res = validate_filfs(fp);					/* Check validity of the object */
+	if (res == FR_OK)
+		res = sync_fil(fp);
+
+	LEAVE_FILFS(fp, fp->fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Synchronize Multiple Files on a Volume at a Time                      */
+/*-----------------------------------------------------------------------*/
+
+static
+void sort_fil (	/* Sort file objects in ascending order of the data sector, directory sector or address */
+	FIL* fps[],		/* Array of pointers to the file objects */
+	UINT n,			/* Number of file objects */
+	int key			/* 0:Sort by data sector (dsect), 1:Sort by directory sector (dir_sect), 2:Sort by address */
+)
+{
+	UINT i, j;
+	FIL *fp;
+
+
+	for (i = 1; i < n; i++) {	/* Insertion sort (the number of files is small) */
+		fp = fps[i];
+		for (j = i; j > 0 && (key == 2 ? fps[j - 1] > fp : key ? fps[j - 1]->dir_sect > fp->dir_sect : fps[j - 1]->dsect > fp->dsect); j--)
+			fps[j] = fps[j - 1];
+		fps[j] = fp;
+	}
+}
+
+
+FRESULT f_syncall (
+	FIL* fps[],	/* Array of pointers to the file objects on a volume (reordered on return) */
+	UINT n		/* Number of file objects */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	FIL *fp;
+	DWORD tm;
+	BYTE *dir;
+	UINT i;
+
+
+	if (!n) return FR_OK;
+#if _FS_REENTRANT == 2
+	sort_fil(fps, n, 2);				/* Lock the file objects in ascending address order ahead of the volume */
+	for (i = 0; i < n; i++) {
+		if (i && fps[i] == fps[i - 1]) continue;	/* Same file object listed twice */
+		res = validate_fil(fps[i]);
+		if (res != FR_OK) {
+			while (i--) {
+				if (!i || fps[i] != fps[i - 1]) unlock_fil(fps[i], FR_OK);
+			}
+			return res;
+		}
+	}
+#endif
+	res = validate(fps[0]);				/* Check validity of the first object and lock the volume */
+	if (res == FR_OK) {
+		fs = fps[0]->fs;
+		for (i = 1; i < n && res == FR_OK; i++) {	/* All the files must be open on the same volume */
+			fp = fps[i];
+			if (!fp || fp->fs != fs || fp->id != fs->id) res = FR_INVALID_OBJECT;
+		}
 
-	LEAVE_FF(fp->fs, res);
+#if !_FS_TINY
+		if (res == FR_OK) sort_fil(fps, n, 0);	/* Write-back cached data in ascending sector order */
+		for (i = 0; i < n && res == FR_OK; i++) {
+			fp = fps[i];
+			if (fp->flag & FA__DIRTY) {
+				if (disk_write(fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
+					res = FR_DISK_ERR;
+				else
+					fp->flag &= ~FA__DIRTY;
+			}
+		}
+#endif
+
+		if (res == FR_OK) sort_fil(fps, n, 1);	/* Update the directory entries in ascending sector order, */
+		tm = GET_FATTIME();					/* so that each directory sector is written only once */
+		for (i = 0; i < n && res == FR_OK; i++) {
+			fp = fps[i];
+			if (!(fp->flag & FA__WRITTEN)) continue;
+#if _FS_EXFAT
+			if (fs->fs_type == FS_EXFAT) {			/* Update the entry set on the exFAT volume */
+				res = sync_xdir(fp, tm);
+				if (res == FR_OK) fp->flag &= ~FA__WRITTEN;
+				continue;
+			}
+#endif
+			res = move_window(fs, fp->dir_sect);
+			if (res == FR_OK) {
+				dir = fp->dir_ptr;
+				dir[DIR_Attr] |= AM_ARC;					/* Set archive bit */
+				ST_DWORD(dir + DIR_FileSize, fp->fsize);	/* Update file size */
+				st_clust(dir, fp->sclust);					/* Update start cluster */
+				ST_DWORD(dir + DIR_WrtTime, tm);			/* Update modified time */
+				ST_WORD(dir + DIR_LstAccDate, 0);
+				fp->flag &= ~FA__WRITTEN;
+				fs->wflag = 1;
+			}
+		}
+		if (res == FR_OK)
+			res = sync_fs(fs);				/* Flush the last directory sector, FSINFO and the drive at once */
+#if _FS_REENTRANT
+		unlock_fs(fs, FR_OK);				/* Unlock volume */
+#endif
+	}
+#if _FS_REENTRANT == 2
+	for (i = 0; i < n; i++) {			/* Unlock the file objects */
+		if (!i || fps[i] != fps[i - 1]) unlock_fil(fps[i], FR_OK);
+	}
+#endif
+
+	return res;
 }
 
 #endif /* !_FS_READONLY */
@@ -2861,25 +5492,39 @@ FRESULT f_close (
 	FRESULT res;
 
 
+	res = validate_filfs(fp);			/* Lock the file and the volume, so that the file is flushed and */
+	if (res == FR_OK) {					/* invalidated with nothing written in between */
+#if _FS_REENTRANT
+		FATFS *fs = fp->fs;
+#endif
 #if !_FS_READONLY
-	res = f_sync(fp);					/* Flush cached data */
-	if (res == FR_OK)
+		res = sync_fil(fp);				/* Flush cached data */
+		if (res == FR_OK)
 #endif
-	{
-		res = validate(fp);				/* Lock volume */
-		if (res == FR_OK) {
-#if _FS_REENTRANT
-			FATFS *fs = fp->fs;
+		{
+#if _FS_POOL
+			pool_free(fp);				/* Return the sector buffer to the pool */
 #endif
 #if _FS_LOCK
 			res = dec_lock(fp->lockid);	/* Decrement file open counter */
 			if (res == FR_OK)
 #endif
+#if _FS_REENTRANT == 2
+			{
+				__atomic_store_n(&fp->fs, (FATFS*)0, __ATOMIC_RELAXED);	/* Invalidate file object, the callers */
+				__atomic_fetch_or(&fp->nuse, FIL_CLOSED, __ATOMIC_RELAXED);	/* waiting on it get FR_INVALID_OBJECT */
+			}
+#else
 				fp->fs = 0;				/* Invalidate file object */
-#if _FS_REENTRANT
-			unlock_fs(fs, FR_OK);		/* Unlock volume */
 #endif
 		}
+#if _FS_REENTRANT
+		unlock_fs(fs, FR_OK);			/* Unlock volume */
+#endif
+#if _FS_REENTRANT == 2
+		ff_rel_grant(fp->sobj);			/* Unlock the file, its sync object is discarded by the last caller out */
+		if (!unuse_fil(fp) && res == FR_OK) res = FR_INT_ERR;
+#endif
 	}
 	return res;
 }
@@ -2887,6 +5532,36 @@ FRESULT f_close (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Pin/Unpin the Sector Buffer of the File                               */
+/*-----------------------------------------------------------------------*/
+#if _FS_POOL
+FRESULT f_pin (
+	FIL* fp,	/* Pointer to the file object */
+	BYTE pin	/* 1:Keep the buffer bound to the file, 0:Allow to reclaim the buffer */
+)
+{
+	FRESULT res;
+	UINT i;
+
+
+	res = validate(fp);					/* Check validity of the object */
+	if (res == FR_OK) {
+		res = pool_bind(fp, 1);			/* Make the buffer resident */
+		if (res == FR_OK) {
+			i = pool_slot(fp);			/* Always found once bound */
+			if (i < _FS_POOL) Pool[i].pin = pin ? 1 : 0;
+			else res = FR_INT_ERR;
+		}
+	}
+
+	LEAVE_FF(fp->fs, res);
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Change Current Directory or Current Drive, Get Current Directory      */
 /*-----------------------------------------------------------------------*/
@@ -3028,20 +5703,21 @@ FRESULT f_getcwd (
 
 FRESULT f_lseek (
 	FIL* fp,		/* Pointer to the file object */
-	DWORD ofs		/* File pointer from top of file */
+	FSIZE_t ofs		/* File pointer from top of file */
 )
 {
 	FRESULT res;
-	DWORD clst, bcs, nsect, ifptr;
+	DWORD clst, bcs, nsect;
+	FSIZE_t ifptr;
 #if _USE_FASTSEEK
 	DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
 #endif
 
 
-	res = validate(fp);					/* Check validity of the object */
-	if (res != FR_OK) LEAVE_FF(fp->fs, res);
+	res = validate_fil(fp);					/* Check validity of the object */
+	if (res != FR_OK) LEAVE_FIL(fp, res);
 	if (fp->err)						/* Check error */
-		LEAVE_FF(fp->fs, (FRESULT)fp->err);
+		LEAVE_FIL(fp, (FRESULT)fp->err);
 
 #if _USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
@@ -3055,7 +5731,7 @@ FRESULT f_lseek (
 					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
 					do {
 						pcl = cl; ncl++;
-						cl = get_fat(fp->fs, cl);
+						cl = get_fat_fil(fp, cl);
 						if (cl <= 1) ABORT(fp->fs, FR_INT_ERR);
 						if (cl == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					} while (cl == pcl + 1);
@@ -3078,7 +5754,7 @@ FRESULT f_lseek (
 				fp->clust = clmt_clust(fp, ofs - 1);
 				dsc = clust2sect(fp->fs, fp->clust);
 				if (!dsc) ABORT(fp->fs, FR_INT_ERR);
-				dsc += (ofs - 1) / SS(fp->fs) & (fp->fs->csize - 1);
+				dsc += (DWORD)((ofs - 1) / SS(fp->fs)) & (fp->fs->csize - 1);
 				if (fp->fptr % SS(fp->fs) && dsc != fp->dsect) {	/* Refill sector cache if needed */
 #if !_FS_TINY
 #if !_FS_READONLY
@@ -3088,6 +5764,7 @@ FRESULT f_lseek (
 						fp->flag &= ~FA__DIRTY;
 					}
 #endif
+					BIND_BUF(fp, 0);
 					if (disk_read(fp->fs->drv, fp->buf, dsc, 1) != RES_OK)	/* Load current sector */
 						ABORT(fp->fs, FR_DISK_ERR);
 #endif
@@ -3100,6 +5777,10 @@ FRESULT f_lseek (
 
 	/* Normal Seek */
 	{
+#if _FS_EXFAT
+		if (fp->fs->fs_type != FS_EXFAT && ofs >= 0x100000000ULL)	/* Clip at 4GB - 1 on the FAT volume */
+			ofs = 0xFFFFFFFF;
+#endif
 		if (ofs > fp->fsize					/* In read-only mode, clip offset with the file size */
 #if !_FS_READONLY
 			 && !(fp->flag & FA_WRITE)
@@ -3112,14 +5793,14 @@ FRESULT f_lseek (
 			bcs = (DWORD)fp->fs->csize * SS(fp->fs);	/* Cluster size (byte) */
 			if (ifptr > 0 &&
 				(ofs - 1) / bcs >= (ifptr - 1) / bcs) {	/* When seek to same or following cluster, */
-				fp->fptr = (ifptr - 1) & ~(bcs - 1);	/* start from the current cluster */
+				fp->fptr = (ifptr - 1) & ~(FSIZE_t)(bcs - 1);	/* start from the current cluster */
 				ofs -= fp->fptr;
 				clst = fp->clust;
 			} else {									/* When seek to back cluster, */
 				clst = fp->sclust;						/* start from the first cluster */
 #if !_FS_READONLY
 				if (clst == 0) {						/* If no cluster chain, create a new chain */
-					clst = create_chain(fp->fs, 0);
+					clst = create_chain_fil(fp, 0);
 					if (clst == 1) ABORT(fp->fs, FR_INT_ERR);
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					fp->sclust = clst;
@@ -3131,13 +5812,13 @@ FRESULT f_lseek (
 				while (ofs > bcs) {						/* Cluster following loop */
 #if !_FS_READONLY
 					if (fp->flag & FA_WRITE) {			/* Check if in write mode or not */
-						clst = create_chain(fp->fs, clst);	/* Force stretch if in write mode */
+						clst = create_chain_fil(fp, clst);	/* Force stretch if in write mode */
 						if (clst == 0) {				/* When disk gets full, clip file size */
 							ofs = bcs; break;
 						}
 					} else
 #endif
-						clst = get_fat(fp->fs, clst);	/* Follow cluster chain if not in write mode */
+						clst = get_fat_fil(fp, clst);	/* Follow cluster chain if not in write mode */
 					if (clst == 0xFFFFFFFF) ABORT(fp->fs, FR_DISK_ERR);
 					if (clst <= 1 || clst >= fp->fs->n_fatent) ABORT(fp->fs, FR_INT_ERR);
 					fp->clust = clst;
@@ -3148,12 +5829,13 @@ FRESULT f_lseek (
 				if (ofs % SS(fp->fs)) {
 					nsect = clust2sect(fp->fs, clst);	/* Current sector */
 					if (!nsect) ABORT(fp->fs, FR_INT_ERR);
-					nsect += ofs / SS(fp->fs);
+					nsect += (DWORD)(ofs / SS(fp->fs));
 				}
 			}
 		}
 		if (fp->fptr % SS(fp->fs) && nsect != fp->dsect) {	/* Fill sector cache if needed */
 #if !_FS_TINY
+			BIND_BUF(fp, 0);
 #if !_FS_READONLY
 			if (fp->flag & FA__DIRTY) {			/* Write-back dirty sector cache */
 				if (disk_write(fp->fs->drv, fp->buf, fp->dsect, 1) != RES_OK)
@@ -3163,6 +5845,7 @@ FRESULT f_lseek (
 #endif
 			if (disk_read(fp->fs->drv, fp->buf, nsect, 1) != RES_OK)	/* Fill sector cache */
 				ABORT(fp->fs, FR_DISK_ERR);
+			STAT_INC(fp->fs, rd_fill);
 #endif
 			fp->dsect = nsect;
 		}
@@ -3174,7 +5857,7 @@ FRESULT f_lseek (
 #endif
 	}
 
-	LEAVE_FF(fp->fs, res);
+	LEAVE_FIL(fp, res);
 }
 
 
@@ -3205,10 +5888,16 @@ FRESULT f_opendir (
 		FREE_BUF();
 		if (res == FR_OK) {						/* Follow completed */
 			if (dp->dir) {						/* It is not the origin directory itself */
-				if (dp->dir[DIR_Attr] & AM_DIR)	/* The object is a sub directory */
+				if (OBJ_ATTR(dp) & AM_DIR) {	/* The object is a sub directory */
+#if _FS_EXFAT
+					if (fs->fs_type == FS_EXFAT)
+						enter_xdir(dp);
+					else
+#endif
 					dp->sclust = ld_clust(fs, dp->dir);
-				else							/* The object is a file */
+				} else {						/* The object is a file */
 					res = FR_NO_PATH;
+				}
 			}
 			if (res == FR_OK) {
 				dp->id = fs->id;
@@ -3309,6 +5998,48 @@ FRESULT f_readdir (
 
 
 
+#if _USE_DIRPLUS
+/*-----------------------------------------------------------------------*/
+/* Read Directory Items in a Batch                                       */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_readdirplus (
+	DIR* dp,			/* Pointer to the open directory object */
+	DIRITEM* items,		/* Pointer to the array of items to return */
+	UINT n,				/* Number of items in the array */
+	UINT* nr			/* Pointer to number of items read (<n:end of directory) */
+)
+{
+	FRESULT res;
+	UINT cnt = 0;
+	DEFINE_NAMEBUF;
+
+
+	*nr = 0;
+	res = validate(dp);						/* Check validity of the object */
+	if (res == FR_OK) {
+		INIT_BUF(*dp);
+		while (cnt < n) {					/* Fill the items while on the volume lock and the current window */
+			res = dir_read(dp, 0);			/* Read an item */
+			if (res != FR_OK) break;
+			get_diritem(dp, &items[cnt++]);	/* Get the object information */
+			res = dir_next(dp, 0);			/* Increment index for next */
+			if (res != FR_OK) break;
+		}
+		if (res == FR_NO_FILE) {			/* Reached end of directory */
+			dp->sect = 0;
+			res = FR_OK;
+		}
+		FREE_BUF();
+		*nr = cnt;
+	}
+
+	LEAVE_FF(dp->fs, res);
+}
+#endif	/* _USE_DIRPLUS */
+
+
+
 #if _USE_FIND
 /*-----------------------------------------------------------------------*/
 /* Find next file                                                        */
@@ -3357,6 +6088,20 @@ FRESULT f_findfirst (
 	return res;
 }
 
+
+
+/*-----------------------------------------------------------------------*/
+/* Match a Name with a Pattern                                           */
+/*-----------------------------------------------------------------------*/
+
+int f_match (				/* 0:mismatched, 1:matched */
+	const TCHAR* pattern,	/* Pointer to the matching pattern */
+	const TCHAR* name		/* Pointer to the name to be tested */
+)
+{
+	return pattern_matching(pattern, name, 0, 0);
+}
+
 #endif	/* _USE_FIND */
 
 
@@ -3412,6 +6157,10 @@ FRESULT f_getfree (
 	DWORD nfree, clst, sect, stat;
 	UINT i;
 	BYTE fat, *p;
+#if _FS_EXFAT
+	UINT b;
+	BYTE bm;
+#endif
 
 
 	/* Get logical drive number */
@@ -3425,14 +6174,33 @@ FRESULT f_getfree (
 			/* Get number of free clusters */
 			fat = fs->fs_type;
 			nfree = 0;
+#if _FS_ALLOCSUM
+			mem_set(fs->as_free, 0, sizeof fs->as_free);	/* and of each region */
+#endif
 			if (fat == FS_FAT12) {	/* Sector unalighed entries: Search FAT via regular routine. */
 				clst = 2;
 				do {
 					stat = get_fat(fs, clst);
 					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
 					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) nfree++;
+					if (stat == 0) { nfree++; AS_CNT(fs, clst); }
 				} while (++clst < fs->n_fatent);
+#if _FS_EXFAT
+			} else if (fat == FS_EXFAT) {	/* Allocation bitmap: Count the clear bits */
+				clst = fs->n_fatent - 2; sect = fs->bitbase;
+				i = 0;
+				do {
+					if (!i) {
+						res = move_window(fs, sect++);
+						if (res != FR_OK) break;
+					}
+					for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
+						if (!(bm & 1)) { nfree++; AS_CNT(fs, fs->n_fatent - clst); }
+						bm >>= 1;
+					}
+					i = (i + 1) % SS(fs);
+				} while (clst);
+#endif
 			} else {				/* Sector alighed entries: Accelerate the FAT search. */
 				clst = fs->n_fatent; sect = fs->fatbase;
 				i = 0; p = 0;
@@ -3444,16 +6212,19 @@ FRESULT f_getfree (
 						i = SS(fs);
 					}
 					if (fat == FS_FAT16) {
-						if (LD_WORD(p) == 0) nfree++;
+						if (LD_WORD(p) == 0) { nfree++; AS_CNT(fs, fs->n_fatent - clst); }
 						p += 2; i -= 2;
 					} else {
-						if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) nfree++;
+						if ((LD_DWORD(p) & 0x0FFFFFFF) == 0) { nfree++; AS_CNT(fs, fs->n_fatent - clst); }
 						p += 4; i -= 4;
 					}
 				} while (--clst);
 			}
 			fs->free_clust = nfree;	/* free_clust is valid */
 			fs->fsi_flag |= 1;		/* FSInfo is to be updated */
+#if _FS_ALLOCSUM
+			if (res == FR_OK) fs->as_flag |= AS_VALID;
+#endif
 			*nclst = nfree;			/* Return the free clusters */
 		}
 	}
@@ -3475,7 +6246,7 @@ FRESULT f_truncate (
 	DWORD ncl;
 
 
-	res = validate(fp);						/* Check validity of the object */
+	res = validate_filfs(fp);						/* Check validity of the object */
 	if (res == FR_OK) {
 		if (fp->err) {						/* Check error */
 			res = (FRESULT)fp->err;
@@ -3487,18 +6258,39 @@ FRESULT f_truncate (
 	if (res == FR_OK) {
 		if (fp->fsize > fp->fptr) {
 			fp->fsize = fp->fptr;	/* Set file size to current R/W point */
+			if (fp->vsize > fp->fptr) fp->vsize = fp->fptr;
+#if _FS_PREFETCH
+			fp->pf_cnt = 0;			/* Discard read-ahead data */
+#endif
 			fp->flag |= FA__WRITTEN;
 			if (fp->fptr == 0) {	/* When set file size to zero, remove entire cluster chain */
+#if _FS_EXFAT
+				if (fp->stat & XS_NOFAT)
+					res = remove_run(fp->fs, fp->sclust, fp->n_cont);
+				else
+#endif
 				res = remove_chain(fp->fs, fp->sclust);
 				fp->sclust = 0;
+#if _FS_EXFAT
+				fp->stat = 0;
+				fp->n_cont = 0;
+#endif
 			} else {				/* When truncate a part of the file, remove remaining clusters */
-				ncl = get_fat(fp->fs, fp->clust);
+				ncl = get_fat_obj(fp, fp->clust);
 				res = FR_OK;
 				if (ncl == 0xFFFFFFFF) res = FR_DISK_ERR;
 				if (ncl == 1) res = FR_INT_ERR;
 				if (res == FR_OK && ncl < fp->fs->n_fatent) {
-					res = put_fat(fp->fs, fp->clust, 0x0FFFFFFF);
-					if (res == FR_OK) res = remove_chain(fp->fs, ncl);
+#if _FS_EXFAT
+					if (fp->stat & XS_NOFAT) {	/* Free the clusters following the current one */
+						res = remove_run(fp->fs, ncl, fp->sclust + fp->n_cont - ncl);
+						fp->n_cont = ncl - fp->sclust;
+					} else
+#endif
+					{
+						res = put_fat(fp->fs, fp->clust, 0x0FFFFFFF);
+						if (res == FR_OK) res = remove_chain(fp->fs, ncl);
+					}
 				}
 			}
 #if !_FS_TINY
@@ -3513,7 +6305,7 @@ FRESULT f_truncate (
 		if (res != FR_OK) fp->err = (FRESULT)res;
 	}
 
-	LEAVE_FF(fp->fs, res);
+	LEAVE_FILFS(fp, fp->fs, res);
 }
 
 
@@ -3531,6 +6323,10 @@ FRESULT f_unlink (
 	DIR dj, sdj;
 	BYTE *dir;
 	DWORD dclst = 0;
+#if _FS_EXFAT
+	DWORD dncl = 0, bcs;
+	BYTE dstat = 0;
+#endif
 	DEFINE_NAMEBUF;
 
 
@@ -3549,12 +6345,20 @@ FRESULT f_unlink (
 			if (!dir) {
 				res = FR_INVALID_NAME;		/* Cannot remove the origin directory */
 			} else {
-				if (dir[DIR_Attr] & AM_RDO)
+				if (OBJ_ATTR(&dj) & AM_RDO)
 					res = FR_DENIED;		/* Cannot remove R/O object */
 			}
 			if (res == FR_OK) {
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, get the chain from the entry set */
+					dclst = LD_DWORD(dj.fs->dirbuf + XDIR_FstClus);
+					dstat = dj.fs->dirbuf[XDIR_GenFlags] & XS_NOFAT;
+					bcs = (DWORD)dj.fs->csize * SS(dj.fs);
+					dncl = (DWORD)((LD_QWORD(dj.fs->dirbuf + XDIR_FileSize) + bcs - 1) / bcs);
+				} else
+#endif
 				dclst = ld_clust(dj.fs, dir);
-				if (dclst && (dir[DIR_Attr] & AM_DIR)) {	/* Is it a sub-directory ? */
+				if (dclst && (OBJ_ATTR(&dj) & AM_DIR)) {	/* Is it a sub-directory ? */
 #if _FS_RPATH
 					if (dclst == dj.fs->cdir) {		 		/* Is it the current directory? */
 						res = FR_DENIED;
@@ -3563,7 +6367,13 @@ FRESULT f_unlink (
 					{
 						mem_cpy(&sdj, &dj, sizeof (DIR));	/* Open the sub-directory */
 						sdj.sclust = dclst;
+#if _FS_EXFAT
+						sdj.stat = dstat;
+						sdj.n_cont = dncl;
+						res = dir_sdi(&sdj, (dj.fs->fs_type == FS_EXFAT) ? 0 : 2);	/* (There are no dot entries on exFAT) */
+#else
 						res = dir_sdi(&sdj, 2);
+#endif
 						if (res == FR_OK) {
 							res = dir_read(&sdj, 0);			/* Read an item (excluding dot entries) */
 							if (res == FR_OK) res = FR_DENIED;	/* Not empty? (cannot remove) */
@@ -3575,7 +6385,20 @@ FRESULT f_unlink (
 			if (res == FR_OK) {
 				res = dir_remove(&dj);		/* Remove the directory entry */
 				if (res == FR_OK && dclst)	/* Remove the cluster chain if exist */
+#if _FS_EXFAT
+					res = dstat ? remove_run(dj.fs, dclst, dncl) : remove_chain(dj.fs, dclst);
+#else
 					res = remove_chain(dj.fs, dclst);
+#endif
+#if _USE_LFN && _LFN_HASH
+				if (dclst && dclst == dj.fs->hc_clust) dj.fs->hc_clust = 0xFFFFFFFF;	/* Forget the names in the removed sub-directory */
+#endif
+#if _FS_DIRHINT
+				if (dclst) dh_forget(dj.fs, dclst);	/* Forget the free entry hint of the removed sub-directory */
+#endif
+#if _FS_DCACHE
+				if (dclst) dc_drop(dj.fs, dclst, 1);	/* Forget the paths through the removed sub-directory */
+#endif
 				if (res == FR_OK) res = sync_fs(dj.fs);
 			}
 		}
@@ -3598,8 +6421,13 @@ FRESULT f_mkdir (
 {
 	FRESULT res;
 	DIR dj;
-	BYTE *dir, n;
+	BYTE *dir;
+	UINT n;
 	DWORD dsc, dcl, pcl, tm = GET_FATTIME();
+#if _FS_EXFAT
+	DWORD dncl;
+	BYTE dstat = 0;
+#endif
 	DEFINE_NAMEBUF;
 
 
@@ -3612,6 +6440,11 @@ FRESULT f_mkdir (
 		if (_FS_RPATH && res == FR_NO_FILE && (dj.fn[NSFLAG] & NS_DOT))
 			res = FR_INVALID_NAME;
 		if (res == FR_NO_FILE) {				/* Can create a new directory */
+#if _FS_EXFAT
+			if (dj.fs->fs_type == FS_EXFAT)
+				dcl = create_xrun(dj.fs, &dstat, 0, &dncl, 0, 1);	/* Allocate a cluster without FAT chain */
+			else
+#endif
 			dcl = create_chain(dj.fs, 0);		/* Allocate a cluster for the new directory table */
 			res = FR_OK;
 			if (dcl == 0) res = FR_DENIED;		/* No space to allocate a new cluster */
@@ -3623,34 +6456,64 @@ FRESULT f_mkdir (
 				dsc = clust2sect(dj.fs, dcl);
 				dir = dj.fs->win;
 				mem_set(dir, 0, SS(dj.fs));
-				mem_set(dir + DIR_Name, ' ', 11);	/* Create "." entry */
-				dir[DIR_Name] = '.';
-				dir[DIR_Attr] = AM_DIR;
-				ST_DWORD(dir + DIR_WrtTime, tm);
-				st_clust(dir, dcl);
-				mem_cpy(dir + SZ_DIRE, dir, SZ_DIRE); 	/* Create ".." entry */
-				dir[SZ_DIRE + 1] = '.'; pcl = dj.sclust;
-				if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
-					pcl = 0;
-				st_clust(dir + SZ_DIRE, pcl);
+#if _FS_EXFAT
+				if (dj.fs->fs_type != FS_EXFAT)		/* (There are no dot entries on exFAT) */
+#endif
+				{
+					mem_set(dir + DIR_Name, ' ', 11);	/* Create "." entry */
+					dir[DIR_Name] = '.';
+					dir[DIR_Attr] = AM_DIR;
+					ST_DWORD(dir + DIR_WrtTime, tm);
+					st_clust(dir, dcl);
+					mem_cpy(dir + SZ_DIRE, dir, SZ_DIRE); 	/* Create ".." entry */
+					dir[SZ_DIRE + 1] = '.'; pcl = dj.sclust;
+					if (dj.fs->fs_type == FS_FAT32 && pcl == dj.fs->dirbase)
+						pcl = 0;
+					st_clust(dir + SZ_DIRE, pcl);
+				}
 				for (n = dj.fs->csize; n; n--) {	/* Write dot entries and clear following sectors */
 					dj.fs->winsect = dsc++;
 					dj.fs->wflag = 1;
-					res = sync_window(dj.fs);
+					res = fill_window(dj.fs);
 					if (res != FR_OK) break;
 					mem_set(dir, 0, SS(dj.fs));
 				}
 			}
 			if (res == FR_OK) res = dir_register(&dj);	/* Register the object to the directoy */
 			if (res != FR_OK) {
+#if _FS_EXFAT
+				if (dstat)
+					remove_run(dj.fs, dcl, 1);		/* Could not register, free the cluster */
+				else
+#endif
 				remove_chain(dj.fs, dcl);			/* Could not register, remove cluster chain */
 			} else {
-				dir = dj.dir;
-				dir[DIR_Attr] = AM_DIR;				/* Attribute */
-				ST_DWORD(dir + DIR_WrtTime, tm);	/* Created time */
-				st_clust(dir, dcl);					/* Table start cluster */
-				dj.fs->wflag = 1;
-				res = sync_fs(dj.fs);
+#if _FS_DCACHE
+				dc_drop(dj.fs, dcl, 1);				/* Forget any stale paths through the reused cluster */
+#endif
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, fill the entry set */
+					dir = dj.fs->dirbuf;
+					dir[XDIR_Attr] = AM_DIR;				/* Attribute */
+					ST_DWORD(dir + XDIR_CrtTime, tm);		/* Created time */
+					ST_DWORD(dir + XDIR_ModTime, tm);
+					ST_DWORD(dir + XDIR_AccTime, tm);
+					dir[XDIR_GenFlags] = 1 | dstat;			/* Table start cluster and size */
+					ST_DWORD(dir + XDIR_FstClus, dcl);
+					ST_QWORD(dir + XDIR_FileSize, (QWORD)dj.fs->csize * SS(dj.fs));
+					ST_QWORD(dir + XDIR_ValidFileSize, (QWORD)dj.fs->csize * SS(dj.fs));
+					res = store_xdir(&dj);
+					if (res == FR_OK) res = sync_fs(dj.fs);
+				} else
+#endif
+				{
+					dir = dj.dir;
+					dir[DIR_Attr] = AM_DIR;				/* Attribute */
+					ST_DWORD(dir + DIR_WrtTime, tm);	/* Created time */
+					st_clust(dir, dcl);					/* Table start cluster */
+					dj.fs->wflag = 1;
+					res = sync_fs(dj.fs);
+				}
 			}
 		}
 		FREE_BUF();
@@ -3691,9 +6554,18 @@ FRESULT f_chmod (
 				res = FR_INVALID_NAME;
 			} else {						/* File or sub directory */
 				mask &= AM_RDO|AM_HID|AM_SYS|AM_ARC;	/* Valid attribute mask */
-				dir[DIR_Attr] = (attr & mask) | (dir[DIR_Attr] & (BYTE)~mask);	/* Apply attribute change */
-				dj.fs->wflag = 1;
-				res = sync_fs(dj.fs);
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, apply it to the entry set */
+					dir = dj.fs->dirbuf;
+					dir[XDIR_Attr] = (attr & mask) | (dir[XDIR_Attr] & (BYTE)~mask);
+					res = store_xdir(&dj);
+				} else
+#endif
+				{
+					dir[DIR_Attr] = (attr & mask) | (dir[DIR_Attr] & (BYTE)~mask);	/* Apply attribute change */
+					dj.fs->wflag = 1;
+				}
+				if (res == FR_OK) res = sync_fs(dj.fs);
 			}
 		}
 	}
@@ -3715,8 +6587,12 @@ FRESULT f_rename (
 {
 	FRESULT res;
 	DIR djo, djn;
-	BYTE buf[21], *dir;
+	BYTE buf[_FS_EXFAT ? SZ_DIRE * 2 : 21], *dir;
 	DWORD dw;
+#if _FS_EXFAT
+	BYTE nf, nn;
+	WORD nh;
+#endif
 	DEFINE_NAMEBUF;
 
 
@@ -3735,7 +6611,22 @@ FRESULT f_rename (
 			if (!djo.dir) {						/* Is root dir? */
 				res = FR_NO_FILE;
 			} else {
+#if _FS_EXFAT
+				if (djo.fs->fs_type == FS_EXFAT)
+					mem_cpy(buf, djo.fs->dirbuf, SZ_DIRE * 2);	/* Save 85 and C0 entries of the object */
+				else
+#endif
 				mem_cpy(buf, djo.dir + DIR_Attr, 21);	/* Save information about object except name */
+#if _FS_DCACHE
+				if (OBJ_ATTR(&djo) & AM_DIR) {			/* Forget the path to the directory to be moved */
+#if _FS_EXFAT
+					if (djo.fs->fs_type == FS_EXFAT)
+						dc_drop(djo.fs, LD_DWORD(djo.fs->dirbuf + XDIR_FstClus), 0);
+					else
+#endif
+					dc_drop(djo.fs, ld_clust(djo.fs, djo.dir), 0);
+				}
+#endif
 				mem_cpy(&djn, &djo, sizeof (DIR));		/* Duplicate the directory object */
 				if (get_ldnumber(&path_new) >= 0)		/* Snip drive number off and ignore it */
 					res = follow_path(&djn, path_new);	/* and make sure if new object name is not conflicting */
@@ -3746,20 +6637,32 @@ FRESULT f_rename (
 					res = dir_register(&djn);			/* Register the new entry */
 					if (res == FR_OK) {
 /* Start of critical section where any interruption can cause a cross-link */
-						dir = djn.dir;					/* Copy information about object except name */
-						mem_cpy(dir + 13, buf + 2, 19);
-						dir[DIR_Attr] = buf[0] | AM_ARC;
-						djo.fs->wflag = 1;
-						if ((dir[DIR_Attr] & AM_DIR) && djo.sclust != djn.sclust) {	/* Update .. entry in the sub-directory if needed */
-							dw = clust2sect(djo.fs, ld_clust(djo.fs, dir));
-							if (!dw) {
-								res = FR_INT_ERR;
-							} else {
-								res = move_window(djo.fs, dw);
-								dir = djo.fs->win + SZ_DIRE * 1;	/* Ptr to .. entry */
-								if (res == FR_OK && dir[1] == '.') {
-									st_clust(dir, djn.sclust);
-									djo.fs->wflag = 1;
+#if _FS_EXFAT
+						if (djo.fs->fs_type == FS_EXFAT) {	/* Copy information about object except name */
+							dir = djo.fs->dirbuf;
+							nf = dir[XDIR_NumSec]; nn = dir[XDIR_NumName]; nh = LD_WORD(dir + XDIR_NameHash);
+							mem_cpy(dir, buf, SZ_DIRE * 2);
+							dir[XDIR_NumSec] = nf; dir[XDIR_NumName] = nn; ST_WORD(dir + XDIR_NameHash, nh);
+							dir[XDIR_Attr] |= AM_ARC;
+							res = store_xdir(&djn);		/* (There is no .. entry to be updated) */
+						} else
+#endif
+						{
+							dir = djn.dir;					/* Copy information about object except name */
+							mem_cpy(dir + 13, buf + 2, 19);
+							dir[DIR_Attr] = buf[0] | AM_ARC;
+							djo.fs->wflag = 1;
+							if ((dir[DIR_Attr] & AM_DIR) && djo.sclust != djn.sclust) {	/* Update .. entry in the sub-directory if needed */
+								dw = clust2sect(djo.fs, ld_clust(djo.fs, dir));
+								if (!dw) {
+									res = FR_INT_ERR;
+								} else {
+									res = move_window(djo.fs, dw);
+									dir = djo.fs->win + SZ_DIRE * 1;	/* Ptr to .. entry */
+									if (res == FR_OK && dir[1] == '.') {
+										st_clust(dir, djn.sclust);
+										djo.fs->wflag = 1;
+									}
 								}
 							}
 						}
@@ -3810,10 +6713,21 @@ FRESULT f_utime (
 			if (!dir) {					/* Root directory */
 				res = FR_INVALID_NAME;
 			} else {					/* File or sub-directory */
-				ST_WORD(dir + DIR_WrtTime, fno->ftime);
-				ST_WORD(dir + DIR_WrtDate, fno->fdate);
-				dj.fs->wflag = 1;
-				res = sync_fs(dj.fs);
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, apply it to the entry set */
+					dir = dj.fs->dirbuf;
+					ST_WORD(dir + XDIR_ModTime, fno->ftime);
+					ST_WORD(dir + XDIR_ModTime + 2, fno->fdate);
+					dir[XDIR_ModTime10] = 0;
+					res = store_xdir(&dj);
+				} else
+#endif
+				{
+					ST_WORD(dir + DIR_WrtTime, fno->ftime);
+					ST_WORD(dir + DIR_WrtDate, fno->fdate);
+					dj.fs->wflag = 1;
+				}
+				if (res == FR_OK) res = sync_fs(dj.fs);
 			}
 		}
 	}
@@ -3821,6 +6735,210 @@ FRESULT f_utime (
 	LEAVE_FF(dj.fs, res);
 }
 
+
+
+#if _USE_DEFRAG || (_USE_FRAGINFO && _USE_DIRPLUS)
+/*-----------------------------------------------------------------------*/
+/* Count Clusters and Fragments of a Chain in the FAT                    */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT count_frags (
+	FATFS* fs,		/* File system object */
+	DWORD scl,		/* Top cluster of the chain (0:no data) */
+	DWORD* ncl,		/* Pointer to the variable to return number of clusters */
+	DWORD* nfrag	/* Pointer to the variable to return number of fragments */
+)
+{
+	DWORD cl, nxt, n = 0, nf = 0;
+	FRESULT res = FR_OK;
+
+
+	for (cl = scl; cl >= 2 && cl < fs->n_fatent; cl = nxt) {
+		nxt = get_fat(fs, cl);
+		if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		if (nxt < 2 || ++n > fs->n_fatent) { res = FR_INT_ERR; break; }	/* Broken or circular chain */
+		if (nxt != cl + 1) nf++;	/* End of a fragment (the last one ends with the end of chain) */
+	}
+	*ncl = n; *nfrag = nf;
+	return res;
+}
+#endif
+
+
+
+#if _USE_DEFRAG
+/*-----------------------------------------------------------------------*/
+/* Count Fragments of a File and Make it Contiguous                      */
+/*-----------------------------------------------------------------------*/
+/* The file is copied into a new contiguous run and the directory entry is
+/  switched to it in a single sector write. The new run is allocated and
+/  flushed before the copy, and the old chain is freed after the switch, so a
+/  power failure at any point leaves the file intact on either chain with at
+/  most a lost chain to be reclaimed. The file must not be open. */
+
+FRESULT f_defrag (
+	const TCHAR* path,	/* Pointer to the file path */
+	BYTE opt,			/* 0:Count fragments only, 1:Make it contiguous, 2:Make it contiguous and verify the copy */
+	void* work,			/* Pointer to the working buffer (not used at opt 0) */
+	UINT sz_work,		/* Size of the working buffer in bytes (one sector or more, two at opt 2) */
+	DWORD* nfrag		/* Pointer to the variable to return number of fragments found (can be null) */
+)
+{
+	FRESULT res;
+	DIR dj;
+	FATFS *fs;
+	BYTE *buf = (BYTE*)work;
+	DWORD scl, cl, nxt, ncl, nf, top, n, ssect, dsect, ns;
+	UINT bsz, cnt;
+#if _FS_EXFAT
+	DWORD bcs;
+	BYTE xstat = 0;
+#endif
+	DEFINE_NAMEBUF;
+
+
+	if (nfrag) *nfrag = 0;
+	res = find_volume(&dj.fs, &path, (BYTE)(opt ? 1 : 0));
+	fs = dj.fs;
+	if (res == FR_OK) {
+		INIT_BUF(dj);
+		res = follow_path(&dj, path);		/* Follow the file path */
+		FREE_BUF();
+		if (_FS_RPATH && res == FR_OK && (dj.fn[NSFLAG] & NS_DOT))
+			res = FR_INVALID_NAME;
+#if _FS_LOCK
+		if (res == FR_OK && opt) res = chk_lock(&dj, 2);	/* Cannot move an open file */
+#endif
+		if (res == FR_OK) {
+			if (!dj.dir) res = FR_INVALID_NAME;					/* Root directory */
+			else if (OBJ_ATTR(&dj) & AM_DIR) res = FR_DENIED;	/* Sub-directories are referred from their dot entries */
+		}
+	}
+	if (res != FR_OK) LEAVE_FF(fs, res);
+
+	/* Count the clusters and fragments of the chain */
+	ncl = nf = 0;
+#if _FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		scl = LD_DWORD(fs->dirbuf + XDIR_FstClus);
+		xstat = fs->dirbuf[XDIR_GenFlags] & XS_NOFAT;
+		bcs = (DWORD)fs->csize * SS(fs);
+		n = (DWORD)((LD_QWORD(fs->dirbuf + XDIR_FileSize) + bcs - 1) / bcs);	/* Clusters used by the file */
+		if (scl && xstat) {				/* A chain without FAT is contiguous */
+			ncl = n; nf = 1;
+		}
+	} else
+#endif
+	{
+		scl = ld_clust(fs, dj.dir);
+	}
+	if (!nf) res = count_frags(fs, scl, &ncl, &nf);
+	if (nfrag) *nfrag = nf;
+	if (res != FR_OK || !opt || nf <= 1) LEAVE_FF(fs, res);
+#if _FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		if (ncl < n) LEAVE_FF(fs, FR_INT_ERR);	/* The chain is shorter than the file */
+		ncl = n;						/* The run holds the clusters used by the file, it is not recorded in the FAT */
+	}
+#endif
+
+	bsz = sz_work / SS(fs);				/* Sectors per disk access */
+	if (opt == 2) bsz /= 2;				/* (The second half takes the data read back) */
+	if (!buf || !bsz) LEAVE_FF(fs, FR_INVALID_PARAMETER);
+
+	/* Allocate the contiguous run and flush it before anything is written to it */
+	cl = fs->last_clust;
+	if (!cl || cl >= fs->n_fatent) cl = 1;
+	top = find_run(fs, cl, ncl, &n);
+	if (top == 0xFFFFFFFF) LEAVE_FF(fs, FR_DISK_ERR);
+	if (top == 1) LEAVE_FF(fs, FR_INT_ERR);
+	if (!top || n < ncl) LEAVE_FF(fs, FR_DENIED);	/* No free run long enough */
+#if _FS_ALLOCSUM
+	res = as_open(fs);					/* Put the summary on the disk out of date before the change */
+	if (res != FR_OK) LEAVE_FF(fs, res);
+#endif
+#if _FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {
+		res = put_bitmap(fs, top, ncl, 1);
+	} else
+#endif
+	{
+		for (cl = top; res == FR_OK && cl < top + ncl - 1; cl++)
+			res = put_fat(fs, cl, cl + 1);
+		if (res == FR_OK) res = put_fat(fs, cl, 0x0FFFFFFF);
+	}
+	fs->last_clust = top + ncl - 1;
+	if (fs->free_clust != 0xFFFFFFFF) {
+		fs->free_clust -= ncl;
+		fs->fsi_flag |= 1;
+	}
+#if _FS_ALLOCSUM
+	as_update(fs, top, ncl, 1);
+#endif
+	if (res == FR_OK) res = sync_fs(fs);
+
+	/* Copy the file extent by extent with multiple sector access */
+	cl = scl; n = ncl;
+	dsect = clust2sect(fs, top);
+	while (res == FR_OK && n) {
+		nxt = 0;
+		for (ns = 1; ns < n; ns++) {	/* Get the length of the extent from cl */
+			nxt = get_fat(fs, cl + ns - 1);
+			if (nxt != cl + ns) break;
+		}
+		if (nxt == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+		ssect = clust2sect(fs, cl);
+		n -= ns; cl = nxt;
+		for (ns *= fs->csize; res == FR_OK && ns; ns -= cnt) {
+			cnt = (ns < bsz) ? (UINT)ns : bsz;
+			if (disk_read(fs->drv, buf, ssect, cnt) != RES_OK || disk_write(fs->drv, buf, dsect, cnt) != RES_OK) {
+				res = FR_DISK_ERR;
+			} else if (opt == 2) {		/* Read back the copy and compare */
+				if (disk_read(fs->drv, buf + bsz * SS(fs), dsect, cnt) != RES_OK || mem_cmp(buf, buf + bsz * SS(fs), cnt * SS(fs)))
+					res = FR_DISK_ERR;
+			}
+			ssect += cnt; dsect += cnt;
+		}
+	}
+	if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK)
+		res = FR_DISK_ERR;
+
+	/* Switch the directory entry to the new run */
+	if (res == FR_OK) {
+#if _FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {
+			ST_DWORD(fs->dirbuf + XDIR_FstClus, top);
+			fs->dirbuf[XDIR_GenFlags] |= XS_NOFAT;
+			res = store_xdir(&dj);
+		} else
+#endif
+		{
+			res = move_window(fs, dj.sect);
+			if (res == FR_OK) {
+				st_clust(dj.dir, top);
+				fs->wflag = 1;
+			}
+		}
+		if (res == FR_OK) res = sync_fs(fs);
+		if (res == FR_OK) {				/* Free the old chain */
+			res = remove_chain(fs, scl);
+			if (res == FR_OK) res = sync_fs(fs);
+		}
+	} else {							/* Could not copy, the file stays on the old chain */
+#if _FS_EXFAT
+		if (fs->fs_type == FS_EXFAT)
+			remove_run(fs, top, ncl);
+		else
+#endif
+		remove_chain(fs, top);
+		sync_fs(fs);
+	}
+
+	LEAVE_FF(fs, res);
+}
+#endif /* _USE_DEFRAG */
+
 #endif /* !_FS_READONLY */
 #endif /* _FS_MINIMIZE == 0 */
 #endif /* _FS_MINIMIZE <= 1 */
@@ -3843,7 +6961,7 @@ FRESULT f_getlabel (
 	FRESULT res;
 	DIR dj;
 	UINT i, j;
-#if _USE_LFN && _LFN_UNICODE
+#if (_USE_LFN && _LFN_UNICODE) || _FS_EXFAT
 	WCHAR w;
 #endif
 
@@ -3854,26 +6972,44 @@ FRESULT f_getlabel (
 	/* Get volume label */
 	if (res == FR_OK && label) {
 		dj.sclust = 0;					/* Open root directory */
+#if _FS_EXFAT
+		dj.stat = 0;
+#endif
 		res = dir_sdi(&dj, 0);
 		if (res == FR_OK) {
 			res = dir_read(&dj, 1);		/* Get an entry with AM_VOL */
 			if (res == FR_OK) {			/* A volume label is exist */
+#if _FS_EXFAT
+				if (dj.fs->fs_type == FS_EXFAT) {	/* On the exFAT volume, the label is in Unicode */
+					for (i = j = 0; i < dj.dir[XDIR_NumLabel] && i < 11; i++) {
+						w = LD_WORD(dj.dir + XDIR_Label + i * 2);
+#if !_LFN_UNICODE
+						w = ff_convert(w, 0);	/* Unicode -> OEM */
+						if (!w || w >= 0x100) w = '?';
+#endif
+						label[j++] = (TCHAR)w;
+					}
+					label[j] = 0;
+				} else
+#endif
+				{
 #if _USE_LFN && _LFN_UNICODE
-				i = j = 0;
-				do {
-					w = (i < 11) ? dj.dir[i++] : ' ';
-					if (IsDBCS1(w) && i < 11 && IsDBCS2(dj.dir[i]))
-						w = w << 8 | dj.dir[i++];
-					label[j++] = ff_convert(w, 1);	/* OEM -> Unicode */
-				} while (j < 11);
+					i = j = 0;
+					do {
+						w = (i < 11) ? dj.dir[i++] : ' ';
+						if (IsDBCS1(w) && i < 11 && IsDBCS2(dj.dir[i]))
+							w = w << 8 | dj.dir[i++];
+						label[j++] = ff_convert(w, 1);	/* OEM -> Unicode */
+					} while (j < 11);
 #else
-				mem_cpy(label, dj.dir, 11);
+					mem_cpy(label, dj.dir, 11);
 #endif
-				j = 11;
-				do {
-					label[j] = 0;
-					if (!j) break;
-				} while (label[--j] == ' ');
+					j = 11;
+					do {
+						label[j] = 0;
+						if (!j) break;
+					} while (label[--j] == ' ');
+				}
 			}
 			if (res == FR_NO_FILE) {	/* No label, return nul string */
 				label[0] = 0;
@@ -3886,7 +7022,7 @@ FRESULT f_getlabel (
 	if (res == FR_OK && vsn) {
 		res = move_window(dj.fs, dj.fs->volbase);
 		if (res == FR_OK) {
-			i = dj.fs->fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID;
+			i = dj.fs->fs_type == FS_EXFAT ? BPB_VolIDEx : dj.fs->fs_type == FS_FAT32 ? BS_VolID32 : BS_VolID;
 			*vsn = LD_DWORD(&dj.fs->win[i]);
 		}
 	}
@@ -3916,6 +7052,9 @@ FRESULT f_setlabel (
 	/* Get logical drive number */
 	res = find_volume(&dj.fs, &label, 1);
 	if (res) LEAVE_FF(dj.fs, res);
+#if _FS_EXFAT
+	if (dj.fs->fs_type == FS_EXFAT) LEAVE_FF(dj.fs, FR_DENIED);	/* (Volume label cannot be changed on exFAT volume) */
+#endif
 
 	/* Create a volume label in directory form */
 	vn[0] = 0;
@@ -3992,6 +7131,217 @@ FRESULT f_setlabel (
 
 
 
+#if _USE_FRAGINFO
+/*-----------------------------------------------------------------------*/
+/* Analyze Fragmentation and Layout of the Volume                        */
+/*-----------------------------------------------------------------------*/
+/* The FAT (allocation bitmap on the exFAT volume) is read from top to end in
+/  a single pass, in blocks of the working buffer when it is given and sector
+/  by sector through the window otherwise. Nothing but the counters is kept,
+/  so the memory used does not depend on the volume size. */
+
+static
+void fi_endrun (
+	FRAGINFO* fi,		/* Pointer to the analysis being collected */
+	DWORD top,			/* Top cluster of the free run */
+	DWORD len			/* Number of clusters in the free run (0:No run) */
+)
+{
+	UINT b;
+
+
+	if (len) {
+		fi->n_frun++;
+		for (b = 0; b < FI_HIST - 1 && (len >> (b + 1)); b++) ;	/* Find the bucket of the length */
+		fi->frun_hist[b]++;
+		if (len > fi->max_frun) {		/* Largest free run so far */
+			fi->max_frun = len; fi->max_ftop = top;
+		}
+	}
+}
+
+
+FRESULT f_fraginfo (
+	const TCHAR* path,	/* Path name of the logical drive number */
+	FRAGINFO* fi,		/* Pointer to the variable to return the analysis */
+	void* work,			/* Pointer to the working buffer for multi-sector reads (null:Use the window) */
+	UINT sz_work		/* Size of the working buffer in bytes */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD cl, val, eoc, sect, nsect, top, len, au, cpa, lead, pos, nused;
+	UINT i, b, bsz, ns;
+	BYTE fmt, *p;
+#if _FS_EXFAT
+	BYTE bm = 0;
+#endif
+
+
+	/* Get logical drive number */
+	res = find_volume(&fs, &path, 0);
+	if (res != FR_OK) LEAVE_FF(fs, res);
+
+	mem_set(fi, 0, sizeof (FRAGINFO));
+	fmt = fs->fs_type;
+	fi->n_clust = fs->n_fatent - 2;
+
+	/* Get the AU (erase block) size and the position of the data area in it */
+	cpa = lead = 0;
+	if (disk_ioctl(fs->drv, GET_BLOCK_SIZE, &au) == RES_OK && au) {
+		fi->au_size = au;
+		fi->au_ofs = fs->database % au;
+		if (au % fs->csize == 0 && fi->au_ofs % fs->csize == 0) {	/* AU statistics need clusters not straddling the AUs */
+			cpa = au / fs->csize;						/* Clusters per AU */
+			lead = (au - fi->au_ofs) % au / fs->csize;	/* Clusters before the first AU boundary */
+		}
+	}
+
+#if !_FS_READONLY
+	if (work) {							/* The table is read bypassing the window */
+		res = sync_window(fs);
+#if _FS_JOURNAL
+		if (res == FR_OK && fs->jbase)	/* and the journal buffer */
+			res = jnl_flush(fs);
+#endif
+		if (res != FR_OK) LEAVE_FF(fs, res);
+	}
+#endif
+	bsz = work ? sz_work / SS(fs) : 0;	/* Sectors per disk access (0:Use the window) */
+	eoc = (fmt == FS_FAT12) ? 0xFF8 : (fmt == FS_FAT16) ? 0xFFF8 : 0x0FFFFFF8;	/* Lowest end of chain mark */
+	sect = fs->fatbase; nsect = fs->fsize;
+	cl = (fmt == FS_FAT12) ? 2 : 0;		/* The FAT starts with the entries of cluster 0 and 1 */
+#if _FS_EXFAT
+	if (fmt == FS_EXFAT) {				/* The allocation bitmap starts with cluster 2 */
+		sect = fs->bitbase; nsect = ((fs->n_fatent - 2 + 7) / 8 + SS(fs) - 1) / SS(fs);
+		cl = 2;
+	}
+#endif
+	top = len = pos = nused = 0;
+	i = b = 0; p = 0;
+#if _FS_ALLOCSUM
+	fs->as_flag &= ~AS_VALID;			/* The region counts are got in the pass */
+	mem_set(fs->as_free, 0, sizeof fs->as_free);
+#endif
+	for ( ; cl < fs->n_fatent; cl++) {
+		/* Get the cluster status */
+		if (fmt == FS_FAT12) {	/* Sector unaligned entries: Get it via regular routine */
+			val = get_fat(fs, cl);
+			if (val == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (val == 1) { res = FR_INT_ERR; break; }
+		} else {				/* Sector aligned entries: Read the table in blocks */
+			if (!i && !b) {
+				if (!nsect) { res = FR_INT_ERR; break; }
+				if (bsz) {
+					ns = (bsz < nsect) ? bsz : nsect;
+					if (disk_read(fs->drv, (BYTE*)work, sect, ns) != RES_OK) { res = FR_DISK_ERR; break; }
+					p = (BYTE*)work;
+				} else {
+					ns = 1;
+					res = move_window(fs, sect);
+					if (res != FR_OK) break;
+					p = fs->win;
+				}
+				sect += ns; nsect -= ns;
+				i = ns * SS(fs);
+			}
+#if _FS_EXFAT
+			if (fmt == FS_EXFAT) {
+				if (!b) { bm = *p++; i--; b = 8; }
+				val = bm & 1; bm >>= 1; b--;
+			} else
+#endif
+			if (fmt == FS_FAT16) {
+				val = LD_WORD(p); p += 2; i -= 2;
+			} else {
+				val = LD_DWORD(p) & 0x0FFFFFFF; p += 4; i -= 4;
+			}
+			if (cl < 2) continue;	/* Not a cluster */
+		}
+
+		if (val == 0) {			/* Free cluster */
+			fi->n_free++;
+			AS_CNT(fs, cl);
+			if (!len) top = cl;
+			len++;
+		} else {				/* Cluster in use */
+			fi_endrun(fi, top, len);
+			len = 0;
+			if (fmt != FS_EXFAT) {
+				if (val >= 2 && val < fs->n_fatent) {
+					if (val != cl + 1) fi->n_extent++;	/* A link out of the extent */
+				} else if (val >= eoc) {
+					fi->n_chain++; fi->n_extent++;		/* End of a chain */
+				} else if (val == eoc - 1) {
+					fi->n_bad++;
+				}
+			}
+		}
+		if (cpa && cl - 2 >= lead) {	/* Collect the AU statistics */
+			if (val) nused++;
+			if (++pos == cpa) {
+				fi->n_au++;
+				if (!nused) fi->n_au_free++;
+				else if (nused < cpa) fi->n_au_part++;
+				pos = nused = 0;
+			}
+		}
+	}
+	if (res == FR_OK) {
+		fi_endrun(fi, top, len);
+#if !_FS_READONLY
+		fs->free_clust = fi->n_free;	/* free_clust is valid */
+		fs->frun_max = fi->max_frun;	/* and so is the longest free run */
+		fs->fsi_flag |= 1;				/* FSInfo is to be updated */
+#if _FS_ALLOCSUM
+		fs->as_flag |= AS_VALID;
+#endif
+#endif
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+#if _USE_DIRPLUS
+/*-----------------------------------------------------------------------*/
+/* Count Fragments of a Directory Item                                   */
+/*-----------------------------------------------------------------------*/
+/* The chain is followed from the item as read by f_readdirplus, so a tree
+/  walk does not have to find each file again by its name. */
+
+FRESULT f_itemfrags (
+	const TCHAR* path,		/* Path name of the logical drive number the item was read from */
+	const DIRITEM* item,	/* Pointer to the directory item */
+	DWORD* nfrag			/* Pointer to the variable to return number of fragments found */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+	DWORD ncl;
+
+
+	*nfrag = 0;
+	res = find_volume(&fs, &path, 0);
+	if (res != FR_OK) LEAVE_FF(fs, res);
+
+	if (item->sclust >= 2 && item->sclust < fs->n_fatent) {
+#if _FS_EXFAT
+		if (fs->fs_type == FS_EXFAT && item->fstat) {	/* A chain without FAT is contiguous */
+			*nfrag = 1;
+			LEAVE_FF(fs, FR_OK);
+		}
+#endif
+		res = count_frags(fs, item->sclust, &ncl, nfrag);
+	}
+	LEAVE_FF(fs, res);
+}
+#endif
+#endif /* _USE_FRAGINFO */
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Forward data to the stream directly (available on only tiny cfg)      */
 /*-----------------------------------------------------------------------*/
@@ -4005,9 +7355,9 @@ FRESULT f_forward (
 )
 {
 	FRESULT res;
-	DWORD remain, clst, sect;
-	UINT rcnt;
-	BYTE csect;
+	DWORD clst, sect;
+	FSIZE_t remain;
+	UINT rcnt, csect;
 
 
 	*bf = 0;	/* Clear transfer byte counter */
@@ -4024,7 +7374,7 @@ FRESULT f_forward (
 
 	for ( ;  btf && (*func)(0, 0);					/* Repeat until all data transferred or stream becomes busy */
 		fp->fptr += rcnt, *bf += rcnt, btf -= rcnt) {
-		csect = (BYTE)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
+		csect = (UINT)(fp->fptr / SS(fp->fs) & (fp->fs->csize - 1));	/* Sector offset in the cluster */
 		if ((fp->fptr % SS(fp->fs)) == 0) {			/* On the sector boundary? */
 			if (!csect) {							/* On the cluster boundary? */
 				clst = (fp->fptr == 0) ?			/* On the top of the file? */
@@ -4135,11 +7485,17 @@ FRESULT f_mkfs (
 	if (fmt == FS_FAT32) {
 		n_fat = ((n_clst * 4) + 8 + SS(fs) - 1) / SS(fs);
 		n_rsv = 32;
+#if _FS_JOURNAL || _FS_ALLOCSUM
+		if (n_rsv < 9 + RSV_SECTS) n_rsv = 9 + RSV_SECTS;	/* Reserve the journal area and allocation summary past the backup boot record */
+#endif
 		n_dir = 0;
 	} else {
 		n_fat = (fmt == FS_FAT12) ? (n_clst * 3 + 1) / 2 + 3 : (n_clst * 2) + 4;
 		n_fat = (n_fat + SS(fs) - 1) / SS(fs);
 		n_rsv = 1;
+#if _FS_JOURNAL || _FS_ALLOCSUM
+		n_rsv += RSV_SECTS;				/* Reserve the journal area and allocation summary */
+#endif
 		n_dir = (DWORD)N_ROOTDIR * SZ_DIRE / SS(fs);
 	}
 	b_fat = b_vol + n_rsv;				/* FAT area start sector */
@@ -4248,6 +7604,32 @@ FRESULT f_mkfs (
 	if (fmt == FS_FAT32)					/* Write it to the backup VBR if needed (VBR + 6) */
 		disk_write(pdrv, tbl, b_vol + 6, 1);
 
+#if _FS_JOURNAL
+	/* Clear the journal area, a record of the former volume must not be applied */
+	mem_set(tbl, 0, SS(fs));
+	for (wsect = b_fat - JNL_SECTS; wsect < b_fat; wsect++) {
+		if (disk_write(pdrv, tbl, wsect, 1) != RES_OK)
+			return FR_DISK_ERR;
+	}
+#endif
+#if _FS_ALLOCSUM
+	/* Create the allocation summary of the empty volume, closed as on unmount (only FAT32 uses it) */
+	if (fmt == FS_FAT32) {
+		fs->n_fatent = n_clst + 2;
+		fs->as_rsize = (n_clst + _FS_ALLOCSUM - 1) / _FS_ALLOCSUM;
+		for (i = 0, vs = n_clst; i < _FS_ALLOCSUM; i++) {
+			fs->as_free[i] = (vs < fs->as_rsize) ? vs : fs->as_rsize;
+			vs -= fs->as_free[i];
+		}
+		fs->as_free[0]--;				/* Cluster 2 is in use by the root directory */
+		fs->free_clust = n_clst - 1; fs->last_clust = 2;
+		fs->as_vsn = n; fs->as_gen = 0;
+		as_fill(fs);
+		if (disk_write(pdrv, tbl, b_fat - RSV_SECTS, 1) != RES_OK)
+			return FR_DISK_ERR;
+	}
+#endif
+
 	/* Initialize FAT area */
 	wsect = b_fat;
 	for (i = 0; i < N_FATS; i++) {		/* Initialize each FAT copy */
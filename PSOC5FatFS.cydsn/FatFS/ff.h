@@ -73,16 +73,95 @@ typedef char TCHAR;
 
 
 
+/* Type of file size variables */
+
+#if _FS_EXFAT
+#if !_USE_LFN
+#error LFN feature must be enabled when exFAT is enabled
+#endif
+typedef QWORD FSIZE_t;
+#else
+typedef DWORD FSIZE_t;
+#endif
+
+
+
+/* File system statistics structure (FSSTAT) */
+
+#if _FS_STATS
+typedef struct {
+	DWORD	rd_fill;		/* Number of file data sectors read into the sector cache */
+	DWORD	rd_skip;		/* Number of sector cache fills zeroed past the valid data extent */
+#if _FS_POOL
+	DWORD	pool_rcl;		/* Number of pooled buffers reclaimed from other files */
+	DWORD	pool_rld;		/* Number of sectors reloaded into a reclaimed buffer */
+#endif
+#if _FS_PREFETCH
+	DWORD	pf_hit;			/* Number of sector loads served from the read-ahead buffer */
+	DWORD	pf_miss;		/* Number of sector loads read from the medium */
+#endif
+#if _FS_JOURNAL
+	DWORD	jnl_rec;		/* Number of journal records written */
+	DWORD	jnl_ckpt;		/* Number of journal checkpoints */
+	DWORD	jnl_hit;		/* Number of window loads served from the journal buffer */
+#endif
+} FSSTAT;
+#endif
+
+
+
+/* Free entry hint (DIRHINT) */
+
+#if _FS_DIRHINT && !_FS_READONLY
+typedef struct {
+	DWORD	clust;			/* Start cluster of the directory (0:root, 0xFFFFFFFF:unused) */
+	WORD	idx;			/* Index of the directory below which all entries are in use */
+} DIRHINT;
+#endif
+
+
+
+/* Path cache item (DCACHE) */
+
+#if _FS_DCACHE
+typedef struct {
+	DWORD	pclust;			/* Start cluster of the parent directory (0:root, 0xFFFFFFFF:unused) */
+	DWORD	sclust;			/* Start cluster of the directory */
+	WORD	idx;			/* Index of the entry in the parent directory (exFAT:top of the entry set) */
+	BYTE	nc;				/* Number of characters in name[] */
+#if _FS_EXFAT
+	BYTE	stat;			/* Chain status of the directory */
+	DWORD	n_cont;			/* Number of clusters of the directory */
+#endif
+	TCHAR	name[12];		/* Path segment as given in the path (not terminated) */
+} DCACHE;
+#endif
+
+
+
+/* Name hash cache item (LFNHASH) */
+
+#if _USE_LFN && _LFN_HASH
+typedef struct {
+	WORD	idx;			/* Index of the SFN entry of the object in the directory */
+	WORD	hash;			/* Hash value of the up-cased LFN (0 when nlfn is 0) */
+	BYTE	nlfn;			/* Number of LFN entries of the object (0:SFN only) */
+	BYTE	sum;			/* Checksum of the SFN */
+} LFNHASH;
+#endif
+
+
+
 /* File system object structure (FATFS) */
 
 typedef struct {
 	BYTE	fs_type;		/* FAT sub-type (0:Not mounted) */
 	BYTE	drv;			/* Physical drive number */
-	BYTE	csize;			/* Sectors per cluster (1,2,4...128) */
 	BYTE	n_fats;			/* Number of FAT copies (1 or 2) */
 	BYTE	wflag;			/* win[] flag (b0:dirty) */
 	BYTE	fsi_flag;		/* FSINFO flags (b7:disabled, b0:dirty) */
 	WORD	id;				/* File system mount ID */
+	WORD	csize;			/* Sectors per cluster (1,2,4...128, up to 32768 on exFAT) */
 	WORD	n_rootdir;		/* Number of root directory entries (FAT12/16) */
 #if _MAX_SS != _MIN_SS
 	WORD	ssize;			/* Bytes per sector (512, 1024, 2048 or 4096) */
@@ -93,6 +172,7 @@ typedef struct {
 #if !_FS_READONLY
 	DWORD	last_clust;		/* Last allocated cluster */
 	DWORD	free_clust;		/* Number of free clusters */
+	DWORD	frun_max;		/* Longest free run found by the last full scan, kept until a cluster is freed (0xFFFFFFFF:unknown) */
 #endif
 #if _FS_RPATH
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -104,6 +184,44 @@ typedef struct {
 	DWORD	dirbase;		/* Root directory start sector (FAT32:Cluster#) */
 	DWORD	database;		/* Data start sector */
 	DWORD	winsect;		/* Current sector appearing in the win[] */
+#if _FS_EXFAT
+	DWORD	bitbase;		/* Allocation bitmap start sector (exFAT) */
+	BYTE	dirbuf[(_MAX_LFN + 44) / 15 * 32];	/* Directory entry set of the object found (exFAT) */
+#endif
+#if _USE_LFN == 1
+	WCHAR	lfnbuf[_MAX_LFN + 1];	/* LFN working buffer */
+#endif
+#if _USE_LFN && _LFN_HASH
+	DWORD	hc_clust;		/* Directory whose names are in the hash cache (0:root, 0xFFFFFFFF:none) */
+	WORD	hc_next;		/* Index where the part of the directory not cached starts */
+	BYTE	hc_eot;			/* hc_next is end of the directory (all names are cached) */
+	BYTE	hc_n;			/* Number of items in hc[] */
+	LFNHASH	hc[_LFN_HASH];	/* Names of the objects in the directory */
+#endif
+#if _FS_DCACHE
+	DCACHE	dc[_FS_DCACHE];	/* Sub-directories followed in the paths (most recent first) */
+#endif
+#if _FS_DIRHINT && !_FS_READONLY
+	DIRHINT	dh[_FS_DIRHINT];	/* Free entry hints of the directories created in last (most recent first) */
+#endif
+#if _FS_STATS
+	FSSTAT	st;				/* I/O statistics (cleared on mount) */
+#endif
+#if _FS_JOURNAL
+	DWORD	jbase;			/* Journal area start sector (0:No journal on the volume) */
+	DWORD	jseq;			/* Sequence number of the last journal record */
+	UINT	jcnt;			/* Number of sectors in the journal buffer */
+	BYTE	jflag;			/* Journal buffer changed since the last record */
+	BYTE	jbuf[(_FS_JOURNAL + 1) * _MAX_SS];	/* Journal record buffer (header and sectors) */
+#endif
+#if _FS_ALLOCSUM
+	DWORD	as_sect;		/* Allocation summary sector (0:No summary on the volume) */
+	DWORD	as_vsn;			/* Volume serial number recorded in the summary */
+	DWORD	as_gen;			/* Generation of the summary (odd:in use, the summary on the disk is out of date) */
+	DWORD	as_rsize;		/* Number of clusters per region */
+	BYTE	as_flag;		/* Summary flags (b0:as_free[] is valid, b1:the summary on the disk was not taken) */
+	DWORD	as_free[_FS_ALLOCSUM];	/* Number of free clusters in each region */
+#endif
 	BYTE	win[_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
 } FATFS;
 
@@ -116,14 +234,23 @@ typedef struct {
 	WORD	id;				/* Owner file system mount ID (**do not change order**) */
 	BYTE	flag;			/* Status flags */
 	BYTE	err;			/* Abort flag (error code) */
-	DWORD	fptr;			/* File read/write pointer (Zeroed on file open) */
-	DWORD	fsize;			/* File size */
+	FSIZE_t	fptr;			/* File read/write pointer (Zeroed on file open) */
+	FSIZE_t	fsize;			/* File size */
 	DWORD	sclust;			/* File start cluster (0:no cluster chain, always 0 when fsize is 0) */
 	DWORD	clust;			/* Current cluster of fpter (not valid when fprt is 0) */
 	DWORD	dsect;			/* Sector number appearing in buf[] (0:invalid) */
 #if !_FS_READONLY
 	DWORD	dir_sect;		/* Sector number containing the directory entry */
 	BYTE*	dir_ptr;		/* Pointer to the directory entry in the win[] */
+	FSIZE_t	vsize;			/* Valid data extent on the medium (<= fsize, not extended by f_lseek) */
+#endif
+#if _FS_EXFAT
+	BYTE	stat;			/* Chain status (b1:contiguous without FAT chain) */
+	BYTE	c_stat;			/* Chain status of the containing directory */
+	WORD	c_idx;			/* Index of the entry set in the containing directory */
+	DWORD	n_cont;			/* Number of clusters in the chain without FAT chain */
+	DWORD	c_scl;			/* Start cluster of the containing directory (0:root) */
+	DWORD	c_ncont;		/* Number of clusters of the containing directory */
 #endif
 #if _USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (Nulled on file open) */
@@ -132,8 +259,22 @@ typedef struct {
 	UINT	lockid;			/* File lock ID origin from 1 (index of file semaphore table Files[]) */
 #endif
 #if !_FS_TINY
+#if _FS_POOL
+	BYTE*	buf;			/* Pointer to the pooled data read/write window (NULL:not resident) */
+#else
 	BYTE	buf[_MAX_SS];	/* File private data read/write window */
 #endif
+#endif
+#if _FS_REENTRANT == 2
+	_SYNC_t	sobj;			/* Identifier of sync object for the file */
+	WORD	nuse;			/* Number of callers holding or waiting for the sync object (b15:closed) */
+#endif
+#if _FS_PREFETCH
+	DWORD	pf_sect;		/* First sector in pf_buf[] */
+	UINT	pf_cnt;			/* Number of sectors in pf_buf[] (0:empty) */
+	FSIZE_t	pf_next;		/* File offset of the sector that continues a sequential read */
+	BYTE	pf_buf[_FS_PREFETCH * _MAX_SS];	/* Read-ahead buffer */
+#endif
 } FIL;
 
 
@@ -154,7 +295,18 @@ typedef struct {
 #endif
 #if _USE_LFN
 	WCHAR*	lfn;			/* Pointer to the LFN working buffer */
-	WORD	lfn_idx;		/* Last matched LFN index number (0xFFFF:No LFN) */
+	WORD	lfn_idx;		/* Last matched LFN index number (0xFFFF:No LFN, exFAT:Top of the entry set) */
+#endif
+#if _USE_LFN && !_FS_READONLY
+	BYTE	nseq;			/* Sequence number of the numbered SFN found not collided by the last search (0:unknown) */
+#endif
+#if _FS_EXFAT
+	BYTE	stat;			/* Chain status (b1:contiguous without FAT chain, b2:stretched) */
+	BYTE	c_stat;			/* Chain status of the containing directory */
+	WORD	c_idx;			/* Index of the entry set in the containing directory */
+	DWORD	n_cont;			/* Number of clusters of the directory */
+	DWORD	c_scl;			/* Start cluster of the containing directory (0:root) */
+	DWORD	c_ncont;		/* Number of clusters of the containing directory */
 #endif
 #if _USE_FIND
 	const TCHAR*	pat;	/* Pointer to the name matching pattern */
@@ -166,7 +318,7 @@ typedef struct {
 /* File information structure (FILINFO) */
 
 typedef struct {
-	DWORD	fsize;			/* File size */
+	FSIZE_t	fsize;			/* File size */
 	WORD	fdate;			/* Last modified date */
 	WORD	ftime;			/* Last modified time */
 	BYTE	fattrib;		/* Attribute */
@@ -179,6 +331,47 @@ typedef struct {
 
 
 
+/* Directory item structure (DIRITEM) */
+
+#if _USE_DIRPLUS
+#if _USE_DIRPLUS < 13 || _USE_DIRPLUS > 256
+#error Wrong _USE_DIRPLUS setting
+#endif
+typedef struct {
+	FSIZE_t	fsize;			/* File size */
+	DWORD	sclust;			/* Start cluster (0:no data) */
+	BYTE	fattrib;		/* Attribute */
+	BYTE	fstat;			/* Chain status (exFAT: non-zero if the data is contiguous without FAT chain) */
+	TCHAR	fname[_USE_DIRPLUS];	/* Long file name if it fits, short file name otherwise */
+} DIRITEM;
+#endif
+
+
+
+/* Volume layout analysis structure (FRAGINFO) */
+
+#if _USE_FRAGINFO
+#define FI_HIST	12			/* Number of buckets of the free run histogram */
+typedef struct {
+	DWORD	n_clust;		/* Number of clusters on the volume */
+	DWORD	n_free;			/* Number of free clusters */
+	DWORD	n_bad;			/* Number of bad clusters (FAT only) */
+	DWORD	n_chain;		/* Number of cluster chains, one per file or directory with data (FAT only) */
+	DWORD	n_extent;		/* Number of contiguous extents of the chains (FAT only) */
+	DWORD	n_frun;			/* Number of free runs */
+	DWORD	max_frun;		/* Number of clusters in the largest free run */
+	DWORD	max_ftop;		/* Top cluster of the largest free run */
+	DWORD	frun_hist[FI_HIST];	/* Free runs by length, bucket n counts 2^n to 2^(n+1)-1 clusters (the last one: all longer) */
+	DWORD	au_size;		/* Allocation unit (erase block) size in sectors (0:Unknown) */
+	DWORD	au_ofs;			/* Offset of the data area from an AU boundary in sectors */
+	DWORD	n_au;			/* Number of whole AUs in the data area (0:Clusters straddle the AUs) */
+	DWORD	n_au_free;		/* Number of them entirely free */
+	DWORD	n_au_part;		/* Number of them partly in use */
+} FRAGINFO;
+#endif
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -214,24 +407,37 @@ FRESULT f_close (FIL* fp);											/* Close an open file object */
 FRESULT f_read (FIL* fp, void* buff, UINT btr, UINT* br);			/* Read data from a file */
 FRESULT f_write (FIL* fp, const void* buff, UINT btw, UINT* bw);	/* Write data to a file */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
-FRESULT f_lseek (FIL* fp, DWORD ofs);								/* Move file pointer of a file object */
+FRESULT f_lseek (FIL* fp, FSIZE_t ofs);								/* Move file pointer of a file object */
 FRESULT f_truncate (FIL* fp);										/* Truncate file */
 FRESULT f_sync (FIL* fp);											/* Flush cached data of a writing file */
+FRESULT f_syncall (FIL* fps[], UINT n);								/* Flush cached data of multiple files on a volume at a time */
+FRESULT f_pin (FIL* fp, BYTE pin);									/* Pin/Unpin the pooled sector buffer of a file */
 FRESULT f_opendir (DIR* dp, const TCHAR* path);						/* Open a directory */
 FRESULT f_closedir (DIR* dp);										/* Close an open directory */
 FRESULT f_readdir (DIR* dp, FILINFO* fno);							/* Read a directory item */
+#if _USE_DIRPLUS
+FRESULT f_readdirplus (DIR* dp, DIRITEM* items, UINT n, UINT* nr);	/* Read directory items in a batch */
+#endif
 FRESULT f_findfirst (DIR* dp, FILINFO* fno, const TCHAR* path, const TCHAR* pattern);	/* Find first file */
 FRESULT f_findnext (DIR* dp, FILINFO* fno);							/* Find next file */
+int f_match (const TCHAR* pattern, const TCHAR* name);				/* Test a name against a matching pattern */
 FRESULT f_mkdir (const TCHAR* path);								/* Create a sub directory */
 FRESULT f_unlink (const TCHAR* path);								/* Delete an existing file or directory */
 FRESULT f_rename (const TCHAR* path_old, const TCHAR* path_new);	/* Rename/Move a file or directory */
 FRESULT f_stat (const TCHAR* path, FILINFO* fno);					/* Get file status */
 FRESULT f_chmod (const TCHAR* path, BYTE attr, BYTE mask);			/* Change attribute of the file/dir */
 FRESULT f_utime (const TCHAR* path, const FILINFO* fno);			/* Change times-tamp of the file/dir */
+FRESULT f_defrag (const TCHAR* path, BYTE opt, void* work, UINT sz_work, DWORD* nfrag);	/* Count fragments of a file/Make it contiguous */
 FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+#if _USE_FRAGINFO
+FRESULT f_fraginfo (const TCHAR* path, FRAGINFO* fi, void* work, UINT sz_work);	/* Analyze fragmentation and layout of the drive */
+#if _USE_DIRPLUS
+FRESULT f_itemfrags (const TCHAR* path, const DIRITEM* item, DWORD* nfrag);	/* Count fragments of a directory item */
+#endif
+#endif
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
@@ -309,6 +515,7 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 #define FS_FAT12	1
 #define FS_FAT16	2
 #define FS_FAT32	3
+#define FS_EXFAT	4
 
 
 /* File attribute bits for directory entry */
@@ -324,7 +531,7 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 
 
 /* Fast seek feature */
-#define CREATE_LINKMAP	0xFFFFFFFF
+#define CREATE_LINKMAP	((FSIZE_t)0 - 1)
 
 
 
@@ -342,6 +549,10 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 #define	ST_WORD(ptr,val)	*(BYTE*)(ptr)=(BYTE)(val); *((BYTE*)(ptr)+1)=(BYTE)((WORD)(val)>>8)
 #define	ST_DWORD(ptr,val)	*(BYTE*)(ptr)=(BYTE)(val); *((BYTE*)(ptr)+1)=(BYTE)((WORD)(val)>>8); *((BYTE*)(ptr)+2)=(BYTE)((DWORD)(val)>>16); *((BYTE*)(ptr)+3)=(BYTE)((DWORD)(val)>>24)
 #endif
+#if _FS_EXFAT			/* 64-bit fields of the exFAT structure */
+#define	LD_QWORD(ptr)		(QWORD)(((QWORD)LD_DWORD((BYTE*)(ptr)+4)<<32)|LD_DWORD(ptr))
+#define	ST_QWORD(ptr,val)	ST_DWORD(ptr,(DWORD)(val)); ST_DWORD((BYTE*)(ptr)+4,(DWORD)((QWORD)(val)>>32))
+#endif
 
 #ifdef __cplusplus
 }
@@ -39,6 +39,13 @@
 /  f_findfirst() and f_findnext(). (0:Disable or 1:Enable) */
 
 
+#define _USE_DIRPLUS	32
+/* This option switches batched directory read function, f_readdirplus(), and
+/  sets the size of the name field of its items in unit of TCHAR. (0:Disable or
+/  13-256) An item takes the long file name when it fits in the field and the
+/  short file name otherwise. */
+
+
 #define	_USE_MKFS		1
 /* This option switches f_mkfs() function. (0:Disable or 1:Enable) */
 
@@ -57,11 +64,23 @@
 /  To enable it, also _FS_TINY need to be set to 1. */
 
 
+#define	_USE_DEFRAG		1
+/* This option switches f_defrag() function, which counts the fragments of a
+/  file and moves it into a contiguous run of clusters. (0:Disable or 1:Enable)
+/  It is not available at read-only configuration. */
+
+
+#define	_USE_FRAGINFO	1
+/* This option switches f_fraginfo() function, which analyzes the fragmentation
+/  of the files and the free space and the alignment of the data area to the
+/  allocation units of the media. (0:Disable or 1:Enable) */
+
+
 /*---------------------------------------------------------------------------/
 / Locale and Namespace Configurations
 /---------------------------------------------------------------------------*/
 
-#define _CODE_PAGE	1
+#define _CODE_PAGE	437
 /* This option specifies the OEM code page to be used on the target system.
 /  Incorrect setting of the code page can cause a file open failure.
 /
@@ -90,22 +109,32 @@
 */
 
 
-#define	_USE_LFN	0
+#define	_USE_LFN	1
 #define	_MAX_LFN	255
 /* The _USE_LFN option switches the LFN feature.
 /
 /   0: Disable LFN feature. _MAX_LFN has no effect.
-/   1: Enable LFN with static working buffer on the BSS. Always NOT thread-safe.
+/   1: Enable LFN with static working buffer in the file system object (per volume).
 /   2: Enable LFN with dynamic working buffer on the STACK.
 /   3: Enable LFN with dynamic working buffer on the HEAP.
 /
-/  When enable the LFN feature, Unicode handling functions (option/unicode.c) must
-/  be added to the project. The LFN working buffer occupies (_MAX_LFN + 1) * 2 bytes.
+/  When enable the LFN feature, Unicode handling functions (ccsbcs.c) must be added
+/  to the project. The LFN working buffer occupies (_MAX_LFN + 1) * 2 bytes. It is
+/  used only while the volume is locked, so that option 1 is also thread-safe.
 /  When use stack for the working buffer, take care on stack overflow. When use heap
 /  memory for the working buffer, memory management functions, ff_memalloc() and
 /  ff_memfree(), must be added to the project. */
 
 
+#define	_LFN_HASH	128
+/* This option sets the number of objects per volume whose name hash is cached (0 to
+/  255, 0:Disable). The hash of the up-cased LFN and the checksum of the SFN of each
+/  object scanned are recorded for the directory searched last. A later search in
+/  the same directory decodes only the objects whose hash or checksum matches the
+/  name to find, and tells a name not found in a fully cached directory without
+/  reading it. Each item occupies 6 bytes in the file system object. */
+
+
 #define	_LFN_UNICODE	0
 /* This option switches character encoding on the API. (0:ANSI/OEM or 1:Unicode)
 /  To use Unicode string for the path name, enable LFN feature and set _LFN_UNICODE
@@ -138,8 +167,9 @@
 / Drive/Volume Configurations
 /---------------------------------------------------------------------------*/
 
-#define _VOLUMES	1
-/* Number of volumes (logical drives) to be used. */
+#define _VOLUMES	2
+/* Number of volumes (logical drives) to be used. Each volume is a card slot of
+/  the SD driver, a slot with no SPI component bound to it reports no disk. */
 
 
 #define _STR_VOLUME_ID	0
@@ -187,6 +217,33 @@
 */
 
 
+#define	_FS_ALLOCSUM	0
+/* This option sets the number of regions in the allocation summary of each
+/  volume (0:Disable or 1-64). The summary is a sector in the reserved area
+/  holding the number of free clusters of the volume and of each region, and it
+/  is written on unmount. The mount that finds it closed takes the counts from
+/  it, so that f_getfree() and the cluster allocation need no FAT scan, and the
+/  allocation skips the regions without free cluster. Its generation counter is
+/  advanced on the disk before the first allocation change after the mount, so
+/  that a summary left by a power failure is not taken and the counts are got
+/  by a FAT scan as without it. A summary not matching the free cluster count
+/  in the FSINFO was changed by another system and is not taken either, so it
+/  is used only on FAT32 volumes and not with _FS_NOFSINFO bit 0 set. When the
+/  allocation misses free clusters hidden by the summary, it searches again
+/  without it. The summary takes a sector in front of the journal area and is
+/  not used on a volume without room for it. f_mkfs() reserves it. */
+
+
+#define	_FS_EXFAT	0
+/* This option switches support of the exFAT file system. (0:Disable or 1:Enable)
+/  exFAT volumes can hold files of 4GB and larger, so the file size and the file
+/  pointer become 64-bit (FSIZE_t) at this configuration. Clusters are allocated
+/  on the allocation bitmap and a file stays without FAT chain as long as it is
+/  contiguous. To enable exFAT, also LFN feature needs to be enabled (_USE_LFN >= 1)
+/  and relative path feature needs to be disabled (_FS_RPATH == 0). f_mkfs()
+/  creates only FAT volumes and f_setlabel() is denied on the exFAT volume. */
+
+
 
 /*---------------------------------------------------------------------------/
 / System Configurations
@@ -200,6 +257,69 @@
 /  data transfer. */
 
 
+#define	_FS_POOL	0
+/* This option switches shared sector buffer pool. (0:Disable or >0:Number of
+/  sector buffers in the pool)
+/  At the pooled buffer configuration, the private sector buffer is removed from
+/  the file object (FIL) and the open files borrow _MAX_SS-byte buffers from a
+/  common pool instead. When all buffers are in use, the least recently used one
+/  is reclaimed from its file, dirty data is written back, and the file reloads
+/  its sector on the next access. f_pin() function keeps the buffer of a file
+/  from being reclaimed. All file objects must be closed with f_close() function
+/  at this configuration. This option cannot be used with _FS_TINY or
+/  _FS_REENTRANT. */
+
+
+#define	_FS_PREFETCH	0
+/* This option switches sequential read-ahead. (0:Disable or >0:Number of
+/  sectors to read ahead)
+/  When f_read() function loads the sector at the top of the file or the one
+/  following the sector it loaded last, up to this number of sectors are read
+/  with one multiple sector read into a read-ahead buffer in the file object,
+/  and the next sector loads are served from it. The read-ahead buffer adds
+/  _FS_PREFETCH * _MAX_SS bytes to the file object and is discarded on each
+/  write to the file. This option cannot be used with _FS_TINY. */
+
+
+#define	_FS_JOURNAL	0
+/* This option sets the number of sectors held by the metadata journal of each
+/  volume (0:Disable or 1-32). The FAT, directory and FSINFO sectors changed
+/  between syncs are kept in a buffer in the file system object and written at
+/  each sync as one record into the reserved area with a single multiple sector
+/  write. They are written in place only when the buffer gets full, on unmount
+/  and, after a power failure, on the next mount, so that an operation is either
+/  seen complete or not at all. An operation changing more sectors than the
+/  buffer holds is written in place in the middle like without the journal.
+/  The journal takes 2 * (_FS_JOURNAL + 1) sectors at end of the reserved area
+/  and is not used on a volume without room for it. f_mkfs() reserves it. The
+/  buffer adds (_FS_JOURNAL + 1) * _MAX_SS bytes to the file system object.
+/  This option cannot be used with _FS_TINY. */
+
+
+#define	_FS_DIRHINT	4
+/* This option sets the number of directories per volume whose first free entry
+/  is remembered (0:Disable). An object created in one of them is allocated
+/  from there instead of scanning the directory table from the top, and the
+/  hint is moved back when an object in the directory is removed. The hints
+/  are kept for the directories where objects were created last. */
+
+
+#define	_FS_DCACHE	8
+/* This option sets the number of sub-directories per volume remembered in the
+/  path cache (0:Disable). A path segment of up to 12 characters followed into a
+/  sub-directory is recorded with its parent, and later paths through it enter
+/  the sub-directory without searching the parent. The segments are compared
+/  as given, so that a path written in another case or with a different
+/  separator is searched and recorded again. An item is forgotten when its
+/  directory is renamed or removed. */
+
+
+#define	_FS_STATS	1
+/* This option switches I/O statistics counters in the file system object. The
+/  counters are cleared on each volume mount and can be read from the member
+/  st of the FATFS structure. (0:Disable or 1:Enable) */
+
+
 #define _FS_NORTC	1
 #define _NORTC_MON	1
 #define _NORTC_MDAY	1
@@ -239,7 +359,19 @@
 /   1: Enable re-entrancy. Also user provided synchronization handlers,
 /      ff_req_grant(), ff_rel_grant(), ff_del_syncobj() and ff_cre_syncobj()
 /      function, must be added to the project. Samples are available in
-/      option/syscall.c.
+/      option/syscall.c and syscall_pthread.c.
+/   2: Enable re-entrancy with a sync object for each open file in addition to
+/      the volume. f_read(), f_write() and f_lseek() function lock only the file
+/      object and take the volume lock just for FAT access, so that the file
+/      data transfers on different files run in parallel. The other functions
+/      working on a file object lock the file object and then the volume. The
+/      disk I/O functions must allow concurrent calls and _FS_TINY must be 0.
+/      The SD card driver of this project does not allow concurrent calls and
+/      stops the build at this setting. A file object shared by tasks can be
+/      closed while the others wait on it, they get FR_INVALID_OBJECT, but its
+/      memory must stay valid until they return. The file lock and the
+/      statistics counters of _FS_STATS use the __atomic built-in functions of
+/      GCC at this setting.
 /
 /  The _FS_TIMEOUT defines timeout period in unit of time tick.
 /  The _SYNC_t defines O/S dependent sync object type. e.g. HANDLE, ID, OS_EVENT*,
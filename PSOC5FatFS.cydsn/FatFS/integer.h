@@ -26,5 +26,8 @@ typedef uint32_t    	UINT;
 typedef int32_t			LONG;
 typedef uint32_t    	DWORD;
 
+/* This type MUST be 64-bit (Remove this for C89 compatibility) */
+typedef uint64_t    	QWORD;
+
 
 #endif
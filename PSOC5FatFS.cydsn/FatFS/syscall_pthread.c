@@ -0,0 +1,142 @@
+/*------------------------------------------------------------------------*/
+/* Sample code of OS dependent controls for FatFs on POSIX threads        */
+/*------------------------------------------------------------------------*/
+/* This file is for building FatFs on a POSIX host (e.g. Linux) with
+/  _FS_REENTRANT 1 or 2. Define _SYNC_t as void* in ffconf.h, the sync
+/  objects are mutexes allocated on the heap and _FS_TIMEOUT is taken in
+/  milliseconds. The LFN working buffer at _USE_LFN 3 is taken from the
+/  heap as well. It is not part of the PSoC Creator project. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include "ff.h"
+
+
+#if _FS_REENTRANT
+/*------------------------------------------------------------------------*/
+/* Create a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called in f_mount() function to create a new
+/  synchronization object, such as semaphore and mutex, and in f_open()
+/  function for the file object at _FS_REENTRANT == 2. When a 0 is returned,
+/  the function fails with FR_INT_ERR.
+*/
+
+int ff_cre_syncobj (	/* !=0:Function succeeded, ==0:Could not create due to any error */
+	BYTE vol,			/* Corresponding logical drive being processed */
+	_SYNC_t *sobj		/* Pointer to return the created sync object */
+)
+{
+	pthread_mutex_t *mtx;
+
+
+	(void)vol;
+	mtx = malloc(sizeof(pthread_mutex_t));
+	if (!mtx) return 0;
+	if (pthread_mutex_init(mtx, 0) != 0) {
+		free(mtx);
+		return 0;
+	}
+	*sobj = mtx;
+	return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Delete a Synchronization Object                                        */
+/*------------------------------------------------------------------------*/
+/* This function is called in f_mount() function to delete a synchronization
+/  object that created with ff_cre_syncobj function, and in f_close() function
+/  for the file object at _FS_REENTRANT == 2. When a 0 is returned, the
+/  function fails with FR_INT_ERR.
+*/
+
+int ff_del_syncobj (	/* !=0:Function succeeded, ==0:Could not delete due to any error */
+	_SYNC_t sobj		/* Sync object tied to the logical drive or file to be deleted */
+)
+{
+	pthread_mutex_t *mtx = sobj;
+
+
+	if (pthread_mutex_destroy(mtx) != 0) return 0;
+	free(mtx);
+	return 1;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Request Grant to Access the Volume or File                             */
+/*------------------------------------------------------------------------*/
+/* This function is called on entering file functions to lock the volume or
+/  the file object. When a 0 is returned, the file function fails with
+/  FR_TIMEOUT.
+*/
+
+int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a grant */
+	_SYNC_t sobj	/* Sync object to wait */
+)
+{
+	struct timespec ts;
+
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += _FS_TIMEOUT / 1000;
+	ts.tv_nsec += (long)(_FS_TIMEOUT % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return pthread_mutex_timedlock((pthread_mutex_t*)sobj, &ts) == 0;
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Release Grant to Access the Volume or File                             */
+/*------------------------------------------------------------------------*/
+/* This function is called on leaving file functions to unlock the volume or
+/  the file object.
+*/
+
+void ff_rel_grant (
+	_SYNC_t sobj	/* Sync object to be signaled */
+)
+{
+	pthread_mutex_unlock((pthread_mutex_t*)sobj);
+}
+
+#endif
+
+
+
+#if _USE_LFN == 3	/* LFN feature with a dynamic working buffer */
+/*------------------------------------------------------------------------*/
+/* Allocate a memory block                                                */
+/*------------------------------------------------------------------------*/
+/* If a NULL is returned, the file function fails with FR_NOT_ENOUGH_CORE.
+*/
+
+void* ff_memalloc (	/* Returns pointer to the allocated memory block */
+	UINT msize		/* Number of bytes to allocate */
+)
+{
+	return malloc(msize);	/* Allocate a new memory block with POSIX API */
+}
+
+
+
+/*------------------------------------------------------------------------*/
+/* Free a memory block                                                    */
+/*------------------------------------------------------------------------*/
+
+void ff_memfree (
+	void* mblock	/* Pointer to the memory block to free */
+)
+{
+	free(mblock);	/* Discard the memory block with POSIX API */
+}
+
+#endif
@@ -1,13 +1,29 @@
 #include "project.h"
 #include <stdio.h>
+#include <string.h>
 #include "FatFS/ff.h"
 #include "FatFS/FatFS_PrettyMacros.h"
+#include "FatFS/FatFS_StreamRing.h"
+#include "FatFS/FatFS_TreeWalk.h"
 #include "FatFSCmdInterface.h"
+#include "StorageService.h"
 
 
 /*  Implementation for the interface of the FatFS testing utility */
 
 
+#define BENCH_FILE_SIZE     32768u      // size the benchmark file is preallocated to
+#define BENCH_RECORD_SIZE   64u         // size of the records the read benchmark reads
+#define BENCH_RING_BURST    24u         // records the ring benchmark commits between drains
+#define DEFRAG_WORK_SIZE    4096u       // copy buffer of the defragmenter, half of it takes the data read back to verify
+#define FRAGINFO_WORK_SIZE  2048u       // FAT read per disk access by the layout analysis
+#define LIST_BATCH_ITEMS    16u         // directory items read per call when listing
+#define LIST_PACKET_SIZE    64u         // bytes handed to the usb uart at a time, one full speed packet
+#define LIST_OUT_SIZE       512u        // listing output is gathered up to this many bytes before it is sent
+#define LIST_LINE_SIZE      (TREE_PATH_SIZE + _USE_DIRPLUS + 24)   // longest line or record of a listing
+#define QUEUED_NAME_SIZE    128u        // file name of a queued write, as long as the file name field of a command
+
+
 
 void Print_ToUSBUart(const char *buf) {
  
@@ -16,18 +32,42 @@ void Print_ToUSBUart(const char *buf) {
 }
 
 
+// send len bytes of buf to the usb uart, unlike Print_ToUSBUart it can send zero bytes
+void Write_ToUSBUart(const uint8_t *buf, uint16_t len) {
+    
+    while (len) {
+        uint16_t packetLen = (len > LIST_PACKET_SIZE) ? LIST_PACKET_SIZE : len;
+        while (!USBUART_CDCIsReady()) {};
+        USBUART_PutData(buf, packetLen);
+        buf += packetLen;
+        len -= packetLen;
+    }
+}
+
+
 // '?' will display the available commands
 void Display_Help(void) {
     Print_ToUSBUart("\n---Available Commands---\n");
     Print_ToUSBUart("NOTE; Commands with multiple parameters should have no spaces after the comma.\n\n");
     Print_ToUSBUart("? : Display this menu\n");
     Print_ToUSBUart("mount : Mount card\n");
+    Print_ToUSBUart("umount : Unmount card, do it before removing the card so the next mount is fast\n");
     Print_ToUSBUart("free : Print free space available\n");
-    Print_ToUSBUart("list : List disk contents\n");
+    Print_ToUSBUart("card : Print card type and geometry\n");
+    Print_ToUSBUart("stats : Print card wait times\n");
+    Print_ToUSBUart("list[,dirName[,bin]] : List dirName (the root when not given) as text, or as packed binary records with bin\n");
+    Print_ToUSBUart("tree[,dirName[,pattern]] : List the files below dirName with their paths, only the ones matching pattern if given\n");
+    Print_ToUSBUart("du[,dirName] : Print the size of every directory below dirName\n");
+    Print_ToUSBUart("fraginfo[,dirName] : Print the free space layout and the fragmented files below dirName\n");
     Print_ToUSBUart("erase,fileName : Erase fileName\n");
     Print_ToUSBUart("create,fileName : Create empty file with fileName\n");
     Print_ToUSBUart("print,fileName : Display contents of filename\n");
-    Print_ToUSBUart("append,fileName,data : Add text 'data' to end of fileName\n\n");
+    Print_ToUSBUart("append,fileName,data : Add text 'data' to end of fileName\n");
+    Print_ToUSBUart("bench,fileName : Fill a preallocated fileName with records and show the sector counters\n");
+    Print_ToUSBUart("readbench,fileName : Read fileName in small records and show the sector counters\n");
+    Print_ToUSBUart("ringbench,fileName : Stream records to fileName through the ISR ring and show its counters\n");
+    Print_ToUSBUart("defrag,fileName : Move fileName into contiguous clusters, verifying the copy\n");
+    Print_ToUSBUart("qwrite,fileName,data : Write text 'data' to a new fileName through the storage queue\n\n");
 }
 
 
@@ -43,6 +83,18 @@ void Mount_Disk(FatFS_t *fatFS) {
 }
 
 
+// unmount the card, the allocation summary (if enabled) is written so the next mount needs no FAT scan
+void Unmount_Disk(void) {
+    FatFS_Result_t res = f_mount(NULL, "", 0);
+    if (res != FR_OK) {
+        Print_ToUSBUart("Error unmounting sd card\n");
+    }
+    else {
+        Print_ToUSBUart("Unmounted sd card\n");
+    }
+}
+
+
 // delete the given fileName from the disk
 void Erase_File(const char *fileName) {
    char buf[64];
@@ -129,26 +181,250 @@ void Append_File(const char *fileName, const char *line) {
 }
 
 
-// List the contents of the root directory
-void List_Dir(void) {
-    char buf[64];
+// listing output is gathered here and sent in full packets instead of one transfer per line
+static uint8_t _OutBuf[LIST_OUT_SIZE];
+static uint16_t _OutLen;
+
+
+// send what has been gathered
+static void Out_Flush(void) {
+
+    Write_ToUSBUart(_OutBuf, _OutLen);
+    _OutLen = 0;
+}
+
+
+// gather len bytes of data, sending what was gathered first if they do not fit
+static void Out_Add(const void *data, uint16_t len) {
+
+    if (_OutLen + len > LIST_OUT_SIZE) {
+        Out_Flush();
+    }
+    memcpy(&_OutBuf[_OutLen], data, len);
+    _OutLen += len;
+}
+
+
+// add one packed binary record for a directory item to the output, records are little endian
+//   size[4] (0xFFFFFFFF when it does not fit), first cluster[4], attributes[1], name length[1], name
+static void Out_DirItem(uint32_t size, uint32_t clust, uint8_t attr, const char *name) {
+    uint8_t record[10 + _USE_DIRPLUS];
+    uint8_t nameLen = strlen(name);
+    
+    for (uint8_t i = 0; i < 4; i++) {
+        record[i] = size >> (i * 8);
+        record[4 + i] = clust >> (i * 8);
+    }
+    record[8] = attr;
+    record[9] = nameLen;
+    memcpy(&record[10], name, nameLen);
+    Out_Add(record, 10 + nameLen);
+}
+
+
+// size of a directory item as the listings show it
+static uint32_t Item_Size(const FatFS_DirItem_t *item) {
+#if _FS_EXFAT
+    return (item->fsize > 0xFFFFFFFF) ? 0xFFFFFFFF : item->fsize;
+#else
+    return item->fsize;
+#endif
+}
+
+
+// List the contents of dirName (the root directory when empty) a batch of items at a time
+//   text: one line per item
+//   binary: packed records followed by an end record with an empty name, the item count as size and the result as attributes
+void List_Dir(const char *dirName, bool binary) {
+    static FatFS_DirItem_t items[LIST_BATCH_ITEMS];
+    char line[LIST_LINE_SIZE];
     FatFS_Dir_t dirObj;         /* Directory search object */
-    FatFS_FileInfo_t fileInfo;    /* File information */
+    uint32_t itemCnt = 0;
+    UINT readCnt = 0;
     
-    Print_ToUSBUart("Listing Dir:\n");
-    FatFS_Result_t res = f_findfirst(&dirObj, &fileInfo, "", "*");
+    if (!binary) {
+        Print_ToUSBUart("Listing Dir:\n");
+    }
+    FatFS_Result_t res = f_opendir(&dirObj, dirName);
     if (res == FR_OK) {
-        while ((res == FR_OK) && (fileInfo.fname[0]) != 0) {
-            sprintf(buf, "File: %s\n", fileInfo.fname);
-            Print_ToUSBUart(buf);
-            res = f_findnext(&dirObj, &fileInfo);
-        }
-        Print_ToUSBUart("\n--Done--\n");
+        do {
+            res = f_readdirplus(&dirObj, items, LIST_BATCH_ITEMS, &readCnt);
+            for (UINT i = 0; (res == FR_OK) && (i < readCnt); i++) {
+                FatFS_DirItem_t *item = &items[i];
+                
+                if (binary) {
+                    Out_DirItem(Item_Size(item), item->sclust, item->fattrib, item->fname);
+                }
+                else {
+                    Out_Add(line, sprintf(line, "%c %10lu %s\n", (item->fattrib & AM_DIR) ? 'd' : '-', Item_Size(item), item->fname));
+                }
+                itemCnt++;
+            }
+        } while ((res == FR_OK) && (readCnt == LIST_BATCH_ITEMS));
         f_closedir(&dirObj);
-        
+    }
+    
+    if (binary) {
+        Out_DirItem(itemCnt, 0, res, "");
+        Out_Flush();
+    }
+    else {
+        Out_Flush();
+        if (res == FR_OK) {
+            sprintf(line, "\n--Done, %lu items--\n", itemCnt);
+            Print_ToUSBUart(line);
+        }
+        else {
+            Print_ToUSBUart("Error listing directory\n");
+        }
+    }
+}
+
+
+// tree walk callback of Tree_List, one line with size and path per file
+static bool Tree_ListFile(TreeWalk_t *walk, TreeEvent_t event, const FatFS_DirItem_t *item) {
+    char line[LIST_LINE_SIZE];
+    
+    if (event == TREE_EVENT_FILE) {
+        const char *sep = (walk->path[0] && (walk->path[strlen(walk->path) - 1] != '/')) ? "/" : "";
+        Out_Add(line, sprintf(line, "%10lu %s%s%s\n", Item_Size(item), walk->path, sep, item->fname));
+    }
+    return true;
+}
+
+
+// tree walk callback of Disk_Usage, one line with the total size per directory once everything below it is done
+static bool Tree_DirUsage(TreeWalk_t *walk, TreeEvent_t event, const FatFS_DirItem_t *item) {
+    char line[LIST_LINE_SIZE];
+    TreeLevel_t *level = &walk->levels[walk->depth];
+    
+    if (event == TREE_EVENT_DIR_DONE) {
+        Out_Add(line, sprintf(line, "%10lu KiB %s\n", (uint32_t)((level->bytes + 1023) / 1024), walk->path[0] ? walk->path : "/"));
+    }
+    return true;
+}
+
+
+// print the totals of a finished tree walk
+static void Tree_PrintTotals(TreeWalk_t *walk, FatFS_Result_t res) {
+    char line[80];
+    TreeLevel_t *level = &walk->levels[0];
+    
+    Out_Flush();
+    if (res == FR_OK) {
+        sprintf(line, "\n--Done, %lu files, %lu dirs, %lu KiB--\n", level->files, level->dirs, (uint32_t)((level->bytes + 1023) / 1024));
+        Print_ToUSBUart(line);
+        if (walk->skipped) {
+            sprintf(line, "Directories too deep to enter: %lu\n", walk->skipped);
+            Print_ToUSBUart(line);
+        }
     }
     else {
-        USBUART_PutString("Error listing directory");   
+        sprintf(line, "Error walking directory %s (%u)\n", walk->path, res);
+        Print_ToUSBUart(line);
+    }
+}
+
+
+// list every file below dirName (the root directory when empty) with its path, only the ones matching pattern if
+// it is not empty, so the contents of a card can be taken as a manifest
+void Tree_List(const char *dirName, const char *pattern) {
+    static TreeWalk_t walk;
+    
+    Print_ToUSBUart("Listing tree:\n");
+    FatFS_Result_t res = TreeWalk_Run(&walk, dirName, pattern, Tree_ListFile, 0);
+    Tree_PrintTotals(&walk, res);
+}
+
+
+// print the size of the files below every directory below dirName (the root directory when empty), deepest first
+void Disk_Usage(const char *dirName) {
+    static TreeWalk_t walk;
+    
+    Print_ToUSBUart("Disk usage:\n");
+    FatFS_Result_t res = TreeWalk_Run(&walk, dirName, 0, Tree_DirUsage, 0);
+    Tree_PrintTotals(&walk, res);
+}
+
+
+// fragment counts of the files visited by Frag_Info
+typedef struct {
+    uint32_t files;                 // files with data
+    uint32_t fragmented;            // files in more than one extent
+    uint32_t extents;               // extents of all the files
+    FatFS_Result_t res;             // error that ended the walk
+} FragCount_t;
+
+
+// tree walk callback of Frag_Info, one line with the extent count per fragmented file
+static bool Tree_FragFile(TreeWalk_t *walk, TreeEvent_t event, const FatFS_DirItem_t *item) {
+    FragCount_t *count = walk->context;
+    DWORD extents;
+    
+    if ((event != TREE_EVENT_FILE) || !item->sclust) return true;
+    
+    // the chain is followed from the item itself, the file is not looked up again by its name
+    count->res = f_itemfrags(walk->path, item, &extents);
+    if (count->res != FR_OK) return false;
+    
+    count->files++;
+    count->extents += extents;
+    if (extents > 1) {
+        char line[LIST_LINE_SIZE + 12];
+        const char *sep = (walk->path[0] && (walk->path[strlen(walk->path) - 1] != '/')) ? "/" : "";
+        count->fragmented++;
+        Out_Add(line, sprintf(line, "%6lu %s%s%s\n", extents, walk->path, sep, item->fname));
+    }
+    return true;
+}
+
+
+// print how the free space is split up and how it sits on the allocation units of the card, then the extent count
+// of every fragmented file below dirName (the root directory when empty)
+void Frag_Info(const char *dirName) {
+    static uint8_t work[FRAGINFO_WORK_SIZE];
+    static TreeWalk_t walk;
+    FatFS_FragInfo_t info;
+    FragCount_t count = { 0, 0, 0, FR_OK };
+    char line[96];
+    
+    FatFS_Result_t res = f_fraginfo("", &info, work, sizeof(work));
+    if (res != FR_OK) {
+        sprintf(line, "Error analyzing disk (%u)\n", res);
+        Print_ToUSBUart(line);
+        return;
+    }
+    
+    sprintf(line, "Clusters: %lu, free: %lu, bad: %lu\n", info.n_clust, info.n_free, info.n_bad);
+    Print_ToUSBUart(line);
+    sprintf(line, "Chains: %lu, extents: %lu\n", info.n_chain, info.n_extent);
+    Print_ToUSBUart(line);
+    sprintf(line, "Free runs: %lu, largest: %lu clusters at %lu\n", info.n_frun, info.max_frun, info.max_ftop);
+    Print_ToUSBUart(line);
+    for (uint8_t i = 0; i < FI_HIST; i++) {
+        if (info.frun_hist[i]) {
+            sprintf(line, "  %6lu%s clusters: %lu\n", 1ul << i, (i == FI_HIST - 1) ? "+" : "", info.frun_hist[i]);
+            Print_ToUSBUart(line);
+        }
+    }
+    if (info.au_size) {
+        sprintf(line, "AU: %lu sectors, data area offset %lu sectors\n", info.au_size, info.au_ofs);
+        Print_ToUSBUart(line);
+        sprintf(line, "AUs: %lu, free: %lu, partly used: %lu\n", info.n_au, info.n_au_free, info.n_au_part);
+        Print_ToUSBUart(line);
+    }
+    
+    Print_ToUSBUart("Fragmented files:\n");
+    res = TreeWalk_Run(&walk, dirName, 0, Tree_FragFile, &count);
+    if (res == FR_OK) res = count.res;
+    Out_Flush();
+    if (res == FR_OK) {
+        sprintf(line, "\n--Done, %lu of %lu files fragmented, %lu extents--\n", count.fragmented, count.files, count.extents);
+        Print_ToUSBUart(line);
+    }
+    else {
+        sprintf(line, "Error walking directory %s (%u)\n", walk.path, res);
+        Print_ToUSBUart(line);
     }
 }
 
@@ -180,3 +456,322 @@ void Get_FreeSpace(FatFS_t *fatFs) {
     }
 }
 
+
+
+// preallocate fileName, fill it with small records and print how many sectors had to be read to do it
+void Bench_Append(FatFS_t *fatFs, const char *fileName) {
+    char buf[80];
+    FatFS_File_t fileHandle;
+    uint32_t recordCnt = 0, written = 0;
+    UINT bytesWritten;
+    
+    sprintf(buf, "Benchmarking appends to file: %s\n", fileName);
+    Print_ToUSBUart(buf);
+
+    FatFS_Result_t res = f_open(&fileHandle, fileName, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        Print_ToUSBUart("Error creating file\n");
+        return;
+    }
+    
+    // extend the file up front like a logger would, then rewind and write into it
+    res = f_lseek(&fileHandle, BENCH_FILE_SIZE);
+    if (res == FR_OK) {
+        res = f_lseek(&fileHandle, 0);
+    }
+    
+#if _FS_STATS
+    FSSTAT before = fatFs->st;
+#endif
+    while ((res == FR_OK) && (written < BENCH_FILE_SIZE)) {
+        sprintf(buf, "Record %05lu: the quick brown fox jumps over the lazy dog\n", recordCnt++);
+        res = f_write(&fileHandle, buf, strlen(buf), &bytesWritten);
+        written += bytesWritten;
+    }
+    if (f_close(&fileHandle) != FR_OK) {
+        res = FR_DISK_ERR;
+    }
+    
+    if (res == FR_OK) {
+        sprintf(buf, "Wrote %lu records, %lu bytes\n", recordCnt, written);
+        Print_ToUSBUart(buf);
+#if _FS_STATS
+        sprintf(buf, "Sector reads: %lu\n", fatFs->st.rd_fill - before.rd_fill);
+        Print_ToUSBUart(buf);
+        sprintf(buf, "Sector reads skipped: %lu\n", fatFs->st.rd_skip - before.rd_skip);
+        Print_ToUSBUart(buf);
+#endif
+        Print_ToUSBUart("Done\n");
+    }
+    else {
+        Print_ToUSBUart("Error writing file\n");
+    }
+}
+
+
+// read fileName in small records and print how many sector loads the read-ahead buffer served
+void Bench_Read(FatFS_t *fatFs, const char *fileName) {
+    char buf[80];
+    uint8_t record[BENCH_RECORD_SIZE];
+    FatFS_File_t fileHandle;
+    uint32_t recordCnt = 0, totalRead = 0;
+    UINT bytesRead;
+    
+    sprintf(buf, "Benchmarking reads from file: %s\n", fileName);
+    Print_ToUSBUart(buf);
+
+    FatFS_Result_t res = f_open(&fileHandle, fileName, FA_READ);
+    if (res != FR_OK) {
+        Print_ToUSBUart("Error opening file\n");
+        return;
+    }
+    
+#if _FS_STATS
+    FSSTAT before = fatFs->st;
+#endif
+    do {
+        res = f_read(&fileHandle, record, BENCH_RECORD_SIZE, &bytesRead);
+        totalRead += bytesRead;
+        recordCnt++;
+    } while ((res == FR_OK) && (bytesRead == BENCH_RECORD_SIZE));
+    f_close(&fileHandle);
+    
+    if (res == FR_OK) {
+        sprintf(buf, "Read %lu records, %lu bytes\n", recordCnt, totalRead);
+        Print_ToUSBUart(buf);
+#if _FS_STATS
+        sprintf(buf, "Sector loads: %lu\n", fatFs->st.rd_fill - before.rd_fill);
+        Print_ToUSBUart(buf);
+#if _FS_PREFETCH
+        uint32_t hits = fatFs->st.pf_hit - before.pf_hit;
+        uint32_t misses = fatFs->st.pf_miss - before.pf_miss;
+        sprintf(buf, "Read-ahead hits: %lu, misses: %lu (%lu%%)\n", hits, misses, (hits + misses) ? (hits * 100 / (hits + misses)) : 0);
+        Print_ToUSBUart(buf);
+#endif
+#endif
+        Print_ToUSBUart("Done\n");
+    }
+    else {
+        Print_ToUSBUart("Error reading file\n");
+    }
+}
+
+
+
+// stream records into fileName through the ring the way an ISR logger would, draining after every burst
+void Bench_Ring(const char *fileName) {
+    static StreamRing_t ring;
+    char buf[80];
+    FatFS_File_t fileHandle;
+    uint32_t recordCnt = 0, committed = 0, slotCnt = 0, drained;
+    
+    sprintf(buf, "Benchmarking ring writes to file: %s\n", fileName);
+    Print_ToUSBUart(buf);
+
+    FatFS_Result_t res = f_open(&fileHandle, fileName, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        Print_ToUSBUart("Error creating file\n");
+        return;
+    }
+    
+    StreamRing_Init(&ring);
+    while ((res == FR_OK) && (committed < BENCH_FILE_SIZE)) {
+        sprintf(buf, "Record %05lu: the quick brown fox jumps over the lazy dog\n", recordCnt++);
+        if (StreamRing_Commit(&ring, buf, strlen(buf))) {
+            committed += strlen(buf);
+        }
+        
+        if ((recordCnt % BENCH_RING_BURST) == 0) {
+            res = StreamRing_Drain(&ring, &fileHandle, &drained);
+            slotCnt += drained;
+        }
+    }
+    if (res == FR_OK) {
+        res = StreamRing_Flush(&ring, &fileHandle);
+    }
+    if (f_close(&fileHandle) != FR_OK) {
+        res = FR_DISK_ERR;
+    }
+    
+    if (res == FR_OK) {
+        sprintf(buf, "Committed %lu records, %lu bytes\n", recordCnt, committed);
+        Print_ToUSBUart(buf);
+        sprintf(buf, "Full slots drained: %lu\n", slotCnt);
+        Print_ToUSBUart(buf);
+        sprintf(buf, "High water: %lu of %u slots\n", ring.highWater, STREAM_SLOT_COUNT);
+        Print_ToUSBUart(buf);
+        sprintf(buf, "Overruns: %lu records, %lu bytes\n", ring.overruns, ring.overrunBytes);
+        Print_ToUSBUart(buf);
+        Print_ToUSBUart("Done\n");
+    }
+    else {
+        Print_ToUSBUart("Error writing file\n");
+    }
+}
+
+// count the fragments of fileName and move it into a contiguous run of clusters, reading the copy back to check it
+void Defrag_File(const char *fileName) {
+    static uint8_t work[DEFRAG_WORK_SIZE];
+    char buf[80];
+    DWORD frags;
+    
+    sprintf(buf, "Defragmenting file: %s\n", fileName);
+    Print_ToUSBUart(buf);
+    
+    // f_defrag moves the data of a file and cannot tell whether it is open without _FS_LOCK, so nothing may be
+    // open through the storage service while it runs (the service runs from this same loop, so none opens meanwhile)
+    if (Storage_OpenFiles()) {
+        sprintf(buf, "Files open through the storage service: %lu, close them first\n", Storage_OpenFiles());
+        Print_ToUSBUart(buf);
+        return;
+    }
+
+    FatFS_Result_t res = f_defrag(fileName, 0, 0, 0, &frags);
+    if (res == FR_OK) {
+        sprintf(buf, "Fragments: %lu\n", frags);
+        Print_ToUSBUart(buf);
+    }
+    if ((res == FR_OK) && (frags > 1)) {
+        res = f_defrag(fileName, 2, work, sizeof(work), &frags);
+        if (res == FR_OK) {
+            res = f_defrag(fileName, 0, 0, 0, &frags);
+        }
+        if (res == FR_OK) {
+            sprintf(buf, "Fragments after: %lu\n", frags);
+            Print_ToUSBUart(buf);
+        }
+    }
+    
+    if (res == FR_OK) {
+        Print_ToUSBUart("Done\n");
+    }
+    else if (res == FR_DENIED) {
+        Print_ToUSBUart("No contiguous free space for the file\n");
+    }
+    else {
+        sprintf(buf, "Error defragmenting file (%u)\n", res);
+        Print_ToUSBUart(buf);
+    }
+}
+
+
+// print the card type, registers and geometry that were read when the card was mounted
+void Print_CardInfo(void) {
+    char buf[64];
+    SDCardInfo_t info;
+    
+    if (disk_ioctl(0, MMC_GET_CARDINFO, &info) != RES_OK) {
+        Print_ToUSBUart("Error getting card info\n");
+        return;
+    }
+    
+    if (info.cardType & CARDTYPE_BLOCK) {
+        Print_ToUSBUart("Card type: SDHC/SDXC\n");
+    }
+    else if (info.cardType & CARDTYPE_SD2) {
+        Print_ToUSBUart("Card type: SD v2\n");
+    }
+    else if (info.cardType & CARDTYPE_SD1) {
+        Print_ToUSBUart("Card type: SD v1\n");
+    }
+    else {
+        Print_ToUSBUart("Card type: MMC\n");
+    }
+    
+    // CID bytes 3-7 hold the product name
+    sprintf(buf, "Manufacturer: 0x%02X, Product: %.5s\n", info.cid[0], (const char *)&info.cid[3]);
+    Print_ToUSBUart(buf);
+    sprintf(buf, "Sectors: %lu\n", info.sectorCount);
+    Print_ToUSBUart(buf);
+    sprintf(buf, "Allocation unit: %lu sectors\n", info.auSectors);
+    Print_ToUSBUart(buf);
+    sprintf(buf, "Speed class: %u\n", info.speedClass);
+    Print_ToUSBUart(buf);
+    sprintf(buf, "CMD23 support: %s\n", info.cmd23Support ? "yes" : "no");
+    Print_ToUSBUart(buf);
+}
+
+
+// print the wait time history of the busy wait engine for read tokens and card busy
+void Print_WaitStats(void) {
+    static const char *kindNames[SD_WAIT_KINDS] = { "Read token", "Busy" };
+    char buf[64];
+    SDWaitStats_t stats;
+    
+    if (disk_ioctl(0, MMC_GET_WAITSTATS, &stats) != RES_OK) {
+        Print_ToUSBUart("Error getting wait stats\n");
+        return;
+    }
+    
+    for (uint8_t kind = 0; kind < SD_WAIT_KINDS; kind++) {
+        sprintf(buf, "%s: waits %lu, timeouts %lu, polls %lu\n", kindNames[kind], stats.waits[kind], stats.timeouts[kind], stats.polls[kind]);
+        Print_ToUSBUart(buf);
+        sprintf(buf, "  expected %lu us, max %lu us\n", stats.expectedUs[kind], stats.maxUs[kind]);
+        Print_ToUSBUart(buf);
+        
+        // only print the histogram bins that have something in them
+        for (uint8_t bin = 0; bin < SD_WAIT_HIST_BINS; bin++) {
+            if (stats.hist[kind][bin] == 0) continue;
+            if (bin == 0) {
+                sprintf(buf, "  ready: %lu\n", stats.hist[kind][bin]);
+            }
+            else {
+                sprintf(buf, "  < %lu us: %lu\n", 1ul << bin, stats.hist[kind][bin]);
+            }
+            Print_ToUSBUart(buf);
+        }
+    }
+}
+
+
+
+// the requests of a queued write, they must stay around until the worker has run them
+static FatFS_File_t _QueuedFile;
+static char _QueuedName[QUEUED_NAME_SIZE];
+static char _QueuedData[64];
+static StorageRequest_t _QueuedOpen, _QueuedWrite, _QueuedClose;
+
+
+// completion notification for the last request of a queued write
+static void Queued_WriteDone(StorageRequest_t *req) {
+    char buf[64];
+
+    if ((_QueuedOpen.result != FR_OK) || (_QueuedWrite.result != FR_OK) || (req->result != FR_OK)) {
+        sprintf(buf, "Queued write to %s failed (%u/%u/%u)\n", _QueuedName, _QueuedOpen.result, _QueuedWrite.result, req->result);
+    }
+    else {
+        sprintf(buf, "Queued write to %s wrote %lu bytes\n", _QueuedName, _QueuedWrite.transferred);
+    }
+    Print_ToUSBUart(buf);
+}
+
+
+// create fileName holding line by handing open/write/close to the storage service, the main loop runs them
+void Queue_Write(const char *fileName, const char *line) {
+    static StorageRequest_t *const batch[] = { &_QueuedOpen, &_QueuedWrite, &_QueuedClose };
+
+    if (!_QueuedClose.complete && (_QueuedClose.op == STORAGE_OP_CLOSE)) {
+        Print_ToUSBUart("Previous queued write still pending\n");
+        return;
+    }
+    if ((strlen(fileName) >= sizeof(_QueuedName)) || (strlen(line) >= sizeof(_QueuedData))) {
+        Print_ToUSBUart("File name or data too long to queue\n");
+        return;
+    }
+
+    strcpy(_QueuedName, fileName);
+    strcpy(_QueuedData, line);
+
+    _QueuedOpen = (StorageRequest_t) { .op = STORAGE_OP_OPEN, .file = &_QueuedFile, .path = _QueuedName, .mode = FA_CREATE_ALWAYS | FA_WRITE };
+    _QueuedWrite = (StorageRequest_t) { .op = STORAGE_OP_WRITE, .file = &_QueuedFile, .buf = _QueuedData, .size = strlen(_QueuedData) };
+    _QueuedClose = (StorageRequest_t) { .op = STORAGE_OP_CLOSE, .file = &_QueuedFile, .callback = Queued_WriteDone };
+
+    // the three requests are queued together or not at all, so the worker never holds some of them while they are
+    // filled in again, and the file is never left open by a write that was only partly queued
+    if (!Storage_SubmitBatch(batch, 3)) {
+        Print_ToUSBUart("Storage queue full\n");
+        _QueuedClose.complete = true;
+        return;
+    }
+    Print_ToUSBUart("Queued\n");
+}
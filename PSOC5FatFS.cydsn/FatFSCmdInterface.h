@@ -1,20 +1,34 @@
 #ifndef FATFS_CMD_INTERFACE_H
 #define FATFS_CMD_INTERFACE_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "FatFS/ff.h"
 #include "FatFS/FatFS_PrettyMacros.h"
 
     
 void Print_ToUSBUart(const char *buf);
+void Write_ToUSBUart(const uint8_t *buf, uint16_t len);
     
 void Display_Help(void);
 void Mount_Disk(FatFS_t *fatFS);
+void Unmount_Disk(void);
 void Erase_File(const char *fileName);
 void Create_File(const char *fileName);
 void Print_File(const char *fileName);
 void Append_File(const char *fileName, const char *line);
-void List_Dir(void);
+void List_Dir(const char *dirName, bool binary);
+void Tree_List(const char *dirName, const char *pattern);
+void Disk_Usage(const char *dirName);
+void Frag_Info(const char *dirName);
 void Get_FreeSpace(FatFS_t *fatFs);
+void Bench_Append(FatFS_t *fatFs, const char *fileName);
+void Bench_Read(FatFS_t *fatFs, const char *fileName);
+void Bench_Ring(const char *fileName);
+void Defrag_File(const char *fileName);
+void Print_CardInfo(void);
+void Print_WaitStats(void);
+void Queue_Write(const char *fileName, const char *line);
 
 
 
@@ -0,0 +1,186 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+#include "StorageService.h"
+
+
+/*  Implementation of the storage service
+ *
+ *  The request queue is a bounded ring of slots, each with a sequence number that says whose turn it is:
+ *    sequence == position          the slot is free for the producer that claims position
+ *    sequence == position + 1      the slot holds a request ready for the worker
+ *  Producers claim a position by advancing _QueueTail with a compare-and-swap, store the request, and then publish
+ *  it by bumping the sequence.  Only the worker moves _QueueHead.  Nothing ever waits on a lock, so Storage_Submit
+ *  can be called from an ISR that interrupts another producer.  Storage_SubmitBatch claims several positions with
+ *  one compare-and-swap, so the requests of a batch are queued back to back or not at all.
+ */
+
+
+typedef struct {
+    uint32_t sequence;
+    StorageRequest_t *req;
+} StorageSlot_t;
+
+
+static StorageSlot_t _Queue[STORAGE_QUEUE_SIZE];
+static uint32_t _QueueTail = 0;         // next position a producer claims
+static uint32_t _QueueHead = 0;         // next position the worker runs (only the worker moves it)
+
+// the volume the worker runs the requests on
+static FatFS_t *_StorageFs;
+
+// files the requests have opened and not yet closed (only the worker changes it)
+static uint32_t _OpenFiles = 0;
+
+
+#if (STORAGE_QUEUE_SIZE & (STORAGE_QUEUE_SIZE - 1)) != 0
+#error STORAGE_QUEUE_SIZE must be a power of 2
+#endif
+
+
+
+// set up the queue, there must be no requests outstanding
+void Storage_Init(FatFS_t *fatFs) {
+
+    for (uint32_t i = 0; i < STORAGE_QUEUE_SIZE; i++) {
+        _Queue[i].sequence = i;
+        _Queue[i].req = 0;
+    }
+    __atomic_store_n(&_QueueHead, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&_QueueTail, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&_OpenFiles, 0, __ATOMIC_RELEASE);
+    _StorageFs = fatFs;
+}
+
+
+// queue count requests for the worker in consecutive positions, all of them or, without waiting if the queue
+// does not have room for them all, none
+bool Storage_SubmitBatch(StorageRequest_t *const *reqs, uint32_t count) {
+    uint32_t pos = __atomic_load_n(&_QueueTail, __ATOMIC_RELAXED);
+
+    if ((count == 0) || (count > STORAGE_QUEUE_SIZE)) return false;
+
+    for (;;) {
+        // the worker frees the slots in order, so when the last of the positions is free all before it are too
+        StorageSlot_t *last = &_Queue[(pos + count - 1) & (STORAGE_QUEUE_SIZE - 1)];
+        int32_t diff = (int32_t)(__atomic_load_n(&last->sequence, __ATOMIC_ACQUIRE) - (pos + count - 1));
+
+        // the slots are free, try to claim their positions (a failed exchange reloads pos for the next try)
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&_QueueTail, &pos, pos + count, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+
+        // the worker has not yet taken the request a whole lap behind the last position, so the queue is full
+        else if (diff < 0) {
+            return false;
+        }
+
+        // another producer claimed these positions first
+        else {
+            pos = __atomic_load_n(&_QueueTail, __ATOMIC_RELAXED);
+        }
+    }
+
+    // hand the requests over to the worker, the request memory is only touched once the positions are ours
+    for (uint32_t i = 0; i < count; i++) {
+        StorageSlot_t *slot = &_Queue[(pos + i) & (STORAGE_QUEUE_SIZE - 1)];
+
+        reqs[i]->complete = false;
+        reqs[i]->transferred = 0;
+        slot->req = reqs[i];
+        __atomic_store_n(&slot->sequence, pos + i + 1, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+
+// queue a request for the worker, returns false without waiting if the queue is full
+bool Storage_Submit(StorageRequest_t *req) {
+
+    return Storage_SubmitBatch(&req, 1);
+}
+
+
+// run one request on the volume and report the result back to the producer
+static void Run_Request(StorageRequest_t *req) {
+    FatFS_Result_t res;
+    UINT bytes = 0;
+
+    switch (req->op) {
+        case STORAGE_OP_MOUNT :
+            res = f_mount(_StorageFs, "", 1);
+            if (res == FR_OK) __atomic_store_n(&_OpenFiles, 0, __ATOMIC_RELEASE);    // the mount drops every open file
+            break;
+
+        case STORAGE_OP_OPEN :
+            res = f_open(req->file, req->path, req->mode);
+            if (res == FR_OK) __atomic_store_n(&_OpenFiles, _OpenFiles + 1, __ATOMIC_RELEASE);
+            break;
+
+        case STORAGE_OP_READ :
+            res = f_read(req->file, req->buf, req->size, &bytes);
+            break;
+
+        case STORAGE_OP_WRITE :
+            res = f_write(req->file, req->buf, req->size, &bytes);
+            break;
+
+        case STORAGE_OP_SYNC :
+            res = f_sync(req->file);
+            break;
+
+        case STORAGE_OP_CLOSE :
+            res = f_close(req->file);
+            if ((res == FR_OK) && _OpenFiles) __atomic_store_n(&_OpenFiles, _OpenFiles - 1, __ATOMIC_RELEASE);
+            break;
+
+        default:
+            res = FR_INVALID_PARAMETER;
+    }
+
+    req->transferred = bytes;
+    req->result = res;
+
+    // the callback runs first as the producer is free to reuse the request once it sees it complete
+    if (req->callback) {
+        req->callback(req);
+    }
+    __atomic_store_n(&req->complete, true, __ATOMIC_RELEASE);
+}
+
+
+// run up to maxRequests queued requests (0 runs until the queue is empty), returns the number run
+uint32_t Storage_Service(uint32_t maxRequests) {
+    uint32_t count = 0;
+
+    while ((maxRequests == 0) || (count < maxRequests)) {
+        StorageSlot_t *slot = &_Queue[_QueueHead & (STORAGE_QUEUE_SIZE - 1)];
+
+        // stop at the first position that is empty or still being filled in by its producer
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != (_QueueHead + 1)) break;
+
+        // take the request and free the slot for the producer one lap ahead
+        StorageRequest_t *req = slot->req;
+        __atomic_store_n(&slot->sequence, _QueueHead + STORAGE_QUEUE_SIZE, __ATOMIC_RELEASE);
+        __atomic_store_n(&_QueueHead, _QueueHead + 1, __ATOMIC_RELEASE);
+
+        Run_Request(req);
+        count++;
+    }
+
+    return count;
+}
+
+
+// true when no request is queued, any thread can ask
+bool Storage_IsIdle(void) {
+    return (__atomic_load_n(&_QueueTail, __ATOMIC_ACQUIRE) == __atomic_load_n(&_QueueHead, __ATOMIC_ACQUIRE));
+}
+
+
+// number of files opened through the queue and not yet closed, any thread can ask
+uint32_t Storage_OpenFiles(void) {
+    return __atomic_load_n(&_OpenFiles, __ATOMIC_ACQUIRE);
+}
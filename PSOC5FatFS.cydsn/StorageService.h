@@ -0,0 +1,60 @@
+#ifndef STORAGE_SERVICE_H
+#define STORAGE_SERVICE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_PrettyMacros.h"
+
+
+/*  A storage service that runs the file operations of any number of producers on one worker
+ *
+ *  Producers (the command parser, ISRs, other tasks) fill in a StorageRequest_t and hand it to Storage_Submit,
+ *  which never blocks.  The worker calls Storage_Service, from the main loop or from its own thread, to run the
+ *  queued requests in order on the volume given to Storage_Init.  The request memory belongs to the producer and
+ *  must stay valid until the request is complete.
+ */
+
+
+// number of requests that can be queued, must be a power of 2
+#define STORAGE_QUEUE_SIZE      16u
+
+
+typedef enum {
+    STORAGE_OP_MOUNT = 0,       // mount the volume
+    STORAGE_OP_OPEN,            // open path into file with mode
+    STORAGE_OP_READ,            // read size bytes from file into buf
+    STORAGE_OP_WRITE,           // write size bytes from buf to file
+    STORAGE_OP_SYNC,            // flush file
+    STORAGE_OP_CLOSE            // close file
+} StorageOp_t;
+
+
+typedef struct StorageRequest {
+    StorageOp_t op;
+    FatFS_File_t *file;                     // file object the operation works on
+    const char *path;                       // file name for STORAGE_OP_OPEN
+    uint8_t mode;                           // FA_* access mode for STORAGE_OP_OPEN
+    void *buf;                              // data for STORAGE_OP_READ and STORAGE_OP_WRITE
+    uint32_t size;                          // bytes to read or write
+
+    // filled in by the worker
+    uint32_t transferred;                   // bytes read or written
+    FatFS_Result_t result;                  // result of the file operation
+    volatile bool complete;                 // set once the request has run and the fields above are valid
+
+    // optional completion notification, called on the worker just before complete is set
+    void (*callback)(struct StorageRequest *req);
+    void *context;                          // for use by the producer
+} StorageRequest_t;
+
+
+void Storage_Init(FatFS_t *fatFs);
+bool Storage_Submit(StorageRequest_t *req);
+bool Storage_SubmitBatch(StorageRequest_t *const *reqs, uint32_t count);
+uint32_t Storage_Service(uint32_t maxRequests);
+bool Storage_IsIdle(void);
+uint32_t Storage_OpenFiles(void);
+
+
+#endif
@@ -3,10 +3,11 @@
 #include "FatFS/ff.h"
 #include "FatFS/FatFS_PrettyMacros.h"
 #include "FatFSCmdInterface.h"
+#include "StorageService.h"
 
 FatFS_t _FatFs;		/* FatFs work area needed for needed for each volume */
 
-char _FnameBuf[32];
+char _FnameBuf[128];     // long file names, a field can take up a whole usb packet
 char _CmdBuf[32];
 char _DataBuf[64];
 
@@ -24,6 +25,10 @@ bool Parse_USBBuffer(void) {
     uint8_t curBufIndex = 0, cmdDataSize = 0, fnameDataSize = 0, dataDataSize = 0;
     char *curBuf = _CmdBuf;
     
+    // optional fields that are not given must read as empty
+    _FnameBuf[0] = 0;
+    _DataBuf[0] = 0;
+    
     for (uint8_t i = 0; i < _USBBufDataCnt; i++) {
         
         uint8_t b = _USBRxBuffer[i];
@@ -80,17 +85,32 @@ bool Parse_USBBuffer(void) {
     
     // no arg commands
     if (!strcmp(_CmdBuf, "?")) return true;
-    if (!strcmp(_CmdBuf, "list")) return true;
     if (!strcmp(_CmdBuf, "free")) return true;
     if (!strcmp(_CmdBuf, "mount")) return true;
+    if (!strcmp(_CmdBuf, "umount")) return true;
+    if (!strcmp(_CmdBuf, "card")) return true;
+    if (!strcmp(_CmdBuf, "stats")) return true;
     
     // check for cmd, fname commands
     if (!strcmp(_CmdBuf, "print") && fnameDataSize) return true;
     if (!strcmp(_CmdBuf, "erase") && fnameDataSize) return true;
     if (!strcmp(_CmdBuf, "create") && fnameDataSize) return true;
+    if (!strcmp(_CmdBuf, "bench") && fnameDataSize) return true;
+    if (!strcmp(_CmdBuf, "readbench") && fnameDataSize) return true;
+    if (!strcmp(_CmdBuf, "ringbench") && fnameDataSize) return true;
+    if (!strcmp(_CmdBuf, "defrag") && fnameDataSize) return true;
+    
+    // list takes an optional directory and an optional output mode
+    if (!strcmp(_CmdBuf, "list") && (!dataDataSize || !strcmp(_DataBuf, "bin") || !strcmp(_DataBuf, "text"))) return true;
+    
+    // tree takes an optional directory and an optional pattern, du and fraginfo only the directory
+    if (!strcmp(_CmdBuf, "tree")) return true;
+    if (!strcmp(_CmdBuf, "du") && !dataDataSize) return true;
+    if (!strcmp(_CmdBuf, "fraginfo") && !dataDataSize) return true;
     
     // check for cmd, fname, data commands
     if (!strcmp(_CmdBuf, "append") && fnameDataSize && dataDataSize) return true;
+    if (!strcmp(_CmdBuf, "qwrite") && fnameDataSize && dataDataSize) return true;
     
     // unknown command or invalid parameters
     Print_ToUSBUart("Unknown command: ");
@@ -113,10 +133,14 @@ int main()
     while(USBUART_GetConfiguration() == 0){};
     USBUART_CDC_Init();
     
+    // the main loop is the storage worker, it runs the queued requests on the volume
+    Storage_Init(&_FatFs);
      
     
     while(true) {
         
+        Storage_Service(0);
+        
         _USBBufDataCnt = USBUART_GetCount();
         
         // when we get usb data, grab it and parse it
@@ -136,7 +160,16 @@ int main()
                 // if we got a vailid command, figure out what it was and run it
                 if (parseRes) {
                     if (!strcmp(_CmdBuf, "list")) {
-                        List_Dir();
+                        List_Dir(_FnameBuf, !strcmp(_DataBuf, "bin"));
+                    }
+                    else if (!strcmp(_CmdBuf, "tree")) {
+                        Tree_List(_FnameBuf, _DataBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "du")) {
+                        Disk_Usage(_FnameBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "fraginfo")) {
+                        Frag_Info(_FnameBuf);
                     }
                     else if (!strcmp(_CmdBuf, "?")) {
                         Display_Help();
@@ -144,9 +177,18 @@ int main()
                     else if (!strcmp(_CmdBuf, "mount")) {
                         Mount_Disk(&_FatFs);
                     }
+                    else if (!strcmp(_CmdBuf, "umount")) {
+                        Unmount_Disk();
+                    }
                     else if (!strcmp(_CmdBuf, "free")) {
                         Get_FreeSpace(&_FatFs);        
                     }
+                    else if (!strcmp(_CmdBuf, "card")) {
+                        Print_CardInfo();
+                    }
+                    else if (!strcmp(_CmdBuf, "stats")) {
+                        Print_WaitStats();
+                    }
                     else if (!strcmp(_CmdBuf, "print")) {
                         Print_File(_FnameBuf);
                     }
@@ -159,6 +201,21 @@ int main()
                     else if (!strcmp(_CmdBuf, "append")) {
                         Append_File(_FnameBuf, _DataBuf);
                     }
+                    else if (!strcmp(_CmdBuf, "bench")) {
+                        Bench_Append(&_FatFs, _FnameBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "readbench")) {
+                        Bench_Read(&_FatFs, _FnameBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "ringbench")) {
+                        Bench_Ring(_FnameBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "defrag")) {
+                        Defrag_File(_FnameBuf);
+                    }
+                    else if (!strcmp(_CmdBuf, "qwrite")) {
+                        Queue_Write(_FnameBuf, _DataBuf);
+                    }
                 }
             }
         }
@@ -0,0 +1,20 @@
+#!/bin/sh
+# conf.sh <FatFS dir> <dir> [option=value]...
+#   copy the FatFS sources to dir and change the given ffconf.h options there,
+#   so a test can build against a configuration other than the project's
+set -e
+src=$1
+dir=$2
+shift 2
+
+mkdir -p "$dir"
+cp "$src"/*.c "$src"/*.h "$dir"
+for opt in "$@"; do
+    name=${opt%%=*}
+    value=${opt#*=}
+    if ! grep -q "^#define[[:space:]]*$name[[:space:]]" "$dir/ffconf.h"; then
+        echo "conf.sh: ffconf.h has no option $name" >&2
+        exit 1
+    fi
+    sed -i "s/^\(#define[[:space:]]*$name[[:space:]]*\)[^[:space:]]*/\1$value/" "$dir/ffconf.h"
+done
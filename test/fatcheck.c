@@ -0,0 +1,327 @@
+// FAT image reader and checker, see fatcheck.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fatcheck.h"
+
+#define MAX_DEPTH               64
+#define MAX_REPORTS             10      // problems printed, the rest are only counted
+
+typedef struct {
+    const uint8_t *image;
+    uint32_t sectorSize;
+    const uint8_t *fat;
+    uint32_t rootSector;                // FAT12 and FAT16 root directory
+    uint32_t rootEntries;
+    uint32_t rootCluster;               // FAT32 root directory
+    uint32_t endOfChain;
+    uint32_t badMark;
+    uint8_t *reached;
+    uint32_t reports;
+    FatCheck_t *check;
+    FatCheckObject_t onObject;
+    void *context;
+} Volume_t;
+
+
+static uint32_t Load16(const uint8_t *p) {
+    return p[0] | (uint32_t)p[1] << 8;
+}
+
+
+static uint32_t Load32(const uint8_t *p) {
+    return Load16(p) | Load16(p + 2) << 16;
+}
+
+
+static void Report(Volume_t *vol, const char *what, const char *path, uint32_t value) {
+    if (vol->reports++ >= MAX_REPORTS) return;
+    if (path) printf("fatcheck: %s: %s (%u)\n", what, path[0] ? path : "/", value);
+    else printf("fatcheck: %s: %u\n", what, value);
+}
+
+
+static const uint8_t *Sector(Volume_t *vol, uint32_t sector) {
+    return vol->image + (size_t)sector * vol->sectorSize;
+}
+
+
+static uint32_t Get_Entry(Volume_t *vol, uint32_t cluster) {
+    switch (vol->check->fatType) {
+    case 12: {
+        uint32_t value = Load16(vol->fat + cluster + cluster / 2);
+        return (cluster & 1) ? value >> 4 : value & 0xFFF;
+    }
+    case 16:
+        return Load16(vol->fat + cluster * 2);
+    default:
+        return Load32(vol->fat + cluster * 4) & 0x0FFFFFFF;
+    }
+}
+
+
+static bool Is_Cluster(Volume_t *vol, uint32_t cluster) {
+    return (cluster >= 2) && (cluster < vol->check->clusters + 2);
+}
+
+
+// follow a chain and mark its clusters, returns the number of clusters and the number of contiguous runs
+static uint32_t Follow_Chain(Volume_t *vol, const char *path, uint32_t start, uint32_t *extents) {
+    uint32_t cluster = start, count = 0;
+
+    *extents = 0;
+    if (!Is_Cluster(vol, start)) {
+        vol->check->badLinks++;
+        Report(vol, "first cluster out of range", path, start);
+        return 0;
+    }
+    *extents = 1;
+    for (;;) {
+        uint32_t next;
+
+        if (vol->reached[cluster]) {
+            vol->check->crossLinks++;
+            Report(vol, "cross linked cluster", path, cluster);
+            break;
+        }
+        vol->reached[cluster] = 1;
+        count++;
+
+        next = Get_Entry(vol, cluster);
+        if (next >= vol->endOfChain) break;
+        if (!Is_Cluster(vol, next)) {
+            vol->check->badLinks++;
+            Report(vol, "link to a free or out of range cluster", path, cluster);
+            break;
+        }
+        if (next != cluster + 1) (*extents)++;
+        cluster = next;
+    }
+    vol->check->chains++;
+    vol->check->extents += *extents;
+    return count;
+}
+
+
+// the 8.3 name of an entry, which FatFs finds as well as the long name
+static void Entry_Name(const uint8_t *entry, char *name) {
+    int n = 0;
+
+    for (int i = 0; (i < 8) && (entry[i] != ' '); i++) name[n++] = (char)entry[i];
+    if (name[0] == 0x05) name[0] = (char)0xE5;
+    if (entry[8] != ' ') {
+        name[n++] = '.';
+        for (int i = 8; (i < 11) && (entry[i] != ' '); i++) name[n++] = (char)entry[i];
+    }
+    name[n] = 0;
+}
+
+
+static void Walk_ClusterDirectory(Volume_t *vol, const char *path, uint32_t start, uint32_t depth, uint32_t *extents);
+static void Walk_Directory(Volume_t *vol, const char *path, const uint8_t *const *sectors, uint32_t count, uint32_t depth);
+
+
+static void Check_Entry(Volume_t *vol, const char *dirPath, const uint8_t *entry, uint32_t depth) {
+    uint32_t clusterBytes = vol->check->clusterSectors * vol->sectorSize;
+    uint32_t start = Load16(entry + 26), size = Load32(entry + 28), extents = 0, clusters = 0;
+    bool dir = (entry[11] & 0x10) != 0;
+    char name[16], path[1024];
+
+    if (vol->check->fatType == 32) start |= Load16(entry + 20) << 16;
+    Entry_Name(entry, name);
+    snprintf(path, sizeof(path), "%s/%s", dirPath, name);
+
+    if (dir) {
+        vol->check->dirs++;
+        if (!start) {
+            vol->check->badEntries++;
+            Report(vol, "directory without a cluster", path, 0);
+        }
+        else if (depth >= MAX_DEPTH) {
+            vol->check->badEntries++;
+            Report(vol, "directories nested too deep", path, depth);
+        }
+        else {
+            Walk_ClusterDirectory(vol, path, start, depth, &extents);
+        }
+        if (vol->onObject) vol->onObject(vol->context, path, true, size, extents);
+        return;
+    }
+
+    vol->check->files++;
+    if (start) clusters = Follow_Chain(vol, path, start, &extents);
+    if (clusters != (uint32_t)(((uint64_t)size + clusterBytes - 1) / clusterBytes)) {
+        vol->check->sizeErrors++;
+        Report(vol, "size does not match the chain", path, size);
+    }
+    if (vol->onObject) vol->onObject(vol->context, path, false, size, extents);
+}
+
+
+static void Walk_Directory(Volume_t *vol, const char *path, const uint8_t *const *sectors, uint32_t count, uint32_t depth) {
+    for (uint32_t s = 0; s < count; s++) {
+        for (uint32_t i = 0; i < vol->sectorSize; i += 32) {
+            const uint8_t *entry = sectors[s] + i;
+
+            if (entry[0] == 0) return;                                  // end of the directory
+            if (entry[0] == 0xE5) continue;                             // deleted
+            if ((entry[11] & 0x3F) == 0x0F) continue;                   // part of a long name
+            if (entry[11] & 0x08) continue;                             // volume label
+            if (entry[0] == '.') continue;                              // dot entries
+            Check_Entry(vol, path, entry, depth);
+        }
+    }
+}
+
+
+// a directory in clusters: list its sectors while following the chain, then read it
+static void Walk_ClusterDirectory(Volume_t *vol, const char *path, uint32_t start, uint32_t depth, uint32_t *extents) {
+    uint32_t clusterSectors = vol->check->clusterSectors;
+    uint32_t clusters = Follow_Chain(vol, path, start, extents);
+    const uint8_t **sectors = malloc(sizeof(*sectors) * (clusters * clusterSectors + 1));
+    uint32_t cluster = start;
+
+    for (uint32_t c = 0; c < clusters; c++, cluster = Get_Entry(vol, cluster)) {
+        for (uint32_t s = 0; s < clusterSectors; s++) {
+            sectors[c * clusterSectors + s] = Sector(vol, vol->check->dataStart + (cluster - 2) * clusterSectors + s);
+        }
+    }
+    Walk_Directory(vol, path, sectors, clusters * clusterSectors, depth + 1);
+    free(sectors);
+}
+
+
+static void End_Run(FatCheck_t *check, uint32_t top, uint32_t length) {
+    uint32_t bucket = 0;
+
+    if (!length) return;
+    while ((bucket < FATCHECK_HIST - 1) && (length >> (bucket + 1))) bucket++;
+    check->runHist[bucket]++;
+    check->freeRuns++;
+    if (length > check->maxRun) {
+        check->maxRun = length;
+        check->maxRunTop = top;
+    }
+}
+
+
+// find the boot sector, directly at the start of the image or at the start of the first partition
+static bool Find_BootSector(const uint8_t *image, uint32_t sectors, uint32_t sectorSize, uint32_t *base) {
+    for (int tries = 0; tries < 2; tries++) {
+        const uint8_t *boot = image + (size_t)*base * sectorSize;
+        uint32_t clusterSectors = boot[13];
+
+        if ((boot[510] == 0x55) && (boot[511] == 0xAA) && ((boot[0] == 0xEB) || (boot[0] == 0xE9)) &&
+            (Load16(boot + 11) == sectorSize) && clusterSectors && !(clusterSectors & (clusterSectors - 1))) {
+            return true;
+        }
+        if ((tries == 0) && (boot[510] == 0x55) && (boot[511] == 0xAA) && boot[446 + 4]) {
+            *base = Load32(boot + 446 + 8);
+            if (*base >= sectors) return false;
+        }
+        else {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+bool FatCheck_Image(const uint8_t *image, uint32_t sectors, uint32_t sectorSize, uint32_t auSize, FatCheck_t *check,
+                    FatCheckObject_t onObject, void *context) {
+    Volume_t vol = { .image = image, .sectorSize = sectorSize, .check = check, .onObject = onObject, .context = context };
+    uint32_t base = 0, reserved, fatCount, fatSectors, totalSectors, rootSectors;
+    uint32_t runTop = 0, runLength = 0;
+    const uint8_t *boot;
+
+    memset(check, 0, sizeof(*check));
+    if ((sectors == 0) || !Find_BootSector(image, sectors, sectorSize, &base)) {
+        printf("fatcheck: no FAT boot sector found\n");
+        return false;
+    }
+    boot = Sector(&vol, base);
+    reserved = Load16(boot + 14);
+    fatCount = boot[16];
+    vol.rootEntries = Load16(boot + 17);
+    totalSectors = Load16(boot + 19) ? Load16(boot + 19) : Load32(boot + 32);
+    fatSectors = Load16(boot + 22) ? Load16(boot + 22) : Load32(boot + 36);
+    rootSectors = (vol.rootEntries * 32 + sectorSize - 1) / sectorSize;
+    check->clusterSectors = boot[13];
+    check->dataStart = base + reserved + fatCount * fatSectors + rootSectors;
+    if (!fatCount || !fatSectors || (check->dataStart >= base + totalSectors) || (base + totalSectors > sectors)) {
+        printf("fatcheck: the boot sector does not fit the image\n");
+        return false;
+    }
+    check->clusters = (base + totalSectors - check->dataStart) / check->clusterSectors;
+    check->fatType = (check->clusters < 4085) ? 12 : (check->clusters < 65525) ? 16 : 32;
+    vol.fat = Sector(&vol, base + reserved);
+    vol.rootSector = base + reserved + fatCount * fatSectors;
+    vol.rootCluster = Load32(boot + 44);
+    vol.endOfChain = (check->fatType == 12) ? 0xFF8 : (check->fatType == 16) ? 0xFFF8 : 0x0FFFFFF8;
+    vol.badMark = vol.endOfChain - 1;
+    vol.reached = calloc(check->clusters + 2, 1);
+
+    // the tree, from the root directory
+    if (check->fatType == 32) {
+        uint32_t extents;
+
+        Walk_ClusterDirectory(&vol, "", vol.rootCluster, 0, &extents);
+    }
+    else {
+        const uint8_t **root = malloc(sizeof(*root) * (rootSectors + 1));
+
+        for (uint32_t s = 0; s < rootSectors; s++) root[s] = Sector(&vol, vol.rootSector + s);
+        Walk_Directory(&vol, "", root, rootSectors, 0);
+        free(root);
+    }
+
+    // the FAT, for the free space and anything in use that no chain reached
+    for (uint32_t cluster = 2; cluster < check->clusters + 2; cluster++) {
+        uint32_t value = Get_Entry(&vol, cluster);
+
+        if (value == 0) {
+            check->free++;
+            if (!runLength) runTop = cluster;
+            runLength++;
+            continue;
+        }
+        if (value == vol.badMark) {
+            check->bad++;
+        }
+        else if (!vol.reached[cluster]) {
+            check->lost++;
+            Report(&vol, "lost cluster", NULL, cluster);
+        }
+        End_Run(check, runTop, runLength);
+        runLength = 0;
+    }
+    End_Run(check, runTop, runLength);
+
+    // whole allocation units in the data area, when clusters line up with them
+    if (auSize) {
+        check->auSize = auSize;
+        check->auOffset = check->dataStart % auSize;
+        if ((auSize % check->clusterSectors == 0) && (check->auOffset % check->clusterSectors == 0)) {
+            uint32_t perAu = auSize / check->clusterSectors;
+            uint32_t first = 2 + (auSize - check->auOffset) % auSize / check->clusterSectors;
+
+            for (uint32_t au = first; au + perAu <= check->clusters + 2; au += perAu) {
+                uint32_t used = 0;
+
+                for (uint32_t c = au; c < au + perAu; c++) used += (Get_Entry(&vol, c) != 0);
+                check->aus++;
+                if (used == 0) check->ausFree++;
+                else if (used < perAu) check->ausPart++;
+            }
+        }
+    }
+
+    free(vol.reached);
+    return true;
+}
+
+
+bool FatCheck_Clean(const FatCheck_t *check) {
+    return !check->lost && !check->crossLinks && !check->badLinks && !check->sizeErrors && !check->badEntries;
+}
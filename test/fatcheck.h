@@ -0,0 +1,57 @@
+// A reader of FAT12, FAT16 and FAT32 images of any sector size that shares no code with FatFs, for checking what
+// FatFs reports and leaves on a disk
+//   the boot sector is found directly or through the first partition of an MBR, the directory tree is walked from
+//   the root, every chain is followed and marked, and the FAT is scanned for the free space and the AU layout
+
+#ifndef FATCHECK_H
+#define FATCHECK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define FATCHECK_HIST                   12      // free run buckets, n counts 2^n to 2^(n+1)-1 clusters, the last all longer
+
+typedef struct {
+    // layout
+    uint32_t fatType;                   // 12, 16 or 32
+    uint32_t clusters;
+    uint32_t clusterSectors;
+    uint32_t dataStart;                 // first sector of cluster 2, counted from the start of the image
+
+    // the tree
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t chains;                    // files and directories with clusters, the FAT32 root directory included
+    uint32_t extents;                   // contiguous runs of those chains
+
+    // the FAT
+    uint32_t free;
+    uint32_t bad;
+    uint32_t freeRuns;
+    uint32_t maxRun;
+    uint32_t maxRunTop;                 // first cluster of the first longest run
+    uint32_t runHist[FATCHECK_HIST];
+
+    // the data area on allocation units of auSize sectors, left 0 when clusters straddle them
+    uint32_t auSize;
+    uint32_t auOffset;
+    uint32_t aus;
+    uint32_t ausFree;
+    uint32_t ausPart;
+
+    // damage, all 0 on a consistent volume
+    uint32_t lost;                      // clusters in use that no chain reaches
+    uint32_t crossLinks;                // clusters reached by two chains, or twice by one
+    uint32_t badLinks;                  // links to free or out of range clusters
+    uint32_t sizeErrors;                // files whose chain does not match the size
+    uint32_t badEntries;                // directory entries that cannot be right
+} FatCheck_t;
+
+// called for every file and directory found, extents is 0 for an object without clusters
+typedef void (*FatCheckObject_t)(void *context, const char *path, bool dir, uint32_t size, uint32_t extents);
+
+bool FatCheck_Image(const uint8_t *image, uint32_t sectors, uint32_t sectorSize, uint32_t auSize, FatCheck_t *check,
+                    FatCheckObject_t onObject, void *context);
+bool FatCheck_Clean(const FatCheck_t *check);
+
+#endif
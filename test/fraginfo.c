@@ -0,0 +1,304 @@
+// fraginfo for raw FAT images on Linux
+//   fraginfo [-a auSectors] <image>...   prints what f_fraginfo and f_defrag report for each image, as the fraginfo
+//                                        command does on the board, and checks every number against fatcheck's own
+//                                        reading of the image, and the extents f_itemfrags counts from the items of
+//                                        a directory walk against it too; the image file is not changed
+//   fraginfo                             does the same on FAT12, FAT16 and FAT32 images it formats and fragments,
+//                                        and checks that damage to a FAT shows up
+//   exFAT images are checked by test_exfat
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "fatcheck.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#if FI_HIST != FATCHECK_HIST
+#error the free run histograms of f_fraginfo and fatcheck differ
+#endif
+
+typedef struct {
+    uint32_t files;
+    uint32_t fragmented;
+    uint32_t extents;
+    uint32_t mismatches;
+} FileCount_t;
+
+static FATFS _Fs;
+static uint8_t _Buf[65536];
+
+
+static void Print_FragInfo(const FRAGINFO *info) {
+    printf("Clusters: %u, free: %u, bad: %u\n", (unsigned)info->n_clust, (unsigned)info->n_free, (unsigned)info->n_bad);
+    printf("Chains: %u, extents: %u\n", (unsigned)info->n_chain, (unsigned)info->n_extent);
+    printf("Free runs: %u, largest: %u clusters at %u\n", (unsigned)info->n_frun, (unsigned)info->max_frun, (unsigned)info->max_ftop);
+    for (int i = 0; i < FI_HIST; i++) {
+        if (info->frun_hist[i]) {
+            printf("  %6lu%s clusters: %u\n", 1ul << i, (i == FI_HIST - 1) ? "+" : "", (unsigned)info->frun_hist[i]);
+        }
+    }
+    if (info->au_size) {
+        printf("AU: %u sectors, data area offset %u sectors\n", (unsigned)info->au_size, (unsigned)info->au_ofs);
+        printf("AUs: %u, free: %u, partly used: %u\n", (unsigned)info->n_au, (unsigned)info->n_au_free, (unsigned)info->n_au_part);
+    }
+}
+
+
+static uint32_t Compare(const char *what, uint32_t fatfs, uint32_t fatcheck) {
+    if (fatfs == fatcheck) return 0;
+    printf("MISMATCH %s: f_fraginfo %u, fatcheck %u\n", what, fatfs, fatcheck);
+    return 1;
+}
+
+
+// the chain and extent counts of f_fraginfo come from the FAT alone, so they only match the tree on a clean volume
+static uint32_t Compare_FragInfo(const FRAGINFO *info, const FatCheck_t *check) {
+    uint32_t mismatches = 0;
+    char what[32];
+
+    mismatches += Compare("clusters", info->n_clust, check->clusters);
+    mismatches += Compare("free", info->n_free, check->free);
+    mismatches += Compare("bad", info->n_bad, check->bad);
+    if (FatCheck_Clean(check)) {
+        mismatches += Compare("chains", info->n_chain, check->chains);
+        mismatches += Compare("extents", info->n_extent, check->extents);
+    }
+    mismatches += Compare("free runs", info->n_frun, check->freeRuns);
+    mismatches += Compare("largest free run", info->max_frun, check->maxRun);
+    mismatches += Compare("largest free run top", info->max_ftop, check->maxRunTop);
+    for (int i = 0; i < FI_HIST; i++) {
+        sprintf(what, "free runs in bucket %d", i);
+        mismatches += Compare(what, info->frun_hist[i], check->runHist[i]);
+    }
+    mismatches += Compare("AU size", info->au_size, check->auSize);
+    mismatches += Compare("AU offset", info->au_ofs, check->auOffset);
+    mismatches += Compare("AUs", info->n_au, check->aus);
+    mismatches += Compare("free AUs", info->n_au_free, check->ausFree);
+    mismatches += Compare("partly used AUs", info->n_au_part, check->ausPart);
+    return mismatches;
+}
+
+
+// every file fatcheck finds is looked up by its 8.3 name, and f_defrag must count the extents fatcheck did
+static void Check_File(void *context, const char *path, bool dir, uint32_t size, uint32_t extents) {
+    FileCount_t *count = context;
+    DWORD fragments;
+    FRESULT res;
+
+    (void)size;
+    if (dir || !extents) return;
+    count->files++;
+    count->extents += extents;
+    res = f_defrag(path, 0, NULL, 0, &fragments);
+    if ((res != FR_OK) || (fragments != extents)) {
+        printf("MISMATCH %s: f_defrag %u fragments (result %d), fatcheck %u extents\n", path, (unsigned)fragments, res, extents);
+        count->mismatches++;
+    }
+    if (extents > 1) {
+        count->fragmented++;
+        printf("%6u %s\n", extents, path);
+    }
+}
+
+
+// count the files with data and their extents below path with f_itemfrags, from the items f_readdirplus reads
+static void Count_Items(char *path, uint32_t *files, uint32_t *extents) {
+    DIRITEM items[8];
+    DWORD fragments;
+    DIR dir;
+    UINT n;
+    size_t len = strlen(path);
+
+    CHECK_FR(f_opendir(&dir, path));
+    do {
+        CHECK_FR(f_readdirplus(&dir, items, 8, &n));
+        for (UINT i = 0; i < n; i++) {
+            if (items[i].fattrib & AM_DIR) {
+                if (items[i].fname[0] == '.') continue;
+                sprintf(path + len, "/%s", items[i].fname);
+                Count_Items(path, files, extents);
+                path[len] = 0;
+            }
+            else if (items[i].sclust) {
+                CHECK_FR(f_itemfrags(path, &items[i], &fragments));
+                (*files)++;
+                *extents += fragments;
+            }
+        }
+    } while (n == 8);
+    CHECK_FR(f_closedir(&dir));
+}
+
+
+// report on the volume on drive 0, returns the number of differences between FatFs and fatcheck
+static uint32_t Analyze_Volume(const char *name, FatCheck_t *check) {
+    static uint8_t work[2048];
+    FRAGINFO info, infoWindow;
+    FileCount_t count = { 0 };
+    uint32_t mismatches = 0;
+
+    printf("== %s\n", name);
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_fraginfo("", &info, work, sizeof(work)));
+    CHECK_FR(f_fraginfo("", &infoWindow, NULL, 0));
+    if (memcmp(&info, &infoWindow, sizeof(info)) != 0) {
+        printf("MISMATCH f_fraginfo with and without the work buffer\n");
+        mismatches++;
+    }
+    Print_FragInfo(&info);
+
+    printf("Fragmented files:\n");
+    if (!FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), RamDisk_SectorSize(0), RamDisk_BlockSize, check,
+                        Check_File, &count)) {
+        CHECK_FR(f_mount(NULL, "", 0));
+        return mismatches + 1;
+    }
+    printf("--%u of %u files fragmented, %u extents--\n", count.fragmented, count.files, count.extents);
+    char path[256] = "";
+    uint32_t itemFiles = 0, itemExtents = 0;
+    Count_Items(path, &itemFiles, &itemExtents);
+    mismatches += Compare("files counted from the directory items", itemFiles, count.files);
+    mismatches += Compare("extents counted from the directory items", itemExtents, count.extents);
+    printf("fatcheck: FAT%u, %u files, %u directories, %u lost, %u cross linked, %u bad links, %u size errors, %u bad entries\n",
+           check->fatType, check->files, check->dirs, check->lost, check->crossLinks, check->badLinks,
+           check->sizeErrors, check->badEntries);
+
+    mismatches += count.mismatches + Compare_FragInfo(&info, check);
+    CHECK_FR(f_mount(NULL, "", 0));
+    return mismatches;
+}
+
+
+static void Write_Chunk(FIL *fil, uint32_t size) {
+    UINT n;
+
+    for (uint32_t i = 0; i < size; i++) _Buf[i] = (uint8_t)(i * 7 + size);
+    CHECK_FR(f_write(fil, _Buf, size, &n));
+    CHECK(n == size);
+    CHECK_FR(f_sync(fil));
+}
+
+
+// files written a piece at a time side by side, some of them deleted, and a directory that grows between them
+static void Make_Fragmented(void) {
+    FIL files[4], fil;
+    char path[48];
+
+    CHECK_FR(f_mkdir("LOGS"));
+    CHECK_FR(f_mkdir("LOGS/OLD"));
+    for (int i = 0; i < 4; i++) {
+        sprintf(path, "LOGS/FILE%d.BIN", i);
+        CHECK_FR(f_open(&files[i], path, FA_CREATE_ALWAYS | FA_WRITE));
+    }
+    for (int round = 0; round < 40; round++) {
+        for (int i = 0; i < 4; i++) Write_Chunk(&files[i], 300 + ((round * 7 + i * 3) % 11) * 700);
+        if (round % 4 == 0) {
+            sprintf(path, "LOGS/OLD/A long name for entry %d.txt", round);
+            CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE));
+            Write_Chunk(&fil, 100 + round * 50);
+            CHECK_FR(f_close(&fil));
+        }
+    }
+    for (int i = 0; i < 4; i++) CHECK_FR(f_close(&files[i]));
+    CHECK_FR(f_unlink("LOGS/FILE1.BIN"));
+    CHECK_FR(f_unlink("LOGS/FILE3.BIN"));
+
+    // an empty file, and one that fills the gaps the deleted ones left
+    CHECK_FR(f_open(&fil, "EMPTY.TXT", FA_CREATE_NEW | FA_WRITE));
+    CHECK_FR(f_close(&fil));
+    CHECK_FR(f_open(&fil, "GAPS.BIN", FA_CREATE_NEW | FA_WRITE));
+    for (int i = 0; i < 10; i++) Write_Chunk(&fil, 8192);
+    CHECK_FR(f_close(&fil));
+}
+
+
+// a free cluster marked as the end of a chain that no file owns must show up as lost, and as a chain in f_fraginfo
+static void Test_LostCluster(uint32_t fatType, uint32_t cluster) {
+    uint8_t *fat = RamDisk_Data(0) + (size_t)_Fs.fatbase * RamDisk_SectorSize(0);
+    FatCheck_t check;
+    FRAGINFO info;
+
+    if (fatType == 32) {
+        memcpy(fat + cluster * 4, "\xFF\xFF\xFF\x0F", 4);
+    }
+    else if (fatType == 16) {
+        memcpy(fat + cluster * 2, "\xFF\xFF", 2);
+    }
+    else if (cluster & 1) {
+        fat[cluster + cluster / 2] |= 0xF0;
+        fat[cluster + cluster / 2 + 1] = 0xFF;
+    }
+    else {
+        fat[cluster + cluster / 2] = 0xFF;
+        fat[cluster + cluster / 2 + 1] |= 0x0F;
+    }
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), RamDisk_SectorSize(0), RamDisk_BlockSize, &check, NULL, NULL));
+    CHECK((check.lost == 1) && !check.crossLinks && !check.badLinks);
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_fraginfo("", &info, NULL, 0));
+    CHECK(info.n_chain == check.chains + 1);
+    CHECK(Compare_FragInfo(&info, &check) == 0);
+    CHECK_FR(f_mount(NULL, "", 0));
+}
+
+
+// sfd 0 puts the volume in a partition, 1 makes the whole disk the volume
+static void Test_Generated(const char *name, uint8_t sfd, uint32_t sectors, uint32_t clusterBytes, uint32_t fatType) {
+    static const uint32_t auSizes[] = { 128, 8192, 3, 0 };
+    FatCheck_t check;
+    char label[64];
+
+    RamDisk_Create(0, sectors, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", sfd, clusterBytes));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    Make_Fragmented();
+    CHECK_FR(f_mount(NULL, "", 0));
+
+    for (uint32_t i = 0; i < sizeof(auSizes) / sizeof(auSizes[0]); i++) {
+        RamDisk_BlockSize = auSizes[i];
+        sprintf(label, "%s, AU of %u sectors", name, auSizes[i]);
+        CHECK(Analyze_Volume(label, &check) == 0);
+        CHECK(check.fatType == fatType);
+        CHECK(FatCheck_Clean(&check));
+        CHECK(check.extents > check.chains);
+    }
+    RamDisk_BlockSize = 128;
+
+    Test_LostCluster(fatType, check.maxRunTop);
+    RamDisk_Free(0);
+}
+
+
+int main(int argc, char **argv) {
+    uint32_t mismatches = 0;
+    int images = 0;
+
+    for (int i = 1; i < argc; i++) {
+        FatCheck_t check;
+
+        if (!strcmp(argv[i], "-a") && (i + 1 < argc)) {
+            RamDisk_BlockSize = (uint32_t)strtoul(argv[++i], NULL, 0);
+            continue;
+        }
+        if (!RamDisk_Map(0, argv[i], false)) {
+            printf("cannot map %s\n", argv[i]);
+            return 2;
+        }
+        mismatches += Analyze_Volume(argv[i], &check);
+        RamDisk_Free(0);
+        images++;
+    }
+    if (images) {
+        printf(mismatches ? "%u MISMATCHES\n" : "f_fraginfo and fatcheck agree\n", mismatches);
+        return mismatches ? 1 : 0;
+    }
+
+    Test_Generated("FAT12", 1, 4000, 512, 12);
+    Test_Generated("FAT16 in a partition", 0, 65536, 2048, 16);
+    Test_Generated("FAT32", 1, 140000, 1024, 32);
+    printf("ALL OK\n");
+    return 0;
+}
@@ -0,0 +1,198 @@
+// RAM disks behind the FatFs disk functions, see ramdisk.h
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "diskio.h"
+#include "ramdisk.h"
+
+typedef struct {
+    uint8_t *data;
+    uint32_t sectors;
+    uint16_t sectorSize;
+    size_t mappedSize;                  // non zero for a mapped image
+} RamDisk_t;
+
+static RamDisk_t _Disks[RAMDISK_COUNT];
+
+RamDiskStats_t RamDisk_Stats;
+uint32_t RamDisk_LatencyUs;
+uint32_t RamDisk_BlockSize = 128;
+uint32_t RamDisk_FailAt;
+bool RamDisk_TornWrite;
+bool RamDisk_Crashed;
+
+
+// the disks can be used from several threads, so the counters are kept with atomics
+#define Count(counter, n)               __atomic_fetch_add(&(counter), (n), __ATOMIC_RELAXED)
+
+
+static RamDisk_t *Get_Disk(BYTE drv) {
+    return ((drv < RAMDISK_COUNT) && _Disks[drv].data) ? &_Disks[drv] : NULL;
+}
+
+
+DSTATUS disk_initialize(BYTE drv) {
+    return Get_Disk(drv) ? 0 : STA_NOINIT;
+}
+
+
+DSTATUS disk_status(BYTE drv) {
+    return Get_Disk(drv) ? 0 : STA_NOINIT;
+}
+
+
+DRESULT disk_read(BYTE drv, BYTE *buf, DWORD sector, UINT count) {
+    RamDisk_t *disk = Get_Disk(drv);
+
+    if (!disk) return RES_NOTRDY;
+    if ((count == 0) || (sector >= disk->sectors) || (count > disk->sectors - sector)) {
+        fprintf(stderr, "ramdisk: read of %u sectors at %u is out of range\n", count, sector);
+        abort();
+    }
+    if (RamDisk_LatencyUs) usleep(RamDisk_LatencyUs);
+
+    memcpy(buf, disk->data + (size_t)sector * disk->sectorSize, (size_t)count * disk->sectorSize);
+    Count(RamDisk_Stats.readCmds, 1);
+    Count(RamDisk_Stats.readSectors, count);
+    return RES_OK;
+}
+
+
+DRESULT disk_write(BYTE drv, const BYTE *buf, DWORD sector, UINT count) {
+    RamDisk_t *disk = Get_Disk(drv);
+    uint32_t cmd;
+
+    if (!disk) return RES_NOTRDY;
+    if ((count == 0) || (sector >= disk->sectors) || (count > disk->sectors - sector)) {
+        fprintf(stderr, "ramdisk: write of %u sectors at %u is out of range\n", count, sector);
+        abort();
+    }
+    if (RamDisk_LatencyUs) usleep(RamDisk_LatencyUs);
+
+    // power fails during write command RamDisk_FailAt, nothing after it reaches the disk
+    cmd = Count(RamDisk_Stats.writeCmds, 1) + 1;
+    if (RamDisk_FailAt && (cmd >= RamDisk_FailAt)) {
+        if ((cmd == RamDisk_FailAt) && RamDisk_TornWrite && (count > 1)) {
+            memcpy(disk->data + (size_t)sector * disk->sectorSize, buf, (size_t)(count / 2) * disk->sectorSize);
+        }
+        RamDisk_Crashed = true;
+        return RES_ERROR;
+    }
+
+    memcpy(disk->data + (size_t)sector * disk->sectorSize, buf, (size_t)count * disk->sectorSize);
+    Count(RamDisk_Stats.writeSectors, count);
+    return RES_OK;
+}
+
+
+DRESULT disk_ioctl(BYTE drv, BYTE cmd, void *buf) {
+    RamDisk_t *disk = Get_Disk(drv);
+
+    if (!disk) return RES_NOTRDY;
+
+    switch (cmd) {
+    case CTRL_SYNC:
+        return RamDisk_Crashed ? RES_ERROR : RES_OK;
+    case GET_SECTOR_COUNT:
+        *(DWORD *)buf = disk->sectors;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD *)buf = disk->sectorSize;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *(DWORD *)buf = RamDisk_BlockSize;
+        return RES_OK;
+    case CTRL_TRIM:
+        return RES_OK;
+    }
+    return RES_PARERR;
+}
+
+
+void Attempt_TransactionCancel(void) {
+}
+
+
+static void Free_Disk(RamDisk_t *disk) {
+    if (disk->mappedSize) {
+        munmap(disk->data, disk->mappedSize);
+    }
+    else {
+        free(disk->data);
+    }
+    memset(disk, 0, sizeof(*disk));
+}
+
+
+// a blank disk
+uint8_t *RamDisk_Create(uint8_t drv, uint32_t sectors, uint16_t sectorSize) {
+    RamDisk_t *disk = &_Disks[drv];
+
+    Free_Disk(disk);
+    disk->data = calloc(sectors, sectorSize);
+    if (!disk->data) {
+        fprintf(stderr, "ramdisk: no memory for %u sectors\n", sectors);
+        abort();
+    }
+    disk->sectors = sectors;
+    disk->sectorSize = sectorSize;
+    RamDisk_Crashed = false;
+    return disk->data;
+}
+
+
+// a raw image file of 512 byte sectors, changes go to the file only when writable is set
+uint8_t *RamDisk_Map(uint8_t drv, const char *path, bool writable) {
+    RamDisk_t *disk = &_Disks[drv];
+    struct stat st;
+    void *data;
+    int fd;
+
+    Free_Disk(disk);
+    fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) return NULL;
+    if ((fstat(fd, &st) != 0) || (st.st_size < 512)) {
+        close(fd);
+        return NULL;
+    }
+    data = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return NULL;
+
+    disk->data = data;
+    disk->mappedSize = (size_t)st.st_size;
+    disk->sectors = (uint32_t)(st.st_size / 512);
+    disk->sectorSize = 512;
+    RamDisk_Crashed = false;
+    return disk->data;
+}
+
+
+void RamDisk_Free(uint8_t drv) {
+    Free_Disk(&_Disks[drv]);
+}
+
+
+uint8_t *RamDisk_Data(uint8_t drv) {
+    return _Disks[drv].data;
+}
+
+
+uint32_t RamDisk_Sectors(uint8_t drv) {
+    return _Disks[drv].sectors;
+}
+
+
+uint16_t RamDisk_SectorSize(uint8_t drv) {
+    return _Disks[drv].sectorSize;
+}
+
+
+void RamDisk_ClearStats(void) {
+    memset(&RamDisk_Stats, 0, sizeof(RamDisk_Stats));
+}
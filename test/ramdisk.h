@@ -0,0 +1,36 @@
+// RAM disks behind the FatFs disk functions, for the host tests
+//   a disk is either allocated or a raw image file mapped into memory
+//   writes can be made to fail from a chosen write command on, to stand in for a power failure
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define RAMDISK_COUNT                   2
+
+typedef struct {
+    uint32_t readCmds;
+    uint32_t readSectors;
+    uint32_t writeCmds;
+    uint32_t writeSectors;
+} RamDiskStats_t;
+
+extern RamDiskStats_t RamDisk_Stats;
+
+extern uint32_t RamDisk_LatencyUs;      // added to every read and write command
+extern uint32_t RamDisk_BlockSize;      // erase block size reported by GET_BLOCK_SIZE, in sectors
+extern uint32_t RamDisk_FailAt;         // crash point: write command number n (from 1) and every one after it fail, 0 for none
+extern bool RamDisk_TornWrite;          // the multi-sector write at the crash point stores its first half
+extern bool RamDisk_Crashed;            // the crash point has been reached
+
+uint8_t *RamDisk_Create(uint8_t drv, uint32_t sectors, uint16_t sectorSize);
+uint8_t *RamDisk_Map(uint8_t drv, const char *path, bool writable);
+void RamDisk_Free(uint8_t drv);
+uint8_t *RamDisk_Data(uint8_t drv);
+uint32_t RamDisk_Sectors(uint8_t drv);
+uint16_t RamDisk_SectorSize(uint8_t drv);
+void RamDisk_ClearStats(void);
+
+#endif
@@ -0,0 +1,613 @@
+// Host models of the PSoC SPI masters and SD cards in SPI mode, see sdspi_model.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <project.h>
+#include "sdspi_model.h"
+
+
+/*-----------------------------------------------------------------------*/
+/* SPI masters                                                           */
+/*-----------------------------------------------------------------------*/
+
+// the registers only need distinct addresses
+reg8 SDSPI_TXDATA_REG;
+reg8 SDSPI_RXDATA_REG;
+reg8 SDSPI_TX_STATUS_REG;
+reg8 SDSPI_RX_STATUS_REG;
+reg8 SDSPI2_TXDATA_REG;
+reg8 SDSPI2_RXDATA_REG;
+reg8 SDSPI2_TX_STATUS_REG;
+reg8 SDSPI2_RX_STATUS_REG;
+
+// a 64MHz cpu driving an 8MHz SPI clock, with a few cycles of loop code around each register access
+SpiModelTiming_t SpiModel_Timing = { 8, 6, 64 };
+SpiModelStats_t SpiModel_Stats;
+
+typedef enum { REG_TXDATA, REG_RXDATA, REG_TX_STATUS, REG_RX_STATUS, REG_COUNT } SpiReg_t;
+
+typedef struct {
+    SpiModelDevice_t device;
+    bool selected;
+
+    uint8_t txFifo[SPI_MODEL_FIFO_DEPTH];
+    uint8_t txHead, txCount;
+    uint8_t rxFifo[SPI_MODEL_FIFO_DEPTH];
+    uint8_t rxHead, rxCount;
+
+    bool shifting;                      // a byte is in the shift register
+    uint8_t shiftByte;
+    uint64_t shiftDone;                 // when its last bit is clocked
+} SpiBus_t;
+
+static reg8 *const _Regs[SPI_MODEL_BUSES][REG_COUNT] = {
+    { &SDSPI_TXDATA_REG, &SDSPI_RXDATA_REG, &SDSPI_TX_STATUS_REG, &SDSPI_RX_STATUS_REG },
+    { &SDSPI2_TXDATA_REG, &SDSPI2_RXDATA_REG, &SDSPI2_TX_STATUS_REG, &SDSPI2_RX_STATUS_REG },
+};
+
+static SpiBus_t _Buses[SPI_MODEL_BUSES];
+
+static uint64_t _Now;                   // cpu clocks since the model was reset
+static uint64_t _StatsStart;
+
+
+static uint32_t Get_InFlight(const SpiBus_t *bus) {
+    return bus->txCount + (bus->shifting ? 1 : 0) + bus->rxCount;
+}
+
+
+static void Note_InFlight(const SpiBus_t *bus) {
+    uint32_t inFlight = Get_InFlight(bus);
+
+    if (inFlight > SpiModel_Stats.maxInFlight) SpiModel_Stats.maxInFlight = inFlight;
+}
+
+
+// the bus and register an address belongs to, NULL if it is not an SPIM register
+static SpiBus_t *Find_Register(reg8 *addr, SpiReg_t *reg) {
+    for (uint8_t b = 0; b < SPI_MODEL_BUSES; b++) {
+        for (uint8_t r = 0; r < REG_COUNT; r++) {
+            if (_Regs[b][r] == addr) {
+                *reg = (SpiReg_t)r;
+                return &_Buses[b];
+            }
+        }
+    }
+    return NULL;
+}
+
+
+static void Load_ShiftRegister(SpiBus_t *bus, uint64_t at) {
+    bus->shiftByte = bus->txFifo[bus->txHead];
+    bus->txHead = (bus->txHead + 1) % SPI_MODEL_FIFO_DEPTH;
+    bus->txCount--;
+    bus->shifting = true;
+    bus->shiftDone = at + 8 * (uint64_t)SpiModel_Timing.cpuPerBit;
+}
+
+
+// run the buses up to the current time, moving finished bytes into the rx fifos
+static void Run_Buses(void) {
+    for (uint8_t b = 0; b < SPI_MODEL_BUSES; b++) {
+        SpiBus_t *bus = &_Buses[b];
+
+        while (bus->shifting && (bus->shiftDone <= _Now)) {
+            uint8_t miso = bus->device ? bus->device(b, bus->shiftByte, bus->selected) : 0xFF;
+
+            SpiModel_Stats.bytes++;
+            SpiModel_Stats.busyCpuClocks += 8 * (uint64_t)SpiModel_Timing.cpuPerBit;
+            if (bus->rxCount == SPI_MODEL_FIFO_DEPTH) {
+                SpiModel_Stats.rxOverruns++;
+            }
+            else {
+                bus->rxFifo[(bus->rxHead + bus->rxCount) % SPI_MODEL_FIFO_DEPTH] = miso;
+                bus->rxCount++;
+            }
+
+            // the next byte starts straight away if one is waiting
+            bus->shifting = false;
+            if (bus->txCount != 0) Load_ShiftRegister(bus, bus->shiftDone);
+        }
+    }
+}
+
+
+static void Spend_CpuClocks(uint64_t clocks) {
+    _Now += clocks;
+    Run_Buses();
+}
+
+
+void SpiModel_WriteReg8(reg8 *addr, uint8 value) {
+    SpiReg_t reg;
+    SpiBus_t *bus = Find_Register(addr, &reg);
+
+    Spend_CpuClocks(SpiModel_Timing.cpuPerAccess);
+
+    if (!bus || (reg != REG_TXDATA)) {
+        *addr = value;
+        return;
+    }
+
+    if (bus->txCount == SPI_MODEL_FIFO_DEPTH) {
+        SpiModel_Stats.txOverflows++;
+        return;
+    }
+    bus->txFifo[(bus->txHead + bus->txCount) % SPI_MODEL_FIFO_DEPTH] = value;
+    bus->txCount++;
+    if (!bus->shifting) Load_ShiftRegister(bus, _Now);
+    Note_InFlight(bus);
+}
+
+
+uint8 SpiModel_ReadReg8(reg8 *addr) {
+    SpiReg_t reg;
+    SpiBus_t *bus = Find_Register(addr, &reg);
+    uint8_t value;
+
+    Spend_CpuClocks(SpiModel_Timing.cpuPerAccess);
+
+    if (!bus) return *addr;
+
+    switch (reg) {
+    case REG_RXDATA:
+        if (bus->rxCount == 0) {
+            SpiModel_Stats.rxUnderruns++;
+            return 0xFF;
+        }
+        value = bus->rxFifo[bus->rxHead];
+        bus->rxHead = (bus->rxHead + 1) % SPI_MODEL_FIFO_DEPTH;
+        bus->rxCount--;
+        return value;
+
+    case REG_RX_STATUS:
+        value = 0;
+        if (bus->rxCount != 0) value |= SDSPI_STS_RX_FIFO_NOT_EMPTY;
+        if (bus->rxCount == SPI_MODEL_FIFO_DEPTH) value |= SDSPI_STS_RX_FIFO_FULL;
+        return value;
+
+    case REG_TX_STATUS:
+        value = 0;
+        if (bus->txCount == 0) value |= SDSPI_STS_TX_FIFO_EMPTY;
+        if (bus->txCount != SPI_MODEL_FIFO_DEPTH) value |= SDSPI_STS_TX_FIFO_NOT_FULL;
+        if ((bus->txCount == 0) && !bus->shifting) value |= SDSPI_STS_SPI_DONE | SDSPI_STS_SPI_IDLE;
+        return value;
+
+    default:
+        return *addr;
+    }
+}
+
+
+void SS_Write(uint8 value) {
+    _Buses[0].selected = (value == 0);
+}
+
+
+void SS2_Write(uint8 value) {
+    _Buses[1].selected = (value == 0);
+}
+
+
+void CyDelay(uint32 milliseconds) {
+    Spend_CpuClocks((uint64_t)milliseconds * 1000 * SpiModel_Timing.cpuPerUs);
+}
+
+
+void CyDelayUs(uint16 microseconds) {
+    Spend_CpuClocks((uint64_t)microseconds * SpiModel_Timing.cpuPerUs);
+}
+
+
+// empty the fifos and start the clock again with device on every bus
+void SpiModel_Reset(SpiModelDevice_t device) {
+    memset(_Buses, 0, sizeof(_Buses));
+    for (uint8_t b = 0; b < SPI_MODEL_BUSES; b++) _Buses[b].device = device;
+    _Now = 0;
+    SpiModel_ClearStats();
+}
+
+
+void SpiModel_ClearStats(void) {
+    memset(&SpiModel_Stats, 0, sizeof(SpiModel_Stats));
+    _StatsStart = _Now;
+    for (uint8_t b = 0; b < SPI_MODEL_BUSES; b++) Note_InFlight(&_Buses[b]);
+}
+
+
+uint64_t SpiModel_Now(void) {
+    return _Now;
+}
+
+
+// bytes in the fifos and shift registers of all the buses
+uint32_t SpiModel_InFlight(void) {
+    uint32_t inFlight = 0;
+
+    for (uint8_t b = 0; b < SPI_MODEL_BUSES; b++) inFlight += Get_InFlight(&_Buses[b]);
+    return inFlight;
+}
+
+
+// bus throughput since the stats were cleared, at most 1/8 per bus with the bus never idle
+double SpiModel_BytesPerBusClock(void) {
+    uint64_t elapsed = _Now - _StatsStart;
+
+    SpiModel_Stats.cpuClocks = elapsed;
+    if (elapsed == 0) return 0;
+    return (double)SpiModel_Stats.bytes * SpiModel_Timing.cpuPerBit / (double)elapsed;
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* SD card                                                               */
+/*-----------------------------------------------------------------------*/
+
+SDModelConfig_t SDModel_Config = { true, true, true, 100, 3 };
+SDModelStats_t SDModel_Stats[SD_MODEL_CARDS];
+
+typedef enum { CARD_IDLE, CARD_READ_MULTI, CARD_WAIT_TOKEN, CARD_RECEIVE } CardMode_t;
+
+typedef struct {
+    SDModelStats_t *stats;
+    uint8_t index;
+
+    uint8_t *disk;
+    uint32_t sectors;
+
+    uint8_t csd[16], scr[8], sdStatus[64];
+
+    bool inIdleState, appCmd;
+    uint8_t acmd41Count;
+    CardMode_t mode;
+    bool multiWrite;
+    uint32_t sector;                    // next sector of the transfer
+    int32_t blockCount;                 // blocks left in a CMD23 transfer, -1 if open ended
+
+    uint8_t cmd[6];
+    uint8_t cmdLength;
+
+    uint8_t out[600];                   // response bytes waiting to be clocked out
+    uint16_t outHead, outTail;
+    uint64_t busyUntil;                 // the card holds MISO low until then
+
+    uint8_t block[514];                 // a data block being received, with its crc
+    uint16_t blockLength;
+} SDModelCard_t;
+
+static const uint8_t _Cid[16] = { 0x03, 'S', 'D', 'M', 'O', 'D', 'E', 'L', 0x10, 1, 2, 3, 4, 0x00, 0xA1, 0x01 };
+
+static SDModelCard_t _ModelCards[SD_MODEL_CARDS];
+
+
+static void Card_Error(SDModelCard_t *c, const char *what, int value) {
+    c->stats->errors++;
+    printf("SD model card %u: %s (%d)\n", c->index, what, value);
+}
+
+
+static void Queue_Byte(SDModelCard_t *c, uint8_t b) {
+    if (c->outTail < sizeof(c->out)) c->out[c->outTail++] = b;
+}
+
+
+static void Queue_DataBlock(SDModelCard_t *c, const uint8_t *data, uint16_t size) {
+    for (uint32_t i = 0; i < SDModel_Config.accessBytes; i++) Queue_Byte(c, 0xFF);
+    Queue_Byte(c, 0xFE);
+    for (uint16_t i = 0; i < size; i++) Queue_Byte(c, data[i]);
+    Queue_Byte(c, 0x12);
+    Queue_Byte(c, 0x34);
+}
+
+
+static uint8_t R1(SDModelCard_t *c) {
+    return c->inIdleState ? 0x01 : 0x00;
+}
+
+
+static void Start_Busy(SDModelCard_t *c) {
+    c->busyUntil = SpiModel_Now() + (uint64_t)SDModel_Config.busyBytes * 8 * SpiModel_Timing.cpuPerBit;
+}
+
+
+static bool Get_Sector(SDModelCard_t *c, uint32_t arg) {
+    if (SDModel_Config.blockAddressing) {
+        c->sector = arg;
+    }
+    else {
+        if (arg % 512) Card_Error(c, "unaligned byte address", (int)arg);
+        c->sector = arg / 512;
+    }
+    return (c->sector < c->sectors);
+}
+
+
+static void Run_AppCommand(SDModelCard_t *c, uint8_t cmd, uint32_t arg) {
+    (void)arg;
+
+    switch (cmd) {
+    case 41:
+        if (++c->acmd41Count >= 2) c->inIdleState = false;
+        Queue_Byte(c, R1(c));
+        break;
+    case 13:
+        Queue_Byte(c, R1(c));
+        Queue_Byte(c, 0x00);
+        Queue_DataBlock(c, c->sdStatus, sizeof(c->sdStatus));
+        break;
+    case 51:
+        Queue_Byte(c, R1(c));
+        Queue_DataBlock(c, c->scr, sizeof(c->scr));
+        break;
+    case 23:
+        Queue_Byte(c, R1(c));
+        break;
+    default:
+        Queue_Byte(c, 0x04 | R1(c));
+        break;
+    }
+}
+
+
+static void Run_Command(SDModelCard_t *c) {
+    uint8_t cmd = c->cmd[0] & 0x3F;
+    uint32_t arg = ((uint32_t)c->cmd[1] << 24) | ((uint32_t)c->cmd[2] << 16) | ((uint32_t)c->cmd[3] << 8) | c->cmd[4];
+    bool app = c->appCmd;
+
+    c->appCmd = false;
+    c->stats->cmds[app ? SD_MODEL_ACMD(cmd) : cmd]++;
+
+    if ((cmd == 0) && (c->cmd[5] != 0x95)) Card_Error(c, "CMD0 crc", c->cmd[5]);
+    if ((cmd == 8) && (c->cmd[5] != 0x87)) Card_Error(c, "CMD8 crc", c->cmd[5]);
+    if ((c->outHead != c->outTail) && (cmd != 12)) Card_Error(c, "command while a response is pending", cmd);
+    if ((c->mode == CARD_READ_MULTI) && (cmd != 12)) Card_Error(c, "command during a multiple block read", cmd);
+
+    // a block count only applies to the command right after it
+    if (!app && (cmd != 12) && (cmd != 18) && (cmd != 23) && (cmd != 25) && (cmd != 55)) c->blockCount = -1;
+
+    Queue_Byte(c, 0xFF);                // NCR
+    if (app) {
+        Run_AppCommand(c, cmd, arg);
+        return;
+    }
+
+    switch (cmd) {
+    case 0:
+        c->inIdleState = true;
+        c->acmd41Count = 0;
+        Queue_Byte(c, 0x01);
+        break;
+    case 8:
+        Queue_Byte(c, R1(c));
+        Queue_Byte(c, 0x00);
+        Queue_Byte(c, 0x00);
+        Queue_Byte(c, 0x01);
+        Queue_Byte(c, c->cmd[4]);
+        break;
+    case 9:
+        Queue_Byte(c, R1(c));
+        Queue_DataBlock(c, c->csd, sizeof(c->csd));
+        break;
+    case 10:
+        Queue_Byte(c, R1(c));
+        Queue_DataBlock(c, _Cid, sizeof(_Cid));
+        break;
+    case 12:
+        if (c->mode != CARD_READ_MULTI) Card_Error(c, "CMD12 outside a multiple block read", 0);
+        c->mode = CARD_IDLE;
+        c->outHead = c->outTail = 0;
+        c->blockCount = -1;
+        Queue_Byte(c, 0x3C);            // stuff byte
+        Queue_Byte(c, 0x00);
+        Start_Busy(c);
+        break;
+    case 16:
+        Queue_Byte(c, R1(c));
+        break;
+    case 17:
+        if (!Get_Sector(c, arg)) {
+            Queue_Byte(c, 0x40);
+            break;
+        }
+        Queue_Byte(c, R1(c));
+        Queue_DataBlock(c, c->disk + (size_t)c->sector * 512, 512);
+        c->stats->readSectors++;
+        break;
+    case 18:
+        if (!Get_Sector(c, arg)) {
+            Queue_Byte(c, 0x40);
+            break;
+        }
+        Queue_Byte(c, R1(c));
+        c->mode = CARD_READ_MULTI;
+        break;
+    case 23:
+        if (!SDModel_Config.cmd23Accepted) {
+            Queue_Byte(c, 0x04 | R1(c));
+            break;
+        }
+        c->blockCount = (int32_t)arg;
+        Queue_Byte(c, R1(c));
+        break;
+    case 24:
+    case 25:
+        Get_Sector(c, arg);
+        Queue_Byte(c, R1(c));
+        c->mode = CARD_WAIT_TOKEN;
+        c->multiWrite = (cmd == 25);
+        break;
+    case 55:
+        c->appCmd = true;
+        Queue_Byte(c, R1(c));
+        break;
+    case 58:
+        Queue_Byte(c, R1(c));
+        Queue_Byte(c, 0x80 | (SDModel_Config.blockAddressing ? 0x40 : 0x00));
+        Queue_Byte(c, 0xFF);
+        Queue_Byte(c, 0x80);
+        Queue_Byte(c, 0x00);
+        break;
+    default:
+        Queue_Byte(c, 0x04 | R1(c));
+        break;
+    }
+}
+
+
+// a data block has been received in full
+static void Store_Block(SDModelCard_t *c) {
+    if (c->sector >= c->sectors) {
+        Queue_Byte(c, 0x0D);            // write error
+        c->mode = CARD_IDLE;
+        return;
+    }
+    memcpy(c->disk + (size_t)c->sector * 512, c->block, 512);
+    c->sector++;
+    c->stats->writeSectors++;
+    Queue_Byte(c, 0xE5);                // data accepted
+    Start_Busy(c);
+
+    c->mode = c->multiWrite ? CARD_WAIT_TOKEN : CARD_IDLE;
+    if (c->multiWrite && (c->blockCount > 0) && (--c->blockCount == 0)) {
+        c->mode = CARD_IDLE;
+        c->blockCount = -1;
+    }
+}
+
+
+// the card on the given bus
+uint8_t SDModel_Exchange(uint8_t bus, uint8_t mosi, bool selected) {
+    SDModelCard_t *c = &_ModelCards[bus];
+    uint8_t miso = 0xFF;
+
+    if (!selected) {
+        if (c->mode == CARD_RECEIVE) Card_Error(c, "deselected in the middle of a data block", c->blockLength);
+        c->cmdLength = 0;
+        c->outHead = c->outTail = 0;
+        return 0xFF;
+    }
+
+    // output side: a pending response, then busy, then the next block of a multiple block read
+    if (c->outHead != c->outTail) {
+        miso = c->out[c->outHead++];
+        if (c->outHead == c->outTail) c->outHead = c->outTail = 0;
+    }
+    else if (SpiModel_Now() < c->busyUntil) {
+        miso = 0x00;
+    }
+    else if (c->mode == CARD_READ_MULTI) {
+        if (c->blockCount == 0) {
+            c->mode = CARD_IDLE;
+            c->blockCount = -1;
+        }
+        else if (c->sector >= c->sectors) {
+            miso = 0x08;                // out of range error token
+            c->mode = CARD_IDLE;
+        }
+        else {
+            Queue_DataBlock(c, c->disk + (size_t)c->sector * 512, 512);
+            c->sector++;
+            c->stats->readSectors++;
+            if (c->blockCount > 0) c->blockCount--;
+            miso = c->out[c->outHead++];
+        }
+    }
+
+    // input side: write data tokens and blocks, then command bytes
+    if ((c->mode == CARD_WAIT_TOKEN) && (c->cmdLength == 0)) {
+        if (mosi == (c->multiWrite ? 0xFC : 0xFE)) {
+            c->mode = CARD_RECEIVE;
+            c->blockLength = 0;
+            return miso;
+        }
+        if (c->multiWrite && (mosi == 0xFD)) {
+            c->stats->stopTokens++;
+            if (c->blockCount >= 0) Card_Error(c, "stop token ending a CMD23 transfer", c->blockCount);
+            c->mode = CARD_IDLE;
+            c->blockCount = -1;
+            Start_Busy(c);
+            return miso;
+        }
+        if ((mosi != 0xFF) && ((mosi & 0xC0) != 0x40)) Card_Error(c, "bad data token", mosi);
+        if ((mosi & 0xC0) != 0x40) return miso;
+    }
+
+    if (c->mode == CARD_RECEIVE) {
+        c->block[c->blockLength++] = mosi;
+        if (c->blockLength == sizeof(c->block)) Store_Block(c);
+        return miso;
+    }
+
+    if (c->cmdLength == 0) {
+        if ((mosi & 0xC0) == 0x40) c->cmd[c->cmdLength++] = mosi;
+    }
+    else {
+        c->cmd[c->cmdLength++] = mosi;
+        if (c->cmdLength == sizeof(c->cmd)) {
+            c->cmdLength = 0;
+            Run_Command(c);
+        }
+    }
+    return miso;
+}
+
+
+// make card a blank card of the given size with the registers to match SDModel_Config
+void SDModel_Create(uint8_t card, uint32_t sectors) {
+    SDModelCard_t *c = &_ModelCards[card];
+
+    c->stats = &SDModel_Stats[card];
+    c->index = card;
+    free(c->disk);
+    c->disk = calloc(sectors, 512);
+    c->sectors = sectors;
+
+    memset(c->csd, 0, sizeof(c->csd));
+    if (SDModel_Config.blockAddressing) {
+        uint32_t cSize = sectors / 1024 - 1;
+
+        c->csd[0] = 0x40;               // CSD version 2
+        c->csd[1] = 0x0E;               // TAAC 1ms
+        c->csd[7] = (cSize >> 16) & 0x3F;
+        c->csd[8] = (uint8_t)(cSize >> 8);
+        c->csd[9] = (uint8_t)cSize;
+    }
+    else {
+        uint32_t mult = 7;
+        uint32_t cSize = sectors / (1u << (mult + 2)) - 1;
+
+        c->csd[1] = 0x26;               // TAAC
+        c->csd[5] = 0x09;               // READ_BL_LEN 512
+        c->csd[6] = (cSize >> 10) & 3;
+        c->csd[7] = (uint8_t)(cSize >> 2);
+        c->csd[8] = (uint8_t)((cSize & 3) << 6);
+        c->csd[9] = (mult >> 1) & 3;
+        c->csd[10] = (uint8_t)(((mult & 1) << 7) | 0x3F);
+        c->csd[11] = 0x80;
+        c->csd[13] = 0x40;
+    }
+
+    memset(c->sdStatus, 0, sizeof(c->sdStatus));
+    c->sdStatus[8] = 2;                 // speed class 4
+    c->sdStatus[10] = 9 << 4;           // AU 4MB
+
+    memset(c->scr, 0, sizeof(c->scr));
+    c->scr[0] = 0x02;
+    c->scr[1] = 0x35;
+    c->scr[3] = SDModel_Config.cmd23Advertised ? 0x02 : 0x00;
+
+    c->inIdleState = true;
+    c->appCmd = false;
+    c->mode = CARD_IDLE;
+    c->blockCount = -1;
+    c->cmdLength = 0;
+    c->outHead = c->outTail = 0;
+    c->busyUntil = 0;
+    memset(c->stats, 0, sizeof(*c->stats));
+}
+
+
+uint8_t *SDModel_Disk(uint8_t card) {
+    return _ModelCards[card].disk;
+}
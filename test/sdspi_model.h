@@ -0,0 +1,75 @@
+// Host models of the PSoC SPI masters and SD cards in SPI mode
+//   the SPIM model keeps time in cpu clocks, moves bytes through 4 byte tx and rx fifos and a shift register
+//   exactly as the hardware would, and counts anything the driver does that would lose data on the real part
+//   there are two SPI masters, SDSPI with the SS chip select and SDSPI2 with SS2, clocked by the same cpu
+//   the card model answers the commands the driver sends, byte by byte, from a RAM image, card n on bus n
+
+#ifndef SDSPI_MODEL_H
+#define SDSPI_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPI_MODEL_FIFO_DEPTH            4
+#define SPI_MODEL_BUSES                 2
+
+
+// device on the other end of a bus, called once per byte as its last bit is clocked
+typedef uint8_t (*SpiModelDevice_t)(uint8_t bus, uint8_t mosi, bool selected);
+
+typedef struct {
+    uint32_t cpuPerBit;                 // cpu clocks per SPI bit clock
+    uint32_t cpuPerAccess;              // cpu clocks per register access, the loop code around it included
+    uint32_t cpuPerUs;                  // cpu clocks per microsecond, used by CyDelay and CyDelayUs
+} SpiModelTiming_t;
+
+// counts of all the buses together
+typedef struct {
+    uint64_t cpuClocks;                 // time since the last reset
+    uint64_t bytes;                     // bytes clocked over the buses
+    uint64_t busyCpuClocks;             // time the shift registers were busy
+    uint32_t maxInFlight;               // most bytes in the tx fifo, shift register and rx fifo of a bus at once
+    uint32_t txOverflows;               // writes to a full tx fifo, the byte is dropped
+    uint32_t rxOverruns;                // bytes received with the rx fifo full, the byte is dropped
+    uint32_t rxUnderruns;               // reads of an empty rx fifo
+} SpiModelStats_t;
+
+extern SpiModelTiming_t SpiModel_Timing;
+extern SpiModelStats_t SpiModel_Stats;
+
+void SpiModel_Reset(SpiModelDevice_t device);
+void SpiModel_ClearStats(void);
+uint64_t SpiModel_Now(void);
+uint32_t SpiModel_InFlight(void);
+double SpiModel_BytesPerBusClock(void);
+
+
+// SD card model configuration, set before SDModel_Create, it applies to every card
+typedef struct {
+    bool blockAddressing;               // SDHC style block addresses, otherwise byte addresses
+    bool cmd23Advertised;               // CMD23 support bit in the SCR
+    bool cmd23Accepted;                 // CMD23 is actually accepted
+    uint32_t busyBytes;                 // bytes the card stays busy after a write or stop
+    uint32_t accessBytes;               // idle bytes before a read data token
+} SDModelConfig_t;
+
+typedef struct {
+    uint32_t cmds[128];                 // commands received, app commands at 64 + n
+    uint32_t readSectors;
+    uint32_t writeSectors;
+    uint32_t stopTokens;
+    uint32_t errors;                    // protocol errors, each is also printed
+} SDModelStats_t;
+
+#define SD_MODEL_CARDS                  SPI_MODEL_BUSES
+
+extern SDModelConfig_t SDModel_Config;
+extern SDModelStats_t SDModel_Stats[SD_MODEL_CARDS];
+
+#define SD_MODEL_ACMD(n)                (64 + (n))
+
+void SDModel_Create(uint8_t card, uint32_t sectors);
+uint8_t *SDModel_Disk(uint8_t card);
+uint8_t SDModel_Exchange(uint8_t bus, uint8_t mosi, bool selected);
+
+#endif
@@ -0,0 +1,26 @@
+// Host stand-in for the PSoC Creator generated cytypes.h
+//   register accesses go to the SPIM model in sdspi_model.c instead of the hardware
+
+#ifndef CYTYPES_H
+#define CYTYPES_H
+
+#include <stdint.h>
+
+typedef uint8_t     uint8;
+typedef uint16_t    uint16;
+typedef uint32_t    uint32;
+typedef int8_t      int8;
+typedef int16_t     int16;
+typedef int32_t     int32;
+
+typedef volatile uint8  reg8;
+typedef volatile uint16 reg16;
+typedef volatile uint32 reg32;
+
+void SpiModel_WriteReg8(reg8 *addr, uint8 value);
+uint8 SpiModel_ReadReg8(reg8 *addr);
+
+#define CY_SET_REG8(addr, value)    SpiModel_WriteReg8((reg8 *)(addr), (uint8)(value))
+#define CY_GET_REG8(addr)           SpiModel_ReadReg8((reg8 *)(addr))
+
+#endif
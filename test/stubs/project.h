@@ -0,0 +1,53 @@
+// Host stand-in for the PSoC Creator generated project.h
+//   only the parts of the SDSPI master and SS pin components the card driver uses, and a second pair of them,
+//   SDSPI2 and SS2, for the second card slot
+
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include <stdint.h>
+#include "cytypes.h"
+
+// SDSPI tx status register bits, as in the SPIM component
+#define SDSPI_STS_SPI_DONE              0x01u
+#define SDSPI_STS_TX_FIFO_EMPTY         0x02u
+#define SDSPI_STS_TX_FIFO_NOT_FULL      0x04u
+#define SDSPI_STS_SPI_IDLE              0x10u
+
+// SDSPI rx status register bits
+#define SDSPI_STS_RX_FIFO_FULL          0x10u
+#define SDSPI_STS_RX_FIFO_NOT_EMPTY     0x20u
+#define SDSPI_STS_RX_FIFO_OVERRUN       0x40u
+
+// the model tells the registers apart by address
+extern reg8 SDSPI_TXDATA_REG;
+extern reg8 SDSPI_RXDATA_REG;
+extern reg8 SDSPI_TX_STATUS_REG;
+extern reg8 SDSPI_RX_STATUS_REG;
+
+#define SDSPI_TXDATA_PTR                (&SDSPI_TXDATA_REG)
+#define SDSPI_RXDATA_PTR                (&SDSPI_RXDATA_REG)
+#define SDSPI_TX_STATUS_PTR             (&SDSPI_TX_STATUS_REG)
+#define SDSPI_RX_STATUS_PTR             (&SDSPI_RX_STATUS_REG)
+
+// the include guards of the second pair's generated headers, the driver binds the second slot when it sees them
+#define CY_SPIM_SDSPI2_H
+#define CY_PINS_SS2_H
+
+extern reg8 SDSPI2_TXDATA_REG;
+extern reg8 SDSPI2_RXDATA_REG;
+extern reg8 SDSPI2_TX_STATUS_REG;
+extern reg8 SDSPI2_RX_STATUS_REG;
+
+#define SDSPI2_TXDATA_PTR               (&SDSPI2_TXDATA_REG)
+#define SDSPI2_RXDATA_PTR               (&SDSPI2_RXDATA_REG)
+#define SDSPI2_TX_STATUS_PTR            (&SDSPI2_TX_STATUS_REG)
+#define SDSPI2_RX_STATUS_PTR            (&SDSPI2_RX_STATUS_REG)
+
+void SS_Write(uint8 value);
+void SS2_Write(uint8 value);
+
+void CyDelay(uint32 milliseconds);
+void CyDelayUs(uint16 microseconds);
+
+#endif
@@ -0,0 +1,22 @@
+// Checks shared by the host tests, a failed check prints where it was and ends the test
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define CHECK(cond)         do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); exit(1); } } while (0)
+
+#define CHECK_RES(x, expected)  do {                                                                        \
+                                    FRESULT _res = (x);                                                     \
+                                    if (_res != (expected)) {                                               \
+                                        printf("FAIL %s:%d: %s -> %d, expected %d\n", __FILE__, __LINE__,   \
+                                               #x, (int)_res, (int)(expected));                             \
+                                        exit(1);                                                            \
+                                    }                                                                       \
+                                } while (0)
+
+#define CHECK_FR(x)         CHECK_RES(x, FR_OK)
+
+#endif
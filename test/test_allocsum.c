@@ -0,0 +1,181 @@
+// The allocation summary against changes made to the volume by another system
+//   a summary closed on unmount is taken by the next mount, unless the FAT was changed in between; here the other
+//   system is stood in for by writing a file straight into the image, the way a host without the summary would, and
+//   the free count FatFs reports must match fatcheck's own count of the FAT
+//   only FAT32 has the FSINFO that shows such a change, so the summary is taken on FAT32 alone
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "fatcheck.h"
+#include "ramdisk.h"
+#include "test.h"
+
+typedef struct {
+    const char *name;
+    uint32_t sectors;
+    uint32_t clusterBytes;
+    uint32_t fatType;
+    uint32_t foreignTop;                // first cluster the other system allocates
+    uint32_t foreignClusters;
+} Geometry_t;
+
+static FATFS _Fs;
+static uint8_t _Data[20000];
+
+
+static uint32_t Get_Word(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t Get_Dword(const uint8_t *p) {
+    return Get_Word(p) | (Get_Word(p + 2) << 16);
+}
+
+
+static void Put_Dword(uint8_t *p, uint32_t value) {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)(value >> 16);
+    p[3] = (uint8_t)(value >> 24);
+}
+
+
+static void Set_Fat(uint8_t *fat, uint32_t fatType, uint32_t cluster, uint32_t value) {
+    if (fatType == 32) {
+        Put_Dword(fat + cluster * 4, value & 0x0FFFFFFF);
+    }
+    else if (fatType == 16) {
+        fat[cluster * 2] = (uint8_t)value;
+        fat[cluster * 2 + 1] = (uint8_t)(value >> 8);
+    }
+    else if (cluster & 1) {
+        fat[cluster + cluster / 2] = (fat[cluster + cluster / 2] & 0x0F) | (uint8_t)((value & 0x0F) << 4);
+        fat[cluster + cluster / 2 + 1] = (uint8_t)(value >> 4);
+    }
+    else {
+        fat[cluster + cluster / 2] = (uint8_t)value;
+        fat[cluster + cluster / 2 + 1] = (fat[cluster + cluster / 2 + 1] & 0xF0) | (uint8_t)((value >> 8) & 0x0F);
+    }
+}
+
+
+// the other system writes a file into the root directory and its chain into every FAT copy, and on FAT32 brings the
+// FSINFO free count down
+static void Foreign_Allocate(const Geometry_t *geo, bool updateFsinfo) {
+    uint8_t *image = RamDisk_Data(0);
+    uint32_t sectorSize = RamDisk_SectorSize(0);
+    uint32_t fatSectors = Get_Word(image + 22) ? Get_Word(image + 22) : Get_Dword(image + 36);
+    uint32_t rootSector = Get_Word(image + 14) + image[16] * fatSectors;
+    uint8_t *entry;
+
+    if (geo->fatType == 32) rootSector += (Get_Dword(image + 44) - 2) * image[13];
+    for (entry = image + rootSector * sectorSize; entry[0]; entry += 32) {}
+    memset(entry, 0, 32);
+    memcpy(entry, "FOREIGN BIN", 11);
+    entry[11] = 0x20;
+    entry[20] = (uint8_t)(geo->foreignTop >> 16);
+    entry[21] = (uint8_t)(geo->foreignTop >> 24);
+    entry[26] = (uint8_t)geo->foreignTop;
+    entry[27] = (uint8_t)(geo->foreignTop >> 8);
+    Put_Dword(entry + 28, geo->foreignClusters * geo->clusterBytes);
+
+    for (uint32_t copy = 0; copy < image[16]; copy++) {
+        uint8_t *fat = image + (Get_Word(image + 14) + copy * fatSectors) * sectorSize;
+
+        for (uint32_t c = geo->foreignTop; c < geo->foreignTop + geo->foreignClusters; c++) {
+            Set_Fat(fat, geo->fatType, c, (c + 1 < geo->foreignTop + geo->foreignClusters) ? c + 1 : 0x0FFFFFFF);
+        }
+    }
+    if (geo->fatType == 32) {
+        uint8_t *fsinfo = image + Get_Word(image + 48) * sectorSize;
+
+        Put_Dword(fsinfo + 488, updateFsinfo ? Get_Dword(fsinfo + 488) - geo->foreignClusters : 0xFFFFFFFF);
+    }
+}
+
+
+// mount and compare f_getfree with fatcheck, returns the sectors read by the mount and f_getfree
+static uint32_t Check_Free(void) {
+    FatCheck_t check;
+    DWORD freeClusters;
+    FATFS *fs;
+
+    RamDisk_ClearStats();
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_getfree("", &freeClusters, &fs));
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), RamDisk_SectorSize(0), 0, &check, NULL, NULL));
+    if (freeClusters != check.free) {
+        printf("f_getfree %u, fatcheck %u\n", (unsigned)freeClusters, check.free);
+        CHECK(false);
+    }
+    return RamDisk_Stats.readSectors;
+}
+
+
+static void Write_File(const char *path) {
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_write(&fil, _Data, sizeof(_Data), &n));
+    CHECK_FR(f_close(&fil));
+}
+
+
+static void Test_Volume(const Geometry_t *geo, bool updateFsinfo) {
+    FatCheck_t check;
+    uint32_t reads;
+
+    RamDisk_Create(0, geo->sectors, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, geo->clusterBytes));
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), 512, 0, &check, NULL, NULL));
+    CHECK(check.fatType == geo->fatType);
+
+    // a clean unmount closes the summary, and on FAT32 the next mount counts the free clusters from it
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    Write_File("A.BIN");
+    CHECK_FR(f_mount(NULL, "", 0));
+    reads = Check_Free();
+    if (geo->fatType == 32) CHECK(reads < 8);
+    CHECK_FR(f_mount(NULL, "", 0));
+
+    // the other system changes the FAT of the closed volume
+    Foreign_Allocate(geo, updateFsinfo);
+    Check_Free();
+
+    // and the allocation after it leaves the volume consistent
+    Write_File("B.BIN");
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), 512, 0, &check, NULL, NULL));
+    CHECK(FatCheck_Clean(&check));
+    CHECK(check.files == 3);
+    Check_Free();
+    CHECK_FR(f_mount(NULL, "", 0));
+
+    printf("%s%s: %u sectors read by a clean mount and f_getfree, the other system's %u clusters counted\n", geo->name,
+           (geo->fatType == 32) ? (updateFsinfo ? ", FSINFO updated" : ", FSINFO invalidated") : "", reads,
+           geo->foreignClusters);
+    RamDisk_Free(0);
+}
+
+
+int main(void) {
+    static const Geometry_t geometries[] = {
+        { "FAT12", 4000, 512, 12, 1000, 1000 },
+        { "FAT16", 65536, 1024, 16, 3000, 6400 },
+        { "FAT32", 140000, 512, 32, 20000, 6400 },
+    };
+
+    for (uint32_t i = 0; i < sizeof(_Data); i++) _Data[i] = (uint8_t)(i * 7);
+
+    for (uint32_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+        Test_Volume(&geometries[g], true);
+        if (geometries[g].fatType == 32) Test_Volume(&geometries[g], false);
+    }
+    printf("ALL OK\n");
+    return 0;
+}
@@ -0,0 +1,857 @@
+// exFAT volumes on a RAM disk
+//   f_mkfs makes only FAT volumes, so the test formats its own exFAT images and checks what FatFs leaves on them
+//   with a checker that reads the image directly: entry set checksums and name hashes, cluster chains and contiguous
+//   (no FAT chain) runs against the sizes, cross links, and the allocation bitmap against the clusters in use
+//   test_exfat <image> runs the checker and a write, read and delete round trip on a copy of a raw exFAT image made
+//   elsewhere, mkfs.exfat on Linux for one, the image file itself is not changed
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define SECTOR_SIZE             512
+#define MAX_DEPTH               8
+#define MAX_DIR_CLUSTERS        4096
+
+// the layout of the volume, read from its boot sector
+typedef struct {
+    uint32_t clusterShift;              // sectors per cluster as a power of 2
+    uint32_t fatOffset;
+    uint32_t heapOffset;
+    uint32_t clusters;
+    uint32_t rootCluster;
+} ExfatGeometry_t;
+
+// what the checker found
+typedef struct {
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t noFat;                     // objects stored as a contiguous run without a FAT chain
+    uint32_t freeClusters;
+} ExfatCheck_t;
+
+static FATFS _Fs;
+static ExfatGeometry_t _Geo;
+static ExfatCheck_t _Check;
+static uint8_t *_Used;                  // clusters found in use by the checker
+static uint32_t _BitmapCluster;
+
+static uint8_t _Buf[1 << 20], _Back[1 << 20];
+
+
+static uint8_t *Sector(uint32_t sector) {
+    return RamDisk_Data(0) + (size_t)sector * SECTOR_SIZE;
+}
+
+
+static uint32_t Cluster_Sector(uint32_t cluster) {
+    return _Geo.heapOffset + ((cluster - 2) << _Geo.clusterShift);
+}
+
+
+static uint32_t Cluster_Bytes(void) {
+    return SECTOR_SIZE << _Geo.clusterShift;
+}
+
+
+static uint32_t Get_Fat(uint32_t cluster) {
+    return LD_DWORD(Sector(_Geo.fatOffset) + cluster * 4);
+}
+
+
+static void Set_Fat(uint32_t cluster, uint32_t value) {
+    ST_DWORD(Sector(_Geo.fatOffset) + cluster * 4, value);
+}
+
+
+static bool Get_Bitmap(uint32_t cluster) {
+    uint8_t *bitmap = Sector(Cluster_Sector(_BitmapCluster));
+
+    cluster -= 2;
+    return (bitmap[cluster / 8] >> (cluster % 8)) & 1;
+}
+
+
+static void Set_Bitmap(uint32_t cluster) {
+    uint8_t *bitmap = Sector(Cluster_Sector(_BitmapCluster));
+
+    cluster -= 2;
+    bitmap[cluster / 8] |= 1 << (cluster % 8);
+}
+
+
+static uint32_t Rotate32(uint32_t sum, uint8_t byte) {
+    return ((sum & 1) ? 0x80000000 : 0) + (sum >> 1) + byte;
+}
+
+
+static uint16_t Rotate16(uint16_t sum, uint8_t byte) {
+    return (uint16_t)(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + byte);
+}
+
+
+static void Read_Geometry(void) {
+    uint8_t *boot = Sector(0);
+
+    CHECK(memcmp(boot + 3, "EXFAT   ", 8) == 0);
+    CHECK(boot[108] == 9);
+    _Geo.clusterShift = boot[109];
+    _Geo.fatOffset = LD_DWORD(boot + 80);
+    _Geo.heapOffset = LD_DWORD(boot + 88);
+    _Geo.clusters = LD_DWORD(boot + 92);
+    _Geo.rootCluster = LD_DWORD(boot + 96);
+}
+
+
+// an exFAT volume of the given size: allocation bitmap, an up-case table of the ASCII letters and the root
+// directory in the first clusters, the volume label TESTVOL in the root
+static void Format_Exfat(uint32_t sectors, uint32_t clusterShift) {
+    uint32_t clusterSectors = 1u << clusterShift;
+    uint32_t fatOffset = 32;
+    uint32_t fatLength = ((((sectors - fatOffset) >> clusterShift) + 2) * 4 + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    uint32_t heapOffset = (fatOffset + fatLength + clusterSectors - 1) / clusterSectors * clusterSectors;
+    uint32_t clusters = (sectors - heapOffset) >> clusterShift;
+    uint32_t bitmapBytes = (clusters + 7) / 8;
+    uint32_t bitmapClusters = (bitmapBytes + (clusterSectors * SECTOR_SIZE) - 1) / (clusterSectors * SECTOR_SIZE);
+    uint32_t upcaseCluster = 2 + bitmapClusters, rootCluster = upcaseCluster + 1;
+    uint32_t sum = 0, upcaseSum = 0;
+    uint8_t *boot, *upcase, *dir;
+
+    RamDisk_Create(0, sectors, SECTOR_SIZE);
+
+    // main boot region: boot sector, 8 extended boot sectors, OEM and reserved sectors, the checksum sector
+    boot = Sector(0);
+    boot[0] = 0xEB; boot[1] = 0x76; boot[2] = 0x90;
+    memcpy(boot + 3, "EXFAT   ", 8);
+    ST_QWORD(boot + 72, sectors);
+    ST_DWORD(boot + 80, fatOffset);
+    ST_DWORD(boot + 84, fatLength);
+    ST_DWORD(boot + 88, heapOffset);
+    ST_DWORD(boot + 92, clusters);
+    ST_DWORD(boot + 96, rootCluster);
+    ST_DWORD(boot + 100, 0x12345678);
+    ST_WORD(boot + 104, 0x100);
+    boot[108] = 9;
+    boot[109] = (uint8_t)clusterShift;
+    boot[110] = 1;
+    boot[111] = 0x80;
+    for (uint32_t s = 0; s <= 8; s++) {
+        Sector(s)[510] = 0x55;
+        Sector(s)[511] = 0xAA;
+    }
+    for (uint32_t i = 0; i < 11 * SECTOR_SIZE; i++) {
+        if ((i != 106) && (i != 107) && (i != 112)) sum = Rotate32(sum, boot[i]);
+    }
+    for (uint32_t i = 0; i < SECTOR_SIZE / 4; i++) {
+        ST_DWORD(Sector(11) + i * 4, sum);
+    }
+    memcpy(Sector(12), Sector(0), 12 * SECTOR_SIZE);
+
+    Read_Geometry();
+    _BitmapCluster = 2;
+    Set_Fat(0, 0xFFFFFFF8);
+    Set_Fat(1, 0xFFFFFFFF);
+    for (uint32_t c = 2; c < upcaseCluster; c++) Set_Fat(c, (c + 1 == upcaseCluster) ? 0xFFFFFFFF : c + 1);
+    Set_Fat(upcaseCluster, 0xFFFFFFFF);
+    Set_Fat(rootCluster, 0xFFFFFFFF);
+    for (uint32_t c = 2; c <= rootCluster; c++) Set_Bitmap(c);
+
+    upcase = Sector(Cluster_Sector(upcaseCluster));
+    for (int i = 0; i < 128; i++) {
+        ST_WORD(upcase + i * 2, ((i >= 'a') && (i <= 'z')) ? i - 32 : i);
+    }
+    for (int i = 0; i < 256; i++) upcaseSum = Rotate32(upcaseSum, upcase[i]);
+
+    dir = Sector(Cluster_Sector(rootCluster));
+    dir[0] = 0x83;
+    dir[1] = 7;
+    for (int i = 0; i < 7; i++) {
+        ST_WORD(dir + 2 + i * 2, "TESTVOL"[i]);
+    }
+    dir[32] = 0x81;
+    ST_DWORD(dir + 32 + 20, _BitmapCluster);
+    ST_QWORD(dir + 32 + 24, bitmapBytes);
+    dir[64] = 0x82;
+    ST_DWORD(dir + 64 + 4, upcaseSum);
+    ST_DWORD(dir + 64 + 20, upcaseCluster);
+    ST_QWORD(dir + 64 + 24, 256);
+}
+
+
+static void Mark_Used(uint32_t cluster) {
+    if ((cluster < 2) || (cluster >= _Geo.clusters + 2)) {
+        printf("FAIL check: cluster %u out of range\n", cluster);
+        exit(1);
+    }
+    if (_Used[cluster]) {
+        printf("FAIL check: cluster %u is cross linked\n", cluster);
+        exit(1);
+    }
+    _Used[cluster] = 1;
+}
+
+
+// mark the clusters of an object, list them if asked, and check there are just enough for its size
+static uint32_t Check_Chain(uint32_t start, bool noFat, uint64_t size, uint32_t *list, uint32_t maxList) {
+    uint32_t need = (uint32_t)((size + Cluster_Bytes() - 1) / Cluster_Bytes());
+    uint32_t n = 0, cluster = start;
+
+    if (start == 0) {
+        CHECK(size == 0);
+        return 0;
+    }
+    if (noFat) {
+        for (n = 0; n < need; n++) {
+            Mark_Used(start + n);
+            if (list && (n < maxList)) list[n] = start + n;
+        }
+        return n;
+    }
+    for (;;) {
+        uint32_t next;
+
+        Mark_Used(cluster);
+        if (list && (n < maxList)) list[n] = cluster;
+        n++;
+        next = Get_Fat(cluster);
+        if (next == 0xFFFFFFFF) break;
+        if ((next < 2) || (next >= _Geo.clusters + 2)) {
+            printf("FAIL check: bad link %u -> %u\n", cluster, next);
+            exit(1);
+        }
+        cluster = next;
+    }
+    if (n != need) {
+        printf("FAIL check: chain at %u has %u clusters for %u\n", start, n, need);
+        exit(1);
+    }
+    return n;
+}
+
+
+// name hash of the stream extension entry, over the up-cased name (ASCII and Latin-1 are enough here)
+static uint16_t Name_Hash(uint8_t **names, uint32_t length) {
+    uint16_t hash = 0;
+
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t ch = LD_WORD(names[i / 15] + 2 + (i % 15) * 2);
+
+        if (ch < 128) {
+            ch = toupper(ch);
+        }
+        else if ((ch >= 0xE0) && (ch <= 0xFE) && (ch != 0xF7)) {
+            ch -= 32;
+        }
+        hash = Rotate16(hash, (uint8_t)ch);
+        hash = Rotate16(hash, (uint8_t)(ch >> 8));
+    }
+    return hash;
+}
+
+
+static void Check_Directory(uint32_t start, bool noFat, uint64_t size, uint32_t depth) {
+    static uint32_t lists[MAX_DEPTH][MAX_DIR_CLUSTERS];
+    uint32_t *list = lists[depth];
+    uint32_t perCluster = Cluster_Bytes() / 32;
+    uint32_t entries = Check_Chain(start, noFat, size, list, MAX_DIR_CLUSTERS) * perCluster;
+
+    CHECK(depth < MAX_DEPTH);
+#define ENTRY(k)    (Sector(Cluster_Sector(list[(k) / perCluster])) + ((k) % perCluster) * 32)
+
+    for (uint32_t i = 0; i < entries; i++) {
+        uint8_t *file = ENTRY(i), *stream, *names[18];
+        uint32_t secondaries, nameLength, first;
+        uint16_t sum = 0;
+        uint64_t validSize, dataSize;
+
+        if (file[0] == 0) break;
+        if (file[0] != 0x85) {
+            // the bitmap, up-case table and label entries belong in the root, anything else in use must be a file
+            if ((depth == 0) && ((file[0] == 0x81) || (file[0] == 0x82) || (file[0] == 0x83))) continue;
+            if (file[0] & 0x80) {
+                printf("FAIL check: stray entry %02X\n", file[0]);
+                exit(1);
+            }
+            continue;
+        }
+
+        secondaries = file[1];
+        CHECK((secondaries >= 2) && (secondaries <= 18) && (i + secondaries < entries));
+        for (uint32_t j = 0; j <= secondaries; j++) {
+            uint8_t *e = ENTRY(i + j);
+
+            for (int k = 0; k < 32; k++) {
+                if ((j != 0) || ((k != 2) && (k != 3))) sum = Rotate16(sum, e[k]);
+            }
+        }
+        if (sum != LD_WORD(file + 2)) {
+            printf("FAIL check: entry set checksum at %u\n", i);
+            exit(1);
+        }
+
+        stream = ENTRY(i + 1);
+        CHECK(stream[0] == 0xC0);
+        nameLength = stream[3];
+        CHECK((nameLength + 14) / 15 == secondaries - 1);
+        for (uint32_t j = 0; j < secondaries - 1; j++) {
+            names[j] = ENTRY(i + 2 + j);
+            CHECK(names[j][0] == 0xC1);
+        }
+        if (Name_Hash(names, nameLength) != LD_WORD(stream + 4)) {
+            printf("FAIL check: name hash at %u\n", i);
+            exit(1);
+        }
+
+        validSize = LD_QWORD(stream + 8);
+        dataSize = LD_QWORD(stream + 24);
+        first = LD_DWORD(stream + 20);
+        noFat = (stream[1] & 2) != 0;
+        if (validSize != dataSize) {
+            printf("FAIL check: valid size %llu, size %llu\n", (unsigned long long)validSize, (unsigned long long)dataSize);
+            exit(1);
+        }
+        CHECK((stream[1] & 1) || (first == 0));
+        if (noFat) _Check.noFat++;
+
+        if (LD_WORD(file + 4) & AM_DIR) {
+            _Check.dirs++;
+            Check_Directory(first, noFat, dataSize, depth + 1);
+        }
+        else {
+            _Check.files++;
+            Check_Chain(first, noFat, dataSize, NULL, 0);
+        }
+        i += secondaries;
+    }
+#undef ENTRY
+}
+
+
+// check the whole image and return the free clusters the bitmap should show
+static uint32_t Check_Volume(void) {
+    uint8_t *root;
+    uint32_t rootClusters = 0;
+
+    Read_Geometry();
+    free(_Used);
+    _Used = calloc(_Geo.clusters + 2, 1);
+    memset(&_Check, 0, sizeof(_Check));
+
+    // the bitmap and up-case table are found from their entries at the start of the root directory
+    _BitmapCluster = 0;
+    root = Sector(Cluster_Sector(_Geo.rootCluster));
+    for (uint32_t i = 0; (i < Cluster_Bytes() / 32) && root[i * 32]; i++) {
+        uint8_t *e = root + i * 32;
+
+        if ((e[0] == 0x81) || (e[0] == 0x82)) {
+            Check_Chain(LD_DWORD(e + 20), false, LD_QWORD(e + 24), NULL, 0);
+            if (e[0] == 0x81) _BitmapCluster = LD_DWORD(e + 20);
+        }
+    }
+    CHECK(_BitmapCluster != 0);
+
+    // the root directory has no size of its own, it is as long as its chain
+    for (uint32_t c = _Geo.rootCluster; c != 0xFFFFFFFF; c = Get_Fat(c)) rootClusters++;
+    Check_Directory(_Geo.rootCluster, false, (uint64_t)rootClusters * Cluster_Bytes(), 0);
+
+    for (uint32_t c = 2; c < _Geo.clusters + 2; c++) {
+        if (Get_Bitmap(c) != _Used[c]) {
+            printf("FAIL check: cluster %u is %s in the bitmap\n", c, _Used[c] ? "free" : "allocated");
+            exit(1);
+        }
+        if (!_Used[c]) _Check.freeClusters++;
+    }
+    return _Check.freeClusters;
+}
+
+
+// the image is consistent and FatFs counts the same free clusters
+static void Check_Free(void) {
+    DWORD freeClusters;
+    FATFS *fs;
+
+    Check_Volume();
+    _Fs.free_clust = 0xFFFFFFFF;
+    CHECK_FR(f_getfree("", &freeClusters, &fs));
+    if (freeClusters != _Check.freeClusters) {
+        printf("FAIL f_getfree %u, checker %u\n", (unsigned)freeClusters, _Check.freeClusters);
+        exit(1);
+    }
+}
+
+
+static uint8_t Pattern(uint32_t file, uint64_t offset) {
+    return (uint8_t)(offset * 7 + file * 13 + (offset >> 9));
+}
+
+
+static void Fill(uint32_t file, uint32_t offset, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) _Buf[i] = Pattern(file, offset + i);
+}
+
+
+static void Write_File(const char *path, uint32_t file, uint32_t size) {
+    FIL fil;
+    UINT n;
+
+    Fill(file, 0, size);
+    CHECK_FR(f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_write(&fil, _Buf, size, &n));
+    CHECK(n == size);
+    CHECK_FR(f_close(&fil));
+}
+
+
+// read the file back in reads of changing sizes
+static void Verify_File(const char *path, uint32_t file, uint32_t size) {
+    uint32_t offset = 0, step = 1;
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    CHECK(f_size(&fil) == size);
+    while (offset < size) {
+        uint32_t chunk = (step++ * 977) % 70000 + 1;
+
+        if (chunk > size - offset) chunk = size - offset;
+        CHECK_FR(f_read(&fil, _Back, chunk, &n));
+        CHECK(n == chunk);
+        for (uint32_t i = 0; i < chunk; i++) {
+            if (_Back[i] != Pattern(file, offset + i)) {
+                printf("FAIL %s: data at %u\n", path, offset + i);
+                exit(1);
+            }
+        }
+        offset += chunk;
+    }
+    CHECK_FR(f_close(&fil));
+}
+
+
+static FRESULT Stat(const char *path) {
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+
+    return f_stat(path, &fi);
+}
+
+
+static int Count_Entries(const char *path) {
+    char lfn[256];
+    FILINFO fi = { .lfname = lfn, .lfsize = sizeof(lfn) };
+    DIR dir;
+    int count = 0;
+
+    CHECK_FR(f_opendir(&dir, path));
+    for (;;) {
+        CHECK_FR(f_readdir(&dir, &fi));
+        if (!fi.fname[0]) break;
+        count++;
+    }
+    CHECK_FR(f_closedir(&dir));
+    return count;
+}
+
+
+// f_readdirplus returns the same items as f_readdir, in the same order
+static void Check_ReadDirPlus(const char *path, int expected) {
+    static DIRITEM items[7];
+    char lfn[256];
+    FILINFO fi = { .lfname = lfn, .lfsize = sizeof(lfn) };
+    DIR dir, dirPlus;
+    UINT n;
+    int count = 0;
+
+    CHECK_FR(f_opendir(&dir, path));
+    CHECK_FR(f_opendir(&dirPlus, path));
+    do {
+        CHECK_FR(f_readdirplus(&dirPlus, items, 7, &n));
+        for (UINT i = 0; i < n; i++, count++) {
+            const char *name;
+
+            CHECK_FR(f_readdir(&dir, &fi));
+            name = (strlen(lfn) < _USE_DIRPLUS) ? lfn : "?";
+            CHECK(strcmp(name, items[i].fname) == 0);
+            CHECK(items[i].fsize == fi.fsize);
+            CHECK(items[i].fattrib == fi.fattrib);
+        }
+    } while (n == 7);
+    CHECK_FR(f_readdir(&dir, &fi));
+    CHECK(!fi.fname[0]);
+    CHECK_FR(f_closedir(&dir));
+    CHECK_FR(f_closedir(&dirPlus));
+    CHECK(count == expected);
+}
+
+
+static void Test_Basic(void) {
+    static const char *longName = "dir one/file number %03d with some padding to make it long.txt";
+    char label[24], path[80];
+    DWORD vsn;
+    FIL a, b;
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+    uint32_t sizeA = 0, sizeB = 0;
+    UINT n;
+
+    Format_Exfat(131072, 3);            // 64MB, 4KB clusters
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK(_Fs.fs_type == FS_EXFAT);
+    CHECK_FR(f_getlabel("", label, &vsn));
+    CHECK(strcmp(label, "TESTVOL") == 0);
+    CHECK(vsn == 0x12345678);
+    CHECK_RES(f_setlabel("X"), FR_DENIED);
+    Check_Free();
+
+    // interleaved writers, the second one loses its contiguous run and needs a FAT chain
+    CHECK_FR(f_open(&a, "First File With A Long Name.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_open(&b, "second.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t k = 0; k < 40; k++) {
+        uint32_t size = (k * 5311) % 9000 + 1;
+
+        Fill(1, sizeA, size);
+        CHECK_FR(f_write(&a, _Buf, size, &n));
+        sizeA += n;
+        size = (k * 3371) % 20000 + 3;
+        Fill(2, sizeB, size);
+        CHECK_FR(f_write(&b, _Buf, size, &n));
+        sizeB += n;
+    }
+    CHECK_FR(f_close(&a));
+    CHECK_FR(f_close(&b));
+    Check_Free();
+    Verify_File("FIRST FILE WITH A LONG NAME.BIN", 1, sizeA);
+    Verify_File("Second.bin", 2, sizeB);
+    Write_File("contig.dat", 3, 700000);
+    Verify_File("CONTIG.DAT", 3, 700000);
+    Check_Free();
+    CHECK(_Check.noFat >= 1);
+
+    // a directory of many long names, split around another file's clusters as it grows
+    CHECK_FR(f_mkdir("dir one"));
+    CHECK_FR(f_mkdir("dir one/sub"));
+    CHECK_RES(f_mkdir("DIR ONE"), FR_EXIST);
+    for (int i = 0; i < 200; i++) {
+        if (i == 120) Write_File("between.bin", 4, 30000);
+        sprintf(path, longName, i);
+        Write_File(path, 10 + i, (i * 131) % 5000);
+    }
+    Check_Free();
+    for (int i = 0; i < 200; i++) {
+        sprintf(path, "DIR ONE/FILE NUMBER %03d WITH SOME PADDING TO MAKE IT LONG.TXT", i);
+        Verify_File(path, 10 + i, (i * 131) % 5000);
+    }
+    CHECK(Count_Entries("dir one") == 201);
+    CHECK(Count_Entries("") == 5);
+    Check_ReadDirPlus("dir one", 201);
+    Check_ReadDirPlus("", 5);
+    CHECK_FR(f_stat("dir one/sub", &fi));
+    CHECK(fi.fattrib & AM_DIR);
+
+    // attributes and time stamps
+    CHECK_FR(f_chmod("between.bin", AM_RDO, AM_RDO));
+    CHECK_FR(f_stat("between.bin", &fi));
+    CHECK(fi.fattrib == (AM_RDO | AM_ARC));
+    CHECK_RES(f_open(&a, "between.bin", FA_WRITE), FR_DENIED);
+    CHECK_FR(f_chmod("between.bin", 0, AM_RDO));
+    fi.fdate = 0x4A21;
+    fi.ftime = 0x6543;
+    CHECK_FR(f_utime("between.bin", &fi));
+    CHECK_FR(f_stat("between.bin", &fi));
+    CHECK((fi.fdate == 0x4A21) && (fi.ftime == 0x6543));
+    Check_Free();
+
+    // rename across directories keeps the data and the time stamp
+    CHECK_FR(f_rename("between.bin", "dir one/sub/Moved And Renamed With A Longer Name Than Before.bin"));
+    CHECK_RES(Stat("between.bin"), FR_NO_FILE);
+    Verify_File("dir one/sub/moved and renamed with a longer name than before.bin", 4, 30000);
+    CHECK_FR(f_stat("dir one/sub/moved and renamed with a longer name than before.bin", &fi));
+    CHECK((fi.fdate == 0x4A21) && (fi.ftime == 0x6543));
+    CHECK_FR(f_rename("dir one/sub", "sub2"));
+    Verify_File("sub2/moved and renamed with a longer name than before.bin", 4, 30000);
+    Check_Free();
+
+    // unlink
+    CHECK_RES(f_unlink("dir one"), FR_DENIED);
+    for (int i = 0; i < 200; i += 2) {
+        sprintf(path, longName, i);
+        CHECK_FR(f_unlink(path));
+    }
+    Check_Free();
+    for (int i = 1; i < 200; i += 2) {
+        sprintf(path, longName, i);
+        Verify_File(path, 10 + i, (i * 131) % 5000);
+        CHECK_FR(f_unlink(path));
+    }
+    CHECK_FR(f_unlink("dir one"));
+    Check_Free();
+
+    // truncate, a contiguous file and a chained one, then to nothing
+    CHECK_FR(f_open(&a, "contig.dat", FA_READ | FA_WRITE));
+    CHECK_FR(f_lseek(&a, 123457));
+    CHECK_FR(f_truncate(&a));
+    CHECK_FR(f_close(&a));
+    Verify_File("contig.dat", 3, 123457);
+    Check_Free();
+    CHECK_FR(f_open(&a, "second.bin", FA_READ | FA_WRITE));
+    CHECK_FR(f_lseek(&a, 5000));
+    CHECK_FR(f_truncate(&a));
+    CHECK_FR(f_close(&a));
+    Verify_File("second.bin", 2, 5000);
+    Check_Free();
+    CHECK_FR(f_open(&a, "second.bin", FA_READ | FA_WRITE));
+    CHECK_FR(f_truncate(&a));
+    CHECK_FR(f_close(&a));
+    Verify_File("second.bin", 2, 0);
+    Check_Free();
+
+    // overwrite, then append after a remount
+    Write_File("First File With A Long Name.bin", 5, 9999);
+    Verify_File("first file with a long name.bin", 5, 9999);
+    Check_Free();
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_open(&a, "first file with a long name.bin", FA_WRITE | FA_OPEN_EXISTING));
+    CHECK_FR(f_lseek(&a, f_size(&a)));
+    Fill(5, 9999, 50000);
+    CHECK_FR(f_write(&a, _Buf, 50000, &n));
+    CHECK_FR(f_close(&a));
+    Verify_File("first file with a long name.bin", 5, 59999);
+    Verify_File("sub2/moved and renamed with a longer name than before.bin", 4, 30000);
+    Check_Free();
+    CHECK_RES(f_open(&a, "bad*name", FA_READ), FR_INVALID_NAME);
+
+    // fill the volume to the last cluster and free it again
+    CHECK_FR(f_open(&a, "fill.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    memset(_Buf, 0xA5, sizeof(_Buf));
+    do {
+        CHECK_FR(f_write(&a, _Buf, sizeof(_Buf), &n));
+    } while (n == sizeof(_Buf));
+    CHECK_FR(f_close(&a));
+    CHECK(Check_Volume() == 0);
+    CHECK_FR(f_unlink("fill.bin"));
+    Check_Free();
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("basic ok: %u objects without a FAT chain\n", _Check.noFat);
+}
+
+
+// paths through directories that grow, move and go away while the path cache holds them
+static void Test_Paths(void) {
+    char path[80];
+    FIL fil;
+
+    Format_Exfat(16384, 0);             // 8MB, 512 byte clusters so a directory grows every 16 entries
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_mkdir("site"));
+    CHECK_FR(f_mkdir("site/2026"));
+    CHECK_FR(f_mkdir("site/2026/10"));
+    for (int i = 0; i < 60; i++) {
+        sprintf(path, "site/2026/file number %d.txt", i);
+        CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE));
+        CHECK_FR(f_close(&fil));
+        sprintf(path, "site/2026/10/inner %d.txt", i);
+        CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE));
+        CHECK_FR(f_close(&fil));
+        if (i % 10 == 0) {
+            sprintf(path, "site/2026/sub%d", i);
+            CHECK_FR(f_mkdir(path));
+            sprintf(path, "site/2026/sub%d/x.txt", i);
+            CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE));
+            CHECK_FR(f_close(&fil));
+        }
+    }
+    for (int i = 0; i < 60; i++) {
+        sprintf(path, "site/2026/10/inner %d.txt", i);
+        CHECK_FR(Stat(path));
+    }
+    Check_Volume();
+
+    CHECK_FR(f_rename("site/2026", "site/2027"));
+    CHECK_RES(Stat("site/2026/10/inner 5.txt"), FR_NO_PATH);
+    CHECK_FR(Stat("site/2027/10/inner 5.txt"));
+    CHECK_FR(f_mkdir("b"));
+    CHECK_FR(f_rename("site/2027/10", "b/10"));
+    CHECK_FR(Stat("b/10/inner 59.txt"));
+    CHECK_RES(Stat("site/2027/10/inner 59.txt"), FR_NO_PATH);
+    for (int i = 0; i < 60; i++) {
+        sprintf(path, "b/10/inner %d.txt", i);
+        CHECK_FR(f_unlink(path));
+    }
+    CHECK_FR(f_unlink("b/10"));
+    CHECK_RES(Stat("b/10/inner 1.txt"), FR_NO_PATH);
+    CHECK_FR(f_mkdir("b/10"));
+    CHECK_RES(Stat("b/10/inner 1.txt"), FR_NO_FILE);
+    Check_Volume();
+    CHECK(_Check.files == 66);
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("paths ok\n");
+}
+
+
+// a file past 4GB, only its last bytes are written so the RAM disk stays mostly untouched
+static void Test_Large(void) {
+    static const FSIZE_t pos = 0x100000000ULL + 1000;
+    char buf[16] = { 0 };
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+    FIL fil;
+    UINT n;
+
+    Format_Exfat(9437184, 8);           // 4.5GB, 128KB clusters
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_open(&fil, "huge.bin", FA_CREATE_ALWAYS | FA_WRITE | FA_READ));
+    CHECK_FR(f_lseek(&fil, pos));
+    CHECK(f_tell(&fil) == pos);
+    CHECK_FR(f_write(&fil, "hello exfat", 11, &n));
+    CHECK(n == 11);
+    CHECK_FR(f_close(&fil));
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_open(&fil, "huge.bin", FA_READ));
+    CHECK(f_size(&fil) == pos + 11);
+    CHECK_FR(f_lseek(&fil, pos));
+    CHECK_FR(f_read(&fil, buf, sizeof(buf), &n));
+    CHECK((n == 11) && (memcmp(buf, "hello exfat", 11) == 0));
+    CHECK_FR(f_close(&fil));
+    CHECK_FR(f_stat("huge.bin", &fi));
+    CHECK(fi.fsize == pos + 11);
+    Check_Free();
+
+    CHECK_FR(f_open(&fil, "huge.bin", FA_READ | FA_WRITE));
+    CHECK_FR(f_lseek(&fil, 0xFFFFFFFFULL));
+    CHECK_FR(f_truncate(&fil));
+    CHECK_FR(f_close(&fil));
+    CHECK_FR(f_stat("huge.bin", &fi));
+    CHECK(fi.fsize == 0xFFFFFFFFULL);
+    Check_Free();
+    CHECK_FR(f_unlink("huge.bin"));
+    Check_Free();
+    CHECK_FR(f_mount(NULL, "", 0));
+    RamDisk_Free(0);
+    printf("large ok\n");
+}
+
+
+// f_itemfrags on the items of the root directory must count what f_defrag counts, with or without a FAT chain
+static void Check_ItemFrags(void) {
+    DIRITEM items[8];
+    DWORD byItem, byName;
+    DIR dir;
+    UINT n;
+
+    CHECK_FR(f_opendir(&dir, ""));
+    CHECK_FR(f_readdirplus(&dir, items, 8, &n));
+    for (UINT i = 0; i < n; i++) {
+        if ((items[i].fattrib & AM_DIR) || !items[i].sclust) continue;
+        CHECK_FR(f_itemfrags("", &items[i], &byItem));
+        CHECK_FR(f_defrag(items[i].fname, 0, NULL, 0, &byName));
+        CHECK(byItem == byName);
+    }
+    CHECK_FR(f_closedir(&dir));
+}
+
+
+// f_defrag and f_fraginfo on exFAT, where a defragmented file goes back to a run without a FAT chain
+static void Test_Defrag(void) {
+    static uint8_t work[8192];
+    FRAGINFO withWork, withoutWork;
+    DWORD fragments, freeClusters;
+    FATFS *fs;
+    FIL a, b;
+    UINT n;
+
+    Format_Exfat(131072, 3);
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK_FR(f_open(&a, "frag a.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_open(&b, "frag b.bin", FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t offset = 0; offset < 200000; offset += 5000) {
+        Fill(1, offset, 5000);
+        CHECK_FR(f_write(&a, _Buf, 5000, &n));
+        CHECK_FR(f_sync(&a));
+        Fill(2, offset, 5000);
+        CHECK_FR(f_write(&b, _Buf, 5000, &n));
+        CHECK_FR(f_sync(&b));
+    }
+    CHECK_FR(f_close(&a));
+    CHECK_FR(f_close(&b));
+
+    Write_File("contig.bin", 3, 50000);
+    CHECK_FR(f_defrag("contig.bin", 0, NULL, 0, &fragments));
+    CHECK(fragments == 1);
+    Check_ItemFrags();
+    CHECK_FR(f_defrag("frag a.bin", 0, NULL, 0, &fragments));
+    CHECK(fragments > 1);
+    CHECK_FR(f_defrag("frag a.bin", 2, work, sizeof(work), &fragments));
+    CHECK_FR(f_defrag("frag a.bin", 0, NULL, 0, &fragments));
+    CHECK(fragments == 1);
+    Verify_File("frag a.bin", 1, 200000);
+    Verify_File("frag b.bin", 2, 200000);
+    Check_ItemFrags();
+    Check_Free();
+
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    Verify_File("frag a.bin", 1, 200000);
+    Check_Free();
+    CHECK_FR(f_fraginfo("", &withWork, work, sizeof(work)));
+    CHECK_FR(f_fraginfo("", &withoutWork, NULL, 0));
+    CHECK(memcmp(&withWork, &withoutWork, sizeof(withWork)) == 0);
+    _Fs.free_clust = 0xFFFFFFFF;
+    CHECK_FR(f_getfree("", &freeClusters, &fs));
+    CHECK(withWork.n_free == freeClusters);
+    CHECK(withWork.n_chain == 0);
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("defrag ok\n");
+}
+
+
+// an image made by another formatter: check it, then write, read back and delete a file and check it again
+static void Test_Image(const char *path) {
+    DIR dir;
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+    uint32_t freeBefore;
+
+    if (!RamDisk_Map(0, path, false)) {
+        printf("FAIL cannot map %s\n", path);
+        exit(1);
+    }
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK(_Fs.fs_type == FS_EXFAT);
+    Check_Free();
+    freeBefore = _Check.freeClusters;
+    printf("%s: %u files, %u directories, %u free clusters of %u\n", path,
+           _Check.files, _Check.dirs, _Check.freeClusters, _Geo.clusters);
+
+    CHECK_FR(f_mkdir("FatFs test directory"));
+    Write_File("FatFs test directory/A file with a long name.bin", 7, 300000);
+    Verify_File("FatFs test directory/a file with a long name.bin", 7, 300000);
+    CHECK_FR(f_opendir(&dir, "FatFs test directory"));
+    CHECK_FR(f_readdir(&dir, &fi));
+    CHECK(fi.fsize == 300000);
+    CHECK_FR(f_closedir(&dir));
+    Check_Free();
+    CHECK_FR(f_unlink("FatFs test directory/A file with a long name.bin"));
+    CHECK_FR(f_unlink("FatFs test directory"));
+    Check_Free();
+    CHECK(_Check.freeClusters == freeBefore);
+    CHECK_FR(f_mount(NULL, "", 0));
+    RamDisk_Free(0);
+    printf("image ok\n");
+}
+
+
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) Test_Image(argv[i]);
+    }
+    else {
+        Test_Defrag();
+        Test_Basic();
+        Test_Paths();
+        Test_Large();
+    }
+    printf("ALL OK\n");
+    return 0;
+}
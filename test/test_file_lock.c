@@ -0,0 +1,420 @@
+// Concurrent file access with _FS_REENTRANT 1 (volume lock) and 2 (file locks, volume lock after them)
+//   built with ThreadSanitizer, which fails the run on any data race or lock order inversion
+//   threads read, write, seek, sync, truncate and close different files, share one file object,
+//   and open and read the same file through objects of their own, while directories change beside them
+//   with file locks, a shared file object is closed under the threads writing to it
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ff.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define WRITERS                 6
+#define WRITER_OPS              3000
+#define WRITER_MAX_SIZE         150000
+#define APPENDERS               4
+#define RECORDS                 400
+#define RECORD_SIZE             16
+#define SAME_FILE_READERS       4
+#define SAME_FILE_SIZE          60000
+
+// the hidden FAT access of ff.c, to count the free clusters independently of f_getfree
+DWORD get_fat(FATFS *fs, DWORD clst);
+
+static FATFS _Fs;
+
+static uint8_t _Model[WRITERS][WRITER_MAX_SIZE];
+static uint32_t _ModelSize[WRITERS];
+
+
+static double Now_Seconds(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void Run_Threads(void *(*func)(void *), int count, pthread_t *threads) {
+    for (long i = 0; i < count; i++) {
+        CHECK(pthread_create(&threads[i], NULL, func, (void *)i) == 0);
+    }
+}
+
+
+static void Join_Threads(int count, pthread_t *threads) {
+    for (int i = 0; i < count; i++) pthread_join(threads[i], NULL);
+}
+
+
+static void Check_File(const char *path, const uint8_t *expected, uint32_t size) {
+    static __thread uint8_t buf[4096];
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    CHECK(f_size(&fil) == size);
+    for (uint32_t ofs = 0; ofs < size; ofs += n) {
+        CHECK_FR(f_read(&fil, buf, sizeof(buf), &n));
+        CHECK(n != 0);
+        CHECK(memcmp(buf, expected + ofs, n) == 0);
+    }
+    CHECK_FR(f_close(&fil));
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Different files                                                       */
+/*-----------------------------------------------------------------------*/
+
+// random reads, writes, seeks, syncs and truncations of one file, checked against a copy in memory
+static void *Writer_Thread(void *arg) {
+    int t = (int)(long)arg;
+    static __thread uint8_t buf[4096];
+    unsigned seed = t * 77 + 1;
+    char path[16];
+    FIL fil;
+    UINT n;
+
+    sprintf(path, "W%d.BIN", t);
+    CHECK_FR(f_open(&fil, path, FA_CREATE_ALWAYS | FA_READ | FA_WRITE));
+
+    for (int op = 0; op < WRITER_OPS; op++) {
+        uint32_t pos = (uint32_t)f_tell(&fil);
+        uint32_t size = _ModelSize[t];
+        uint32_t len = rand_r(&seed) % 3000 + 1;
+        int kind = rand_r(&seed) % 20;
+
+        if (kind < 8) {
+            if (pos + len > WRITER_MAX_SIZE) {
+                CHECK_FR(f_lseek(&fil, 0));
+                continue;
+            }
+            for (uint32_t i = 0; i < len; i++) buf[i] = (uint8_t)rand_r(&seed);
+            CHECK_FR(f_write(&fil, buf, len, &n));
+            CHECK(n == len);
+            if (pos > size) memset(&_Model[t][size], 0, pos - size);
+            memcpy(&_Model[t][pos], buf, len);
+            if (pos + len > size) _ModelSize[t] = pos + len;
+        }
+        else if (kind < 14) {
+            uint32_t expect = (pos >= size) ? 0 : ((size - pos < len) ? size - pos : len);
+
+            CHECK_FR(f_read(&fil, buf, len, &n));
+            CHECK(n == expect);
+            CHECK(memcmp(buf, &_Model[t][pos], n) == 0);
+        }
+        else if (kind < 17) {
+            CHECK_FR(f_lseek(&fil, rand_r(&seed) % (size + 1)));
+        }
+        else if (kind < 19) {
+            CHECK_FR(f_sync(&fil));
+        }
+        else {
+            uint32_t cut = rand_r(&seed) % (size + 1);
+
+            CHECK_FR(f_lseek(&fil, cut));
+            CHECK_FR(f_truncate(&fil));
+            _ModelSize[t] = cut;
+        }
+
+        // close and open again from time to time
+        if (op % 500 == 499) {
+            CHECK_FR(f_close(&fil));
+            CHECK_FR(f_open(&fil, path, FA_OPEN_EXISTING | FA_READ | FA_WRITE));
+            CHECK(f_size(&fil) == _ModelSize[t]);
+        }
+    }
+    CHECK_FR(f_close(&fil));
+    Check_File(path, _Model[t], _ModelSize[t]);
+    return NULL;
+}
+
+
+// creates, appends to, removes and lists files in a directory of its own
+static void *Directory_Thread(void *arg) {
+    DIR dir;
+    FILINFO info;
+    char path[32];
+    FIL fil;
+    UINT n;
+
+    (void)arg;
+    info.lfname = NULL;
+    info.lfsize = 0;
+    for (int k = 0; k < 300; k++) {
+        sprintf(path, "D/FILE%d.TXT", k % 17);
+        if (k % 3 == 2) {
+            f_unlink(path);
+        }
+        else {
+            CHECK_FR(f_open(&fil, path, FA_OPEN_ALWAYS | FA_WRITE));
+            CHECK_FR(f_lseek(&fil, f_size(&fil)));
+            CHECK_FR(f_write(&fil, "hello world\n", 12, &n));
+            CHECK_FR(f_close(&fil));
+        }
+        CHECK_FR(f_opendir(&dir, "D"));
+        while ((f_readdir(&dir, &info) == FR_OK) && info.fname[0]) {}
+        CHECK_FR(f_closedir(&dir));
+    }
+    return NULL;
+}
+
+
+static void Test_DifferentFiles(void) {
+    pthread_t threads[WRITERS + 1];
+
+    CHECK_FR(f_mkdir("D"));
+    Run_Threads(Writer_Thread, WRITERS, threads);
+    Run_Threads(Directory_Thread, 1, &threads[WRITERS]);
+    Join_Threads(WRITERS + 1, threads);
+    printf("different files ok\n");
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* The same file                                                         */
+/*-----------------------------------------------------------------------*/
+
+static FIL _Shared;
+static FIL _Others[APPENDERS];
+
+// append tagged records to the shared file object, each write must land whole
+static void *Appender_Thread(void *arg) {
+    int t = (int)(long)arg;
+    char record[RECORD_SIZE + 1];
+    UINT n;
+
+    for (int i = 0; i < RECORDS; i++) {
+        snprintf(record, sizeof(record), "T%d R%04d ......", t, i);
+        CHECK_FR(f_write(&_Shared, record, RECORD_SIZE, &n));
+        CHECK(n == RECORD_SIZE);
+        CHECK_FR(f_write(&_Others[t], record, RECORD_SIZE, &n));
+    }
+    return NULL;
+}
+
+
+// commit the shared file together with the files the appenders write on their own
+static void *Syncer_Thread(void *arg) {
+    FIL *files[APPENDERS + 1];
+
+    (void)arg;
+    for (int i = 0; i < APPENDERS; i++) files[i] = &_Others[APPENDERS - 1 - i];
+    files[APPENDERS] = &_Shared;
+    for (int k = 0; k < 200; k++) {
+        CHECK_FR(f_syncall(files, APPENDERS + 1));
+    }
+    return NULL;
+}
+
+
+// read the same file through an object of its own, again and again
+static void *SameFile_Reader_Thread(void *arg) {
+    static __thread uint8_t buf[3000];
+    unsigned seed = (unsigned)(long)arg + 5;
+    FIL fil;
+    UINT n;
+
+    for (int k = 0; k < 20; k++) {
+        uint32_t ofs = 0;
+
+        CHECK_FR(f_open(&fil, "SAME.BIN", FA_READ));
+        do {
+            UINT len = rand_r(&seed) % sizeof(buf) + 1;
+
+            CHECK_FR(f_read(&fil, buf, len, &n));
+            for (UINT i = 0; i < n; i++) CHECK(buf[i] == (uint8_t)((ofs + i) * 3));
+            ofs += n;
+        } while (n != 0);
+        CHECK(ofs == SAME_FILE_SIZE);
+        CHECK_FR(f_close(&fil));
+    }
+    return NULL;
+}
+
+
+static void Test_SameFile(void) {
+    static uint8_t data[SAME_FILE_SIZE];
+    pthread_t threads[APPENDERS + 1 + SAME_FILE_READERS];
+    int count[APPENDERS] = { 0 };
+    char record[RECORD_SIZE + 1];
+    char path[16];
+    FIL fil;
+    UINT n;
+
+    for (uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 3);
+    CHECK_FR(f_open(&fil, "SAME.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_write(&fil, data, sizeof(data), &n));
+    CHECK_FR(f_close(&fil));
+
+    CHECK_FR(f_open(&_Shared, "SHARED.TXT", FA_CREATE_ALWAYS | FA_WRITE));
+    for (int t = 0; t < APPENDERS; t++) {
+        sprintf(path, "OWN%d.TXT", t);
+        CHECK_FR(f_open(&_Others[t], path, FA_CREATE_ALWAYS | FA_WRITE));
+    }
+
+    Run_Threads(Appender_Thread, APPENDERS, threads);
+    Run_Threads(Syncer_Thread, 1, &threads[APPENDERS]);
+    Run_Threads(SameFile_Reader_Thread, SAME_FILE_READERS, &threads[APPENDERS + 1]);
+    Join_Threads(APPENDERS + 1 + SAME_FILE_READERS, threads);
+
+    CHECK(f_size(&_Shared) == APPENDERS * RECORDS * RECORD_SIZE);
+    CHECK_FR(f_close(&_Shared));
+    for (int t = 0; t < APPENDERS; t++) CHECK_FR(f_close(&_Others[t]));
+
+    // every record is whole, and the records of each thread are in the order it wrote them
+    CHECK_FR(f_open(&fil, "SHARED.TXT", FA_READ));
+    for (int i = 0; i < APPENDERS * RECORDS; i++) {
+        int t, r;
+
+        CHECK_FR(f_read(&fil, record, RECORD_SIZE, &n));
+        CHECK(n == RECORD_SIZE);
+        record[RECORD_SIZE] = 0;
+        CHECK(sscanf(record, "T%d R%d", &t, &r) == 2);
+        CHECK((t >= 0) && (t < APPENDERS));
+        CHECK(r == count[t]);
+        count[t]++;
+    }
+    CHECK_FR(f_close(&fil));
+    printf("same file ok\n");
+}
+
+
+#if _FS_REENTRANT == 2
+/*-----------------------------------------------------------------------*/
+/* Closing a shared file                                                 */
+/*-----------------------------------------------------------------------*/
+
+static uint32_t _Appended;
+
+// append to the shared file object until it is closed under the thread
+static void *Closed_Appender_Thread(void *arg) {
+    char record[RECORD_SIZE + 1];
+    FRESULT res;
+    UINT n;
+
+    snprintf(record, sizeof(record), "T%d ............", (int)(long)arg);
+    while ((res = f_write(&_Shared, record, RECORD_SIZE, &n)) == FR_OK) {
+        CHECK(n == RECORD_SIZE);
+        __atomic_fetch_add(&_Appended, 1, __ATOMIC_RELAXED);
+    }
+    CHECK(res == FR_INVALID_OBJECT);
+    return NULL;
+}
+
+
+// f_close while the others wait on the file lock, they must get FR_INVALID_OBJECT rather than a discarded lock
+static void Test_CloseShared(void) {
+    pthread_t threads[APPENDERS];
+    FILINFO info = { .lfname = NULL, .lfsize = 0 };
+
+    _Appended = 0;
+    CHECK_FR(f_open(&_Shared, "CLOSED.TXT", FA_CREATE_ALWAYS | FA_WRITE));
+    Run_Threads(Closed_Appender_Thread, APPENDERS, threads);
+    while (__atomic_load_n(&_Appended, __ATOMIC_RELAXED) < 1000) {}
+    CHECK_FR(f_close(&_Shared));
+    Join_Threads(APPENDERS, threads);
+
+    CHECK_FR(f_stat("CLOSED.TXT", &info));
+    CHECK(info.fsize == _Appended * RECORD_SIZE);
+    printf("closing a shared file ok\n");
+}
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Volume check and read benchmark                                       */
+/*-----------------------------------------------------------------------*/
+
+static void Check_Volume(void) {
+    FATFS *fs;
+    DWORD free, counted = 0;
+    char path[16];
+
+    for (DWORD c = 2; c < _Fs.n_fatent; c++) {
+        if (get_fat(&_Fs, c) == 0) counted++;
+    }
+    _Fs.free_clust = 0xFFFFFFFF;
+    CHECK_FR(f_getfree("", &free, &fs));
+    CHECK(free == counted);
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    for (int t = 0; t < WRITERS; t++) {
+        sprintf(path, "W%d.BIN", t);
+        Check_File(path, _Model[t], _ModelSize[t]);
+    }
+    printf("volume ok\n");
+}
+
+
+static void *Benchmark_Reader_Thread(void *arg) {
+    int t = (int)(long)arg;
+    uint8_t buf[64];
+    char path[16];
+    uint32_t ofs = 0;
+    FIL fil;
+    UINT n;
+
+    sprintf(path, "R%d.BIN", t);
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    do {
+        CHECK_FR(f_read(&fil, buf, sizeof(buf), &n));
+        for (UINT i = 0; i < n; i++) CHECK(buf[i] == (uint8_t)(ofs + i + t));
+        ofs += n;
+    } while (n == sizeof(buf));
+    CHECK_FR(f_close(&fil));
+    return NULL;
+}
+
+
+// small record reads of four files with 200us of latency per disk command
+static void Benchmark_Readers(void) {
+    static uint8_t data[100000];
+    pthread_t threads[4];
+    char path[16];
+    double start;
+    FIL fil;
+    UINT n;
+
+    for (int t = 0; t < 4; t++) {
+        for (uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i + t);
+        sprintf(path, "R%d.BIN", t);
+        CHECK_FR(f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE));
+        CHECK_FR(f_write(&fil, data, sizeof(data), &n));
+        CHECK_FR(f_close(&fil));
+    }
+
+    RamDisk_LatencyUs = 200;
+    start = Now_Seconds();
+    Run_Threads(Benchmark_Reader_Thread, 4, threads);
+    Join_Threads(4, threads);
+    printf("_FS_REENTRANT %d: 4 readers of different files took %.3f s\n", _FS_REENTRANT, Now_Seconds() - start);
+    RamDisk_LatencyUs = 0;
+}
+
+
+int main(void) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    RamDisk_Create(0, 40000, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 1024));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+
+    Test_DifferentFiles();
+    Test_SameFile();
+#if _FS_REENTRANT == 2
+    Test_CloseShared();
+#endif
+    Check_Volume();
+    Benchmark_Readers();
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("ALL OK\n");
+    return 0;
+}
@@ -0,0 +1,96 @@
+// Cluster allocation on a volume whose free space is split into single clusters
+//   two files are written a cluster at a time in turn until the volume is full, and one of them is removed, so
+//   every free run is one cluster long; a file written in one call then asks for a run of all its clusters at every
+//   cluster boundary, and the sectors read to allocate it show whether each of those searches scanned the whole FAT
+//   once clusters are freed again a long run must be found and taken whole
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "fatcheck.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define VOLUME_SECTORS          16384
+#define CLUSTER_BYTES           512
+#define WRITE_CLUSTERS          200
+
+static FATFS _Fs;
+static uint8_t _Data[WRITE_CLUSTERS * CLUSTER_BYTES], _Back[WRITE_CLUSTERS * CLUSTER_BYTES];
+
+
+// fill the volume with A.BIN and B.BIN a cluster each in turn, then remove B.BIN
+static void Fragment(void) {
+    FIL a, b;
+    UINT n = CLUSTER_BYTES;
+
+    CHECK_FR(f_open(&a, "A.BIN", FA_CREATE_NEW | FA_WRITE));
+    CHECK_FR(f_open(&b, "B.BIN", FA_CREATE_NEW | FA_WRITE));
+    while (n == CLUSTER_BYTES) {
+        CHECK_FR(f_write(&a, _Data, CLUSTER_BYTES, &n));
+        if (n == CLUSTER_BYTES) CHECK_FR(f_write(&b, _Data, CLUSTER_BYTES, &n));
+    }
+    CHECK_FR(f_close(&a));
+    CHECK_FR(f_close(&b));
+    CHECK_FR(f_unlink("B.BIN"));
+}
+
+
+// write path in one call, returns the sectors read to do it
+static uint32_t Write_File(const char *path) {
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE | FA_READ));
+    RamDisk_ClearStats();
+    CHECK_FR(f_write(&fil, _Data, sizeof(_Data), &n));
+    CHECK(n == sizeof(_Data));
+    CHECK_FR(f_sync(&fil));
+    uint32_t reads = RamDisk_Stats.readSectors;
+    CHECK_FR(f_lseek(&fil, 0));
+    CHECK_FR(f_read(&fil, _Back, sizeof(_Back), &n));
+    CHECK(n == sizeof(_Back));
+    CHECK(memcmp(_Back, _Data, sizeof(_Data)) == 0);
+    CHECK_FR(f_close(&fil));
+    return reads;
+}
+
+
+int main(void) {
+    FatCheck_t check;
+    DWORD extents;
+    uint32_t fatSectors, reads;
+
+    for (uint32_t i = 0; i < sizeof(_Data); i++) _Data[i] = (uint8_t)(i * 7 + (i >> 9));
+
+    RamDisk_Create(0, VOLUME_SECTORS, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, CLUSTER_BYTES));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK(_Fs.fs_type == FS_FAT16);
+    fatSectors = _Fs.fsize;
+
+    // every cluster boundary of the write asks for a run no longer there, only the first search may scan the FAT
+    Fragment();
+    reads = Write_File("C.BIN");
+    CHECK_FR(f_defrag("C.BIN", 0, 0, 0, &extents));
+    CHECK(extents == WRITE_CLUSTERS);
+    printf("%u single cluster runs taken: %u sectors read, the FAT is %u sectors\n", WRITE_CLUSTERS, reads, fatSectors);
+    CHECK(reads < 3 * fatSectors);
+
+    // with the clusters of A.BIN and C.BIN free the next file is contiguous again
+    CHECK_FR(f_unlink("A.BIN"));
+    CHECK_FR(f_unlink("C.BIN"));
+    Write_File("D.BIN");
+    CHECK_FR(f_defrag("D.BIN", 0, 0, 0, &extents));
+    CHECK(extents == 1);
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), 512, 0, &check, NULL, NULL));
+    CHECK(FatCheck_Clean(&check));
+    CHECK(check.files == 1);
+    RamDisk_Free(0);
+    printf("ALL OK\n");
+    return 0;
+}
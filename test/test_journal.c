@@ -0,0 +1,255 @@
+// Power failures at every disk write, with and without the metadata journal
+//   a script of creates, appends, renames, unlinks and directory changes runs on a fresh volume until write
+//   command n fails, and every write after it fails too, as when the power goes; the FATFS object is dropped, the
+//   volume mounted again (replaying the journal), and fatcheck reads the image for lost clusters, cross links and
+//   sizes that do not match their chains; n goes from 1 until the script runs through
+//   each sweep is run again with the failing multiple sector write storing its first half
+//   with _FS_JOURNAL the volume must come back consistent after every crash, without it the damage is only reported
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "fatcheck.h"
+#include "ramdisk.h"
+#include "test.h"
+
+typedef struct {
+    const char *name;
+    uint32_t sectors;
+    uint16_t sectorSize;
+    uint32_t clusterBytes;
+    uint32_t fatType;
+} Geometry_t;
+
+typedef struct {
+    uint32_t crashPoints;
+    uint32_t inconsistent;              // crash points after which the volume was not consistent
+    uint32_t maxLost;
+} SweepResult_t;
+
+static FATFS _Fs;
+static uint8_t _Data[30000];
+
+
+static void Format(const Geometry_t *geo) {
+    RamDisk_Create(0, geo->sectors, geo->sectorSize);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, geo->clusterBytes));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+}
+
+
+// the power comes back: whatever the FATFS object held is gone, and the volume is mounted from the disk
+static void Power_Cycle(void) {
+    RamDisk_FailAt = 0;
+    RamDisk_TornWrite = false;
+    RamDisk_Crashed = false;
+    _Fs.fs_type = 0;
+    CHECK_FR(f_mount(&_Fs, "", 1));
+}
+
+
+// every file fatcheck finds must open and read to its size, context counts the ones that do not
+static void Read_File(void *context, const char *path, bool dir, uint32_t size, uint32_t extents) {
+    static uint8_t buf[4096];
+    uint32_t *unreadable = context, total = 0;
+    FIL fil;
+    UINT n;
+
+    (void)extents;
+    if (dir) return;
+    if ((f_open(&fil, path, FA_READ) != FR_OK) || (f_size(&fil) != size)) {
+        (*unreadable)++;
+        return;
+    }
+    do {
+        if (f_read(&fil, buf, sizeof(buf), &n) != FR_OK) break;
+        total += n;
+    } while (n == sizeof(buf));
+    if (total != size) (*unreadable)++;
+    f_close(&fil);
+}
+
+
+// check the mounted volume, returns true when it is consistent, every file reads back, and FatFs counts the same
+// free clusters as fatcheck
+static bool Check_Volume(FatCheck_t *check) {
+    uint32_t unreadable = 0;
+    DWORD freeClusters;
+    FATFS *fs;
+
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), RamDisk_SectorSize(0), 0, check, Read_File, &unreadable));
+    CHECK_FR(f_getfree("", &freeClusters, &fs));
+    return FatCheck_Clean(check) && !unreadable && (freeClusters == check->free);
+}
+
+
+// errors are expected once the disk has failed, so the script goes on regardless
+static void Write_File(const char *path, BYTE mode, uint32_t size) {
+    FIL fil;
+    UINT n;
+
+    if (f_open(&fil, path, mode | FA_WRITE) != FR_OK) return;
+    if (mode & FA_OPEN_ALWAYS) f_lseek(&fil, f_size(&fil));
+    f_write(&fil, _Data, size, &n);
+    f_close(&fil);
+}
+
+
+static void Run_Script(void) {
+    char path[20];
+    FIL fil;
+    UINT n;
+
+    Write_File("A.TXT", FA_CREATE_NEW, 3000);
+    f_mkdir("D");
+    Write_File("D/B.TXT", FA_CREATE_NEW, 5000);
+    if (f_open(&fil, "A.TXT", FA_OPEN_EXISTING | FA_WRITE) == FR_OK) {
+        f_lseek(&fil, f_size(&fil));
+        f_write(&fil, _Data, 2000, &n);
+        f_sync(&fil);
+        f_write(&fil, _Data, 1500, &n);
+        f_close(&fil);
+    }
+    f_rename("A.TXT", "D/A2.TXT");
+    f_unlink("D/B.TXT");
+    Write_File("C.TXT", FA_CREATE_NEW, 20000);
+    if (f_open(&fil, "C.TXT", FA_OPEN_EXISTING | FA_WRITE) == FR_OK) {
+        f_lseek(&fil, 5000);
+        f_truncate(&fil);
+        f_close(&fil);
+    }
+    f_mkdir("E");
+    for (int i = 0; i < 20; i++) {
+        sprintf(path, "E/F%02d.TXT", i);
+        Write_File(path, FA_CREATE_NEW, 100);
+    }
+    f_unlink("D/A2.TXT");
+}
+
+
+static SweepResult_t Sweep(const Geometry_t *geo, bool torn) {
+    SweepResult_t result = { 0 };
+
+    for (uint32_t crashAt = 1; ; crashAt++) {
+        FatCheck_t check;
+        bool crashed, consistent;
+
+        Format(geo);
+        RamDisk_ClearStats();
+        RamDisk_FailAt = crashAt;
+        RamDisk_TornWrite = torn;
+        Run_Script();
+        crashed = RamDisk_Crashed;
+        Power_Cycle();
+
+        consistent = Check_Volume(&check);
+        if (!consistent) result.inconsistent++;
+        if (check.lost > result.maxLost) result.maxLost = check.lost;
+
+        // the volume takes new work and stays consistent; with the journal the state in place lags behind until the
+        // next checkpoint, so the power goes again before the image is read
+        if (consistent) {
+            Write_File("AFTER.TXT", FA_CREATE_ALWAYS, 7000);
+            Power_Cycle();
+            CHECK(Check_Volume(&check));
+        }
+        CHECK_FR(f_mount(NULL, "", 0));
+        if (!crashed) break;
+        result.crashPoints++;
+    }
+    printf("%s%s: %u crash points, inconsistent after %u (at most %u lost clusters)\n", geo->name, torn ? " torn" : "",
+           result.crashPoints, result.inconsistent, result.maxLost);
+    return result;
+}
+
+
+// write commands for an append of one sector and a sync
+static void Measure_Appends(const Geometry_t *geo) {
+    FIL fil;
+    UINT n;
+
+    Format(geo);
+    CHECK_FR(f_open(&fil, "LOG.TXT", FA_CREATE_NEW | FA_WRITE));
+    CHECK_FR(f_sync(&fil));
+    RamDisk_ClearStats();
+    for (int i = 0; i < 50; i++) {
+        CHECK_FR(f_write(&fil, _Data, geo->sectorSize, &n));
+        CHECK_FR(f_sync(&fil));
+    }
+    printf("%s append and sync: %.2f write commands, %.2f sectors per record\n", geo->name,
+           RamDisk_Stats.writeCmds / 50.0, RamDisk_Stats.writeSectors / 50.0);
+    CHECK_FR(f_close(&fil));
+    CHECK_FR(f_mount(NULL, "", 0));
+}
+
+
+#if _FS_JOURNAL
+// the state is in place after an unmount, so the journal area can be wiped; without an unmount the state in place
+// lags behind, and the next mount brings it up from the journal
+static void Test_Checkpoints(const Geometry_t *geo) {
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+    FatCheck_t check;
+    DWORD journal;
+
+    Format(geo);
+    CHECK(_Fs.jbase != 0);
+    journal = _Fs.jbase;
+    Write_File("Z.TXT", FA_CREATE_NEW, 7000);
+    CHECK_FR(f_mount(NULL, "", 0));
+    memset(RamDisk_Data(0) + (size_t)journal * geo->sectorSize, 0, 2 * (_FS_JOURNAL + 1) * geo->sectorSize);
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    CHECK(Check_Volume(&check));
+    CHECK_FR(f_stat("Z.TXT", &fi));
+    CHECK(fi.fsize == 7000);
+    CHECK_FR(f_mount(NULL, "", 0));
+
+    Format(geo);
+    Write_File("Y.TXT", FA_CREATE_NEW, 7000);
+    printf("%s checkpoints: %u records, %u checkpoints, %u window loads from the journal\n", geo->name,
+           (unsigned)_Fs.st.jnl_rec, (unsigned)_Fs.st.jnl_ckpt, (unsigned)_Fs.st.jnl_hit);
+    Power_Cycle();
+    CHECK(Check_Volume(&check));
+    CHECK_FR(f_stat("Y.TXT", &fi));
+    CHECK(fi.fsize == 7000);
+    CHECK_FR(f_mount(NULL, "", 0));
+}
+#endif
+
+
+int main(void) {
+    static const Geometry_t geometries[] = {
+        { "FAT12", 4000, 512, 512, 12 },
+        { "FAT16", 65536, 512, 1024, 16 },
+        { "FAT32", 140000, 512, 512, 32 },
+#if _MAX_SS >= 1024
+        { "FAT16 1K sectors", 32768, 1024, 1024, 16 },
+        { "FAT32 1K sectors", 70000, 1024, 1024, 32 },
+#endif
+    };
+
+    for (uint32_t i = 0; i < sizeof(_Data); i++) _Data[i] = (uint8_t)(i * 7);
+
+    for (uint32_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+        const Geometry_t *geo = &geometries[g];
+        FatCheck_t check;
+
+        Format(geo);
+        CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), RamDisk_SectorSize(0), 0, &check, NULL, NULL));
+        CHECK(check.fatType == geo->fatType);
+        CHECK_FR(f_mount(NULL, "", 0));
+
+        Measure_Appends(geo);
+#if _FS_JOURNAL
+        Test_Checkpoints(geo);
+        CHECK(Sweep(geo, false).inconsistent == 0);
+        CHECK(Sweep(geo, true).inconsistent == 0);
+#else
+        Sweep(geo, false);
+        Sweep(geo, true);
+#endif
+    }
+    printf("ALL OK\n");
+    return 0;
+}
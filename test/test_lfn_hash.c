@@ -0,0 +1,138 @@
+// The LFN name hash cache kept up to date through creates and unlinks
+//   every name that is in the directory must be found by name, and creating it again must say it exists
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define NAMES                   64
+
+static FATFS _Fs;
+
+
+static void Create(const char *path) {
+    FIL fil;
+
+    CHECK_FR(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE));
+    CHECK_FR(f_close(&fil));
+}
+
+
+static void Check_Exists(const char *path) {
+    FIL fil;
+
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    CHECK_FR(f_close(&fil));
+    CHECK_RES(f_open(&fil, path, FA_CREATE_NEW | FA_WRITE), FR_EXIST);
+}
+
+
+static int Count_Entries(const char *path) {
+    FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+    DIR dir;
+    int count = 0;
+
+    CHECK_FR(f_opendir(&dir, path));
+    for (;;) {
+        CHECK_FR(f_readdir(&dir, &fi));
+        if (!fi.fname[0]) break;
+        count++;
+    }
+    CHECK_FR(f_closedir(&dir));
+    return count;
+}
+
+
+// a new name whose LFN entries start in the freed entries below the cached part and whose SFN lands after it
+static void Test_LfnAcrossCachedPart(void) {
+    static const char *third = "a much longer third name that needs more entries.txt";
+
+    RamDisk_Create(0, 8192, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 0));
+
+    Create("first long name.txt");
+    Create("second.txt.long");
+    CHECK_FR(f_unlink("second.txt.long"));
+    Create(third);
+    Check_Exists(third);
+    Check_Exists("first long name.txt");
+    CHECK(Count_Entries("") == 2);
+
+    // and from a cold cache
+    CHECK_FR(f_mount(&_Fs, "", 1));
+    Check_Exists(third);
+    CHECK(Count_Entries("") == 2);
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("lfn across the cached part ok\n");
+}
+
+
+// names of 1 to 5 LFN entries created and unlinked at random, so new names keep landing in freed gaps of
+// every size on both sides of the cached part
+static void Test_RandomNames(const char *dirPath) {
+    static char names[NAMES][96];
+    static bool live[NAMES];
+    char path[128];
+    int liveCount = 0, others = Count_Entries(dirPath);
+
+    srand(42);
+    for (int i = 0; i < NAMES; i++) {
+        int length = 5 + (i * 37) % 60;
+
+        for (int k = 0; k < length; k++) names[i][k] = "abcdefghij klmnopqrstuvwxyz0123456789"[(i * 7 + k * 13) % 37];
+        sprintf(names[i] + length, "%02d.dat", i);
+        live[i] = false;
+    }
+
+    for (int step = 0; step < 3000; step++) {
+        int i = rand() % NAMES;
+
+        sprintf(path, "%s/%s", dirPath, names[i]);
+        if (live[i]) {
+            CHECK_FR(f_unlink(path));
+            liveCount--;
+        }
+        else {
+            Create(path);
+            liveCount++;
+        }
+        live[i] = !live[i];
+
+        // look up a few names, live and gone, so the cache is rebuilt part way through the directory
+        for (int k = 0; k < 4; k++) {
+            FILINFO fi = { .lfname = NULL, .lfsize = 0 };
+            int j = rand() % NAMES;
+
+            sprintf(path, "%s/%s", dirPath, names[j]);
+            CHECK_RES(f_stat(path, &fi), live[j] ? FR_OK : FR_NO_FILE);
+        }
+        if (step % 100 == 99) {
+            for (int j = 0; j < NAMES; j++) {
+                if (!live[j]) continue;
+                sprintf(path, "%s/%s", dirPath, names[j]);
+                Check_Exists(path);
+            }
+            CHECK(Count_Entries(dirPath) == others + liveCount);
+        }
+    }
+}
+
+
+int main(void) {
+    Test_LfnAcrossCachedPart();
+
+    RamDisk_Create(0, 8192, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 0));
+    CHECK_FR(f_mkdir("dir"));
+    Test_RandomNames("dir");
+    Test_RandomNames("");
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("random names ok\n");
+    printf("ALL OK\n");
+    return 0;
+}
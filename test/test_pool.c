@@ -0,0 +1,154 @@
+// Six files sharing a pool of two sector buffers
+//   reads, writes and seeks on the files in random turns are checked against a model of each file, so every access
+//   after another file took the buffer has to write back and reload its sector; a file pinned keeps its buffer and
+//   with both buffers pinned another file is turned away
+//   a byte copy of an open file object, whose buffer pointer the pool never gave it, binds a buffer of its own
+//   instead of searching past the end of the pool
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "fatcheck.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#if _FS_POOL != 2
+#error test_pool expects a pool of two buffers
+#endif
+
+#define FILES                   6
+#define MAX_FILE_SIZE           6000
+#define OPERATIONS              20000
+
+static FATFS _Fs;
+static FIL _Fil[FILES];
+static uint8_t _Model[FILES][MAX_FILE_SIZE];
+static uint32_t _Size[FILES];
+static uint8_t _Buf[MAX_FILE_SIZE];
+
+
+static void File_Name(char *path, uint32_t f) {
+    sprintf(path, "FILE%u.BIN", f);
+}
+
+
+static void Run_Operations(void) {
+    char path[16];
+    UINT n;
+
+    for (uint32_t f = 0; f < FILES; f++) {
+        File_Name(path, f);
+        CHECK_FR(f_open(&_Fil[f], path, FA_CREATE_ALWAYS | FA_READ | FA_WRITE));
+    }
+
+    srand(1);
+    for (uint32_t op = 0; op < OPERATIONS; op++) {
+        uint32_t f = (uint32_t)rand() % FILES;
+        uint32_t pos = (uint32_t)rand() % (_Size[f] + 1);
+        uint32_t len = 1 + (uint32_t)rand() % ((rand() % 4) ? 40 : 1500);
+        uint32_t kind = (uint32_t)rand() % 8;
+
+        CHECK_FR(f_lseek(&_Fil[f], pos));
+        if (kind < 4) {
+            if (pos + len > MAX_FILE_SIZE) len = MAX_FILE_SIZE - pos;
+            for (uint32_t i = 0; i < len; i++) _Buf[i] = (uint8_t)rand();
+            CHECK_FR(f_write(&_Fil[f], _Buf, len, &n));
+            CHECK(n == len);
+            memcpy(&_Model[f][pos], _Buf, len);
+            if (pos + len > _Size[f]) _Size[f] = pos + len;
+        }
+        else if (kind < 7) {
+            CHECK_FR(f_read(&_Fil[f], _Buf, len, &n));
+            CHECK(n == ((len < _Size[f] - pos) ? len : _Size[f] - pos));
+            CHECK(memcmp(_Buf, &_Model[f][pos], n) == 0);
+        }
+        else {
+            CHECK_FR(f_sync(&_Fil[f]));
+        }
+    }
+
+    for (uint32_t f = 0; f < FILES; f++) CHECK_FR(f_close(&_Fil[f]));
+}
+
+
+static void Verify_Files(void) {
+    char path[16];
+    FIL fil;
+    UINT n;
+
+    for (uint32_t f = 0; f < FILES; f++) {
+        File_Name(path, f);
+        CHECK_FR(f_open(&fil, path, FA_READ));
+        CHECK_FR(f_read(&fil, _Buf, sizeof(_Buf), &n));
+        CHECK(n == _Size[f]);
+        CHECK(memcmp(_Buf, _Model[f], n) == 0);
+        CHECK_FR(f_close(&fil));
+    }
+}
+
+
+// two pinned files keep their buffers, a third cannot get one until a pin is released
+static void Test_Pin(void) {
+    char path[16];
+    UINT n;
+
+    for (uint32_t f = 0; f < 3; f++) {
+        File_Name(path, f);
+        CHECK_FR(f_open(&_Fil[f], path, FA_READ));
+    }
+    CHECK_FR(f_pin(&_Fil[0], 1));
+    CHECK_FR(f_pin(&_Fil[1], 1));
+    CHECK(f_pin(&_Fil[2], 1) == FR_NOT_ENOUGH_CORE);
+    CHECK_FR(f_read(&_Fil[0], _Buf, 10, &n));
+    CHECK(memcmp(_Buf, _Model[0], 10) == 0);
+    CHECK_FR(f_pin(&_Fil[1], 0));
+    CHECK_FR(f_read(&_Fil[2], _Buf, 10, &n));
+    CHECK(memcmp(_Buf, _Model[2], 10) == 0);
+    for (uint32_t f = 0; f < 3; f++) CHECK_FR(f_close(&_Fil[f]));
+}
+
+
+// a copy of an open file object is not the owner of the buffer its pointer shows
+static void Test_Copy(void) {
+    FIL copy;
+    UINT n;
+
+    CHECK_FR(f_open(&_Fil[0], "FILE0.BIN", FA_READ));
+    CHECK_FR(f_read(&_Fil[0], _Buf, 10, &n));
+    memcpy(&copy, &_Fil[0], sizeof(copy));
+    CHECK_FR(f_read(&copy, _Buf, 10, &n));
+    CHECK(memcmp(_Buf, &_Model[0][10], 10) == 0);
+    CHECK(copy.buf != _Fil[0].buf);
+    CHECK_FR(f_close(&copy));
+    CHECK_FR(f_read(&_Fil[0], _Buf, 10, &n));
+    CHECK(memcmp(_Buf, &_Model[0][10], 10) == 0);
+    CHECK_FR(f_close(&_Fil[0]));
+}
+
+
+int main(void) {
+    FatCheck_t check;
+
+    RamDisk_Create(0, 8192, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 512));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+
+    Run_Operations();
+    printf("%u operations on %u files: %u buffers reclaimed, %u sectors reloaded\n", OPERATIONS, FILES,
+           (unsigned)_Fs.st.pool_rcl, (unsigned)_Fs.st.pool_rld);
+    CHECK(_Fs.st.pool_rcl > 0);
+    CHECK(_Fs.st.pool_rld > 0);
+    Verify_Files();
+    Test_Pin();
+    Test_Copy();
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    CHECK(FatCheck_Image(RamDisk_Data(0), RamDisk_Sectors(0), 512, 0, &check, NULL, NULL));
+    CHECK(FatCheck_Clean(&check));
+    CHECK(check.files == FILES);
+    RamDisk_Free(0);
+    printf("ALL OK\n");
+    return 0;
+}
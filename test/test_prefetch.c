@@ -0,0 +1,179 @@
+// Sequential read-ahead of f_read
+//   a file read from its start in records that do not end on sector boundaries has its sectors loaded from the
+//   read-ahead buffer, with one multiple sector read for every _FS_PREFETCH sectors; the data must be what a plain
+//   sector by sector reader sees, on a contiguous file, on a fragmented one whose runs clip the read-ahead, and
+//   around writes into sectors already read ahead
+//   reads at random positions must not read ahead
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#if _FS_PREFETCH != 8
+#error test_prefetch expects 8 sectors of read-ahead
+#endif
+
+#define FILE_SIZE               100000
+#define RECORD_SIZE             100
+#define SECTOR_SIZE             512
+
+static FATFS _Fs;
+static uint8_t _Data[FILE_SIZE], _Back[FILE_SIZE], _Plain[FILE_SIZE];
+
+
+static void Fill(uint32_t seed) {
+    for (uint32_t i = 0; i < FILE_SIZE; i++) _Data[i] = (uint8_t)(i * 7 + seed + (i >> 9));
+}
+
+
+// the file as a sector by sector reader sees it, each f_read loads one sector straight into the caller's buffer
+// or through the file buffer and so never from the read-ahead buffer
+static void Read_Plain(const char *path, uint8_t *buf) {
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    for (uint32_t pos = 0; pos < FILE_SIZE; pos += SECTOR_SIZE) {
+        CHECK_FR(f_lseek(&fil, pos));
+        CHECK_FR(f_read(&fil, buf + pos, (FILE_SIZE - pos < SECTOR_SIZE) ? FILE_SIZE - pos : SECTOR_SIZE, &n));
+    }
+    CHECK_FR(f_close(&fil));
+}
+
+
+// read path from its start in records, returns the read commands it took
+static uint32_t Read_Records(const char *path, uint32_t *hits, uint32_t *misses) {
+    uint32_t hit = _Fs.st.pf_hit, miss = _Fs.st.pf_miss;
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    RamDisk_ClearStats();
+    for (uint32_t pos = 0; pos < FILE_SIZE; pos += n) {
+        CHECK_FR(f_read(&fil, _Back + pos, RECORD_SIZE, &n));
+        CHECK(n == ((FILE_SIZE - pos < RECORD_SIZE) ? FILE_SIZE - pos : RECORD_SIZE));
+    }
+    CHECK_FR(f_close(&fil));
+    *hits = _Fs.st.pf_hit - hit;
+    *misses = _Fs.st.pf_miss - miss;
+    return RamDisk_Stats.readCmds;
+}
+
+
+static void Write_File(const char *path) {
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_write(&fil, _Data, FILE_SIZE, &n));
+    CHECK(n == FILE_SIZE);
+    CHECK_FR(f_close(&fil));
+}
+
+
+// two files written a cluster each in turn, so every cluster of them is a run of its own
+static void Write_Interleaved(const char *pathA, const char *pathB) {
+    FIL a, b;
+    UINT n;
+
+    CHECK_FR(f_open(&a, pathA, FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_open(&b, pathB, FA_CREATE_ALWAYS | FA_WRITE));
+    for (uint32_t pos = 0; pos < FILE_SIZE; pos += n) {
+        uint32_t len = (FILE_SIZE - pos < 2048) ? FILE_SIZE - pos : 2048;
+
+        CHECK_FR(f_write(&a, _Data + pos, len, &n));
+        CHECK_FR(f_sync(&a));
+        CHECK_FR(f_write(&b, _Data + pos, len, &n));
+        CHECK_FR(f_sync(&b));
+    }
+    CHECK_FR(f_close(&a));
+    CHECK_FR(f_close(&b));
+}
+
+
+static void Check_Sequential(const char *name, const char *path, uint32_t maxMisses) {
+    uint32_t hits, misses, reads;
+
+    Read_Plain(path, _Plain);
+    CHECK(memcmp(_Plain, _Data, FILE_SIZE) == 0);
+    reads = Read_Records(path, &hits, &misses);
+    printf("%s: %u records, %u sector loads read ahead, %u from the medium, %u read commands\n", name,
+           (FILE_SIZE + RECORD_SIZE - 1) / RECORD_SIZE, hits, misses, reads);
+    CHECK(memcmp(_Back, _Plain, FILE_SIZE) == 0);
+    CHECK(hits + misses == (FILE_SIZE + SECTOR_SIZE - 1) / SECTOR_SIZE);
+    CHECK(misses <= maxMisses);
+}
+
+
+// writes into sectors already read ahead must be seen by the reads after them
+static void Check_WriteBetween(const char *path) {
+    static const uint8_t patch[] = "patched into the read-ahead";
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, path, FA_READ | FA_WRITE));
+    for (uint32_t pos = 0; pos < 1000; pos += n) CHECK_FR(f_read(&fil, &_Back[pos], RECORD_SIZE, &n));
+    CHECK_FR(f_lseek(&fil, 2000));
+    CHECK_FR(f_write(&fil, patch, sizeof(patch), &n));
+    memcpy(&_Data[2000], patch, sizeof(patch));
+    CHECK_FR(f_lseek(&fil, 1000));
+    for (uint32_t pos = 1000; pos < 4000; pos += n) CHECK_FR(f_read(&fil, &_Back[pos], RECORD_SIZE, &n));
+    CHECK(memcmp(_Back, _Data, 4000) == 0);
+    CHECK_FR(f_close(&fil));
+    Read_Plain(path, _Plain);
+    CHECK(memcmp(_Plain, _Data, FILE_SIZE) == 0);
+}
+
+
+// reads jumping about the file load single sectors
+static void Check_Random(const char *path) {
+    uint32_t miss = _Fs.st.pf_miss, hit = _Fs.st.pf_hit;
+    FIL fil;
+    UINT n;
+
+    srand(1);
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    RamDisk_ClearStats();
+    for (uint32_t i = 0; i < 200; i++) {
+        uint32_t pos = SECTOR_SIZE + (uint32_t)rand() % (FILE_SIZE - 2 * SECTOR_SIZE);
+
+        CHECK_FR(f_lseek(&fil, pos));
+        CHECK_FR(f_read(&fil, _Back, 10, &n));
+        CHECK(memcmp(_Back, &_Data[pos], 10) == 0);
+    }
+    CHECK_FR(f_close(&fil));
+    printf("random: 200 reads, %u sector loads from the medium, %u sectors in %u read commands\n",
+           _Fs.st.pf_miss - miss, RamDisk_Stats.readSectors, RamDisk_Stats.readCmds);
+    CHECK(RamDisk_Stats.readSectors == RamDisk_Stats.readCmds);
+    CHECK(_Fs.st.pf_hit - hit < 20);
+}
+
+
+int main(void) {
+    RamDisk_Create(0, 8192, SECTOR_SIZE);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 2048));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+
+    // a miss for every 8 sectors
+    Fill(1);
+    Write_File("CONTIG.BIN");
+    Check_Sequential("contiguous", "CONTIG.BIN", (FILE_SIZE / SECTOR_SIZE + 8) / 8);
+
+    // runs of one 4 sector cluster: a miss for every run
+    Fill(2);
+    Write_Interleaved("FRAG1.BIN", "FRAG2.BIN");
+    Check_Sequential("fragmented", "FRAG1.BIN", (FILE_SIZE / SECTOR_SIZE + 4) / 4);
+
+    Fill(1);
+    Check_WriteBetween("CONTIG.BIN");
+    Check_Random("CONTIG.BIN");
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    RamDisk_Free(0);
+    printf("ALL OK\n");
+    return 0;
+}
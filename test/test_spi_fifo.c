@@ -0,0 +1,239 @@
+// Streaming SPI transfers of the SD card driver against the SPIM fifo model
+//   the driver is included whole so its static transfer loops can be called directly
+//   the mirrored and striped transfers run on two card models, each on an SPI master of its own
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sdspi_model.h"
+#include "test.h"
+#include "FatFS/PSOC5_FatFS_SPIInterface.c"
+
+
+// a device that answers with a counting pattern and records what it was sent
+static uint8_t _Sent[1024];
+static uint32_t _SentCount;
+static uint8_t _Next;
+
+static uint8_t Pattern_Exchange(uint8_t bus, uint8_t mosi, bool selected) {
+    (void)bus;
+    (void)selected;
+    if (_SentCount < sizeof(_Sent)) _Sent[_SentCount] = mosi;
+    _SentCount++;
+    return _Next++;
+}
+
+
+static void Start_PatternBus(void) {
+    SpiModel_Reset(Pattern_Exchange);
+    _SentCount = 0;
+    _Next = 0x40;
+}
+
+
+// nothing may be lost and nothing may be left behind
+static void Check_Bus(uint32_t size) {
+    CHECK(SpiModel_Stats.bytes == size);
+    CHECK(SpiModel_Stats.txOverflows == 0);
+    CHECK(SpiModel_Stats.rxOverruns == 0);
+    CHECK(SpiModel_Stats.rxUnderruns == 0);
+    CHECK(SpiModel_Stats.maxInFlight <= SDSPI_FIFO_DEPTH);
+    CHECK(SpiModel_InFlight() == 0);
+}
+
+
+static void Test_Kernels(void) {
+    static const uint32_t sizes[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 16, 100, 511, 512, 513 };
+    static const uint32_t accessCosts[] = { 1, 6, 24, 80 };    // 80 is slower than a byte on the bus
+    static uint8_t buf[1024];
+    SDCard_t *card = &_Cards[0];
+
+    for (uint32_t t = 0; t < sizeof(accessCosts) / sizeof(accessCosts[0]); t++) {
+        SpiModel_Timing.cpuPerAccess = accessCosts[t];
+
+        for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            uint32_t size = sizes[s];
+
+            // receive: dummy bytes out, the pattern back in order
+            Start_PatternBus();
+            memset(buf, 0, sizeof(buf));
+            Receive_DataBuf(card, buf, size);
+            Check_Bus(size);
+            for (uint32_t i = 0; i < size; i++) {
+                CHECK(buf[i] == (uint8_t)(0x40 + i));
+                CHECK(_Sent[i] == SDSPI_DUMMY_BYTE);
+            }
+            CHECK(buf[size] == 0);
+
+            // transmit: the buffer out in order, everything clocked back is thrown away
+            Start_PatternBus();
+            for (uint32_t i = 0; i < size; i++) buf[i] = (uint8_t)(i * 7 + s);
+            Send_BufferToSDCard(card, buf, size);
+            Check_Bus(size);
+            CHECK(memcmp(_Sent, buf, size) == 0);
+        }
+    }
+    SpiModel_Timing.cpuPerAccess = 6;
+    printf("kernels ok\n");
+}
+
+
+// bytes per bus clock for a 512 byte block, streamed and a byte at a time as the driver did before
+static void Measure_Throughput(void) {
+    static uint8_t buf[512];
+    SDCard_t *card = &_Cards[0];
+    double streamRx, streamTx, byteRx;
+
+    Start_PatternBus();
+    Receive_DataBuf(card, buf, 512);
+    streamRx = SpiModel_BytesPerBusClock();
+
+    Start_PatternBus();
+    Send_BufferToSDCard(card, buf, 512);
+    streamTx = SpiModel_BytesPerBusClock();
+
+    Start_PatternBus();
+    for (uint32_t i = 0; i < 512; i++) buf[i] = Exchange_SDByte(card, SDSPI_DUMMY_BYTE);
+    byteRx = SpiModel_BytesPerBusClock();
+
+    printf("bytes per bus clock (max 0.125): stream rx %.4f, stream tx %.4f, byte at a time %.4f\n", streamRx, streamTx, byteRx);
+    CHECK(streamRx > 0.12);
+    CHECK(streamTx > 0.12);
+    CHECK(streamRx > byteRx);
+}
+
+
+// the whole driver under FatFs on the card model
+static void Test_Card(bool blockAddressing, bool cmd23Advertised, bool cmd23Accepted) {
+    static uint8_t data[150000], back[150000];
+    static FATFS fs;
+    FIL fil;
+    UINT n;
+
+    SDModel_Config.blockAddressing = blockAddressing;
+    SDModel_Config.cmd23Advertised = cmd23Advertised;
+    SDModel_Config.cmd23Accepted = cmd23Accepted;
+    SDModel_Create(0, 131072);
+    SpiModel_Reset(SDModel_Exchange);
+    _Cards[0] = (SDCard_t)SD_CARD_SLOT(SDSPI, SS);
+
+    CHECK(disk_initialize(0) == DISK_STATUS_OK);
+    CHECK(_Cards[0].info.cmd23Support == cmd23Advertised);
+    CHECK_FR(f_mount(&fs, "", 0));
+    CHECK_FR(f_mkfs("", 0, 0));
+    CHECK_FR(f_mount(&fs, "", 1));
+
+    for (uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 13 + (i >> 10));
+    CHECK_FR(f_open(&fil, "DATA.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_write(&fil, data, sizeof(data), &n));
+    CHECK_FR(f_close(&fil));
+
+    CHECK_FR(f_mount(&fs, "", 1));
+    CHECK_FR(f_open(&fil, "DATA.BIN", FA_READ));
+    CHECK_FR(f_read(&fil, back, sizeof(back), &n));
+    CHECK(n == sizeof(data));
+    CHECK(memcmp(back, data, sizeof(data)) == 0);
+    CHECK_FR(f_lseek(&fil, 777));
+    CHECK_FR(f_read(&fil, back, 40000, &n));
+    CHECK(memcmp(back, data + 777, 40000) == 0);
+    CHECK_FR(f_close(&fil));
+    CHECK_FR(f_mount(NULL, "", 0));
+
+    CHECK(SDModel_Stats[0].errors == 0);
+    CHECK(SpiModel_Stats.txOverflows == 0);
+    CHECK(SpiModel_Stats.rxOverruns == 0);
+    CHECK(SpiModel_Stats.rxUnderruns == 0);
+    CHECK(SpiModel_Stats.maxInFlight <= SDSPI_FIFO_DEPTH);
+
+    // multiple block writes are closed ended when CMD23 works, otherwise they get the pre-erase hint
+    CHECK(SDModel_Stats[0].cmds[25] != 0);
+    if (cmd23Advertised && cmd23Accepted) {
+        CHECK(SDModel_Stats[0].stopTokens == 0);
+        CHECK(SDModel_Stats[0].cmds[SD_MODEL_ACMD(23)] == 0);
+    }
+    else {
+        CHECK(SDModel_Stats[0].cmds[SD_MODEL_ACMD(23)] == SDModel_Stats[0].cmds[25]);
+    }
+    printf("card ok: %s, cmd23 %s\n", blockAddressing ? "block addressed" : "byte addressed",
+           !cmd23Advertised ? "not supported" : (cmd23Accepted ? "supported" : "advertised but rejected"));
+}
+
+
+// the bus and both card models must have seen nothing wrong
+static void Check_Cards(void) {
+    for (uint8_t c = 0; c < SD_MODEL_CARDS; c++) CHECK(SDModel_Stats[c].errors == 0);
+    CHECK(SpiModel_Stats.txOverflows == 0);
+    CHECK(SpiModel_Stats.rxOverruns == 0);
+    CHECK(SpiModel_Stats.rxUnderruns == 0);
+    CHECK(SpiModel_Stats.maxInFlight <= SDSPI_FIFO_DEPTH);
+}
+
+
+// mirrored writes land on both cards and striped transfers round trip, with logical sector n of a stripe on card
+// n % 2 at sector n / 2; the time of a mirrored write is compared with the same write to each card in turn
+static void Test_MirrorStripe(void) {
+    static const uint8_t both[] = { 0, 1 }, second[] = { 1 }, twice[] = { 0, 0 };
+    static const uint32_t stripes[][2] = { { 0, 1 }, { 0, 2 }, { 7, 1 }, { 10, 64 }, { 33, 17 }, { 1000, 3 } };
+    static uint8_t data[64 * 512], back[64 * 512];
+    uint64_t start, mirrorClocks, sequentialClocks;
+
+    SDModel_Config = (SDModelConfig_t){ true, true, true, 100, 3 };
+    SDModel_Create(0, 8192);
+    SDModel_Create(1, 8192);
+    SpiModel_Reset(SDModel_Exchange);
+    _Cards[0] = (SDCard_t)SD_CARD_SLOT(SDSPI, SS);
+    _Cards[1] = (SDCard_t)SD_CARD_SLOT(SDSPI2, SS2);
+    CHECK(disk_initialize(0) == DISK_STATUS_OK);
+    CHECK(disk_initialize(1) == DISK_STATUS_OK);
+    for (uint32_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)(i * 11 + (i >> 9));
+
+    // a drive may appear only once
+    CHECK(SD_MirrorWrite(twice, 2, data, 0, 1) == RES_NOTRDY);
+    CHECK(SD_StripeRead(twice, 2, back, 0, 1) == RES_NOTRDY);
+
+    start = SpiModel_Now();
+    CHECK(SD_MirrorWrite(both, 2, data, 100, 64) == RES_OK);
+    mirrorClocks = SpiModel_Now() - start;
+    for (uint8_t c = 0; c < 2; c++) CHECK(memcmp(SDModel_Disk(c) + 100 * 512, data, sizeof(data)) == 0);
+
+    start = SpiModel_Now();
+    CHECK(disk_write(0, data, 200, 64) == RES_OK);
+    CHECK(disk_write(1, data, 200, 64) == RES_OK);
+    sequentialClocks = SpiModel_Now() - start;
+    CHECK(mirrorClocks < sequentialClocks);
+
+    for (uint32_t t = 0; t < sizeof(stripes) / sizeof(stripes[0]); t++) {
+        uint32_t sector = stripes[t][0], count = stripes[t][1];
+
+        CHECK(SD_StripeWrite(both, 2, data, sector, count) == RES_OK);
+        for (uint32_t n = sector; n < sector + count; n++) {
+            CHECK(memcmp(SDModel_Disk(n % 2) + (n / 2) * 512, data + (n - sector) * 512, 512) == 0);
+        }
+        memset(back, 0, sizeof(back));
+        CHECK(SD_StripeRead(both, 2, back, sector, count) == RES_OK);
+        CHECK(memcmp(back, data, count * 512) == 0);
+    }
+
+    // a stripe of one card is a plain transfer to it
+    CHECK(SD_StripeWrite(second, 1, data, 300, 5) == RES_OK);
+    CHECK(memcmp(SDModel_Disk(1) + 300 * 512, data, 5 * 512) == 0);
+    memset(back, 0, sizeof(back));
+    CHECK(SD_StripeRead(second, 1, back, 300, 5) == RES_OK);
+    CHECK(memcmp(back, data, 5 * 512) == 0);
+
+    Check_Cards();
+    printf("mirror and stripe ok: 64 block mirrored write %.2f ms, written to each card in turn %.2f ms\n",
+           mirrorClocks / (SpiModel_Timing.cpuPerUs * 1000.0), sequentialClocks / (SpiModel_Timing.cpuPerUs * 1000.0));
+}
+
+
+int main(void) {
+    Test_Kernels();
+    Measure_Throughput();
+    Test_Card(true, true, true);
+    Test_Card(true, true, false);
+    Test_Card(false, false, false);
+    Test_MirrorStripe();
+    printf("ALL OK\n");
+    return 0;
+}
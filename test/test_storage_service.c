@@ -0,0 +1,257 @@
+// Storage service with producer threads and the worker on a thread of its own
+//   producers queue open, write, sync, read and close requests for files of their own, the worker runs them
+//   on a RAM disk that takes 100us per command, like a card would
+//   a batch of requests is checked to be queued whole or not at all
+//   the run reports how long Storage_Submit keeps a producer, against calling f_write and f_sync directly
+//   built once under ThreadSanitizer for the queue and once optimized for the timings
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "FatFS/ff.h"
+#include "StorageService.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define PRODUCERS               4
+#define RECORDS                 400
+#define RECORD_SIZE             100
+#define SYNC_EVERY              50
+#define DISK_LATENCY_US         100
+
+typedef struct {
+    uint64_t submits;
+    uint64_t fullRetries;               // submits turned away because the queue was full
+    uint64_t totalNs;                   // time spent in the submits that were taken
+    uint64_t maxNs;
+} ProducerStats_t;
+
+static FATFS _Fs;
+static volatile int _StopWorker;
+static uint32_t _Callbacks;
+static ProducerStats_t _Stats[PRODUCERS];
+
+
+static uint64_t Now_Ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+static uint8_t Record_Byte(int producer, int record, int i) {
+    return (uint8_t)(producer * 31 + record * 7 + i);
+}
+
+
+static void Count_Callback(StorageRequest_t *req) {
+    (void)req;
+    __atomic_fetch_add(&_Callbacks, 1, __ATOMIC_RELAXED);
+}
+
+
+// queue a request, trying again while the queue is full as a producer with nothing better to do would
+static void Submit(ProducerStats_t *stats, StorageRequest_t *req) {
+    for (;;) {
+        uint64_t start = Now_Ns();
+        bool taken = Storage_Submit(req);
+        uint64_t ns = Now_Ns() - start;
+
+        if (taken) {
+            stats->submits++;
+            stats->totalNs += ns;
+            if (ns > stats->maxNs) stats->maxNs = ns;
+            return;
+        }
+        stats->fullRetries++;
+        sched_yield();
+    }
+}
+
+
+static void Wait_Complete(StorageRequest_t *req) {
+    while (!__atomic_load_n(&req->complete, __ATOMIC_ACQUIRE)) sched_yield();
+}
+
+
+static void *Worker_Thread(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&_StopWorker, __ATOMIC_ACQUIRE) || !Storage_IsIdle()) {
+        if (Storage_Service(4) == 0) sched_yield();
+    }
+    return NULL;
+}
+
+
+// write records to a file of its own through the queue, then read them back through it
+static void *Producer_Thread(void *arg) {
+    int p = (int)(long)arg;
+    ProducerStats_t *stats = &_Stats[p];
+    static __thread StorageRequest_t reqs[RECORDS + RECORDS / SYNC_EVERY + 2];
+    static __thread uint8_t records[RECORDS][RECORD_SIZE];
+    static __thread uint8_t back[RECORDS * RECORD_SIZE];
+    static __thread char path[16];
+    static __thread FIL fil;
+    StorageRequest_t readReq;
+    uint32_t n = 0;
+
+    sprintf(path, "P%d.BIN", p);
+    reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_OPEN, .file = &fil, .path = path, .mode = FA_CREATE_ALWAYS | FA_READ | FA_WRITE };
+    Submit(stats, &reqs[n++]);
+
+    for (int r = 0; r < RECORDS; r++) {
+        for (int i = 0; i < RECORD_SIZE; i++) records[r][i] = Record_Byte(p, r, i);
+        reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_WRITE, .file = &fil, .buf = records[r], .size = RECORD_SIZE, .callback = Count_Callback };
+        Submit(stats, &reqs[n++]);
+        if (r % SYNC_EVERY == SYNC_EVERY - 1) {
+            reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_SYNC, .file = &fil };
+            Submit(stats, &reqs[n++]);
+        }
+    }
+
+    // the requests run in order, so once the last write is complete so are all before it
+    Wait_Complete(&reqs[n - 1]);
+    for (uint32_t i = 0; i < n; i++) {
+        CHECK(reqs[i].complete);
+        CHECK(reqs[i].result == FR_OK);
+        if (reqs[i].op == STORAGE_OP_WRITE) CHECK(reqs[i].transferred == RECORD_SIZE);
+    }
+
+    // rewind is not a queued operation, so read back through a second open of the file
+    reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_CLOSE, .file = &fil };
+    Submit(stats, &reqs[n]);
+    Wait_Complete(&reqs[n]);
+    CHECK(reqs[n].result == FR_OK);
+    reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_OPEN, .file = &fil, .path = path, .mode = FA_READ };
+    Submit(stats, &reqs[n]);
+    readReq = (StorageRequest_t){ .op = STORAGE_OP_READ, .file = &fil, .buf = back, .size = sizeof(back) };
+    Submit(stats, &readReq);
+    Wait_Complete(&readReq);
+    CHECK(reqs[n].result == FR_OK);
+    CHECK(readReq.result == FR_OK);
+    CHECK(readReq.transferred == sizeof(back));
+    CHECK(memcmp(back, records, sizeof(back)) == 0);
+
+    reqs[n] = (StorageRequest_t){ .op = STORAGE_OP_CLOSE, .file = &fil };
+    Submit(stats, &reqs[n]);
+    Wait_Complete(&reqs[n]);
+    CHECK(reqs[n].result == FR_OK);
+    return NULL;
+}
+
+
+// a batch is queued whole or not at all: with two slots left a batch of three is turned away and leaves the
+// queue and its requests as they were, once the worker has made room it goes in and runs in order, and the file
+// counts as open through the service from its open to its close
+static void Test_Batch(void) {
+    StorageRequest_t fillers[STORAGE_QUEUE_SIZE - 2], open, write, close;
+    StorageRequest_t *const batch[] = { &open, &write, &close };
+    static char data[] = "batched";
+    FIL fil;
+
+    memset(&fil, 0, sizeof(fil));
+    for (uint32_t i = 0; i < STORAGE_QUEUE_SIZE - 2; i++) {
+        fillers[i] = (StorageRequest_t){ .op = STORAGE_OP_SYNC, .file = &fil };
+        CHECK(Storage_Submit(&fillers[i]));
+    }
+    open = (StorageRequest_t){ .op = STORAGE_OP_OPEN, .file = &fil, .path = "BATCH.TXT", .mode = FA_CREATE_ALWAYS | FA_WRITE };
+    write = (StorageRequest_t){ .op = STORAGE_OP_WRITE, .file = &fil, .buf = data, .size = sizeof(data) - 1 };
+    close = (StorageRequest_t){ .op = STORAGE_OP_CLOSE, .file = &fil };
+    open.complete = write.complete = close.complete = true;
+    CHECK(!Storage_SubmitBatch(batch, 3));
+    CHECK(open.complete && write.complete && close.complete);
+
+    // the syncs of a file that is not open fail, the slots they leave take the batch
+    CHECK(Storage_Service(1) == 1);
+    CHECK(fillers[0].result == FR_INVALID_OBJECT);
+    CHECK(Storage_SubmitBatch(batch, 3));
+    CHECK(!Storage_SubmitBatch(batch, STORAGE_QUEUE_SIZE + 1));
+    CHECK(Storage_OpenFiles() == 0);
+    CHECK(Storage_Service(STORAGE_QUEUE_SIZE - 2) == STORAGE_QUEUE_SIZE - 2);
+    CHECK(open.complete && !write.complete);
+    CHECK(Storage_OpenFiles() == 1);
+    CHECK(Storage_Service(0) == 2);
+    CHECK(Storage_OpenFiles() == 0);
+    CHECK(Storage_IsIdle());
+    CHECK(open.result == FR_OK && write.result == FR_OK && close.result == FR_OK);
+    CHECK(write.transferred == sizeof(data) - 1);
+}
+
+
+// the same records written by the caller itself, which waits for the disk every time
+static void Measure_DirectWrites(uint64_t *meanNs, uint64_t *maxNs) {
+    static uint8_t record[RECORD_SIZE];
+    uint64_t total = 0, worst = 0;
+    FIL fil;
+    UINT n;
+
+    CHECK_FR(f_open(&fil, "DIRECT.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    for (int r = 0; r < RECORDS; r++) {
+        uint64_t start = Now_Ns(), ns;
+
+        CHECK_FR(f_write(&fil, record, RECORD_SIZE, &n));
+        if (r % SYNC_EVERY == SYNC_EVERY - 1) CHECK_FR(f_sync(&fil));
+        ns = Now_Ns() - start;
+        total += ns;
+        if (ns > worst) worst = ns;
+    }
+    CHECK_FR(f_close(&fil));
+    *meanNs = total / RECORDS;
+    *maxNs = worst;
+}
+
+
+int main(void) {
+    pthread_t worker, producers[PRODUCERS];
+    StorageRequest_t mount = { .op = STORAGE_OP_MOUNT };
+    ProducerStats_t all = { 0 };
+    uint64_t directMeanNs, directMaxNs, start, elapsedNs;
+
+    RamDisk_Create(0, 8192, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 0));
+
+    // the worker can be driven from the caller too, as the main loop on the board does
+    Storage_Init(&_Fs);
+    CHECK(Storage_Submit(&mount));
+    CHECK(Storage_Service(0) == 1);
+    CHECK(mount.complete && (mount.result == FR_OK));
+    CHECK(Storage_IsIdle());
+    Test_Batch();
+
+    RamDisk_LatencyUs = DISK_LATENCY_US;
+    start = Now_Ns();
+    CHECK(pthread_create(&worker, NULL, Worker_Thread, NULL) == 0);
+    for (long p = 0; p < PRODUCERS; p++) {
+        CHECK(pthread_create(&producers[p], NULL, Producer_Thread, (void *)p) == 0);
+    }
+    for (int p = 0; p < PRODUCERS; p++) pthread_join(producers[p], NULL);
+    __atomic_store_n(&_StopWorker, 1, __ATOMIC_RELEASE);
+    pthread_join(worker, NULL);
+    elapsedNs = Now_Ns() - start;
+
+    CHECK(_Callbacks == PRODUCERS * RECORDS);
+    for (int p = 0; p < PRODUCERS; p++) {
+        all.submits += _Stats[p].submits;
+        all.fullRetries += _Stats[p].fullRetries;
+        all.totalNs += _Stats[p].totalNs;
+        if (_Stats[p].maxNs > all.maxNs) all.maxNs = _Stats[p].maxNs;
+    }
+
+    Measure_DirectWrites(&directMeanNs, &directMaxNs);
+    RamDisk_LatencyUs = 0;
+
+    printf("%d producers, %llu requests in %.3f s, queue full %llu times\n", PRODUCERS,
+           (unsigned long long)all.submits, elapsedNs * 1e-9, (unsigned long long)all.fullRetries);
+    printf("Storage_Submit: mean %llu ns, max %llu ns\n",
+           (unsigned long long)(all.totalNs / all.submits), (unsigned long long)all.maxNs);
+    printf("direct f_write: mean %llu ns, max %llu ns\n",
+           (unsigned long long)directMeanNs, (unsigned long long)directMaxNs);
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    printf("ALL OK\n");
+    return 0;
+}
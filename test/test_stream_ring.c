@@ -0,0 +1,190 @@
+// The ISR to file streaming ring with the producer on a thread of its own
+//   the producer commits numbered records of varying size as fast as it can while the consumer drains the ring to
+//   a file, so the ring wraps many times and overruns while the consumer is held up; the file must hold the records
+//   in order, each whole, with exactly the ones the producer was told were dropped missing and the ring's counters
+//   matching
+//   a drain that fills the volume in the middle of a slot must not write the part that got in again once there is
+//   room, the file has to hold the stream exactly once
+//   built under ThreadSanitizer
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "FatFS/ff.h"
+#include "FatFS/FatFS_StreamRing.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define RECORDS                 100000
+#define MAX_RECORD              60
+#define HEADER_SIZE             100
+#define STALL_EVERY             200     // the consumer is held up for STALL_US every so many drains
+#define STALL_US                2000
+
+static FATFS _Fs;
+static StreamRing_t _Ring;
+static volatile int _ProducerDone;
+static uint32_t _Dropped, _DroppedBytes;
+static uint8_t _Stream[2 * STREAM_SLOT_COUNT * STREAM_SLOT_SIZE];
+
+
+// record n: its number, its size, then a pattern from both
+static uint32_t Make_Record(uint8_t *record, uint32_t n) {
+    uint32_t size = 6 + n % (MAX_RECORD - 5);
+
+    memcpy(record, &n, 4);
+    record[4] = (uint8_t)size;
+    for (uint32_t i = 5; i < size; i++) record[i] = (uint8_t)(n * 13 + i);
+    return size;
+}
+
+
+static void *Producer_Thread(void *arg) {
+    uint8_t record[MAX_RECORD];
+
+    (void)arg;
+    for (uint32_t n = 0; n < RECORDS; n++) {
+        uint32_t size = Make_Record(record, n);
+
+        if (!StreamRing_Commit(&_Ring, record, size)) {
+            _Dropped++;
+            _DroppedBytes += size;
+        }
+        if (n % 64 == 0) sched_yield();
+    }
+    __atomic_store_n(&_ProducerDone, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+
+// read the records back from the file, every one whole and in order, returns the number missing
+static uint32_t Check_Records(const char *path, uint32_t *found) {
+    uint8_t record[MAX_RECORD], expected[MAX_RECORD];
+    uint32_t next = 0, missing = 0, n;
+    FIL fil;
+    UINT br;
+
+    *found = 0;
+    CHECK_FR(f_open(&fil, path, FA_READ));
+    for (;;) {
+        CHECK_FR(f_read(&fil, record, 5, &br));
+        if (br == 0) break;
+        CHECK(br == 5);
+        memcpy(&n, record, 4);
+        CHECK((n >= next) && (n < RECORDS));
+        CHECK_FR(f_read(&fil, record + 5, record[4] - 5, &br));
+        CHECK(br == record[4] - 5u);
+        CHECK(Make_Record(expected, n) == record[4]);
+        CHECK(memcmp(record, expected, record[4]) == 0);
+        missing += n - next;
+        next = n + 1;
+        (*found)++;
+    }
+    CHECK_FR(f_close(&fil));
+    return missing + (RECORDS - next);
+}
+
+
+static void Test_Threads(void) {
+    pthread_t producer;
+    uint32_t drains = 0, slots = 0, loops = 0, written, found, missing;
+    FIL fil;
+
+    StreamRing_Init(&_Ring);
+    CHECK_FR(f_open(&fil, "STREAM.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK(pthread_create(&producer, NULL, Producer_Thread, NULL) == 0);
+    while (!__atomic_load_n(&_ProducerDone, __ATOMIC_ACQUIRE)) {
+        CHECK_FR(StreamRing_Drain(&_Ring, &fil, &written));
+        slots += written;
+        if (written) drains++;
+        else sched_yield();
+
+        // the main loop has other work too, the ring overruns while it is away
+        if (++loops % STALL_EVERY == 0) usleep(STALL_US);
+    }
+    pthread_join(producer, NULL);
+    CHECK_FR(StreamRing_Drain(&_Ring, &fil, &written));
+    slots += written;
+    CHECK_FR(StreamRing_Flush(&_Ring, &fil));
+    CHECK_FR(f_close(&fil));
+
+    missing = Check_Records("STREAM.BIN", &found);
+    printf("%u records, %u slots in %u drains, ring wrapped %u times, high water %u of %u slots\n", RECORDS, slots,
+           drains, slots / STREAM_SLOT_COUNT, _Ring.highWater, STREAM_SLOT_COUNT);
+    printf("overruns: %u records, %u bytes\n", _Ring.overruns, _Ring.overrunBytes);
+    CHECK(slots / STREAM_SLOT_COUNT > 10);
+    CHECK(_Ring.overruns > 0);
+    CHECK(found + missing == RECORDS);
+    CHECK(missing == _Dropped);
+    CHECK(_Ring.overruns == _Dropped);
+    CHECK(_Ring.overrunBytes == _DroppedBytes);
+    CHECK(StreamRing_Pending(&_Ring) == 0);
+    CHECK_FR(f_unlink("STREAM.BIN"));
+}
+
+
+// the file starts with a header so the slots straddle the clusters, and the volume fills in the middle of a slot
+static void Test_ShortWrite(void) {
+    uint8_t header[HEADER_SIZE], back[HEADER_SIZE + sizeof(_Stream)];
+    uint32_t streamSize = 0, written;
+    DWORD freeClusters;
+    FATFS *fs;
+    FIL fil, filler;
+    UINT n;
+
+    memset(header, 'H', sizeof(header));
+    CHECK_FR(f_open(&fil, "SHORT.BIN", FA_CREATE_ALWAYS | FA_WRITE | FA_READ));
+    CHECK_FR(f_write(&fil, header, sizeof(header), &n));
+    CHECK_FR(f_sync(&fil));
+
+    // leave room for the header's cluster and three more, the ring then holds eight slots
+    CHECK_FR(f_getfree("", &freeClusters, &fs));
+    CHECK_FR(f_open(&filler, "FILLER.BIN", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_lseek(&filler, (FSIZE_t)(freeClusters - 3) * fs->csize * 512));
+    CHECK(f_tell(&filler) == (FSIZE_t)(freeClusters - 3) * fs->csize * 512);
+    CHECK_FR(f_close(&filler));
+
+    StreamRing_Init(&_Ring);
+    while (StreamRing_Pending(&_Ring) < STREAM_SLOT_COUNT) {
+        uint8_t record[MAX_RECORD];
+        uint32_t size = Make_Record(record, streamSize);
+
+        if (!StreamRing_Commit(&_Ring, record, size)) break;
+        memcpy(&_Stream[streamSize], record, size);
+        streamSize += size;
+    }
+    CHECK(StreamRing_Drain(&_Ring, &fil, &written) == FR_DENIED);
+    CHECK(_Ring.part != 0);
+    printf("short write: %u of %u slots written and %u bytes of the next\n", written, STREAM_SLOT_COUNT, _Ring.part);
+
+    // once there is room the rest goes in after what is already there
+    CHECK_FR(f_unlink("FILLER.BIN"));
+    CHECK_FR(StreamRing_Flush(&_Ring, &fil));
+    CHECK(_Ring.part == 0);
+    CHECK(f_size(&fil) == HEADER_SIZE + streamSize);
+    CHECK_FR(f_lseek(&fil, 0));
+    CHECK_FR(f_read(&fil, back, sizeof(back), &n));
+    CHECK(n == HEADER_SIZE + streamSize);
+    CHECK(memcmp(back, header, HEADER_SIZE) == 0);
+    CHECK(memcmp(back + HEADER_SIZE, _Stream, streamSize) == 0);
+    CHECK_FR(f_close(&fil));
+}
+
+
+int main(void) {
+    RamDisk_Create(0, 16384, 512);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 512));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+
+    Test_Threads();
+    Test_ShortWrite();
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    RamDisk_Free(0);
+    printf("ALL OK\n");
+    return 0;
+}
@@ -0,0 +1,176 @@
+// Reads, writes and seeks at random positions of a file against a model of its contents
+//   the data area is filled with a pattern before the volume is formatted, so the part of a file that was extended
+//   by f_lseek and never written holds whatever the medium had; a byte written must read back as written, and a
+//   byte never written must read the same every time until a write goes into its sector, whichever sectors the
+//   file object happened to hold in its cache
+//   the data sectors read are counted for a preallocated file filled from its start, which must need none
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ff.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define VOLUME_SECTORS          16384
+#define MAX_FILE_SIZE           40000
+#define SECTOR_SIZE             512
+#define OPERATIONS              20000
+#define NOISE                   0xA5
+
+// what the model knows about each byte of the file
+typedef enum { BYTE_UNKNOWN, BYTE_SEEN, BYTE_WRITTEN } ByteState_t;
+
+static FATFS _Fs;
+static FIL _Fil;
+static uint8_t _Model[MAX_FILE_SIZE];
+static uint8_t _State[MAX_FILE_SIZE];
+static uint32_t _Size;
+static uint8_t _Buf[MAX_FILE_SIZE];
+
+
+// a write makes the unwritten bytes of the sectors it goes into unknown again, f_write may zero-fill them
+static void Model_Write(uint32_t pos, const uint8_t *data, uint32_t len) {
+    uint32_t first = pos - pos % SECTOR_SIZE;
+    uint32_t last = (pos + len + SECTOR_SIZE - 1) / SECTOR_SIZE * SECTOR_SIZE;
+
+    for (uint32_t i = first; (i < last) && (i < MAX_FILE_SIZE); i++) {
+        if (_State[i] == BYTE_SEEN) _State[i] = BYTE_UNKNOWN;
+    }
+    memcpy(&_Model[pos], data, len);
+    memset(&_State[pos], BYTE_WRITTEN, len);
+    if (pos + len > _Size) _Size = pos + len;
+}
+
+
+static void Model_Read(uint32_t pos, const uint8_t *data, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t at = pos + i;
+
+        if (_State[at] == BYTE_UNKNOWN) {
+            _Model[at] = data[i];
+            _State[at] = BYTE_SEEN;
+        }
+        else if (_Model[at] != data[i]) {
+            printf("byte %u of %u reads 0x%02X, expected 0x%02X (%s)\n", at, _Size, data[i], _Model[at],
+                   (_State[at] == BYTE_WRITTEN) ? "written" : "read before");
+            CHECK(false);
+        }
+    }
+}
+
+
+// bytes cut off by f_truncate are gone, extending the file again brings back whatever the clusters hold
+static void Model_Truncate(uint32_t size) {
+    memset(&_State[size], BYTE_UNKNOWN, _Size - size);
+    _Size = size;
+}
+
+
+static void Run_Operations(uint32_t seed) {
+    UINT n;
+
+    srand(seed);
+    CHECK_FR(f_open(&_Fil, "RANDOM.BIN", FA_CREATE_ALWAYS | FA_READ | FA_WRITE));
+    memset(_State, BYTE_UNKNOWN, sizeof(_State));
+    _Size = 0;
+
+    for (uint32_t op = 0; op < OPERATIONS; op++) {
+        uint32_t pos = (uint32_t)rand() % MAX_FILE_SIZE;
+        uint32_t len = 1 + (uint32_t)rand() % ((rand() % 8) ? 64 : 3000);
+        uint32_t kind = (uint32_t)rand() % 16;
+
+        // seek anywhere, past the end extends the file
+        if (kind < 5) {
+            CHECK_FR(f_lseek(&_Fil, pos));
+            if (pos > _Size) _Size = pos;
+        }
+
+        // write at the file pointer
+        else if (kind < 9) {
+            pos = (uint32_t)f_tell(&_Fil);
+            if (pos + len > MAX_FILE_SIZE) len = MAX_FILE_SIZE - pos;
+            for (uint32_t i = 0; i < len; i++) _Buf[i] = (uint8_t)rand();
+            CHECK_FR(f_write(&_Fil, _Buf, len, &n));
+            CHECK(n == len);
+            Model_Write(pos, _Buf, len);
+        }
+
+        // read at the file pointer
+        else if (kind < 13) {
+            pos = (uint32_t)f_tell(&_Fil);
+            CHECK_FR(f_read(&_Fil, _Buf, len, &n));
+            CHECK(n == ((pos >= _Size) ? 0 : ((len < _Size - pos) ? len : _Size - pos)));
+            Model_Read(pos, _Buf, n);
+        }
+
+        else if (kind == 13) {
+            CHECK_FR(f_sync(&_Fil));
+        }
+
+        // close and open again, the file object starts over with an empty cache
+        else if (kind == 14) {
+            pos = (uint32_t)f_tell(&_Fil);
+            CHECK_FR(f_close(&_Fil));
+            CHECK_FR(f_open(&_Fil, "RANDOM.BIN", FA_OPEN_EXISTING | FA_READ | FA_WRITE));
+            CHECK(f_size(&_Fil) == _Size);
+            CHECK_FR(f_lseek(&_Fil, pos));
+        }
+
+        // now and then cut the file somewhere
+        else if ((rand() % 4) == 0) {
+            pos %= _Size + 1;
+            CHECK_FR(f_lseek(&_Fil, pos));
+            CHECK_FR(f_truncate(&_Fil));
+            Model_Truncate(pos);
+        }
+        CHECK(f_size(&_Fil) == _Size);
+    }
+
+    // everything written is on the medium after the close
+    CHECK_FR(f_close(&_Fil));
+    CHECK_FR(f_open(&_Fil, "RANDOM.BIN", FA_READ));
+    CHECK_FR(f_read(&_Fil, _Buf, sizeof(_Buf), &n));
+    CHECK(n == _Size);
+    Model_Read(0, _Buf, n);
+    CHECK_FR(f_close(&_Fil));
+}
+
+
+// a logger preallocates its file and fills it from the start in records that do not end on sector boundaries
+static void Measure_PreallocatedFill(void) {
+    static const char record[] = "Record: the quick brown fox jumps over the lazy dog\n";
+    uint32_t written = 0, fills;
+    UINT n;
+
+    CHECK_FR(f_open(&_Fil, "LOG.TXT", FA_CREATE_ALWAYS | FA_WRITE));
+    CHECK_FR(f_lseek(&_Fil, 32768));
+    CHECK_FR(f_lseek(&_Fil, 0));
+    fills = _Fs.st.rd_fill;
+    while (written + sizeof(record) - 1 <= 32768) {
+        CHECK_FR(f_write(&_Fil, record, sizeof(record) - 1, &n));
+        written += n;
+    }
+    CHECK_FR(f_close(&_Fil));
+    fills = _Fs.st.rd_fill - fills;
+    printf("preallocated fill: %u bytes written, %u data sectors read\n", written, fills);
+    CHECK(fills == 0);
+}
+
+
+int main(void) {
+    RamDisk_Create(0, VOLUME_SECTORS, SECTOR_SIZE);
+    memset(RamDisk_Data(0), NOISE, (size_t)VOLUME_SECTORS * SECTOR_SIZE);
+    CHECK_FR(f_mount(&_Fs, "", 0));
+    CHECK_FR(f_mkfs("", 1, 1024));
+    CHECK_FR(f_mount(&_Fs, "", 1));
+
+    for (uint32_t seed = 1; seed <= 8; seed++) Run_Operations(seed);
+    printf("%u random operations on each of 8 files checked\n", OPERATIONS);
+    Measure_PreallocatedFill();
+
+    CHECK_FR(f_mount(NULL, "", 0));
+    RamDisk_Free(0);
+    printf("ALL OK\n");
+    return 0;
+}